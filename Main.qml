@@ -36,7 +36,7 @@ ApplicationWindow {
         id: mainCanvas
         anchors.fill: parent
 
-        // bind width and height to controller height and width
+        // bind width and height to controller height and width (the view, not the canvas)
         onWidthChanged: CanvasController.width = mainCanvas.width
         onHeightChanged: CanvasController.height = mainCanvas.height
 
@@ -49,7 +49,8 @@ ApplicationWindow {
             }
 
             color: "white"
-            text: `Canvas size: ${CanvasController.width} x ${CanvasController.height} \n` +
+            text: `View size: ${CanvasController.width} x ${CanvasController.height} \n` +
+                  `Canvas size: ${CanvasController.canvasWidth} x ${CanvasController.canvasHeight} \n` +
                   `Scale: ${CanvasController.zoom} \n` +
                   `Active layer: ${CanvasController.activeLayer}`
             z: 1
@@ -57,6 +58,8 @@ ApplicationWindow {
 
         CanvasRenderer {
             anchors.fill: parent
+            clip: true
+            controller: CanvasController
         }
     }
 }
@@ -0,0 +1,198 @@
+// pixelair-cli: batch processing of projects and images without a display.
+//
+// Every input is loaded (a .pxa project flattened, or one of its layers; any
+// image Qt reads), resized, recolored and written to the output directory under
+// its own name, each on one core, as many at once as there are cores.
+//
+//   pixelair-cli -o out/ --scale 4 --recolor "#ff0000=#00ff00" sprites/ hero.pxa
+
+#include <imageio.h>
+#include <layerops.h>
+#include <projectfile.h>
+#include <workerpool.h>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QSaveFile>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+struct Options {
+    QDir output;
+    bool raw = false;          // RGBA8 rather than PNG
+    int layer = -1;            // layer of a project to take, -1 to flatten
+    qreal scale = 1;
+    QSize size;                // overrides scale when valid
+    LayerOps::ColorMap colors;
+};
+
+static bool fail(QString* error, const QString& message) {
+    if (error) *error = message;
+    return false;
+}
+
+// parse "from=to" into colors. Returns false if either side is not a color
+static bool parseRecolor(const QString& pair, LayerOps::ColorMap& colors) {
+    const QStringList sides = pair.split('=');
+    if (sides.size() != 2) return false;
+    const QColor from = QColor::fromString(sides[0].trimmed()), to = QColor::fromString(sides[1].trimmed());
+    if (!from.isValid() || !to.isValid()) return false;
+    colors[Pixel(from).argb] = Pixel(to).argb;
+    return true;
+}
+
+// the name of the file an input is written to in the output directory
+static QString outputName(const QString& input, const Options& options) {
+    return QFileInfo(input).completeBaseName() + (options.raw ? ".rgba" : ".png");
+}
+
+// the files to process: inputs as they are, and the projects and images inside
+// input directories. Fails if two of them would be written to the same output
+// file, as they are written from different threads
+static bool collectInputs(const QStringList& inputs, const Options& options, QStringList* files, QString* error) {
+    QStringList filters{"*.pxa"};
+    for (const QByteArray& format : QImageReader::supportedImageFormats()) filters << "*." + QString::fromLatin1(format);
+
+    for (const QString& input : inputs) {
+        const QFileInfo info(input);
+        if (!info.isDir()) {
+            *files << input;
+            continue;
+        }
+        for (const QFileInfo& entry : QDir(input).entryInfoList(filters, QDir::Files, QDir::Name))
+            *files << entry.filePath();
+    }
+
+    // case-insensitively, for the file systems that are
+    QHash<QString, QString> written;
+    for (const QString& file : *files) {
+        const QString name = outputName(file, options).toLower();
+        const auto other = written.constFind(name);
+        if (other != written.constEnd())
+            return fail(error, QString("%1 and %2 would both be written to %3")
+                                   .arg(*other, file, outputName(file, options)));
+        written.insert(name, file);
+    }
+    return true;
+}
+
+// run one input through the pipeline
+static bool process(const QString& input, const Options& options, QString* error) {
+    RasterLayer image;
+    QRect box;
+    if (input.endsWith(".pxa", Qt::CaseInsensitive)) {
+        QSize size;
+        QVector<RasterLayer> layers;
+        if (!ProjectFile::load(input, &size, &layers, error)) return false;
+        box = QRect(QPoint(0, 0), size);
+        if (options.layer < 0) {
+            image = LayerOps::flattened(layers, box);
+        } else if (options.layer < layers.size()) {
+            image = layers[options.layer];
+        } else {
+            return fail(error, QString("no layer %1").arg(options.layer));
+        }
+    } else {
+        // the reader only looks at the header for this
+        box = QRect(QPoint(0, 0), QImageReader(input).size());
+        if (box.isEmpty()) return fail(error, "not an image");
+        QFile file(input);
+        if (!file.open(QIODevice::ReadOnly)) return fail(error, file.errorString());
+        if (!ImageIO::readImage(&file, QPoint(0, 0), image, nullptr, error)) return false;
+    }
+
+    const QSize size = options.size.isValid() ? options.size
+                                              : QSize(std::max(1, qRound(box.width() * options.scale)),
+                                                      std::max(1, qRound(box.height() * options.scale)));
+    if (size != box.size()) {
+        image = LayerOps::resized(image, box, size);
+        box = QRect(QPoint(0, 0), size);
+    }
+    LayerOps::recolor(image, box, options.colors);
+
+    const QString path = options.output.filePath(outputName(input, options));
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return fail(error, file.errorString());
+    Scanlines rows(image, box);
+    if (!(options.raw ? ImageIO::writeRaw(rows, &file, error) : ImageIO::writePng(rows, &file, error))) return false;
+    if (!file.commit()) return fail(error, file.errorString());
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("pixelair-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts PixelAir projects and images in batch.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("inputs", "Projects (.pxa), images, or directories of them.", "inputs...");
+    const QCommandLineOption outputOption({"o", "output"}, "Directory to write to.", "dir");
+    const QCommandLineOption formatOption({"f", "format"}, "png (default) or rgba, raw 8 bit RGBA.", "format", "png");
+    const QCommandLineOption layerOption({"l", "layer"}, "Take this layer of projects instead of flattening them.", "index");
+    const QCommandLineOption scaleOption({"s", "scale"}, "Scale by this factor, nearest neighbour.", "factor", "1");
+    const QCommandLineOption sizeOption("size", "Resize to exactly WxH, nearest neighbour.", "WxH");
+    const QCommandLineOption recolorOption({"r", "recolor"}, "Replace a color, as from=to (#rrggbb or #aarrggbb). Repeatable.", "from=to");
+    const QCommandLineOption jobsOption({"j", "jobs"}, "Files processed at once (default: one per core).", "count");
+    parser.addOptions({outputOption, formatOption, layerOption, scaleOption, sizeOption, recolorOption, jobsOption});
+    parser.process(app);
+
+    auto usage = [&](const QString& message) {
+        std::fprintf(stderr, "%s\n\n", qPrintable(message));
+        parser.showHelp(1);
+    };
+
+    Options options;
+    if (!parser.isSet(outputOption)) usage("No output directory given.");
+    options.output = QDir(parser.value(outputOption));
+    if (!options.output.mkpath(".")) usage("Cannot create the output directory.");
+
+    const QString format = parser.value(formatOption).toLower();
+    if (format != "png" && format != "rgba") usage("Unknown format " + format + ".");
+    options.raw = format == "rgba";
+
+    bool ok = true;
+    if (parser.isSet(layerOption)) options.layer = parser.value(layerOption).toInt(&ok);
+    if (!ok || options.layer < -1) usage("Bad layer index.");
+    options.scale = parser.value(scaleOption).toDouble(&ok);
+    if (!ok || !(options.scale > 0)) usage("Bad scale.");
+    if (parser.isSet(sizeOption)) {
+        const QStringList sides = parser.value(sizeOption).split('x');
+        bool okHeight = false;
+        if (sides.size() == 2) options.size = QSize(sides[0].toInt(&ok), sides[1].toInt(&okHeight));
+        if (sides.size() != 2 || !ok || !okHeight || options.size.isEmpty()) usage("Bad size.");
+    }
+    for (const QString& pair : parser.values(recolorOption))
+        if (!parseRecolor(pair, options.colors)) usage("Bad recolor " + pair + ".");
+
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    if (parser.isSet(jobsOption)) jobs = parser.value(jobsOption).toInt(&ok);
+    if (!ok || jobs < 1) usage("Bad job count.");
+
+    QStringList inputs;
+    QString reason;
+    if (!collectInputs(parser.positionalArguments(), options, &inputs, &reason)) usage(reason + ".");
+    if (inputs.isEmpty()) usage("Nothing to process.");
+
+    // one file per item: sprites are small, so files rather than rows are what to
+    // spread over the cores. The calling thread is one of the jobs
+    WorkerPool pool(jobs - 1);
+    std::mutex printing;
+    std::atomic<int> failed{0};
+    pool.parallelFor(static_cast<int>(inputs.size()), [&](int i) {
+        QString error;
+        if (process(inputs[i], options, &error)) return;
+        failed++;
+        std::lock_guard<std::mutex> lock(printing);
+        std::fprintf(stderr, "%s: %s\n", qPrintable(inputs[i]), qPrintable(error));
+    });
+
+    std::printf("%lld files, %d failed\n", static_cast<long long>(inputs.size()), failed.load());
+    return failed > 0 ? 1 : 0;
+}
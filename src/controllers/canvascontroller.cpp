@@ -1,69 +1,482 @@
 #include "canvascontroller.h"
 #include <QtQml/qqmlregistration.h>
 #include <QDebug>
+#include <imageio.h>
+#include <projectfile.h>
+#include <QFile>
+#include <QSaveFile>
+#include <climits>
 
 CanvasController::CanvasController(QObject *parent)
-    :m_activeLayer(0), m_height(100), m_width(100), m_x(0), m_y(0), m_zoom(1.0), m_defaultPixelSize(50.0f) {
+    :m_activeLayer(0), m_height(100), m_width(100), m_canvasWidth(512), m_canvasHeight(512), m_x(0), m_y(0), m_zoom(1.0), m_defaultPixelSize(50.0f),
+     m_pendingLayer(0), m_strokeOpen(false), m_strokeLayer(0) {
+    m_clock.start();
+
+    m_regionTimer.setSingleShot(true);
+    m_regionTimer.setInterval(0);
+    connect(&m_regionTimer, &QTimer::timeout, this, &CanvasController::emitRegionChanged);
+
     // initialize layers
     m_layers = QVector<RasterLayer>();
     // add an initial empty layer
     m_layers.emplaceBack(RasterLayer());
-
-    // debug: add some nodes
-    RasterLayer layer = m_layers[0];
-    layer.upsert({1, 1}, QColor(255, 0, 0, 255));
-    layer.upsert({0, 0}, QColor(0, 255, 0, 255));
-    layer.upsert({3, 1}, QColor(0, 0, 255, 255));
-    layer.upsert({1, 0}, QColor(255, 255, 0, 255));
-    layer.upsert({2, 1}, QColor(0, 255, 255, 255));
-    layer.upsert({4, 0}, QColor(255, 0, 255, 255));
-    layer.upsert({1, 2}, QColor(255, 0, 0, 255));
 }
 
 void CanvasController::drawPixel(int x, int y, QColor c) {
+    if (!isSelected(x, y)) return;
     // get the active layer
-    RasterLayer layer = m_layers[m_activeLayer];
-    layer.upsert({x, y}, c);
+    RasterLayer& layer = m_layers[m_activeLayer];
+    const Pixel p(c);
+
+    auto before = layer.get({x, y});
+    beginEdit().record({x, y}, before.has_value() ? std::optional<Pixel>(before->value) : std::nullopt, p);
+    layer.upsert({x, y}, p);
+    endEdit();
 }
 
 void CanvasController::erasePixel(int x, int y) {
+    if (!isSelected(x, y)) return;
     // get the active layer
-    RasterLayer layer = m_layers[m_activeLayer];
+    RasterLayer& layer = m_layers[m_activeLayer];
+
+    auto before = layer.get({x, y});
+    if (!before.has_value()) return; // nothing to erase, nothing to undo
+    beginEdit().record({x, y}, before->value, std::nullopt);
     layer.remove({x, y});
+    endEdit();
+}
+
+void CanvasController::drawPixels(const QList<int>& points, QColor c) {
+    const Pixel p(c);
+    QVector<PixelRef> pixels;
+    pixels.reserve(points.size() / 2);
+    for (qsizetype i = 0; i + 1 < points.size(); i += 2)
+        if (isSelected(points[i], points[i + 1])) pixels.emplaceBack(points[i], points[i + 1], p);
+
+    // get the active layer
+    RasterLayer& layer = m_layers[m_activeLayer];
+    beginEdit().recordUpserts(layer, pixels);
+    layer.upsertMany(std::move(pixels));
+    endEdit();
+}
+
+void CanvasController::erasePixels(const QList<int>& points) {
+    QVector<QPoint> locs;
+    locs.reserve(points.size() / 2);
+    for (qsizetype i = 0; i + 1 < points.size(); i += 2)
+        if (isSelected(points[i], points[i + 1])) locs.emplaceBack(points[i], points[i + 1]);
+
+    // get the active layer
+    RasterLayer& layer = m_layers[m_activeLayer];
+    beginEdit().recordRemoves(layer, locs);
+    layer.removeMany(std::move(locs));
+    endEdit();
+}
+
+void CanvasController::fillRect(int x, int y, int width, int height, QColor c) {
+    // get the active layer
+    RasterLayer& layer = m_layers[m_activeLayer];
+    const QRect box(x, y, width, height);
+    if (!m_selection.isEmpty()) {
+        const QVector<ColumnRun> runs = m_selection.clip(box);
+        beginEdit().recordRuns(layer, runs, Pixel(c));
+        layer.fillRuns(runs, Pixel(c));
+        endEdit();
+        return;
+    }
+    beginEdit().recordFill(layer, box, Pixel(c));
+    layer.fillRect(box, Pixel(c));
+    endEdit();
+}
+
+void CanvasController::setBrush(int size, int shape, float spacing) {
+    m_stroke.setBrush({size, shape == 1 ? StrokeEngine::Shape::Square : StrokeEngine::Shape::Round, spacing});
+}
+
+void CanvasController::paintTo(qreal x, qreal y, QColor c) { strokeTo(x, y, Pixel(c)); }
+
+void CanvasController::eraseTo(qreal x, qreal y) { strokeTo(x, y, std::nullopt); }
+
+void CanvasController::floodFill(int x, int y, QColor c, int tolerance, bool contiguous) {
+    // get the active layer
+    RasterLayer& layer = m_layers[m_activeLayer];
+    QVector<ColumnRun> runs =
+        FloodFill::region(layer, canvasRect(), QPoint(x, y), tolerance,
+                          contiguous ? FloodFill::Mode::Contiguous : FloodFill::Mode::Global, WorkerPool::global());
+    if (!m_selection.isEmpty()) runs = m_selection.clip(std::move(runs));
+    if (runs.isEmpty()) return;
+
+    const std::optional<Pixel> value = c.alpha() > 0 ? std::optional<Pixel>(Pixel(c)) : std::nullopt;
+    beginEdit().recordRuns(layer, runs, value);
+    if (value) {
+        layer.fillRuns(runs, *value);
+    } else {
+        layer.eraseRuns(runs);
+    }
+    endEdit();
 }
 
 void CanvasController::clearLayer() {
     // get the active layer
-    RasterLayer layer = m_layers[m_activeLayer];
+    RasterLayer& layer = m_layers[m_activeLayer];
+    if (!m_selection.isEmpty()) {
+        const QVector<ColumnRun> runs = m_selection.runs();
+        beginEdit().recordRuns(layer, runs, std::nullopt);
+        layer.eraseRuns(runs);
+        endEdit();
+        return;
+    }
+    beginEdit().recordClear(layer);
     layer.clear();
+    endEdit();
+}
+
+// selection
+
+void CanvasController::selectRect(int x, int y, int width, int height, int op) {
+    select(SelectionMask::rect(QRect(x, y, width, height)), op);
+}
+
+void CanvasController::selectEllipse(int x, int y, int width, int height, int op) {
+    select(SelectionMask::ellipse(QRect(x, y, width, height)), op);
+}
+
+void CanvasController::selectLasso(const QList<qreal>& points, int op) {
+    QVector<QPointF> polygon;
+    polygon.reserve(points.size() / 2);
+    for (qsizetype i = 0; i + 1 < points.size(); i += 2) polygon.append(QPointF(points[i], points[i + 1]));
+    select(SelectionMask::lasso(polygon), op);
+}
+
+void CanvasController::selectMagicWand(int x, int y, int tolerance, bool contiguous, int op) {
+    select(SelectionMask::magicWand(m_layers[m_activeLayer], canvasRect(), QPoint(x, y), tolerance,
+                                    contiguous ? FloodFill::Mode::Contiguous : FloodFill::Mode::Global,
+                                    WorkerPool::global()),
+           op);
+}
+
+void CanvasController::selectAll() { select(SelectionMask::rect(canvasRect()), 0); }
+
+void CanvasController::clearSelection() {
+    if (m_selection.isEmpty()) return;
+    m_selection = SelectionMask();
+    m_strokeLayer = -1;
+    emit selectionChanged();
+}
+
+// project files
+
+bool CanvasController::saveProject(const QString& path) {
+    QString error;
+    if (!ProjectFile::save(path, QSize(m_canvasWidth, m_canvasHeight), m_layers, &error)) {
+        qWarning() << "could not save" << path << ":" << error;
+        return false;
+    }
+    return true;
+}
+
+bool CanvasController::loadProject(const QString& path) {
+    QSize size;
+    QVector<RasterLayer> layers;
+    QString error;
+    if (!ProjectFile::load(path, &size, &layers, &error)) {
+        qWarning() << "could not open" << path << ":" << error;
+        return false;
+    }
+    if (layers.isEmpty()) layers.emplaceBack(RasterLayer()); // there is always a layer to draw on
+
+    // nothing of the old document carries over: no open stroke, no selection
+    if (m_strokeOpen) endStroke();
+    clearSelection();
+
+    // the old pixels go away too, so report them before the layers are swapped
+    flushEdit();
+    for (RasterLayer& layer : m_layers) layer.clear();
+    emitRegionChanged();
+
+    m_layers = std::move(layers);
+    setCanvasWidth(size.width());
+    setCanvasHeight(size.height());
+    m_history.clear();
+    m_activeLayer = 0;
+    m_strokeLayer = -1;
+    emit activeLayerChanged();
+    emit historyChanged();
+    scheduleRegionChanged();
+    return true;
+}
+
+// image files
+
+bool CanvasController::exportImage(const QString& path, int layer, int x, int y, int width, int height) {
+    if (layer < -1 || layer >= m_layers.size()) return false;
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "could not export" << path << ":" << file.errorString();
+        return false;
+    }
+
+    const QRect box(x, y, width, height);
+    Scanlines rows = layer < 0 ? Scanlines(m_layers, box) : Scanlines(m_layers[layer], box);
+    const bool raw = path.endsWith(".rgba", Qt::CaseInsensitive) || path.endsWith(".raw", Qt::CaseInsensitive);
+    QString error;
+    if (!(raw ? ImageIO::writeRaw(rows, &file, &error) : ImageIO::writePng(rows, &file, &error)) || !file.commit()) {
+        qWarning() << "could not export" << path << ":" << (error.isEmpty() ? file.errorString() : error);
+        return false;
+    }
+    return true;
+}
+
+bool CanvasController::importImage(const QString& path, int x, int y) {
+    return importFile(path, x, y, 0);
+}
+
+bool CanvasController::importRaw(const QString& path, int x, int y, int width) {
+    return width > 0 && importFile(path, x, y, width);
+}
+
+bool CanvasController::importFile(const QString& path, int x, int y, int rawWidth) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "could not import" << path << ":" << file.errorString();
+        return false;
+    }
+
+    // an undo step of its own, unless a stroke is open
+    if (!m_strokeOpen) {
+        flushEdit();
+        m_history.closeEntry();
+    }
+    RasterLayer& layer = m_layers[m_activeLayer];
+    LayerDelta& delta = beginEdit();
+    QString error;
+    const bool ok = rawWidth > 0 ? ImageIO::readRaw(&file, rawWidth, QPoint(x, y), layer, &delta, &error)
+                                 : ImageIO::readImage(&file, QPoint(x, y), layer, &delta, &error);
+    endEdit();
+    if (!m_strokeOpen) m_history.closeEntry();
+    if (!ok) qWarning() << "could not import" << path << ":" << error;
+    return ok;
+}
+
+// undo / redo
+
+void CanvasController::beginStroke() {
+    flushEdit();
+    m_strokeOpen = true;
+    m_stroke.reset();
+}
+
+void CanvasController::endStroke() {
+    m_strokeOpen = false;
+    m_stroke.reset();
+    flushEdit();
+    m_history.closeEntry(); // the next edit starts a new undo step
+}
+
+void CanvasController::undo() {
+    if (m_strokeOpen) endStroke();
+    if (m_history.undo(m_layers) < 0) return;
+    m_strokeLayer = -1;
+    emit historyChanged();
+    scheduleRegionChanged();
+}
+
+void CanvasController::redo() {
+    if (m_strokeOpen) endStroke();
+    if (m_history.redo(m_layers) < 0) return;
+    m_strokeLayer = -1;
+    emit historyChanged();
+    scheduleRegionChanged();
+}
+
+// layer properties. The layers mark their pixels dirty when these change
+
+void CanvasController::setLayerVisible(int layer, bool visible) {
+    if (layer < 0 || layer >= m_layers.size()) return;
+    m_layers[layer].setVisible(visible);
+    scheduleRegionChanged();
+}
+
+void CanvasController::setLayerOpacity(int layer, float opacity) {
+    if (layer < 0 || layer >= m_layers.size()) return;
+    m_layers[layer].setOpacity(opacity);
+    scheduleRegionChanged();
+}
+
+void CanvasController::setLayerBlendMode(int layer, int mode) {
+    if (layer < 0 || layer >= m_layers.size()) return;
+    mode = clampToRange(mode, 0, static_cast<int>(RasterLayer::BlendMode::Add));
+    m_layers[layer].setBlendMode(static_cast<RasterLayer::BlendMode>(mode));
+    scheduleRegionChanged();
+}
+
+bool CanvasController::canUndo() const { return m_history.canUndo() || !m_pendingEdit.isEmpty(); }
+bool CanvasController::canRedo() const { return m_history.canRedo(); }
+
+bool CanvasController::hasSelection() const { return !m_selection.isEmpty(); }
+QRect CanvasController::selectionBounds() const { return m_selection.boundingRect(); }
+const SelectionMask& CanvasController::selection() const { return m_selection; }
+
+qint64 CanvasController::undoMemoryLimit() const { return m_history.memoryLimit(); }
+void CanvasController::setUndoMemoryLimit(qint64 bytes) {
+    if (bytes == m_history.memoryLimit()) return;
+    m_history.setMemoryLimit(std::max<qint64>(0, bytes));
+    emit undoMemoryLimitChanged();
+    emit historyChanged();
+}
+
+LayerDelta& CanvasController::beginEdit() {
+    // a stroke that moves to another layer splits into one undo step per layer
+    if (m_pendingLayer != m_activeLayer) flushEdit();
+    m_pendingLayer = m_activeLayer;
+    m_strokeLayer = -1; // may change what the brush's last stamp put down
+    return m_pendingEdit;
+}
+
+void CanvasController::endEdit() {
+    if (!m_strokeOpen) flushEdit();
+    scheduleRegionChanged();
+}
+
+void CanvasController::flushEdit() {
+    if (m_pendingEdit.isEmpty()) return;
+
+    m_history.push(m_pendingLayer, std::move(m_pendingEdit), m_clock.elapsed());
+    m_pendingEdit = LayerDelta();
+    emit historyChanged();
+}
+
+void CanvasController::strokeTo(qreal x, qreal y, const std::optional<Pixel> value) {
+    // the engine leaves out what its last stamp covered, which is only right if that
+    // stamp put down the same thing in the same place, with no other edit since
+    if (value != m_strokeValue || m_activeLayer != m_strokeLayer) m_stroke.restamp();
+    QVector<ColumnRun> runs = m_stroke.moveTo(QPointF(x, y));
+    if (!m_selection.isEmpty()) runs = m_selection.clip(std::move(runs));
+    if (runs.isEmpty()) return;
+
+    // get the active layer
+    RasterLayer& layer = m_layers[m_activeLayer];
+    LayerDelta& delta = beginEdit();
+    m_strokeValue = value;
+    m_strokeLayer = m_activeLayer;
+    delta.recordRuns(layer, runs, value);
+    if (value) {
+        layer.fillRuns(runs, *value);
+    } else {
+        layer.eraseRuns(runs);
+    }
+    endEdit();
+}
+
+void CanvasController::select(const SelectionMask& mask, int op) {
+    switch (op) {
+    case 1: m_selection = m_selection.united(mask); break;
+    case 2: m_selection = m_selection.subtracted(mask); break;
+    case 3: m_selection = m_selection.intersected(mask); break;
+    default: m_selection = mask; break;
+    }
+    m_strokeLayer = -1; // the brush's last stamp was clipped to the old selection
+    emit selectionChanged();
+}
+
+bool CanvasController::isSelected(int x, int y) const {
+    return m_selection.isEmpty() || m_selection.contains(QPoint(x, y));
+}
+
+void CanvasController::scheduleRegionChanged() {
+    if (!m_regionTimer.isActive()) m_regionTimer.start();
+}
+
+void CanvasController::emitRegionChanged() {
+    m_regionTimer.stop();
+
+    QRegion region;
+    for (RasterLayer& layer : m_layers) {
+        if (!layer.isDirty()) continue;
+
+        // sorted by row, then column, and disjoint: already in QRegion's banded form
+        const QVector<QRect> rects = layer.takeDirtyRects();
+        QRegion changed;
+        changed.setRects(rects.constData(), static_cast<int>(rects.size()));
+        region += changed;
+    }
+    if (!region.isEmpty()) emit regionChanged(region);
 }
 
 std::optional<PixelRef> CanvasController::getPixel(int x, int y) const {
     // get the active layer
-    RasterLayer layer = m_layers[m_activeLayer];
+    const RasterLayer& layer = m_layers[m_activeLayer];
     return layer.get({x, y});
 }
 
+QColor CanvasController::pixelColor(int x, int y) const {
+    auto pixel = getPixel(x, y);
+    if (!pixel.has_value()) return QColor(Qt::transparent);
+    return pixel->value.toColor();
+}
+
 QVector<PixelRef> CanvasController::getLayerPixels(int layer) const {
-    // get the active layer
-    RasterLayer l = m_layers[layer];
+    if (layer < 0 || layer >= m_layers.size()) return {};
+
+    const RasterLayer& l = m_layers[layer];
+    return l.get(QRect(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX)));
+}
+
+RasterLayer CanvasController::snapshotLayer(int layer) const {
+    if (layer < 0 || layer >= m_layers.size()) return RasterLayer();
+    return m_layers[layer]; // shares pixels with the live layer until it is next drawn on
+}
+
+const QVector<RasterLayer>& CanvasController::layers() const { return m_layers; }
+
+float CanvasController::pixelSize() const { return m_defaultPixelSize * m_zoom; }
+
+QRect CanvasController::viewport() const {
+    const QRectF area = visibleArea(m_x, m_y, pixelSize(), QSizeF(m_width, m_height));
+    return area.isEmpty() ? QRect() : area.toAlignedRect();
+}
+
+QRectF CanvasController::visibleArea(qreal x, qreal y, qreal pixelSize, const QSizeF& size) {
+    if (pixelSize <= 0) return QRectF();
+    const qreal w = size.width() / pixelSize, h = size.height() / pixelSize;
+    return QRectF(x - w / 2, y - h / 2, w, h);
 }
 
 int CanvasController::width() const { return m_width; }
 void CanvasController::setWidth(int width) {
     m_width = clampToNonNegative(width);
     emit widthChanged();
+    emit viewportChanged();
 }
 
 int CanvasController::height() const { return m_height; }
 void CanvasController::setHeight(int height) {
     m_height = clampToNonNegative(height);
     emit heightChanged();
+    emit viewportChanged();
+}
+
+int CanvasController::canvasWidth() const { return m_canvasWidth; }
+void CanvasController::setCanvasWidth(int width) {
+    width = clampToNonNegative(width);
+    if (width == m_canvasWidth) return;
+    m_canvasWidth = width;
+    emit canvasWidthChanged();
 }
 
+int CanvasController::canvasHeight() const { return m_canvasHeight; }
+void CanvasController::setCanvasHeight(int height) {
+    height = clampToNonNegative(height);
+    if (height == m_canvasHeight) return;
+    m_canvasHeight = height;
+    emit canvasHeightChanged();
+}
+
+QRect CanvasController::canvasRect() const { return QRect(0, 0, m_canvasWidth, m_canvasHeight); }
+
 int CanvasController::activeLayer() const { return m_activeLayer; }
 void CanvasController::setActiveLayer(int newActiveLayer) {
-    m_activeLayer = clampToRange(newActiveLayer, 0, static_cast<int>(m_layers.size()));
+    m_activeLayer = clampToRange(newActiveLayer, 0, static_cast<int>(m_layers.size()) - 1);
     emit activeLayerChanged();
 }
 
@@ -77,6 +490,7 @@ int CanvasController::clampToRange(int value, int min, int max) const {
     return std::max(min, std::min(max, value));
 }
 
+
 // canvas Controls
 
 float CanvasController::x() const { return m_x; }
@@ -85,6 +499,7 @@ void CanvasController::setX(float newX) {
         return;
     m_x = newX;
     emit xChanged();
+    emit viewportChanged();
 }
 float CanvasController::y() const { return m_y; }
 void CanvasController::setY(float newY) {
@@ -92,6 +507,7 @@ void CanvasController::setY(float newY) {
         return;
     m_y = newY;
     emit yChanged();
+    emit viewportChanged();
 }
 float CanvasController::zoom() const { return m_zoom; }
 void CanvasController::setZoom(float newZoom) {
@@ -99,4 +515,5 @@ void CanvasController::setZoom(float newZoom) {
         return;
     m_zoom = newZoom;
     emit zoomChanged();
+    emit viewportChanged();
 }
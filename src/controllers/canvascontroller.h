@@ -1,9 +1,17 @@
 #ifndef CANVASCONTROLLER_H
 #define CANVASCONTROLLER_H
 
+#include <QElapsedTimer>
 #include <QObject>
+#include <QRectF>
+#include <QRegion>
+#include <QTimer>
 #include <qqmlintegration.h>
+#include <floodfill.h>
 #include <rasterlayer.h>
+#include <selectionmask.h>
+#include <strokeengine.h>
+#include <undohistory.h>
 
 class CanvasController : public QObject
 {
@@ -13,10 +21,18 @@ class CanvasController : public QObject
 
     Q_PROPERTY(int width READ width WRITE setWidth NOTIFY widthChanged)
     Q_PROPERTY(int height READ height WRITE setHeight NOTIFY heightChanged)
+    Q_PROPERTY(int canvasWidth READ canvasWidth WRITE setCanvasWidth NOTIFY canvasWidthChanged)
+    Q_PROPERTY(int canvasHeight READ canvasHeight WRITE setCanvasHeight NOTIFY canvasHeightChanged)
     Q_PROPERTY(float x READ x WRITE setX NOTIFY xChanged)
     Q_PROPERTY(float y READ y WRITE setY NOTIFY yChanged)
     Q_PROPERTY(float zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
+    Q_PROPERTY(QRect viewport READ viewport NOTIFY viewportChanged)
     Q_PROPERTY(int activeLayer READ activeLayer WRITE setActiveLayer NOTIFY activeLayerChanged)
+    Q_PROPERTY(bool canUndo READ canUndo NOTIFY historyChanged)
+    Q_PROPERTY(bool canRedo READ canRedo NOTIFY historyChanged)
+    Q_PROPERTY(qint64 undoMemoryLimit READ undoMemoryLimit WRITE setUndoMemoryLimit NOTIFY undoMemoryLimitChanged)
+    Q_PROPERTY(bool hasSelection READ hasSelection NOTIFY selectionChanged)
+    Q_PROPERTY(QRect selectionBounds READ selectionBounds NOTIFY selectionChanged)
 
 public:
     explicit CanvasController(QObject *parent = nullptr);
@@ -26,17 +42,105 @@ public:
     }
     Q_INVOKABLE void drawPixel(int x, int y, QColor c);
     Q_INVOKABLE void erasePixel(int x, int y);
+
+    // batch versions for brush strokes, so a whole stroke crosses from QML in one call.
+    // points is packed as [x0, y0, x1, y1, ...]
+    Q_INVOKABLE void drawPixels(const QList<int>& points, QColor c);
+    Q_INVOKABLE void erasePixels(const QList<int>& points);
+    Q_INVOKABLE void fillRect(int x, int y, int width, int height, QColor c);
+    // brush strokes from raw pointer samples: each call paints or erases what the
+    // brush covers from the previous sample of the stroke to (x, y), so fast motion
+    // leaves no gaps. shape is 0 for round, 1 for square; spacing is the distance
+    // between stamps as a fraction of size. beginStroke and endStroke start a new line
+    Q_INVOKABLE void setBrush(int size, int shape, float spacing);
+    Q_INVOKABLE void paintTo(qreal x, qreal y, QColor c);
+    Q_INVOKABLE void eraseTo(qreal x, qreal y);
     Q_INVOKABLE void clearLayer();
+    // bucket fill from (x, y) on the active layer, within the canvas (canvasWidth x
+    // canvasHeight pixels from (0, 0)): the pixels whose channels are all within
+    // tolerance (0 to 255) of the seed's, connected to it or anywhere. A transparent
+    // color erases them
+    Q_INVOKABLE void floodFill(int x, int y, QColor c, int tolerance, bool contiguous);
+
+    // while there is a selection, every edit above only changes selected pixels. op 0
+    // replaces the selection, 1 adds to it, 2 subtracts from it and 3 keeps what is in
+    // both. The lasso is packed as [x0, y0, x1, y1, ...] in canvas pixels; the magic
+    // wand selects what floodFill would fill
+    Q_INVOKABLE void selectRect(int x, int y, int width, int height, int op);
+    Q_INVOKABLE void selectEllipse(int x, int y, int width, int height, int op);
+    Q_INVOKABLE void selectLasso(const QList<qreal>& points, int op);
+    Q_INVOKABLE void selectMagicWand(int x, int y, int tolerance, bool contiguous, int op);
+    Q_INVOKABLE void selectAll();
+    Q_INVOKABLE void clearSelection();
+
+    // write the layers and the canvas size to a .pxa project, or replace them with the
+    // ones of a project. Loading clears the undo history. Both return false if the
+    // file could not be written or read, and leave the canvas as it was
+    Q_INVOKABLE bool saveProject(const QString& path);
+    Q_INVOKABLE bool loadProject(const QString& path);
+
+    // write a box of canvas to an image file, streamed a band of rows at a time: one
+    // layer, or every layer flattened for layer -1. Raw RGBA8 for a path ending in
+    // .rgba or .raw, PNG otherwise. Returns false if the file could not be written
+    Q_INVOKABLE bool exportImage(const QString& path, int layer, int x, int y, int width, int height);
+    // load an image file, PNG or anything Qt reads, onto the active layer with its top
+    // left pixel at (x, y), as one undo step. Raw RGBA8 has no header, so needs its
+    // width. Returns false if the file could not be read; rows read before the error
+    // stay
+    Q_INVOKABLE bool importImage(const QString& path, int x, int y);
+    Q_INVOKABLE bool importRaw(const QString& path, int x, int y, int width);
+
+    // every edit between beginStroke and endStroke undoes as one step. Edits outside
+    // a stroke are coalesced when they come in quick succession on the same layer
+    Q_INVOKABLE void beginStroke();
+    Q_INVOKABLE void endStroke();
+    Q_INVOKABLE void undo();
+    Q_INVOKABLE void redo();
+
+    // how a layer is composited. mode is a RasterLayer::BlendMode: 0 normal,
+    // 1 multiply, 2 screen, 3 add
+    Q_INVOKABLE void setLayerVisible(int layer, bool visible);
+    Q_INVOKABLE void setLayerOpacity(int layer, float opacity);
+    Q_INVOKABLE void setLayerBlendMode(int layer, int mode);
+
+    // color of the pixel at (x, y) on the active layer, transparent if there is none.
+    // Layers store packed Pixels, this is where they turn back into QColors for QML
+    Q_INVOKABLE QColor pixelColor(int x, int y) const;
 
     std::optional<PixelRef> getPixel(int x, int y) const;
     QVector<PixelRef> getLayerPixels(int layer) const;
 
+    // an O(1) copy of a layer for undo, export or rendering off the GUI thread
+    RasterLayer snapshotLayer(int layer) const;
+
+    // the layers, bottom first, for the renderer
+    const QVector<RasterLayer>& layers() const;
+
+    // size of one canvas pixel on screen, in item units, at the current zoom
+    float pixelSize() const;
+
+    // the canvas pixels on screen: the view is width x height item units centered
+    // on (x, y), rounded out to whole pixels
+    QRect viewport() const;
+
+    // the canvas area shown by a view of size item units centered on (x, y), where a
+    // canvas pixel is pixelSize units wide
+    static QRectF visibleArea(qreal x, qreal y, qreal pixelSize, const QSizeF& size);
+
     int width() const;
     void setWidth(int width);
 
     int height() const;
     void setHeight(int height);
 
+    // size of the canvas in canvas pixels, the bounds of fills, selections and projects.
+    // width and height are the view's, in item units
+    int canvasWidth() const;
+    void setCanvasWidth(int width);
+
+    int canvasHeight() const;
+    void setCanvasHeight(int height);
+
     int activeLayer() const;
     void setActiveLayer(int newActiveLayer);
 
@@ -47,21 +151,47 @@ public:
     float zoom() const;
     void setZoom(float newZoom);
 
+    bool canUndo() const;
+    bool canRedo() const;
+    qint64 undoMemoryLimit() const;
+    void setUndoMemoryLimit(qint64 bytes);
+
+    bool hasSelection() const;
+    QRect selectionBounds() const;
+    const SelectionMask& selection() const;
+
 signals:
     void widthChanged();
     void heightChanged();
+    void canvasWidthChanged();
+    void canvasHeightChanged();
     void activeLayerChanged();
 
     void xChanged();
     void yChanged();
     void zoomChanged();
+    void viewportChanged();
+
+    void historyChanged();
+    void selectionChanged();
+
+    // pixels within region changed on some layer since the last emission. Edits are
+    // collected by the layers and reported once per pass of the event loop, so a burst
+    // of them (a stroke's worth of input in one frame) costs the view one update
+    void regionChanged(const QRegion& region);
+    void undoMemoryLimitChanged();
 
 private:
     int m_width;
     int m_height;
+    int m_canvasWidth;
+    int m_canvasHeight;
     int m_activeLayer;
     QVector<RasterLayer> m_layers;
 
+    // the canvas, (0, 0) to canvasWidth x canvasHeight
+    QRect canvasRect() const;
+
     // helper functions
     int clampToRange(int value, int min, int max) const;
     int clampToNonNegative(int value) const;
@@ -70,6 +200,43 @@ private:
     float m_zoom;
 
     float m_defaultPixelSize;
+
+    // undo history. Edits are recorded into m_pendingEdit, which goes on the
+    // history after each call, or at the end of the stroke if one is open
+    UndoHistory m_history;
+    LayerDelta m_pendingEdit;
+    int m_pendingLayer;
+    bool m_strokeOpen;
+    QElapsedTimer m_clock; // timestamps for coalescing
+    StrokeEngine m_stroke; // interpolates paintTo and eraseTo samples
+    std::optional<Pixel> m_strokeValue; // what the last of them put down, nullopt for erasing
+    int m_strokeLayer;                  // and where, -1 after any other edit
+
+    // return the delta to record an edit of the active layer into
+    LayerDelta& beginEdit();
+    // finish an edit started with beginEdit
+    void endEdit();
+    // push the pending delta onto the history
+    void flushEdit();
+    // paint value along the stroke to (x, y), or erase for nullopt
+    void strokeTo(qreal x, qreal y, const std::optional<Pixel> value);
+
+    // the selection, empty for none
+    SelectionMask m_selection;
+    // combine mask into the selection as op of the select functions says
+    void select(const SelectionMask& mask, int op);
+    // return if an edit may change the pixel at (x, y)
+    bool isSelected(int x, int y) const;
+    // load path onto the active layer: raw RGBA8 rows of rawWidth pixels, or an image
+    // file for 0
+    bool importFile(const QString& path, int x, int y, int rawWidth);
+
+    // collects layer changes into one regionChanged per pass of the event loop
+    QTimer m_regionTimer;
+    // emit regionChanged for whatever the layers changed since the last time
+    void emitRegionChanged();
+    // emit it once the current burst of changes is over
+    void scheduleRegionChanged();
 };
 
 #endif // CANVASCONTROLLER_H
@@ -3,59 +3,180 @@
 
 #include <QColor>
 #include <QRect>
+#include <nodestorage.h>
+#include <algorithm>
+#include <iterator>
 #include <optional>
+#include <type_traits>
 
-template <typename K, typename V>
+// Nodes is the storage policy (see nodestorage.h): PooledNodes keeps pointer
+// linked nodes in a slab pool, IndexedNodes keeps them in one contiguous vector.
+template <typename K, typename V, typename Nodes = PooledNodes>
 
 class AVLTree {
 
 private:
+    struct Node;
+    typedef typename Nodes::template Link<Node> Link;
+    typedef typename Nodes::template Store<Node> Store;
+
     struct Node {
         K key;
         V val;
-        Node* parent;
-        Node* left;
-        Node* right;
+        Link parent;
+        Link left;
+        Link right;
         int height;
 
         Node(K k, V v)
-            : key(k), val(v), parent(nullptr), left(nullptr), right(nullptr), height(0) {};
+            : key(std::move(k)), val(std::move(v)), parent(Store::nil), left(Store::nil), right(Store::nil), height(0) {};
     };
 
-    Node* root;
+    static constexpr Link nil = Store::nil;
+
+    Link root;
     int size_;
+    Store nodes_; // every node of this tree lives in here
 
     // helper functions ---------------------------
 
+    // resolve a link to its node
+    Node& node(Link x) const { return nodes_.at(x); }
+
+    // height of the subtree at x (-1 for nil)
+    int height(Link x) const { return x == nil ? -1 : node(x).height; }
+
+    // find the node with key k, or nil
+    Link find(const K& k) const;
+
     // find the min
-    Node* min(Node* x) const;
+    Link min(Link x) const;
 
     // find the max
-    Node* max(Node* x) const;
+    Link max(Link x) const;
+
+    // find the first node with key >= k, or nil
+    Link lowerBoundLink(const K& k) const;
+
+    // find the first node with key > k, or nil
+    Link upperBoundLink(const K& k) const;
+
+    // find the in-order successor of x, or nil
+    Link nextLink(Link x) const;
+
+    // find the in-order predecessor of x, or nil
+    Link prevLink(Link x) const;
 
     // rotate left on node x
-    void leftRotate(Node* x);
+    void leftRotate(Link x);
 
     // rotate right on node x
-    void rightRotate(Node* x);
+    void rightRotate(Link x);
 
     // fix the balance after an insertion or deletion
-    void balance(Node* x);
+    void balance(Link x);
 
-    // copy a tree from node x
-    void copyTree(Node* x);
+    // build a perfectly balanced subtree out of the next n entries of it, taken in
+    // order, and return its root. Nodes are created in key order too
+    template <typename It>
+    Link buildSorted(It& it, int n) {
+        if (n == 0) return nil;
+
+        const int leftCount = (n - 1) / 2;
+        Link left = buildSorted(it, leftCount);
+        Link x;
+        {
+            auto&& entry = *it;
+            x = nodes_.create(entry.first, entry.second);
+        }
+        ++it;
+        Link right = buildSorted(it, n - 1 - leftCount);
+
+        // no Node& may be held across create(), IndexedNodes can move them
+        Node& X = node(x);
+        X.left = left;
+        X.right = right;
+        X.height = 1 + std::max(height(left), height(right));
+        if (left != nil) node(left).parent = x;
+        if (right != nil) node(right).parent = x;
+        return x;
+    }
 
 public:
+    // In-order bidirectional iterator. Steps along the parent links, so walking
+    // needs no stack and can stop anywhere. Dereferencing gives a (key, value)
+    // pair of references. Inserting or removing invalidates iterators
+    class iterator {
+        friend class AVLTree;
+
+        const AVLTree* tree_;
+        Link cur_; // nil is end()
+
+        iterator(const AVLTree* tree, Link cur) : tree_(tree), cur_(cur) {}
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<const K&, V&>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<const K&, V&>;
+
+        // operator-> needs something to point at
+        struct pointer {
+            reference entry;
+            const reference* operator->() const { return &entry; }
+        };
+
+        iterator() : tree_(nullptr), cur_(nil) {}
+
+        const K& key() const { return tree_->node(cur_).key; }
+        V& value() const { return tree_->node(cur_).val; }
+
+        reference operator*() const { return {key(), value()}; }
+        pointer operator->() const { return {**this}; }
+
+        iterator& operator++() {
+            cur_ = tree_->nextLink(cur_);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        // end() steps back onto the last node
+        iterator& operator--() {
+            cur_ = cur_ == nil ? tree_->max(tree_->root) : tree_->prevLink(cur_);
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator& other) const { return cur_ == other.cur_; }
+        bool operator!=(const iterator& other) const { return cur_ != other.cur_; }
+    };
+    typedef iterator const_iterator; // the tree hands out mutable values from const methods as well
+
     // constructor destructor ---------------------------
     AVLTree();
     AVLTree(const AVLTree& other);
+    AVLTree(AVLTree&& other) noexcept;
     ~AVLTree();
 
+    AVLTree& operator=(const AVLTree& other);
+    AVLTree& operator=(AVLTree&& other) noexcept;
+
     // accessors ---------------------------
 
     // return the number of nodes in the tree
     int size() const;
 
+    // return the number of heap allocations the tree has made for its nodes
+    int allocations() const;
+
     // return if there is a node at location k
     bool contains(const K k) const;
 
@@ -64,11 +185,61 @@ public:
     // return all values within a given range (inclusive). If there are no values in the range, return an empty vector
     QVector<QPair<K, std::reference_wrapper<V>>> getRange(const K lower, const K upper) const;
 
+    // in-order iteration, smallest key first
+    iterator begin() const { return iterator(this, root == nil ? nil : min(root)); }
+    iterator end() const { return iterator(this, nil); }
+
+    // the node with the smallest / largest key, or end() if the tree is empty
+    iterator first() const { return begin(); }
+    iterator last() const { return iterator(this, root == nil ? nil : max(root)); }
+
+    // the first node with key >= k / key > k, or end()
+    iterator lowerBound(const K k) const { return iterator(this, lowerBoundLink(k)); }
+    iterator upperBound(const K k) const { return iterator(this, upperBoundLink(k)); }
+
+    // the nearest node with key > k / key < k, or end(). k itself need not be in the tree
+    iterator successor(const K k) const { return upperBound(k); }
+    iterator predecessor(const K k) const {
+        Link x = lowerBoundLink(k);
+        return iterator(this, x == nil ? (root == nil ? nil : max(root)) : prevLink(x));
+    }
+
+    // call visit(key, value) for every node within a given range (inclusive), in key order.
+    // Walks the tree in place, no allocation. visit may return false to stop early, in
+    // which case this returns false too
+    template <typename F>
+    bool forEachInRange(const K lower, const K upper, F&& visit) const {
+        if (upper < lower) return true;
+
+        for (Link cur = lowerBoundLink(lower); cur != nil; cur = nextLink(cur)) {
+            Node& n = node(cur);
+            if (upper < n.key) break;
+
+            if constexpr (std::is_void_v<std::invoke_result_t<F&, const K&, V&>>) {
+                visit(n.key, n.val);
+            } else if (!visit(n.key, n.val)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     // mutators ---------------------------
 
     // clear the tree
     void clear();
 
+    // replace the contents with the (key, value) pairs of [first, last), which must be
+    // sorted by strictly increasing key and must not come from this tree. Builds a
+    // perfectly balanced tree in O(n) with no rotations, instead of n upserts
+    template <typename It>
+    void buildFromSorted(It first, It last) {
+        const int n = static_cast<int>(std::distance(first, last));
+        clear();
+        root = buildSorted(first, n);
+        size_ = n;
+    }
+
     // update the pixel at location k with value v. If the pixel does not exist, do nothing
     void update(const K k, const V v);
 
@@ -78,6 +249,11 @@ public:
     // remove the pixel at location k. If the pixel does not exist, do nothing
     void remove(const K k);
 
+    // re-lay the nodes out in breadth-first (Eytzinger) order, so the top levels
+    // that every search walks through sit next to each other. Worth it for trees
+    // that are read far more often than they are edited
+    void compact();
+
     // other functions ---------------------------
 
     // write the tree in string format
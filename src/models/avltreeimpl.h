@@ -0,0 +1,517 @@
+#ifndef AVLTREEIMPL_H
+#define AVLTREEIMPL_H
+
+// The member definitions of AVLTree. Only included by the .cpp files that
+// instantiate it: avltree.cpp for the plain key and value types, and each
+// storage backend for the trees of its own types.
+
+#include <avltree.h>
+
+#include <QtCore/qdebug.h>
+#include <algorithm>
+#include <queue>
+#include <sstream>
+#include <stack>
+#include <tuple>
+#include <type_traits>
+
+// template <typename K, typename V>
+// typename AVLTree<K, V>::Node* AVLTree<K, V>::nil = nullptr;
+
+// template <typename K, typename V>
+// int AVLTree<K, V>::nilInstances_ = 0;
+
+template <typename K, typename V, typename Nodes>
+AVLTree<K, V, Nodes>::AVLTree() {
+    root = nil;
+    size_ = 0;
+}
+
+template <typename K, typename V, typename Nodes>
+AVLTree<K, V, Nodes>::AVLTree(const AVLTree<K, V, Nodes>& other) {
+    // deep copy tree. other is already sorted, so bulk build instead of re-inserting
+    auto it = other.begin();
+    root = buildSorted(it, other.size_);
+    size_ = other.size_;
+}
+
+template <typename K, typename V, typename Nodes>
+AVLTree<K, V, Nodes>::AVLTree(AVLTree<K, V, Nodes>&& other) noexcept
+    : root(other.root), size_(other.size_), nodes_(std::move(other.nodes_)) {
+    // nodes stay where they are, only ownership of the storage moves
+    other.root = nil;
+    other.size_ = 0;
+}
+
+template <typename K, typename V, typename Nodes>
+AVLTree<K, V, Nodes>::~AVLTree() {
+    clear();
+}
+
+template <typename K, typename V, typename Nodes>
+AVLTree<K, V, Nodes>& AVLTree<K, V, Nodes>::operator=(const AVLTree<K, V, Nodes>& other) {
+    if (this == &other) return *this;
+
+    clear();
+    auto it = other.begin();
+    root = buildSorted(it, other.size_);
+    size_ = other.size_;
+    return *this;
+}
+
+template <typename K, typename V, typename Nodes>
+AVLTree<K, V, Nodes>& AVLTree<K, V, Nodes>::operator=(AVLTree<K, V, Nodes>&& other) noexcept {
+    if (this == &other) return *this;
+
+    clear();
+    root = other.root;
+    size_ = other.size_;
+    nodes_ = std::move(other.nodes_);
+
+    other.root = nil;
+    other.size_ = 0;
+    return *this;
+}
+
+// helper functions ---------------------------
+
+// find()
+// returns the node holding key k, or nil if there is none.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::find(const K& k) const {
+    Link cur = root;
+    while (cur != nil) {
+        const Node& n = node(cur);
+        if (k == n.key) return cur;
+        cur = (k < n.key) ? n.left : n.right;
+    }
+    return nil;
+}
+
+// min()
+// If the subtree rooted at R is not empty, returns a pointer to the
+// leftmost Node in that subtree, otherwise returns nil.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::min(Link x) const {
+    if (x == nil) return nil;
+    while (node(x).left != nil) x = node(x).left;
+    return x;
+}
+
+// max()
+// if the subtree rooted at R is not empty, returns a pointer to the
+// rightmost Node in that subtree, otherwise returns nil.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::max(Link x) const {
+    if (x == nil) return nil;
+    while (node(x).right != nil) x = node(x).right;
+    return x;
+}
+
+// lowerBoundLink()
+// returns the node with the smallest key that is not less than k, or nil.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::lowerBoundLink(const K& k) const {
+    Link cur = root;
+    Link best = nil;
+    while (cur != nil) {
+        const Node& n = node(cur);
+        if (n.key < k) {
+            cur = n.right;
+        } else { // candidate, look for a smaller one on the left
+            best = cur;
+            cur = n.left;
+        }
+    }
+    return best;
+}
+
+// upperBoundLink()
+// returns the node with the smallest key greater than k, or nil.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::upperBoundLink(const K& k) const {
+    Link cur = root;
+    Link best = nil;
+    while (cur != nil) {
+        const Node& n = node(cur);
+        if (k < n.key) { // candidate, look for a smaller one on the left
+            best = cur;
+            cur = n.left;
+        } else {
+            cur = n.right;
+        }
+    }
+    return best;
+}
+
+// nextLink()
+// returns the next node in key order, or nil if x is the last one. Uses the
+// parent links, so there is no stack to allocate.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::nextLink(Link x) const {
+    if (node(x).right != nil) return min(node(x).right);
+
+    // climb until we come up from a left child
+    Link parent = node(x).parent;
+    while (parent != nil && x == node(parent).right) {
+        x = parent;
+        parent = node(parent).parent;
+    }
+    return parent;
+}
+
+// prevLink()
+// returns the previous node in key order, or nil if x is the first one.
+template <typename K, typename V, typename Nodes>
+typename AVLTree<K, V, Nodes>::Link AVLTree<K, V, Nodes>::prevLink(Link x) const {
+    if (node(x).left != nil) return max(node(x).left);
+
+    // climb until we come up from a right child
+    Link parent = node(x).parent;
+    while (parent != nil && x == node(parent).left) {
+        x = parent;
+        parent = node(parent).parent;
+    }
+    return parent;
+}
+
+// leftRotate()
+// do a single left rotation on the node x.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::leftRotate(Link x) {
+    if(x == nil || node(x).right == nil) return; // can't rotate
+
+    // normal rotation
+    Node& X = node(x);
+    Link y = X.right;
+    Node& Y = node(y);
+    X.right = Y.left;
+    if(X.right != nil) node(X.right).parent = x;
+    Y.left = x;
+
+    // relink parent
+    Y.parent = X.parent;
+    X.parent = y;
+
+    if(Y.parent == nil) root = y;
+    else if (node(Y.parent).left == x) node(Y.parent).left = y; // left child
+    else node(Y.parent).right = y; // right child
+
+    // update height
+    X.height = 1 + std::max(height(X.left), height(X.right));
+    Y.height = 1 + std::max(height(Y.left), height(Y.right));
+}
+
+// rightRotate()
+// do a single right rotation on the node x.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::rightRotate(Link x) {
+    if(x == nil || node(x).left == nil) return; // can't rotate
+
+    // normal rotation
+    Node& X = node(x);
+    Link y = X.left;
+    Node& Y = node(y);
+    X.left = Y.right;
+    if(X.left != nil) node(X.left).parent = x;
+    Y.right = x;
+
+    // relink parent
+    Y.parent = X.parent;
+    X.parent = y;
+
+    if(Y.parent == nil) root = y;
+    else if (node(Y.parent).left == x) node(Y.parent).left = y; // left child
+    else node(Y.parent).right = y; // right child
+
+    // update height
+    X.height = 1 + std::max(height(X.left), height(X.right));
+    Y.height = 1 + std::max(height(Y.left), height(Y.right));
+}
+
+// balance()
+// balances the tree after an insertion or deletion.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::balance(Link x) {
+    while (x != nil && node(x).parent != nil) {
+        Link y = node(x).parent; // get parent
+        Node& Y = node(y);
+
+        // update height
+        int leftHeight = height(Y.left);
+        int rightHeight = height(Y.right);
+        Y.height = 1 + std::max(leftHeight, rightHeight);
+
+        // calculate bf
+        int bf = leftHeight - rightHeight;
+
+        if (bf > 1) { // left heavy
+            int leftBf = height(node(Y.left).left) - height(node(Y.left).right);
+            if (leftBf < 0) leftRotate(Y.left); // right heavy on left subtree
+            rightRotate(y);
+        } else if (bf < -1) { // right heavy
+            int rightBf = height(node(Y.right).left) - height(node(Y.right).right);
+            if (rightBf > 0) rightRotate(Y.right); // left heavy on right subtree
+            leftRotate(y);
+        }
+
+        x = y;
+    }
+}
+
+// accessors ---------------------------
+
+// size()
+// returns the number of pixels in the tree.
+template <typename K, typename V, typename Nodes>
+int AVLTree<K, V, Nodes>::size() const {
+    return size_;
+}
+
+// allocations()
+// returns the number of times node storage has been requested from the heap.
+template <typename K, typename V, typename Nodes>
+int AVLTree<K, V, Nodes>::allocations() const {
+    return nodes_.allocations();
+}
+
+// contains()
+// returns true if the tree contains a pixel at location k.
+template <typename K, typename V, typename Nodes>
+bool AVLTree<K, V, Nodes>::contains(const K k) const {
+    return find(k) != nil;
+}
+
+// get(const Location k)
+// returns the pixel at location k. If there is no pixel at location k, returns std::nullopt.
+template <typename K, typename V, typename Nodes>
+std::optional<std::reference_wrapper<V>> AVLTree<K, V, Nodes>::get(const K k) const {
+    Link cur = find(k);
+    if (cur == nil) return std::nullopt;
+    return std::ref(node(cur).val);
+}
+
+// getRange()
+// returns every (key, value) pair with lower <= key <= upper, in key order.
+template <typename K, typename V, typename Nodes>
+QVector<QPair<K, std::reference_wrapper<V>>> AVLTree<K, V, Nodes>::getRange(const K lower, const K upper) const {
+    QVector<QPair<K, std::reference_wrapper<V>>> values;
+
+    forEachInRange(lower, upper, [&values](const K& k, V& v) {
+        values.push_back({k, std::ref(v)});
+    });
+
+    return values;
+}
+
+// mutators ---------------------------
+
+// clear()
+// clears the tree. Node storage is handed back to the heap in bulk, so when
+// nodes need no destructor this is a handful of frees regardless of size.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::clear() {
+    if constexpr (!Store::releaseDestroysNodes && !std::is_trivially_destructible_v<Node>) {
+        // post-walk the tree so every value gets destroyed
+        Link cur = root;
+
+        while (cur != nil) {
+            Node& C = node(cur);
+            if (C.left != nil) {
+                // traverse left as far as possible
+                cur = C.left;
+            } else if (C.right != nil) {
+                // if left is unavailable, go right if possible
+                cur = C.right;
+            } else {
+                // no leaf nodes left. delete current and step back
+                Link N = cur;
+                cur = C.parent;
+
+                if (cur != nil) { // set nils
+                    if (node(cur).left == N) node(cur).left = nil;
+                    else if (node(cur).right == N) node(cur).right = nil;
+                }
+
+                C.~Node();
+            }
+        }
+    }
+
+    nodes_.release();
+    root = nil;
+    size_ = 0;
+}
+
+// update()
+// updates the pixel at location k with value v. If the pixel does not exist, does nothing.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::update(const K k, const V v) {
+    Link cur = find(k);
+    if (cur != nil) { // update
+        node(cur).val = v;
+    }
+}
+
+// upsert()
+// inserts or updates the pixel at location k with value v.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::upsert(const K k, const V v) {
+    // insert or update
+    Link cur = root;
+    Link parent = nil;
+    while (cur != nil && node(cur).key != k) {
+        parent = cur;
+        if (k < node(cur).key) cur = node(cur).left;
+        else cur = node(cur).right;
+    }
+
+    if (cur != nil) { // update
+        node(cur).val = v;
+        return;
+    }
+
+    // create new node (may move other nodes, so only hold links across this)
+    cur = nodes_.create(k, v);
+    node(cur).parent = parent;
+
+    // update parent
+    if(parent == nil) root = cur;
+    else if (k < node(parent).key) node(parent).left = cur;
+    else node(parent).right = cur;
+
+    // balance the tree
+    balance(cur);
+    size_++;
+}
+
+// remove()
+// removes the pixel at location k. If the pixel does not exist, does nothing.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::remove(const K k) {
+    Link cur = find(k);
+    if(cur == nil) return; // element doesnt exist
+
+    Node& C = node(cur);
+    Link parent = C.parent;
+
+    if (C.left == nil) {
+        // move right subtree to where cur is
+        if (cur == root) root = C.right;
+        else if (cur == node(parent).left) node(parent).left = C.right;
+        else node(parent).right = C.right;
+
+        // update parent if right is not nil
+        if(C.right != nil) node(C.right).parent = parent;
+
+        // delete cur
+        nodes_.destroy(cur);
+    } else if (C.right == nil) {
+        // move left subtree to where cur is
+        if (cur == root) root = C.left;
+        else if (cur == node(parent).left) node(parent).left = C.left;
+        else node(parent).right = C.left;
+
+        // update parent if left is not nil (should always be true)
+        if(C.left != nil) node(C.left).parent = parent;
+
+        // delete cur
+        nodes_.destroy(cur);
+    } else { // find the min in the right subtree
+        Link minRight = min(C.right);
+        Node& M = node(minRight);
+        C.key = std::move(M.key);
+        C.val = std::move(M.val);
+        parent = M.parent;
+
+        // remove the old min value
+        if (minRight == node(M.parent).left) node(M.parent).left = M.right;
+        else node(M.parent).right = M.right;
+
+        // update parent if minRight's right is not nil
+        if(M.right != nil) node(M.right).parent = M.parent;
+
+        // delete minRight
+        nodes_.destroy(minRight);
+    }
+
+    // balance the tree
+    balance(parent);
+    size_--;
+}
+
+// compact()
+// moves every node into fresh storage in breadth-first order. Links are rebuilt
+// as we go, the shape of the tree (and so its balance) is unchanged.
+template <typename K, typename V, typename Nodes>
+void AVLTree<K, V, Nodes>::compact() {
+    if (root == nil) return;
+
+    Store fresh;
+    Link freshRoot = nil;
+
+    // (old node, new parent, is left child)
+    std::queue<std::tuple<Link, Link, bool>> queue;
+    queue.push({root, nil, false});
+
+    while (!queue.empty()) {
+        auto [old, parent, isLeft] = queue.front();
+        queue.pop();
+
+        Node& O = node(old);
+        Link n = fresh.create(std::move(O.key), std::move(O.val));
+        Node& N = fresh.at(n);
+        N.height = O.height;
+        N.parent = parent;
+
+        if (parent == nil) freshRoot = n;
+        else if (isLeft) fresh.at(parent).left = n;
+        else fresh.at(parent).right = n;
+
+        if (O.left != nil) queue.push({O.left, n, true});
+        if (O.right != nil) queue.push({O.right, n, false});
+    }
+
+    // the old nodes only hold moved-from values now, drop them
+    int size = size_;
+    clear();
+    nodes_ = std::move(fresh);
+    root = freshRoot;
+    size_ = size;
+}
+
+// toString()
+// returns a string representation of the tree.
+template <typename K, typename V, typename Nodes>
+std::string AVLTree<K, V, Nodes>::toString(std::function<std::string(const K&)> keyToStr) const{
+    // dfs the tree
+    std::ostringstream oss;
+    if (root == nil) return oss.str();
+
+    std::stack<Link> stack;
+    stack.push(root);
+
+    while (!stack.empty()) {
+        const Node& cur = node(stack.top());
+        stack.pop();
+
+        // print current node
+        oss << "(" << keyToStr(cur.key) << ") -> ";
+        // print child if there is any
+        if (cur.left != nil) oss << "(" << keyToStr(node(cur.left).key) << ")";
+        else oss << "nil";
+        oss << ", ";
+        if (cur.right != nil) oss << "(" << keyToStr(node(cur.right).key) << ")";
+        else oss << "nil";
+        oss << std::endl;
+
+        // push right child
+        if (cur.right != nil) stack.push(cur.right);
+        // push left child
+        if (cur.left != nil) stack.push(cur.left);
+    }
+
+    return oss.str();
+}
+
+#endif // AVLTREEIMPL_H
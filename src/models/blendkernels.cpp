@@ -0,0 +1,261 @@
+#include "blendkernels.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define PIXELAIR_SSE2
+#    include <emmintrin.h>
+#  endif
+#  if defined(PIXELAIR_SSE2) && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#    define PIXELAIR_AVX2
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#      include <intrin.h>
+#      define AVX2_FUNCTION // MSVC takes AVX2 intrinsics anywhere
+#    else
+#      define AVX2_FUNCTION __attribute__((target("avx2")))
+#    endif
+#  endif
+#endif
+
+typedef RasterLayer::BlendMode Mode;
+
+// scalar ---------------------------
+
+// a * b / 255, rounded to nearest, for a and b in 0..255
+static inline uint mul255(const uint a, const uint b) {
+    const uint t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+template <Mode M>
+static inline uint blendChannel(const uint s, const uint d, const uint sa, const uint da) {
+    uint r;
+    switch (M) {
+    case Mode::Normal:   r = s + mul255(d, 255 - sa); break;
+    case Mode::Multiply: r = mul255(s, d) + mul255(s, 255 - da) + mul255(d, 255 - sa); break;
+    case Mode::Screen:   r = s + d - mul255(s, d); break;
+    case Mode::Add:      r = s + d; break;
+    }
+    return std::min(r, 255u);
+}
+
+template <Mode M>
+static void scalarRow(QRgb* dst, const QRgb* src, int count, int opacity) {
+    for (int i = 0; i < count; i++) {
+        QRgb s = src[i];
+        if (s == 0) continue; // no pixel on this layer
+
+        if (opacity < 255) {
+            s = qRgba(mul255(qRed(s), opacity), mul255(qGreen(s), opacity),
+                      mul255(qBlue(s), opacity), mul255(qAlpha(s), opacity));
+        }
+        const uint sa = qAlpha(s);
+        if (M == Mode::Normal && sa == 255) {
+            dst[i] = s;
+            continue;
+        }
+
+        const QRgb d = dst[i];
+        const uint da = qAlpha(d);
+        dst[i] = qRgba(blendChannel<M>(qRed(s), qRed(d), sa, da), blendChannel<M>(qGreen(s), qGreen(d), sa, da),
+                       blendChannel<M>(qBlue(s), qBlue(d), sa, da), blendChannel<M>(sa, da, sa, da));
+    }
+}
+
+// SSE2 ---------------------------
+//
+// Pixels are widened to 16 bits per channel, two to a register. x / 255 rounded
+// is ((x + 128) * 257) >> 16, which is exactly the scalar (t + (t >> 8)) >> 8 for
+// every product of two bytes.
+
+#ifdef PIXELAIR_SSE2
+
+static inline __m128i div255(const __m128i x) {
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+
+// each pixel's alpha in all four of its channels
+static inline __m128i alphas(const __m128i x) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+template <Mode M>
+static inline __m128i blendWide(const __m128i s, const __m128i d) {
+    const __m128i full = _mm_set1_epi16(255);
+    switch (M) {
+    case Mode::Normal:
+        return _mm_add_epi16(s, div255(_mm_mullo_epi16(d, _mm_sub_epi16(full, alphas(s)))));
+    case Mode::Multiply:
+        return _mm_add_epi16(_mm_add_epi16(div255(_mm_mullo_epi16(s, d)),
+                                           div255(_mm_mullo_epi16(s, _mm_sub_epi16(full, alphas(d))))),
+                             div255(_mm_mullo_epi16(d, _mm_sub_epi16(full, alphas(s)))));
+    case Mode::Screen:
+        return _mm_sub_epi16(_mm_add_epi16(s, d), div255(_mm_mullo_epi16(s, d)));
+    case Mode::Add:
+        break; // done on bytes
+    }
+    return s;
+}
+
+template <Mode M>
+static void sse2Row(QRgb* dst, const QRgb* src, int count, int opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000u));
+    const __m128i scale = _mm_set1_epi16(static_cast<short>(opacity));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff) continue;
+
+        __m128i sLo = _mm_unpacklo_epi8(s, zero), sHi = _mm_unpackhi_epi8(s, zero);
+        if (opacity < 255) {
+            sLo = div255(_mm_mullo_epi16(sLo, scale));
+            sHi = div255(_mm_mullo_epi16(sHi, scale));
+            s = _mm_packus_epi16(sLo, sHi);
+        }
+
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i);
+        if (M == Mode::Normal && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), alphaMask)) == 0xffff) {
+            _mm_storeu_si128(out, s);
+            continue;
+        }
+
+        const __m128i d = _mm_loadu_si128(out);
+        if (M == Mode::Add) {
+            _mm_storeu_si128(out, _mm_adds_epu8(s, d));
+            continue;
+        }
+        const __m128i dLo = _mm_unpacklo_epi8(d, zero), dHi = _mm_unpackhi_epi8(d, zero);
+        _mm_storeu_si128(out, _mm_packus_epi16(blendWide<M>(sLo, dLo), blendWide<M>(sHi, dHi)));
+    }
+    scalarRow<M>(dst + i, src + i, count - i, opacity);
+}
+
+#endif // PIXELAIR_SSE2
+
+// AVX2 ---------------------------
+//
+// The SSE2 code on 256 bit registers. Unpacking and packing both work within
+// each 128 bit half, so pixels come back out in the order they went in.
+
+#ifdef PIXELAIR_AVX2
+
+AVX2_FUNCTION static inline __m256i div255(const __m256i x) {
+    return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(128)), _mm256_set1_epi16(257));
+}
+
+AVX2_FUNCTION static inline __m256i alphas(const __m256i x) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+template <Mode M>
+AVX2_FUNCTION static inline __m256i blendWide(const __m256i s, const __m256i d) {
+    const __m256i full = _mm256_set1_epi16(255);
+    switch (M) {
+    case Mode::Normal:
+        return _mm256_add_epi16(s, div255(_mm256_mullo_epi16(d, _mm256_sub_epi16(full, alphas(s)))));
+    case Mode::Multiply:
+        return _mm256_add_epi16(_mm256_add_epi16(div255(_mm256_mullo_epi16(s, d)),
+                                                 div255(_mm256_mullo_epi16(s, _mm256_sub_epi16(full, alphas(d))))),
+                                div255(_mm256_mullo_epi16(d, _mm256_sub_epi16(full, alphas(s)))));
+    case Mode::Screen:
+        return _mm256_sub_epi16(_mm256_add_epi16(s, d), div255(_mm256_mullo_epi16(s, d)));
+    case Mode::Add:
+        break;
+    }
+    return s;
+}
+
+template <Mode M>
+AVX2_FUNCTION static void avx2Row(QRgb* dst, const QRgb* src, int count, int opacity) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+    const __m256i scale = _mm256_set1_epi16(static_cast<short>(opacity));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(s, zero)) == -1) continue;
+
+        __m256i sLo = _mm256_unpacklo_epi8(s, zero), sHi = _mm256_unpackhi_epi8(s, zero);
+        if (opacity < 255) {
+            sLo = div255(_mm256_mullo_epi16(sLo, scale));
+            sHi = div255(_mm256_mullo_epi16(sHi, scale));
+            s = _mm256_packus_epi16(sLo, sHi);
+        }
+
+        __m256i* out = reinterpret_cast<__m256i*>(dst + i);
+        if (M == Mode::Normal
+            && _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alphaMask), alphaMask)) == -1) {
+            _mm256_storeu_si256(out, s);
+            continue;
+        }
+
+        const __m256i d = _mm256_loadu_si256(out);
+        if (M == Mode::Add) {
+            _mm256_storeu_si256(out, _mm256_adds_epu8(s, d));
+            continue;
+        }
+        const __m256i dLo = _mm256_unpacklo_epi8(d, zero), dHi = _mm256_unpackhi_epi8(d, zero);
+        _mm256_storeu_si256(out, _mm256_packus_epi16(blendWide<M>(sLo, dLo), blendWide<M>(sHi, dHi)));
+    }
+    sse2Row<M>(dst + i, src + i, count - i, opacity);
+}
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (!osSavesYmm) return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PIXELAIR_AVX2
+
+// dispatch ---------------------------
+
+static const BlendKernels Scalar = {
+    "scalar",
+    {scalarRow<Mode::Normal>, scalarRow<Mode::Multiply>, scalarRow<Mode::Screen>, scalarRow<Mode::Add>},
+};
+
+#ifdef PIXELAIR_SSE2
+static const BlendKernels Sse2 = {
+    "sse2",
+    {sse2Row<Mode::Normal>, sse2Row<Mode::Multiply>, sse2Row<Mode::Screen>, sse2Row<Mode::Add>},
+};
+#endif
+
+#ifdef PIXELAIR_AVX2
+static const BlendKernels Avx2 = {
+    "avx2",
+    {avx2Row<Mode::Normal>, avx2Row<Mode::Multiply>, avx2Row<Mode::Screen>, avx2Row<Mode::Add>},
+};
+#endif
+
+const BlendKernels& scalarBlendKernels() { return Scalar; }
+
+std::vector<const BlendKernels*> supportedBlendKernels() {
+    std::vector<const BlendKernels*> kernels{&Scalar};
+#ifdef PIXELAIR_SSE2
+    kernels.push_back(&Sse2);
+#endif
+#ifdef PIXELAIR_AVX2
+    if (cpuHasAvx2()) kernels.push_back(&Avx2);
+#endif
+    return kernels;
+}
+
+const BlendKernels& blendKernels() {
+    static const BlendKernels& best = *supportedBlendKernels().back(); // asked once, thread-safe
+    return best;
+}
@@ -0,0 +1,42 @@
+#ifndef BLENDKERNELS_H
+#define BLENDKERNELS_H
+
+#include <rasterlayer.h>
+
+// Row kernels that blend premultiplied ARGB32 pixels (Pixel words) from a
+// source row onto a destination row, one per blend mode. Each comes as
+// portable scalar code and, on x86, as SSE2 and AVX2 versions; blendKernels()
+// picks the widest one the CPU runs, once, at first use. All versions give
+// bit-identical results, so what ends up on screen does not depend on the
+// machine.
+//
+// Per channel c (alpha included) with s the source scaled by the opacity and
+// d the destination, all in 0..255:
+//   Normal    s + d * (255 - sa) / 255
+//   Multiply  s * d / 255 + s * (255 - da) / 255 + d * (255 - sa) / 255
+//   Screen    s + d - s * d / 255
+//   Add       s + d
+// with every product rounded to nearest and the result clamped to 255. A fully
+// transparent source pixel leaves the destination as it is in every mode.
+struct BlendKernels {
+    // blend count pixels of src onto dst. opacity is 0..255
+    typedef void (*Row)(QRgb* dst, const QRgb* src, int count, int opacity);
+
+    const char* name;
+    Row rows[4]; // indexed by RasterLayer::BlendMode
+
+    void blend(RasterLayer::BlendMode mode, QRgb* dst, const QRgb* src, int count, int opacity) const {
+        rows[static_cast<int>(mode)](dst, src, count, opacity);
+    }
+};
+
+// return the fastest kernels this CPU supports
+const BlendKernels& blendKernels();
+
+// return the portable kernels, the reference the others are tested against
+const BlendKernels& scalarBlendKernels();
+
+// return every kernel set this CPU supports, scalar first
+std::vector<const BlendKernels*> supportedBlendKernels();
+
+#endif // BLENDKERNELS_H
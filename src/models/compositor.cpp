@@ -0,0 +1,321 @@
+#include "compositor.h"
+#include <blendkernels.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// the average of four premultiplied pixels, rounded. Red and blue, then alpha and
+// green, are summed as two 16 bit lanes at once
+static inline QRgb average4(QRgb a, QRgb b, QRgb c, QRgb d) {
+    const quint32 rb = (a & 0x00ff00ff) + (b & 0x00ff00ff) + (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002;
+    const quint32 ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) + ((c >> 8) & 0x00ff00ff) +
+                       ((d >> 8) & 0x00ff00ff) + 0x00020002;
+    return ((rb >> 2) & 0x00ff00ff) | (((ag >> 2) & 0x00ff00ff) << 8);
+}
+
+// drop the tiles of cache in [tx0, tx1] x [ty0, ty1]
+static void eraseTiles(std::unordered_map<quint64, std::unique_ptr<QRgb[]>>& cache, int tx0, int tx1, int ty0, int ty1) {
+    if (cache.empty()) return;
+
+    // look the few tiles of a small edit up, scan the cache for a large one
+    if (static_cast<qint64>(tx1 - tx0 + 1) * (ty1 - ty0 + 1) <= static_cast<qint64>(cache.size())) {
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                cache.erase((static_cast<quint64>(static_cast<quint32>(ty)) << 32) | static_cast<quint32>(tx));
+        return;
+    }
+    for (auto it = cache.begin(); it != cache.end();) {
+        const int tx = static_cast<qint32>(it->first), ty = static_cast<qint32>(it->first >> 32);
+        if (tx >= tx0 && tx <= tx1 && ty >= ty0 && ty <= ty1) it = cache.erase(it);
+        else ++it;
+    }
+}
+
+// constructor destructor ---------------------------
+
+Compositor::Compositor()
+    : finished_(nullptr), pending_(0) {}
+
+Compositor::~Compositor() {
+    std::unique_lock<std::mutex> lock(idleMutex_);
+    idle_.wait(lock, [this] { return pending_.load(std::memory_order_acquire) == 0; });
+    lock.unlock();
+    takeFinished();
+}
+
+// helper functions ---------------------------
+
+bool Compositor::composite(const QVector<RasterLayer>& layers, const QRect& box, QRgb* dst, qsizetype stride,
+                           std::vector<QRgb>& scratch) {
+    const int width = box.width(), height = box.height();
+    const BlendKernels& kernels = blendKernels();
+
+    // each layer is spread over scratch first (absent pixels stay 0, which every
+    // blend mode leaves alone), then blended in one pass over the rows it touched
+    scratch.assign(static_cast<size_t>(width) * height, 0);
+    bool any = false;
+    for (const RasterLayer& layer : layers) {
+        const int opacity = static_cast<int>(std::lround(layer.opacity() * 255));
+        if (!layer.isVisible() || opacity == 0 || layer.size() == 0) continue;
+
+        int top = height, bottom = -1;
+        layer.forEachInRect(box, [&](const QPoint loc, const Pixel p) {
+            const int row = loc.y() - box.top();
+            scratch[static_cast<size_t>(row) * width + (loc.x() - box.left())] = p.argb;
+            top = std::min(top, row);
+            bottom = std::max(bottom, row);
+        });
+        if (bottom < 0) continue;
+        any = true;
+
+        QRgb* rows = scratch.data() + static_cast<size_t>(top) * width;
+        if (stride == width) { // contiguous, one call
+            kernels.blend(layer.blendMode(), dst + top * stride, rows, (bottom - top + 1) * width, opacity);
+        } else {
+            for (int row = top; row <= bottom; row++) {
+                kernels.blend(layer.blendMode(), dst + row * stride, scratch.data() + static_cast<size_t>(row) * width,
+                              width, opacity);
+            }
+        }
+        std::fill(rows, scratch.data() + static_cast<size_t>(bottom + 1) * width, 0);
+    }
+    return any;
+}
+
+std::unique_ptr<QRgb[]> Compositor::flattenTile(const QVector<RasterLayer>& layers, int tx, int ty,
+                                                std::vector<QRgb>& scratch) {
+    std::unique_ptr<QRgb[]> pixels(new QRgb[TileSize * TileSize]()); // transparent
+    if (!composite(layers, QRect(tx * TileSize, ty * TileSize, TileSize, TileSize), pixels.get(), TileSize, scratch)) {
+        pixels.reset(); // remember the tile is empty without holding memory for it
+    }
+    return pixels;
+}
+
+bool Compositor::isEmpty(const QVector<RasterLayer>& layers, const QRect& box) {
+    for (const RasterLayer& layer : layers) {
+        if (!layer.isVisible() || std::lround(layer.opacity() * 255) == 0 || layer.size() == 0) continue;
+        if (!layer.forEachInRect(box, [](QPoint, Pixel) { return false; })) return false; // stopped at a pixel
+    }
+    return true;
+}
+
+QRect Compositor::tileRect(int tx, int ty, int level) {
+    // clamped, as tiles at coarse levels reach past the int range
+    const qint64 span = qint64(TileSize) << level;
+    auto edge = [](qint64 v) { return static_cast<int>(std::clamp(v, qint64(INT_MIN), qint64(INT_MAX))); };
+    return QRect(QPoint(edge(tx * span), edge(ty * span)), QPoint(edge((tx + 1) * span - 1), edge((ty + 1) * span - 1)));
+}
+
+const QRgb* Compositor::storeMip(int tx, int ty, int level, const QRgb* const children[4]) {
+    constexpr int Half = TileSize / 2;
+    std::unique_ptr<QRgb[]> pixels;
+    for (int i = 0; i < 4; i++) {
+        const QRgb* child = children[i];
+        if (!child) continue; // leaves its quarter transparent
+        if (!pixels) pixels.reset(new QRgb[TileSize * TileSize]());
+
+        QRgb* quarter = pixels.get() + (i >> 1) * Half * TileSize + (i & 1) * Half;
+        for (int y = 0; y < Half; y++) {
+            const QRgb* top = child + 2 * y * TileSize;
+            const QRgb* bottom = top + TileSize;
+            for (int x = 0; x < Half; x++)
+                quarter[y * TileSize + x] = average4(top[2 * x], top[2 * x + 1], bottom[2 * x], bottom[2 * x + 1]);
+        }
+    }
+    return (levels_[level][tileKey(tx, ty)] = std::move(pixels)).get();
+}
+
+// accessors ---------------------------
+
+int Compositor::cachedTiles() const {
+    size_t count = 0;
+    for (const TileCache& cache : levels_) count += cache.size();
+    return static_cast<int>(count);
+}
+
+bool Compositor::cached(int tx, int ty, const QRgb** pixels, int level) const {
+    auto it = levels_[level].find(tileKey(tx, ty));
+    if (it == levels_[level].end()) return false;
+    *pixels = it->second.get();
+    return true;
+}
+
+bool Compositor::isBusy() const { return pending_.load(std::memory_order_acquire) > 0; }
+
+// mutators ---------------------------
+
+const QRgb* Compositor::tile(const QVector<RasterLayer>& layers, int tx, int ty, int level) {
+    const quint64 key = tileKey(tx, ty);
+    auto it = levels_[level].find(key);
+    if (it != levels_[level].end()) return it->second.get();
+    if (level == 0) return levels_[0].emplace(key, flattenTile(layers, tx, ty, scratch_)).first->second.get();
+
+    if (isEmpty(layers, tileRect(tx, ty, level))) return (levels_[level][key] = nullptr).get();
+
+    const QRgb* children[4];
+    for (int i = 0; i < 4; i++) children[i] = tile(layers, 2 * tx + (i & 1), 2 * ty + (i >> 1), level - 1);
+    return storeMip(tx, ty, level, children);
+}
+
+bool Compositor::tryTile(const QVector<RasterLayer>& layers, int tx, int ty, int level, const QRgb** pixels,
+                         std::vector<QPoint>& missing) {
+    const quint64 key = tileKey(tx, ty);
+    auto it = levels_[level].find(key);
+    if (it != levels_[level].end()) {
+        *pixels = it->second.get();
+        return true;
+    }
+    if (isEmpty(layers, tileRect(tx, ty, level))) { // no need to wait for the workers
+        levels_[level][key] = nullptr;
+        *pixels = nullptr;
+        return true;
+    }
+    if (level == 0) {
+        if (inFlight_.find(key) == inFlight_.end()) missing.emplace_back(tx, ty);
+        return false;
+    }
+
+    // go through all four children, so every missing tile under this one is listed
+    const QRgb* children[4];
+    bool ready = true;
+    for (int i = 0; i < 4; i++) {
+        if (!tryTile(layers, 2 * tx + (i & 1), 2 * ty + (i >> 1), level - 1, &children[i], missing)) ready = false;
+    }
+    if (!ready) return false;
+    *pixels = storeMip(tx, ty, level, children);
+    return true;
+}
+
+void Compositor::invalidate(const QRect& box) {
+    if (box.isEmpty()) return;
+    for (int level = 0; level <= MaxLevel; level++) {
+        const int shift = TileShift + level;
+        eraseTiles(levels_[level], box.left() >> shift, box.right() >> shift, box.top() >> shift, box.bottom() >> shift);
+    }
+
+    // whatever is being composited there now is out of date
+    const int tx0 = box.left() >> TileShift, tx1 = box.right() >> TileShift;
+    const int ty0 = box.top() >> TileShift, ty1 = box.bottom() >> TileShift;
+    for (auto& [key, edited] : inFlight_) {
+        const int tx = static_cast<qint32>(key), ty = static_cast<qint32>(key >> 32);
+        if (tx >= tx0 && tx <= tx1 && ty >= ty0 && ty <= ty1) edited = true;
+    }
+}
+
+void Compositor::invalidateAll() {
+    for (TileCache& cache : levels_) cache.clear();
+    for (auto& entry : inFlight_) entry.second = true;
+}
+
+void Compositor::evict(int tx, int ty, int level) { levels_[level].erase(tileKey(tx, ty)); }
+
+void Compositor::trim(const QRect& keep) {
+    for (int level = 0; level <= MaxLevel; level++) {
+        const int shift = TileShift + level;
+        const int tx0 = keep.left() >> shift, tx1 = keep.right() >> shift;
+        const int ty0 = keep.top() >> shift, ty1 = keep.bottom() >> shift;
+        TileCache& cache = levels_[level];
+        for (auto it = cache.begin(); it != cache.end();) {
+            const int tx = static_cast<qint32>(it->first), ty = static_cast<qint32>(it->first >> 32);
+            if (keep.isEmpty() || tx < tx0 || tx > tx1 || ty < ty0 || ty > ty1) it = cache.erase(it);
+            else ++it;
+        }
+    }
+}
+
+void Compositor::store(int tx, int ty, std::unique_ptr<QRgb[]> pixels) {
+    levels_[0][tileKey(tx, ty)] = std::move(pixels);
+    // the levels above were shrunk from the old tile
+    for (int level = 1; level <= MaxLevel; level++) levels_[level].erase(tileKey(tx >> level, ty >> level));
+}
+
+void Compositor::prefetch(const QVector<RasterLayer>& layers, const std::vector<QPoint>& tiles, WorkerPool& pool) {
+    std::vector<QPoint> missing;
+    for (const QPoint& t : tiles)
+        if (levels_[0].find(tileKey(t.x(), t.y())) == levels_[0].end()) missing.push_back(t);
+
+    // each worker fills its own slots, so the cache is only touched from this thread
+    std::vector<std::unique_ptr<QRgb[]>> out(missing.size());
+    pool.parallelFor(static_cast<int>(missing.size()), [&](int i) {
+        thread_local std::vector<QRgb> scratch;
+        out[i] = flattenTile(layers, missing[i].x(), missing[i].y(), scratch);
+    });
+    for (size_t i = 0; i < missing.size(); i++) store(missing[i].x(), missing[i].y(), std::move(out[i]));
+}
+
+void Compositor::request(const QVector<RasterLayer>& layers, std::vector<Request> requests, WorkerPool& pool,
+                         std::function<void()> ready) {
+    if (requests.empty()) return;
+
+    // the copy shares every layer's pixels; an edit made meanwhile detaches the edited layer
+    auto snapshot = std::make_shared<const QVector<RasterLayer>>(layers);
+    auto list = std::make_shared<const std::vector<Request>>(std::move(requests));
+    pending_.fetch_add(1, std::memory_order_acq_rel);
+
+    pool.submit(
+        static_cast<int>(list->size()),
+        [this, snapshot, list](int i) {
+            thread_local std::vector<QRgb> scratch;
+            const Request& r = (*list)[i];
+            auto* node = new FinishedNode{{r.tx, r.ty, r.stamp, flattenTile(*snapshot, r.tx, r.ty, scratch)}, nullptr};
+            node->next = finished_.load(std::memory_order_relaxed);
+            while (!finished_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                                    std::memory_order_relaxed)) {}
+        },
+        [this, ready] {
+            if (ready) ready();
+            // under the lock, so the destructor can't miss the wake up, nor destroy idle_
+            // before notify_all() returns. The destructor may run once it is released
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) idle_.notify_all();
+        });
+}
+
+std::vector<Compositor::Finished> Compositor::takeFinished() {
+    FinishedNode* node = finished_.exchange(nullptr, std::memory_order_acquire);
+    std::vector<Finished> out;
+    while (node) {
+        out.push_back(std::move(node->tile));
+        FinishedNode* next = node->next;
+        delete node;
+        node = next;
+    }
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+void Compositor::requestMissing(const QVector<RasterLayer>& layers, const std::vector<QPoint>& tiles, WorkerPool& pool,
+                                std::function<void()> ready) {
+    std::vector<Request> requests;
+    for (const QPoint& t : tiles) {
+        const quint64 key = tileKey(t.x(), t.y());
+        if (levels_[0].find(key) != levels_[0].end() || !inFlight_.emplace(key, false).second) continue;
+        requests.push_back({t.x(), t.y(), 0});
+    }
+    request(layers, std::move(requests), pool, std::move(ready));
+}
+
+int Compositor::collect() {
+    int count = 0;
+    for (Finished& done : takeFinished()) {
+        auto it = inFlight_.find(tileKey(done.tx, done.ty));
+        if (it == inFlight_.end()) continue;
+        const bool edited = it->second;
+        inFlight_.erase(it);
+        if (edited) continue; // still missing, so the next tryTile() lists it again
+
+        store(done.tx, done.ty, std::move(done.pixels));
+        count++;
+    }
+    return count;
+}
+
+// other functions ---------------------------
+
+bool Compositor::flatten(const QVector<RasterLayer>& layers, const QRect& box, QRgb* dst, qsizetype stride) {
+    if (box.isEmpty()) return false;
+    for (int row = 0; row < box.height(); row++) std::fill(dst + row * stride, dst + row * stride + box.width(), 0);
+
+    std::vector<QRgb> scratch;
+    return composite(layers, box, dst, stride, scratch);
+}
@@ -0,0 +1,183 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <rasterlayer.h>
+#include <workerpool.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Flattens a stack of layers into one image of premultiplied ARGB32 words, the
+// layout of Pixel and of QImage::Format_ARGB32_Premultiplied. Layers go bottom
+// first; hidden ones are skipped and the rest are combined with their blend
+// mode and opacity by the fastest BlendKernels the CPU has.
+//
+// Flattened tiles are cached. An edit only has to invalidate() the tiles under
+// it, and the next request for one of those composites just that tile again.
+//
+// Tiles can also be composited on a WorkerPool: prefetch() blocks until a list
+// of tiles is cached, while request() returns at once and hands each finished
+// tile back through takeFinished(). The workers read a copy of the layer stack
+// taken at request time, which costs a reference per layer thanks to
+// copy-on-write, so the layers can be edited while they run. A layer decides
+// whether it may write in place from its storage's use count, which a worker
+// drops when it lets go of the copy; the layer follows that check with an
+// acquire fence, so the worker's reads happen before the write. Finished tiles
+// are pushed onto a lock-free list, and takeFinished() takes the whole list with
+// a single exchange.
+//
+// For zoomed out views the cache holds a mip pyramid: a tile at level n covers
+// 2^n x 2^n full resolution tiles in TileSize x TileSize pixels, each the box
+// filtered average of 2 x 2 pixels of the level below. Levels are built on
+// demand from the four tiles under them, skipping areas with nothing in them,
+// and an edit drops the tiles above it along with the full resolution ones, so
+// a zoomed out view only redoes one chain of tiles per edited tile.
+class Compositor
+{
+public:
+    static constexpr int TileShift = RasterLayer::DirtyShift;
+    static constexpr int TileSize = 1 << TileShift;
+    // the coarsest level, where a tile covers 65536 x 65536 canvas pixels
+    static constexpr int MaxLevel = 10;
+
+    // a tile to composite in the background, and a stamp to tell stale results by
+    struct Request {
+        int tx, ty;
+        quint64 stamp;
+    };
+
+    // a tile composited in the background
+    struct Finished {
+        int tx, ty;
+        quint64 stamp;
+        std::unique_ptr<QRgb[]> pixels; // nullptr if the tile is empty
+    };
+
+private:
+    struct FinishedNode {
+        Finished tile;
+        FinishedNode* next;
+    };
+
+    // flattened tiles by key, nullptr for tiles known to be empty
+    typedef std::unordered_map<quint64, std::unique_ptr<QRgb[]>> TileCache;
+
+    TileCache levels_[MaxLevel + 1]; // levels_[0] is full resolution
+    // full resolution tiles requested by requestMissing() and not collected yet, and
+    // whether they were invalidated since
+    std::unordered_map<quint64, bool> inFlight_;
+    std::vector<QRgb> scratch_; // one layer's pixels over the box being flattened
+
+    std::atomic<FinishedNode*> finished_; // newest first, pushed by workers
+    std::atomic<int> pending_;            // background batches still running
+    std::mutex idleMutex_;                // taken to signal or wait for pending_ reaching 0
+    std::condition_variable idle_;
+
+    static quint64 tileKey(int tx, int ty) {
+        return (static_cast<quint64>(static_cast<quint32>(ty)) << 32) | static_cast<quint32>(tx);
+    }
+
+    // blend the layers over box onto dst, stride words per row. Returns false if no
+    // visible pixel falls in box
+    static bool composite(const QVector<RasterLayer>& layers, const QRect& box, QRgb* dst, qsizetype stride,
+                          std::vector<QRgb>& scratch);
+
+    // composite tile (tx, ty) into a new buffer, or return nullptr if it is empty
+    static std::unique_ptr<QRgb[]> flattenTile(const QVector<RasterLayer>& layers, int tx, int ty,
+                                               std::vector<QRgb>& scratch);
+
+    // return true if no visible pixel falls in box
+    static bool isEmpty(const QVector<RasterLayer>& layers, const QRect& box);
+
+    // the canvas pixels under tile (tx, ty) of level
+    static QRect tileRect(int tx, int ty, int level);
+
+    // cache tile (tx, ty) of level, shrunk from the four tiles under it (nullptr if empty),
+    // top left first and row by row
+    const QRgb* storeMip(int tx, int ty, int level, const QRgb* const children[4]);
+
+public:
+    // constructor destructor ---------------------------
+    Compositor();
+    // waits for the background requests still running
+    ~Compositor();
+
+    Compositor(const Compositor&) = delete;
+    Compositor& operator=(const Compositor&) = delete;
+
+    // accessors ---------------------------
+
+    // return the number of tiles cached, empty ones included
+    int cachedTiles() const;
+
+    // return true if tile (tx, ty) of level is cached, and set pixels to it (nullptr if empty)
+    bool cached(int tx, int ty, const QRgb** pixels, int level = 0) const;
+
+    // return true while background requests are running
+    bool isBusy() const;
+
+    // mutators ---------------------------
+
+    // return tile (tx, ty) of level flattened, TileSize x TileSize words row by row,
+    // compositing or shrinking it first unless cached. Returns nullptr if no visible
+    // pixel falls in the tile. The pointer stays valid until the tile is invalidated
+    // or evicted
+    const QRgb* tile(const QVector<RasterLayer>& layers, int tx, int ty, int level = 0);
+
+    // like tile() without compositing anything: return true and set pixels if tile (tx, ty)
+    // of level is empty, cached or can be shrunk from cached tiles. Otherwise add the
+    // full resolution tiles it still needs to missing, leaving out those already requested
+    bool tryTile(const QVector<RasterLayer>& layers, int tx, int ty, int level, const QRgb** pixels,
+                 std::vector<QPoint>& missing);
+
+    // drop the cached tiles overlapping box, in canvas pixels, on every level
+    void invalidate(const QRect& box);
+
+    // drop every cached tile, for changes that affect the whole stack
+    void invalidateAll();
+
+    // drop tile (tx, ty) of level, e.g. once it is far off screen
+    void evict(int tx, int ty, int level = 0);
+
+    // drop the cached tiles of every level that lie wholly outside keep, in canvas pixels
+    void trim(const QRect& keep);
+
+    // cache tile (tx, ty), e.g. one handed back by takeFinished()
+    void store(int tx, int ty, std::unique_ptr<QRgb[]> pixels);
+
+    // composite the tiles of the list that are not cached yet on pool, and cache them.
+    // Returns once all are done; the calling thread works too
+    void prefetch(const QVector<RasterLayer>& layers, const std::vector<QPoint>& tiles, WorkerPool& pool);
+
+    // composite the requested tiles on pool in the background, from the layers as they
+    // are now. Returns at once; the tiles come back through takeFinished(), and ready
+    // runs on a worker thread once the last one is there
+    void request(const QVector<RasterLayer>& layers, std::vector<Request> requests, WorkerPool& pool,
+                 std::function<void()> ready);
+
+    // return the background tiles finished since the last call, oldest first. They are
+    // not cached; the caller checks their stamps and store()s the ones still wanted
+    std::vector<Finished> takeFinished();
+
+    // request the full resolution tiles of the list that are not cached or requested yet,
+    // as with request(). collect() caches them once finished
+    void requestMissing(const QVector<RasterLayer>& layers, const std::vector<QPoint>& tiles, WorkerPool& pool,
+                        std::function<void()> ready);
+
+    // cache the tiles requested by requestMissing() that finished since the last call.
+    // Tiles invalidated after their request are dropped, to be requested again. Returns
+    // the number cached. Takes every finished tile, so use either this or takeFinished()
+    int collect();
+
+    // other functions ---------------------------
+
+    // flatten the layers over box into dst, stride words per row, without caching.
+    // dst is cleared first. Returns false if no visible pixel falls in box
+    static bool flatten(const QVector<RasterLayer>& layers, const QRect& box, QRgb* dst, qsizetype stride);
+};
+
+#endif // COMPOSITOR_H
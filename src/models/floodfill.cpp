@@ -0,0 +1,124 @@
+#include "floodfill.h"
+#include <algorithm>
+#include <cstdlib>
+
+// return if every channel of a is within tolerance of b's
+static bool isClose(QRgb a, QRgb b, int tolerance) {
+    for (int shift = 0; shift < 32; shift += 8)
+        if (std::abs(static_cast<int>((a >> shift) & 0xff) - static_cast<int>((b >> shift) & 0xff)) > tolerance) return false;
+    return true;
+}
+
+// other functions ---------------------------
+
+void FloodFill::matchColumn(const RasterLayer& layer, const QRect& bounds, int x, QRgb seed, int tolerance,
+                            std::vector<Span>& out, std::vector<Span>& runs) {
+    // where empty canvas matches, the spans are the gaps between the runs that don't;
+    // elsewhere they are made of the runs that do. Either way only those runs are kept
+    // from the walk, which a Runs layer hands out whole
+    const bool emptyMatches = isClose(0, seed, tolerance);
+    runs.clear();
+    layer.forEachRunInRect(QRect(x, bounds.top(), 1, bounds.height()), [&](const ColumnRun& run, Pixel p) {
+        if (isClose(p.argb, seed, tolerance) != emptyMatches) runs.push_back({run.y, run.y + run.length});
+    });
+    auto byTop = [](const Span& a, const Span& b) { return a.top < b.top; };
+    if (!std::is_sorted(runs.begin(), runs.end(), byTop)) std::sort(runs.begin(), runs.end(), byTop);
+
+    const size_t first = out.size();
+    auto append = [&](int top, int bottom) {
+        if (top >= bottom) return;
+        if (out.size() > first && out.back().bottom == top) {
+            out.back().bottom = bottom;
+        } else {
+            out.push_back({top, bottom});
+        }
+    };
+    if (!emptyMatches) {
+        for (const Span& run : runs) append(run.top, run.bottom);
+        return;
+    }
+    int from = bounds.top();
+    for (const Span& run : runs) {
+        append(from, run.top);
+        from = run.bottom;
+    }
+    append(from, bounds.bottom() + 1);
+}
+
+QVector<ColumnRun> FloodFill::region(const RasterLayer& layer, const QRect& bounds, const QPoint seed, int tolerance,
+                                     Mode mode, WorkerPool& pool) {
+    QVector<ColumnRun> runs;
+    if (!bounds.contains(seed)) return runs;
+    const auto value = layer.get(seed);
+    const QRgb target = value.has_value() ? value->value.argb : 0;
+    tolerance = std::clamp(tolerance, 0, 255);
+
+    if (mode == Mode::Global) {
+        // a share of the columns per item, a few per thread so stealing can even them out
+        const int shares = std::min(bounds.width(), (pool.threadCount() + 1) * 4);
+        std::vector<QVector<ColumnRun>> found(shares);
+        pool.parallelFor(shares, [&](int i) {
+            const int begin = bounds.left() + static_cast<int>(static_cast<qint64>(bounds.width()) * i / shares);
+            const int end = bounds.left() + static_cast<int>(static_cast<qint64>(bounds.width()) * (i + 1) / shares);
+            std::vector<Span> spans, scratch;
+            for (int x = begin; x < end; x++) {
+                spans.clear();
+                matchColumn(layer, bounds, x, target, tolerance, spans, scratch);
+                for (const Span& s : spans) found[i].append({x, s.top, s.bottom - s.top});
+            }
+        });
+        for (const QVector<ColumnRun>& share : found) runs.append(share); // in column order already
+        return runs;
+    }
+
+    // the spans of each column, read the first time the search reaches it
+    struct Column {
+        bool read = false;
+        std::vector<Span> spans;
+        std::vector<bool> reached;
+    };
+    std::vector<Column> columns(bounds.width());
+    std::vector<Span> scratch;
+    auto column = [&](int x) -> Column& {
+        Column& c = columns[x - bounds.left()];
+        if (!c.read) {
+            matchColumn(layer, bounds, x, target, tolerance, c.spans, scratch);
+            c.reached.assign(c.spans.size(), false);
+            c.read = true;
+        }
+        return c;
+    };
+
+    // the seed's span, which always matches as the seed matches itself
+    std::vector<std::pair<int, size_t>> pending; // column and span index
+    {
+        Column& c = column(seed.x());
+        const auto it = std::upper_bound(c.spans.begin(), c.spans.end(), seed.y(),
+                                         [](int y, const Span& s) { return y < s.top; });
+        const size_t i = static_cast<size_t>(it - c.spans.begin()) - 1;
+        c.reached[i] = true;
+        pending.emplace_back(seed.x(), i);
+    }
+    while (!pending.empty()) {
+        const auto [x, i] = pending.back();
+        pending.pop_back();
+        const Span span = columns[x - bounds.left()].spans[i];
+        runs.append({x, span.top, span.bottom - span.top});
+
+        // the spans of the columns either side that share a row with this one
+        for (const int next : {x - 1, x + 1}) {
+            if (next < bounds.left() || next > bounds.right()) continue;
+            Column& c = column(next);
+            auto it = std::upper_bound(c.spans.begin(), c.spans.end(), span.top,
+                                       [](int y, const Span& s) { return y < s.bottom; });
+            for (; it != c.spans.end() && it->top < span.bottom; ++it) {
+                const size_t j = static_cast<size_t>(it - c.spans.begin());
+                if (c.reached[j]) continue;
+                c.reached[j] = true;
+                pending.emplace_back(next, j);
+            }
+        }
+    }
+    RasterLayer::uniteRuns(runs);
+    return runs;
+}
@@ -0,0 +1,53 @@
+#ifndef FLOODFILL_H
+#define FLOODFILL_H
+
+#include <rasterlayer.h>
+#include <workerpool.h>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+#include <vector>
+
+// The region a bucket fill covers, as column runs ready for
+// LayerDelta::recordRuns and RasterLayer::fillRuns.
+//
+// A pixel matches when no channel of its premultiplied color is further than
+// the tolerance from the seed's; no pixel counts as transparent black, so
+// filling empty canvas takes the gaps between pixels. The fill never leaves
+// its bounds, the canvas.
+//
+// Each column is read once, with one walk of the storage down the column,
+// into its matching spans: the runs of consecutive matching pixels. A
+// contiguous fill is a search over those spans, from the seed's to the spans
+// next to it that share a row with it (4-connected), so its cost follows the
+// number of spans rather than pixels, and empty canvas is one span per column.
+// A global fill takes every matching span, the columns shared out on a
+// WorkerPool.
+class FloodFill
+{
+public:
+    enum class Mode {
+        Contiguous, // the matching pixels connected to the seed
+        Global,     // every matching pixel within the bounds
+    };
+
+private:
+    // a matching span of a column, rows [top, bottom)
+    struct Span {
+        int top, bottom;
+    };
+
+    // append the matching spans of column x within bounds to out. runs is scratch space
+    static void matchColumn(const RasterLayer& layer, const QRect& bounds, int x, QRgb seed, int tolerance,
+                            std::vector<Span>& out, std::vector<Span>& runs);
+
+public:
+    // other functions ---------------------------
+
+    // return the pixels a fill from seed covers, united as by RasterLayer::uniteRuns.
+    // Empty if the seed is outside bounds. Global fills run on pool
+    static QVector<ColumnRun> region(const RasterLayer& layer, const QRect& bounds, const QPoint seed, int tolerance,
+                                     Mode mode, WorkerPool& pool);
+};
+
+#endif // FLOODFILL_H
@@ -0,0 +1,520 @@
+#include "imageio.h"
+#include <compositor.h>
+#include <QImage>
+#include <QImageReader>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <zlib.h>
+
+static const uchar PngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+// deflate output is cut into IDAT chunks of this size, and input read in pieces of it
+static constexpr int ChunkBytes = 64 * 1024;
+
+static bool fail(QString* error, const QString& message) {
+    if (error) *error = message;
+    return false;
+}
+
+static bool readFully(QIODevice* device, void* data, qint64 count) {
+    return device->read(static_cast<char*>(data), count) == count;
+}
+
+static bool writeFully(QIODevice* device, const void* data, qint64 count) {
+    return device->write(static_cast<const char*>(data), count) == count;
+}
+
+static quint32 readBigEndian(const uchar* p) {
+    return static_cast<quint32>(p[0]) << 24 | static_cast<quint32>(p[1]) << 16 | static_cast<quint32>(p[2]) << 8 | p[3];
+}
+
+static void writeBigEndian(uchar* p, quint32 v) {
+    p[0] = static_cast<uchar>(v >> 24);
+    p[1] = static_cast<uchar>(v >> 16);
+    p[2] = static_cast<uchar>(v >> 8);
+    p[3] = static_cast<uchar>(v);
+}
+
+// premultiplied ARGB32 words to straight RGBA8 bytes
+static void toRgba8(const QRgb* src, int count, uchar* dst) {
+    for (int i = 0; i < count; i++, dst += 4) {
+        const QRgb c = qUnpremultiply(src[i]);
+        dst[0] = static_cast<uchar>(qRed(c));
+        dst[1] = static_cast<uchar>(qGreen(c));
+        dst[2] = static_cast<uchar>(qBlue(c));
+        dst[3] = static_cast<uchar>(qAlpha(c));
+    }
+}
+
+// Scanlines ---------------------------
+
+Scanlines::Scanlines(const RasterLayer& layer, const QRect& box)
+    : layers_{layer}, flatten_(false), box_(box), bandTop_(0), bandBottom_(-1), row_(box.top()) {}
+
+Scanlines::Scanlines(const QVector<RasterLayer>& layers, const QRect& box)
+    : layers_(layers), flatten_(true), box_(box), bandTop_(0), bandBottom_(-1), row_(box.top()) {}
+
+void Scanlines::fillBand(int top) {
+    // up to the end of the canvas tile row, so every band after the first is aligned
+    const int tileBottom = static_cast<int>(std::min<qint64>(INT_MAX, (static_cast<qint64>(top >> RasterLayer::DirtyShift) + 1) * BandRows - 1));
+    bandTop_ = top;
+    bandBottom_ = std::min(box_.bottom(), tileBottom);
+
+    const int width = box_.width();
+    const QRect band(QPoint(box_.left(), bandTop_), QPoint(box_.right(), bandBottom_));
+    band_.resize(static_cast<size_t>(width) * band.height());
+    if (flatten_) {
+        Compositor::flatten(layers_, band, band_.data(), width);
+        return;
+    }
+
+    std::fill(band_.begin(), band_.end(), 0);
+    QRgb* origin = band_.data() - bandTop_ * static_cast<qsizetype>(width) - box_.left();
+    layers_[0].forEachInRect(band, [origin, width](QPoint loc, Pixel p) {
+        origin[loc.y() * static_cast<qsizetype>(width) + loc.x()] = p.argb;
+    });
+}
+
+QRect Scanlines::box() const { return box_; }
+
+const QRgb* Scanlines::next() {
+    if (box_.isEmpty() || row_ > box_.bottom() || row_ < box_.top()) return nullptr; // done, or wrapped past INT_MAX
+    if (row_ > bandBottom_ || row_ < bandTop_) fillBand(row_);
+    const QRgb* row = band_.data() + static_cast<size_t>(row_ - bandTop_) * box_.width();
+    row_++;
+    return row;
+}
+
+// BandLoader ---------------------------
+
+BandLoader::BandLoader(RasterLayer& layer, LayerDelta* delta, const QPoint& at, int width)
+    : layer_(layer), delta_(delta), at_(at), width_(width), rows_(static_cast<size_t>(width) * Scanlines::BandRows),
+      count_(0), y_(at.y()) {}
+
+QRgb* BandLoader::row() { return rows_.data() + static_cast<size_t>(count_) * width_; }
+
+void BandLoader::push() {
+    count_++;
+    y_++;
+    if (count_ == Scanlines::BandRows || (y_ & (Scanlines::BandRows - 1)) == 0) flush();
+}
+
+void BandLoader::flush() {
+    if (count_ == 0) return;
+    const int top = static_cast<int>(y_ - count_);
+
+    // column by column, which is the order upsertMany wants
+    QVector<PixelRef> pixels;
+    for (int x = 0; x < width_; x++) {
+        const QRgb* column = rows_.data() + x;
+        for (int r = 0; r < count_; r++) {
+            const QRgb word = column[static_cast<size_t>(r) * width_];
+            if (qAlpha(word) != 0) pixels.emplaceBack(at_.x() + x, top + r, Pixel::fromPremultiplied(word));
+        }
+    }
+    count_ = 0;
+    if (pixels.isEmpty()) return;
+    if (delta_) delta_->recordUpserts(layer_, pixels);
+    layer_.upsertMany(std::move(pixels));
+}
+
+// Qt decoding ---------------------------
+
+// load a decoded image whole, for what the streaming decoder does not handle
+static bool loadImage(QImageReader& reader, const QPoint& at, RasterLayer& layer, LayerDelta* delta, QString* error) {
+    QImage image = reader.read();
+    if (image.isNull()) return fail(error, reader.errorString());
+    image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied); // the layout of Pixel
+
+    BandLoader loader(layer, delta, at, image.width());
+    for (int y = 0; y < image.height(); y++) {
+        memcpy(loader.row(), image.constScanLine(y), image.width() * sizeof(QRgb));
+        loader.push();
+    }
+    loader.flush();
+    return true;
+}
+
+// PNG ---------------------------
+
+static int paeth(int a, int b, int c) {
+    const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// one PNG row filter, turning raw into out (both rowBytes long) with prev the raw
+// row above (zeros for the first row) and bpp the bytes per pixel, rounded up
+static void filterRow(int type, const uchar* raw, const uchar* prev, int rowBytes, int bpp, uchar* out) {
+    // a loop per filter rather than a switch per byte, which the compiler can vectorize
+    switch (type) {
+    case 0: memcpy(out, raw, rowBytes); break;
+    case 1:
+        for (int i = 0; i < rowBytes; i++) out[i] = static_cast<uchar>(raw[i] - (i >= bpp ? raw[i - bpp] : 0));
+        break;
+    case 2:
+        for (int i = 0; i < rowBytes; i++) out[i] = static_cast<uchar>(raw[i] - prev[i]);
+        break;
+    case 3:
+        for (int i = 0; i < rowBytes; i++) out[i] = static_cast<uchar>(raw[i] - ((i >= bpp ? raw[i - bpp] : 0) + prev[i]) / 2);
+        break;
+    case 4:
+        for (int i = 0; i < rowBytes; i++)
+            out[i] = static_cast<uchar>(raw[i] - (i >= bpp ? paeth(raw[i - bpp], prev[i], prev[i - bpp]) : prev[i]));
+        break;
+    }
+}
+
+// undo filterRow in place. Returns false for an unknown filter
+static bool unfilterRow(int type, uchar* row, const uchar* prev, int rowBytes, int bpp) {
+    switch (type) {
+    case 0: break;
+    case 1:
+        for (int i = bpp; i < rowBytes; i++) row[i] = static_cast<uchar>(row[i] + row[i - bpp]);
+        break;
+    case 2:
+        for (int i = 0; i < rowBytes; i++) row[i] = static_cast<uchar>(row[i] + prev[i]);
+        break;
+    case 3:
+        for (int i = 0; i < rowBytes; i++) row[i] = static_cast<uchar>(row[i] + ((i >= bpp ? row[i - bpp] : 0) + prev[i]) / 2);
+        break;
+    case 4:
+        for (int i = 0; i < rowBytes; i++)
+            row[i] = static_cast<uchar>(row[i] + (i >= bpp ? paeth(row[i - bpp], prev[i], prev[i - bpp]) : prev[i]));
+        break;
+    default: return false;
+    }
+    return true;
+}
+
+static bool writeChunk(QIODevice* device, const char type[4], const uchar* data, quint32 length) {
+    uchar head[8];
+    writeBigEndian(head, length);
+    memcpy(head + 4, type, 4);
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+    if (length) crc = crc32(crc, data, length);
+    uchar tail[4];
+    writeBigEndian(tail, static_cast<quint32>(crc));
+    return writeFully(device, head, 8) && (length == 0 || writeFully(device, data, length)) && writeFully(device, tail, 4);
+}
+
+// the header and palette of a PNG being read, and how to turn its rows into pixels
+struct PngFormat {
+    quint32 width, height;
+    int depth, colorType, interlace;
+    int channels;
+    QRgb palette[256]; // premultiplied
+    int paletteSize;
+    bool keyed;        // gray or truecolor with one color (key) made transparent
+    quint16 key[3];
+
+    int bitsPerPixel() const { return channels * depth; }
+    qint64 rowBytes() const { return (static_cast<qint64>(width) * bitsPerPixel() + 7) / 8; }
+
+    bool valid() const {
+        switch (colorType) {
+        case 0: return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+        case 3: return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+        case 2: case 4: case 6: return depth == 8 || depth == 16;
+        default: return false;
+        }
+    }
+
+    // sample i of a row, counting channels across pixels
+    quint32 sample(const uchar* row, qint64 i) const {
+        if (depth == 8) return row[i];
+        if (depth == 16) return static_cast<quint32>(row[2 * i]) << 8 | row[2 * i + 1];
+        const qint64 bit = i * depth;
+        return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+    }
+
+    // a sample scaled to 8 bits
+    int to8(quint32 v) const {
+        if (depth == 8) return static_cast<int>(v);
+        if (depth == 16) return static_cast<int>((v * 255 + 32767) / 65535);
+        return static_cast<int>(v * 255 / ((1u << depth) - 1));
+    }
+
+    void convert(const uchar* row, QRgb* out) const {
+        if (colorType == 6 && depth == 8) { // the common case, and what writePng makes
+            for (quint32 x = 0; x < width; x++, row += 4) out[x] = qPremultiply(qRgba(row[0], row[1], row[2], row[3]));
+            return;
+        }
+        if (colorType == 3 && depth == 8) {
+            for (quint32 x = 0; x < width; x++) out[x] = row[x] < paletteSize ? palette[row[x]] : 0;
+            return;
+        }
+
+        for (quint32 x = 0; x < width; x++) {
+            const qint64 i = static_cast<qint64>(x) * channels;
+            switch (colorType) {
+            case 0: {
+                const quint32 g = sample(row, i);
+                const int v = to8(g);
+                out[x] = keyed && g == key[0] ? 0 : qRgba(v, v, v, 255);
+                break;
+            }
+            case 2: {
+                const quint32 r = sample(row, i), g = sample(row, i + 1), b = sample(row, i + 2);
+                out[x] = keyed && r == key[0] && g == key[1] && b == key[2] ? 0 : qRgba(to8(r), to8(g), to8(b), 255);
+                break;
+            }
+            case 3: {
+                const quint32 index = sample(row, i);
+                out[x] = static_cast<int>(index) < paletteSize ? palette[index] : 0;
+                break;
+            }
+            case 4: {
+                const int v = to8(sample(row, i));
+                out[x] = qPremultiply(qRgba(v, v, v, to8(sample(row, i + 1))));
+                break;
+            }
+            case 6:
+                out[x] = qPremultiply(qRgba(to8(sample(row, i)), to8(sample(row, i + 1)), to8(sample(row, i + 2)),
+                                            to8(sample(row, i + 3))));
+                break;
+            }
+        }
+    }
+};
+
+// decode the rows of the PNG whose signature was just read. Sets fallback instead if
+// it is interlaced, before reading any pixel data
+static bool readPng(QIODevice* device, const QPoint& at, RasterLayer& layer, LayerDelta* delta, bool& fallback,
+                    QString* error) {
+    PngFormat format{};
+    bool haveHeader = false, done = false;
+    std::vector<uchar> data;
+    std::vector<uchar> current, previous; // filter byte plus row, and the row above
+    std::unique_ptr<BandLoader> loader;
+    qint64 filled = 0;
+    quint32 rows = 0;
+
+    z_stream zs{};
+    if (inflateInit(&zs) != Z_OK) return fail(error, "out of memory");
+    struct InflateEnd {
+        z_stream& zs;
+        ~InflateEnd() { inflateEnd(&zs); }
+    } inflateEndGuard{zs};
+
+    while (!done) {
+        uchar head[8];
+        if (!readFully(device, head, 8)) return fail(error, "truncated PNG");
+        const quint32 length = readBigEndian(head);
+        char type[4];
+        memcpy(type, head + 4, 4);
+        if (length > 0x7fffffffu) return fail(error, "corrupt PNG");
+        uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+
+        const bool isData = memcmp(type, "IDAT", 4) == 0;
+        if (!haveHeader && memcmp(type, "IHDR", 4) != 0) return fail(error, "corrupt PNG");
+        if (isData && !loader) return fail(error, "corrupt PNG"); // no IHDR, or a palette image without PLTE
+
+        // pixel data in pieces; the other chunks are small and parsed whole
+        if (!isData) {
+            data.resize(length);
+            if (length && !readFully(device, data.data(), length)) return fail(error, "truncated PNG");
+            crc = crc32(crc, data.data(), length);
+        }
+        for (quint32 left = isData ? length : 0; left > 0;) {
+            const quint32 piece = std::min<quint32>(left, ChunkBytes);
+            data.resize(piece);
+            if (!readFully(device, data.data(), piece)) return fail(error, "truncated PNG");
+            crc = crc32(crc, data.data(), piece);
+            left -= piece;
+
+            // inflate into the current row, taking each as it fills up
+            zs.next_in = data.data();
+            zs.avail_in = piece;
+            while (zs.avail_in > 0 && rows < format.height) {
+                zs.next_out = current.data() + filled;
+                zs.avail_out = static_cast<uInt>(current.size() - filled);
+                const int status = inflate(&zs, Z_NO_FLUSH);
+                if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) return fail(error, "corrupt PNG data");
+                filled = static_cast<qint64>(current.size()) - zs.avail_out;
+                if (filled == static_cast<qint64>(current.size())) {
+                    const int bpp = std::max(1, format.bitsPerPixel() / 8);
+                    if (!unfilterRow(current[0], current.data() + 1, previous.data(), static_cast<int>(current.size() - 1), bpp))
+                        return fail(error, "corrupt PNG data");
+                    format.convert(current.data() + 1, loader->row());
+                    loader->push();
+                    std::copy(current.begin() + 1, current.end(), previous.begin());
+                    filled = 0;
+                    rows++;
+                }
+                if (status == Z_STREAM_END) break;
+                if (status == Z_BUF_ERROR && zs.avail_out > 0) break; // wants more input
+            }
+        }
+
+        uchar tail[4];
+        if (!readFully(device, tail, 4)) return fail(error, "truncated PNG");
+        if (readBigEndian(tail) != static_cast<quint32>(crc)) return fail(error, "corrupt PNG (checksum)");
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (haveHeader || length != 13) return fail(error, "corrupt PNG");
+            format.width = readBigEndian(data.data());
+            format.height = readBigEndian(data.data() + 4);
+            format.depth = data[8];
+            format.colorType = data[9];
+            format.interlace = data[12];
+            format.channels = format.colorType == 2 ? 3 : format.colorType == 4 ? 2 : format.colorType == 6 ? 4 : 1;
+            if (format.width == 0 || format.height == 0 || format.width > INT_MAX || format.height > INT_MAX || !format.valid()
+                || data[10] != 0 || data[11] != 0 || format.interlace > 1 || format.rowBytes() >= INT_MAX)
+                return fail(error, "unsupported PNG");
+            if (format.interlace) { // rows come in seven passes; leave that to Qt
+                fallback = true;
+                return false;
+            }
+            haveHeader = true;
+            for (QRgb& c : format.palette) c = 0;
+            if (format.colorType != 3) loader.reset(new BandLoader(layer, delta, at, static_cast<int>(format.width)));
+            current.assign(format.rowBytes() + 1, 0);
+            previous.assign(format.rowBytes(), 0);
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            if (length % 3 != 0 || length > 3 * 256) return fail(error, "corrupt PNG");
+            format.paletteSize = static_cast<int>(length / 3);
+            for (int i = 0; i < format.paletteSize; i++)
+                format.palette[i] = qRgba(data[3 * i], data[3 * i + 1], data[3 * i + 2], 255);
+            if (format.colorType == 3 && !loader) loader.reset(new BandLoader(layer, delta, at, static_cast<int>(format.width)));
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            if (format.colorType == 3) {
+                for (quint32 i = 0; i < length && static_cast<int>(i) < format.paletteSize; i++)
+                    format.palette[i] = qPremultiply(qRgba(qRed(format.palette[i]), qGreen(format.palette[i]), qBlue(format.palette[i]), data[i]));
+            } else if ((format.colorType == 0 && length >= 2) || (format.colorType == 2 && length >= 6)) {
+                format.keyed = true;
+                for (int c = 0; c < (format.colorType == 0 ? 1 : 3); c++)
+                    format.key[c] = static_cast<quint16>(data[2 * c] << 8 | data[2 * c + 1]);
+            }
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            done = true;
+        } else if (!isData && !(type[0] & 0x20)) { // an unknown chunk the image depends on
+            return fail(error, "unsupported PNG");
+        }
+    }
+
+    if (loader) loader->flush();
+    if (rows < format.height) return fail(error, "truncated PNG");
+    return true;
+}
+
+// ImageIO ---------------------------
+
+bool ImageIO::writeRaw(Scanlines& rows, QIODevice* device, QString* error) {
+    std::vector<uchar> bytes(static_cast<size_t>(rows.box().width()) * 4);
+    while (const QRgb* row = rows.next()) {
+        toRgba8(row, rows.box().width(), bytes.data());
+        if (!writeFully(device, bytes.data(), static_cast<qint64>(bytes.size()))) return fail(error, device->errorString());
+    }
+    return true;
+}
+
+bool ImageIO::writePng(Scanlines& rows, QIODevice* device, QString* error) {
+    const QRect box = rows.box();
+    if (box.isEmpty()) return fail(error, "nothing to write");
+    const int rowBytes = box.width() * 4;
+
+    uchar header[13];
+    writeBigEndian(header, static_cast<quint32>(box.width()));
+    writeBigEndian(header + 4, static_cast<quint32>(box.height()));
+    header[8] = 8;  // bits per channel
+    header[9] = 6;  // RGBA
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // not interlaced
+    if (!writeFully(device, PngSignature, sizeof(PngSignature)) || !writeChunk(device, "IHDR", header, sizeof(header)))
+        return fail(error, device->errorString());
+
+    z_stream zs{};
+    // fastest: flat runs of pixel art compress about as well at any level
+    if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) return fail(error, "out of memory");
+    struct DeflateEnd {
+        z_stream& zs;
+        ~DeflateEnd() { deflateEnd(&zs); }
+    } deflateEndGuard{zs};
+
+    std::vector<uchar> out(ChunkBytes);
+    auto pump = [&](int flush) {
+        do {
+            zs.next_out = out.data();
+            zs.avail_out = static_cast<uInt>(out.size());
+            if (deflate(&zs, flush) == Z_STREAM_ERROR) return false;
+            const quint32 produced = static_cast<quint32>(out.size() - zs.avail_out);
+            if (produced && !writeChunk(device, "IDAT", out.data(), produced)) return false;
+        } while (zs.avail_out == 0);
+        return true;
+    };
+
+    // the raw row and the one above, and the row under each filter, filter byte first
+    std::vector<uchar> raw(rowBytes), previous(rowBytes, 0);
+    std::vector<uchar> filtered[5];
+    for (std::vector<uchar>& f : filtered) f.resize(rowBytes + 1);
+
+    while (const QRgb* row = rows.next()) {
+        toRgba8(row, box.width(), raw.data());
+
+        // the filter leaving the smallest sum of bytes taken as signed, the usual guess
+        // at what deflates best
+        int best = 0;
+        long bestSum = LONG_MAX;
+        for (int type = 0; type < 5; type++) {
+            filtered[type][0] = static_cast<uchar>(type);
+            filterRow(type, raw.data(), previous.data(), rowBytes, 4, filtered[type].data() + 1);
+            long sum = 0;
+            for (int i = 1; i <= rowBytes && sum < bestSum; i++) sum += std::abs(static_cast<signed char>(filtered[type][i]));
+            if (sum < bestSum) {
+                bestSum = sum;
+                best = type;
+            }
+        }
+
+        zs.next_in = filtered[best].data();
+        zs.avail_in = static_cast<uInt>(rowBytes + 1);
+        if (!pump(Z_NO_FLUSH)) return fail(error, device->errorString());
+        raw.swap(previous);
+    }
+    if (!pump(Z_FINISH) || !writeChunk(device, "IEND", nullptr, 0)) return fail(error, device->errorString());
+    return true;
+}
+
+bool ImageIO::readRaw(QIODevice* device, int width, const QPoint& at, RasterLayer& layer, LayerDelta* delta,
+                      QString* error) {
+    if (width <= 0) return fail(error, "no width given");
+
+    BandLoader loader(layer, delta, at, width);
+    std::vector<uchar> bytes(static_cast<size_t>(width) * 4);
+    for (;;) {
+        const qint64 got = device->read(reinterpret_cast<char*>(bytes.data()), static_cast<qint64>(bytes.size()));
+        if (got == 0) break;
+        if (got != static_cast<qint64>(bytes.size())) {
+            loader.flush();
+            return fail(error, got < 0 ? device->errorString() : QString("file ends within a row"));
+        }
+
+        QRgb* row = loader.row();
+        for (int x = 0; x < width; x++) {
+            const uchar* p = bytes.data() + 4 * x;
+            row[x] = qPremultiply(qRgba(p[0], p[1], p[2], p[3]));
+        }
+        loader.push();
+    }
+    loader.flush();
+    return true;
+}
+
+bool ImageIO::readImage(QIODevice* device, const QPoint& at, RasterLayer& layer, LayerDelta* delta, QString* error) {
+    const qint64 start = device->pos();
+    uchar signature[sizeof(PngSignature)];
+    if (readFully(device, signature, sizeof(signature)) && memcmp(signature, PngSignature, sizeof(signature)) == 0) {
+        bool fallback = false;
+        if (readPng(device, at, layer, delta, fallback, error)) return true;
+        if (!fallback) return false;
+    }
+
+    // not something read here: hand the whole file to Qt
+    if (!device->seek(start)) return fail(error, device->errorString());
+    QImageReader reader(device);
+    return loadImage(reader, at, layer, delta, error);
+}
@@ -0,0 +1,119 @@
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include <layerdelta.h>
+#include <rasterlayer.h>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+#include <vector>
+
+// The rows of a box of canvas, top to bottom, as premultiplied ARGB32 words,
+// for writing images out without a full size copy. Rows are gathered a band
+// at a time with one region walk per band; bands follow the 64 pixel tile rows
+// of the canvas, so a tiled layer is read tile by tile. Memory is one band,
+// whatever the height of the box.
+//
+// Reads copies of the layers taken at construction, which are O(1) thanks to
+// copy-on-write, so the originals can be edited meanwhile.
+class Scanlines
+{
+public:
+    static constexpr int BandRows = 1 << RasterLayer::DirtyShift;
+
+private:
+    QVector<RasterLayer> layers_;
+    bool flatten_;           // composite layers_, rather than take layers_[0] as is
+    QRect box_;
+    std::vector<QRgb> band_; // rows bandTop_ to bandBottom_ of box_
+    int bandTop_, bandBottom_;
+    int row_;                // next row to hand out
+
+    // gather the band starting at row top
+    void fillBand(int top);
+
+public:
+    // constructor destructor ---------------------------
+
+    // the pixels of one layer inside box, transparent where there are none
+    Scanlines(const RasterLayer& layer, const QRect& box);
+    // the layers flattened over box, as the Compositor does it
+    Scanlines(const QVector<RasterLayer>& layers, const QRect& box);
+
+    // accessors ---------------------------
+
+    // return the area read
+    QRect box() const;
+
+    // mutators ---------------------------
+
+    // return the next row, box().width() words, or nullptr after the last. Valid until
+    // the next call
+    const QRgb* next();
+};
+
+// Loads rows of pixels onto a layer, the counterpart of Scanlines. Rows are
+// collected into bands along the 64 pixel tile rows of the canvas and each band
+// goes in with one upsertMany, built column by column so it needs no sorting.
+// Fully transparent pixels are skipped. Each band is recorded into delta first
+// if one is given, for undo.
+class BandLoader
+{
+    RasterLayer& layer_;
+    LayerDelta* delta_;
+    QPoint at_;              // where the first row starts
+    int width_;
+    std::vector<QRgb> rows_; // the rows of the current band
+    int count_;              // rows in rows_
+    qint64 y_;               // canvas row of the next row
+
+public:
+    // constructor destructor ---------------------------
+
+    // rows of width pixels, the first of them starting at at
+    BandLoader(RasterLayer& layer, LayerDelta* delta, const QPoint& at, int width);
+
+    // mutators ---------------------------
+
+    // return the buffer to fill with the next row, width premultiplied words
+    QRgb* row();
+
+    // take the row filled in, loading the band if it ends here
+    void push();
+
+    // load the rows taken so far. Call after the last row
+    void flush();
+};
+
+// Streams pixels between layers and image files, a row at a time.
+//
+// Writing takes Scanlines. PNG is 8 bit RGBA, non interlaced, with each row
+// filtered (by the usual least-sum heuristic) and deflated as it comes. Raw is
+// RGBA8 with no header: 4 bytes per pixel, red first, not premultiplied, rows
+// top to bottom.
+//
+// Reading goes through a BandLoader. PNGs of every color type and bit depth
+// are decoded here row by row; interlaced PNGs and other formats go through
+// QImageReader, which decodes them whole.
+class ImageIO
+{
+public:
+    // other functions ---------------------------
+
+    // write rows to device as raw RGBA8. Returns false on failure, with the reason in
+    // error if given
+    static bool writeRaw(Scanlines& rows, QIODevice* device, QString* error = nullptr);
+    // same, as PNG
+    static bool writePng(Scanlines& rows, QIODevice* device, QString* error = nullptr);
+
+    // read raw RGBA8 rows of width pixels from device, to its end, onto layer with the
+    // top left pixel at at. Returns false on failure, with the reason in error if given;
+    // the rows before it are loaded
+    static bool readRaw(QIODevice* device, int width, const QPoint& at, RasterLayer& layer,
+                        LayerDelta* delta = nullptr, QString* error = nullptr);
+    // same for an image file, PNG or anything else QImageReader reads
+    static bool readImage(QIODevice* device, const QPoint& at, RasterLayer& layer,
+                          LayerDelta* delta = nullptr, QString* error = nullptr);
+};
+
+#endif // IMAGEIO_H
@@ -0,0 +1,378 @@
+#include "layerdelta.h"
+#include <algorithm>
+#include <climits>
+#include <numeric>
+#include <set>
+
+// covers every representable pixel
+static const QRect Everything(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX));
+
+static bool byLocation(const ColumnRun& a, const ColumnRun& b) {
+    return a.x != b.x ? a.x < b.x : a.y < b.y;
+}
+
+// the runs of pixels layer holds inside box, sorted by location
+static std::vector<std::pair<ColumnRun, Pixel>> piecesIn(const RasterLayer& layer, const QRect& box) {
+    std::vector<std::pair<ColumnRun, Pixel>> pieces;
+    layer.forEachRunInRect(box, [&pieces](const ColumnRun& run, Pixel v) {
+        pieces.emplace_back(run, v);
+    });
+    std::sort(pieces.begin(), pieces.end(), [](const auto& a, const auto& b) { return byLocation(a.first, b.first); });
+    return pieces;
+}
+
+// packed format ---------------------------
+//
+// One record per run of changes in the same column, at consecutive y, with the
+// same before and the same after:
+//   varint zigzag(x - previous x)
+//   varint zigzag(first y - previous run's last y)
+//   varint run length
+//   flags byte: bit 0 has before, bit 1 has after
+//   before word (4 bytes, little endian) if present
+//   after word (4 bytes, little endian) if present
+
+static void putVarint(std::vector<quint8>& out, quint64 v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<quint8>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<quint8>(v));
+}
+
+static quint64 getVarint(const quint8*& in) {
+    quint64 v = 0;
+    for (int shift = 0;; shift += 7) {
+        const quint8 b = *in++;
+        v |= static_cast<quint64>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+static quint64 zigzag(qint64 v) { return (static_cast<quint64>(v) << 1) ^ static_cast<quint64>(v >> 63); }
+static qint64 unzigzag(quint64 v) { return static_cast<qint64>(v >> 1) ^ -static_cast<qint64>(v & 1); }
+
+static void putWord(std::vector<quint8>& out, QRgb w) {
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<quint8>(w >> (8 * i)));
+}
+
+static QRgb getWord(const quint8*& in) {
+    QRgb w = 0;
+    for (int i = 0; i < 4; i++) w |= static_cast<QRgb>(*in++) << (8 * i);
+    return w;
+}
+
+// constructor destructor ---------------------------
+
+LayerDelta::LayerDelta()
+    : count_(0), sealed_(true), compressed_(false) {}
+
+// helper functions ---------------------------
+
+template <typename F>
+void LayerDelta::forEachRun(F&& visit) const {
+    if (!compressed_) {
+        for (const Span& s : spans_) visit(s.x, s.y, s.length, s.before, s.after);
+        return;
+    }
+
+    const quint8* in = packed_.data();
+    const quint8* end = in + packed_.size();
+    qint64 x = 0, y = 0;
+    while (in != end) {
+        x += unzigzag(getVarint(in));
+        y += unzigzag(getVarint(in));
+        const int length = static_cast<int>(getVarint(in));
+        const quint8 flags = *in++;
+
+        std::optional<Pixel> before, after;
+        if (flags & 1) before = Pixel::fromPremultiplied(getWord(in));
+        if (flags & 2) after = Pixel::fromPremultiplied(getWord(in));
+
+        visit(static_cast<int>(x), static_cast<int>(y), length, before, after);
+        y += length - 1; // runs are relative to the last y of the previous run
+    }
+}
+
+std::vector<LayerDelta::Span> LayerDelta::unpacked() const {
+    if (!compressed_) return spans_;
+
+    std::vector<Span> spans;
+    forEachRun([&spans](int x, int y, int length, const std::optional<Pixel>& before, const std::optional<Pixel>& after) {
+        spans.push_back({x, y, length, before, after});
+    });
+    return spans;
+}
+
+void LayerDelta::recordSpan(const int x, const int y, const int length, const std::optional<Pixel> before,
+                            const std::optional<Pixel> after) {
+    if (length <= 0) return;
+    if (compressed_) { // back to the raw form to take more changes
+        spans_ = unpacked();
+        std::vector<quint8>().swap(packed_);
+        compressed_ = false;
+    }
+
+    spans_.push_back({x, y, length, before, after});
+    count_ += length;
+    sealed_ = false;
+}
+
+void LayerDelta::recordOver(const ColumnRun& run, Pieces::const_iterator first, Pieces::const_iterator last,
+                            const std::optional<Pixel> after) {
+    // the gaps between pieces only change for a fill; an erase leaves them empty
+    qint64 y = run.y;
+    for (; first != last; ++first) {
+        const ColumnRun& piece = first->first;
+        if (after.has_value() && piece.y > y) recordSpan(run.x, static_cast<int>(y), static_cast<int>(piece.y - y), std::nullopt, after);
+        recordSpan(run.x, piece.y, piece.length, first->second, after);
+        y = static_cast<qint64>(piece.y) + piece.length;
+    }
+    const qint64 end = static_cast<qint64>(run.y) + run.length;
+    if (after.has_value() && end > y) recordSpan(run.x, static_cast<int>(y), static_cast<int>(end - y), std::nullopt, after);
+}
+
+void LayerDelta::apply(RasterLayer& layer, bool after) const {
+    QVector<PixelRef> upserts;
+    QVector<QPoint> removes;
+
+    // runs in neighbouring columns covering the same rows with the same value grow
+    // into one block, so undoing a fill is a fill (or erase) again, not a pixel list
+    QRect block;
+    std::optional<Pixel> blockValue;
+
+    auto flush = [&]() {
+        if (block.isEmpty()) return;
+        if (static_cast<qint64>(block.width()) * block.height() >= 16) {
+            if (blockValue.has_value()) layer.fillRect(block, blockValue.value());
+            else layer.eraseRect(block);
+        } else { // too small to bother, batch it with the single pixels
+            for (int x = block.left(); x <= block.right(); x++)
+                for (int y = block.top(); y <= block.bottom(); y++) {
+                    if (blockValue.has_value()) upserts.emplaceBack(x, y, blockValue.value());
+                    else removes.append(QPoint(x, y));
+                }
+        }
+        block = QRect();
+    };
+
+    forEachRun([&](int x, int y, int length, const std::optional<Pixel>& before, const std::optional<Pixel>& afterValue) {
+        const std::optional<Pixel>& value = after ? afterValue : before;
+        if (!block.isEmpty() && value == blockValue && block.top() == y && block.height() == length
+            && static_cast<qint64>(block.right()) + 1 == x) {
+            block.setRight(x);
+            return;
+        }
+        flush();
+        block = QRect(x, y, 1, length);
+        blockValue = value;
+    });
+    flush();
+
+    // the stragglers come out sorted, so the batch calls skip their sort
+    layer.removeMany(std::move(removes));
+    layer.upsertMany(std::move(upserts));
+}
+
+// accessors ---------------------------
+
+int LayerDelta::size() const { return count_; }
+
+bool LayerDelta::isEmpty() const { return count_ == 0; }
+
+bool LayerDelta::isCompressed() const { return compressed_; }
+
+qint64 LayerDelta::bytes() const {
+    return static_cast<qint64>(sizeof(LayerDelta) + spans_.capacity() * sizeof(Span) + packed_.capacity());
+}
+
+std::vector<LayerDelta::Change> LayerDelta::changes() const {
+    if (!sealed_) {
+        LayerDelta copy = *this;
+        copy.seal();
+        return copy.changes();
+    }
+
+    std::vector<Change> changes;
+    changes.reserve(count_);
+    forEachRun([&changes](int x, int y, int length, const std::optional<Pixel>& before, const std::optional<Pixel>& after) {
+        for (qint64 i = 0; i < length; i++) {
+            changes.push_back({QPoint(x, static_cast<int>(y + i)), before, after});
+        }
+    });
+    return changes;
+}
+
+// mutators ---------------------------
+
+void LayerDelta::record(const QPoint loc, const std::optional<Pixel> before, const std::optional<Pixel> after) {
+    recordSpan(loc.x(), loc.y(), 1, before, after);
+}
+
+void LayerDelta::recordUpserts(const RasterLayer& layer, const QVector<PixelRef>& pixels) {
+    for (const PixelRef& p : pixels) {
+        auto before = layer.get(p.location);
+        record(p.location, before.has_value() ? std::optional<Pixel>(before->value) : std::nullopt, p.value);
+    }
+}
+
+void LayerDelta::recordRemoves(const RasterLayer& layer, const QVector<QPoint>& locs) {
+    for (const QPoint& loc : locs) {
+        auto before = layer.get(loc);
+        if (before.has_value()) record(loc, before->value, std::nullopt);
+    }
+}
+
+void LayerDelta::recordFill(const RasterLayer& layer, const QRect& box, const Pixel p) {
+    if (box.isEmpty()) return;
+
+    // one walk over the box, then a span per stretch of each column
+    const Pieces pieces = piecesIn(layer, box);
+    auto next = pieces.cbegin();
+    for (qint64 x = box.left(); x <= box.right(); x++) {
+        auto end = next;
+        while (end != pieces.cend() && end->first.x == x) ++end;
+        recordOver(ColumnRun{static_cast<int>(x), box.top(), box.height()}, next, end, p);
+        next = end;
+    }
+}
+
+void LayerDelta::recordRuns(const RasterLayer& layer, const QVector<ColumnRun>& runs, const std::optional<Pixel> after) {
+    for (const ColumnRun& run : runs) {
+        // one column walk per run: runs are short, where a box around them all could
+        // hold far more than they cover
+        if (run.length <= 0) continue;
+        const Pieces pieces = piecesIn(layer, QRect(run.x, run.y, 1, run.length));
+        recordOver(run, pieces.cbegin(), pieces.cend(), after);
+    }
+}
+
+void LayerDelta::recordClear(const RasterLayer& layer) {
+    layer.forEachRunInRect(Everything, [this](const ColumnRun& run, Pixel v) {
+        recordSpan(run.x, run.y, run.length, v, std::nullopt);
+    });
+}
+
+void LayerDelta::merge(const LayerDelta& later) {
+    if (later.isEmpty()) return;
+
+    std::vector<Span> newer = later.unpacked();
+    if (compressed_) {
+        spans_ = unpacked();
+        std::vector<quint8>().swap(packed_);
+        compressed_ = false;
+    }
+
+    spans_.insert(spans_.end(), newer.begin(), newer.end());
+    sealed_ = false;
+    seal();
+}
+
+void LayerDelta::seal() {
+    if (sealed_) return;
+
+    // spans by location; stable, so those starting at one location stay in the order
+    // they were recorded
+    std::vector<size_t> order(spans_.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return spans_[a].x != spans_[b].x ? spans_[a].x < spans_[b].x : spans_[a].y < spans_[b].y;
+    });
+
+    std::vector<Span> out;
+    auto emit = [&out](int x, qint64 y, qint64 length, const std::optional<Pixel>& before, const std::optional<Pixel>& after) {
+        if (before == after) return; // changed nothing
+        if (!out.empty()) {
+            Span& last = out.back();
+            if (last.x == x && static_cast<qint64>(last.y) + last.length == y && last.before == before && last.after == after) {
+                last.length += static_cast<int>(length);
+                return;
+            }
+        }
+        out.push_back({x, static_cast<int>(y), static_cast<int>(length), before, after});
+    };
+
+    std::vector<std::pair<qint64, size_t>> edges;
+    std::set<size_t> open;
+    for (size_t i = 0; i < order.size();) {
+        const int x = spans_[order[i]].x;
+        size_t j = i;
+        bool overlaps = false;
+        qint64 reach = LLONG_MIN;
+        for (; j < order.size() && spans_[order[j]].x == x; j++) {
+            const Span& s = spans_[order[j]];
+            if (s.y < reach) overlaps = true;
+            reach = std::max(reach, static_cast<qint64>(s.y) + s.length);
+        }
+
+        if (!overlaps) {
+            for (size_t k = i; k < j; k++) {
+                const Span& s = spans_[order[k]];
+                emit(x, s.y, s.length, s.before, s.after);
+            }
+            i = j;
+            continue;
+        }
+
+        // cut the column wherever a span starts or ends. Each piece between cuts keeps
+        // the before of the first span recorded over it and the after of the last
+        edges.clear();
+        for (size_t k = i; k < j; k++) {
+            const Span& s = spans_[order[k]];
+            edges.emplace_back(s.y, order[k]);
+            edges.emplace_back(static_cast<qint64>(s.y) + s.length, order[k]);
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t e = 0; e < edges.size();) {
+            const qint64 row = edges[e].first;
+            for (; e < edges.size() && edges[e].first == row; e++) {
+                if (!open.erase(edges[e].second)) open.insert(edges[e].second);
+            }
+            if (!open.empty() && e < edges.size()) {
+                emit(x, row, edges[e].first - row, spans_[*open.begin()].before, spans_[*open.rbegin()].after);
+            }
+        }
+        i = j;
+    }
+    out.shrink_to_fit();
+    spans_ = std::move(out);
+
+    qint64 count = 0;
+    for (const Span& s : spans_) count += s.length;
+    count_ = static_cast<int>(count);
+    sealed_ = true;
+}
+
+void LayerDelta::compress() {
+    if (compressed_) return;
+    seal();
+
+    std::vector<quint8> packed;
+    qint64 lastX = 0, lastY = 0;
+    forEachRun([&](int x, int y, int length, const std::optional<Pixel>& before, const std::optional<Pixel>& after) {
+        putVarint(packed, zigzag(x - lastX));
+        putVarint(packed, zigzag(y - lastY));
+        putVarint(packed, static_cast<quint64>(length));
+        packed.push_back(static_cast<quint8>((before.has_value() ? 1 : 0) | (after.has_value() ? 2 : 0)));
+        if (before.has_value()) putWord(packed, before->argb);
+        if (after.has_value()) putWord(packed, after->argb);
+
+        lastX = x;
+        lastY = static_cast<qint64>(y) + length - 1;
+    });
+
+    packed.shrink_to_fit();
+    packed_ = std::move(packed);
+    std::vector<Span>().swap(spans_); // release the raw form
+    compressed_ = true;
+}
+
+// other functions ---------------------------
+
+void LayerDelta::revert(RasterLayer& layer) const {
+    apply(layer, false);
+}
+
+void LayerDelta::reapply(RasterLayer& layer) const {
+    apply(layer, true);
+}
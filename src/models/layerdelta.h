@@ -0,0 +1,117 @@
+#ifndef LAYERDELTA_H
+#define LAYERDELTA_H
+
+#include <rasterlayer.h>
+#include <optional>
+#include <vector>
+
+// The pixels one edit (a stroke, a fill, a clear) changed on a RasterLayer:
+// for every touched location, the value before and after (nil meaning no pixel).
+// Enough to undo the edit by writing the befores back, and redo it by writing
+// the afters.
+//
+// Changes are recorded raw as spans down a column sharing one before and one
+// after (a single pixel is a span of one), then sealed: sorted, overlaps cut so
+// each location has one change, neighbours joined. Fills and runs record a span
+// per stretch of the column they cover, not a change per pixel, so even a fill
+// of the whole canvas stays a few KB raw. A sealed delta can be compressed into
+// a run-length byte stream of the same spans, a few bytes each.
+class LayerDelta
+{
+public:
+    struct Change {
+        QPoint location;
+        std::optional<Pixel> before;
+        std::optional<Pixel> after;
+    };
+
+private:
+    // rows y to y + length - 1 of column x all go from before to after
+    struct Span {
+        int x, y;
+        int length;
+        std::optional<Pixel> before;
+        std::optional<Pixel> after;
+    };
+    // the runs of pixels a layer holds in some region, sorted by location
+    typedef std::vector<std::pair<ColumnRun, Pixel>> Pieces;
+
+    std::vector<Span> spans_;    // raw form, sorted, disjoint and joined once sealed
+    std::vector<quint8> packed_; // compressed form, see compress()
+    int count_;                  // number of changed locations, in either form
+    bool sealed_;
+    bool compressed_;
+
+    // the raw spans, unpacking them if compressed
+    std::vector<Span> unpacked() const;
+
+    // call visit(x, y, length, before, after) for each span, in order, without unpacking
+    template <typename F>
+    void forEachRun(F&& visit) const;
+
+    // append a span to the raw form
+    void recordSpan(const int x, const int y, const int length, const std::optional<Pixel> before,
+                    const std::optional<Pixel> after);
+
+    // record the rows of run going to after (or erased, for nil), given the pieces of
+    // the layer inside them
+    void recordOver(const ColumnRun& run, Pieces::const_iterator first, Pieces::const_iterator last,
+                    const std::optional<Pixel> after);
+
+    // write either side of every change into layer
+    void apply(RasterLayer& layer, bool after) const;
+
+public:
+    // constructor destructor ---------------------------
+    LayerDelta();
+
+    // accessors ---------------------------
+
+    // return the number of changed locations (after sealing; before it, the number of
+    // locations recorded, repeats included)
+    int size() const;
+    bool isEmpty() const;
+
+    // return if the delta has been compressed
+    bool isCompressed() const;
+
+    // return the approximate number of bytes the delta occupies
+    qint64 bytes() const;
+
+    // return the changes sorted by location
+    std::vector<Change> changes() const;
+
+    // mutators ---------------------------
+
+    // record that loc goes from before to after. If loc is recorded again, the first
+    // before and the last after are kept
+    void record(const QPoint loc, const std::optional<Pixel> before, const std::optional<Pixel> after);
+
+    // record the edits below before making them on layer. Each reads the before values
+    // from layer, so call it first
+    void recordUpserts(const RasterLayer& layer, const QVector<PixelRef>& pixels);
+    void recordRemoves(const RasterLayer& layer, const QVector<QPoint>& locs);
+    void recordFill(const RasterLayer& layer, const QRect& box, const Pixel p);
+    // runs united as by RasterLayer::uniteRuns, filled with after, or erased for nil
+    void recordRuns(const RasterLayer& layer, const QVector<ColumnRun>& runs, const std::optional<Pixel> after);
+    void recordClear(const RasterLayer& layer);
+
+    // fold a later delta on the same layer into this one
+    void merge(const LayerDelta& later);
+
+    // sort the changes, collapse repeats and drop the ones that changed nothing
+    void seal();
+
+    // pack a sealed delta into its run-length form. Reading it back costs a decode
+    void compress();
+
+    // other functions ---------------------------
+
+    // write the before values back into layer (undo)
+    void revert(RasterLayer& layer) const;
+
+    // write the after values into layer (redo)
+    void reapply(RasterLayer& layer) const;
+};
+
+#endif // LAYERDELTA_H
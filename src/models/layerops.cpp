@@ -0,0 +1,65 @@
+#include "layerops.h"
+#include <imageio.h>
+#include <cstring>
+
+// other functions ---------------------------
+
+RasterLayer LayerOps::flattened(const QVector<RasterLayer>& layers, const QRect& box) {
+    RasterLayer out;
+    if (box.isEmpty()) return out;
+
+    Scanlines rows(layers, box);
+    BandLoader loader(out, nullptr, box.topLeft(), box.width());
+    while (const QRgb* row = rows.next()) {
+        memcpy(loader.row(), row, box.width() * sizeof(QRgb));
+        loader.push();
+    }
+    loader.flush();
+    return out;
+}
+
+RasterLayer LayerOps::resized(const RasterLayer& layer, const QRect& box, const QSize& size) {
+    RasterLayer out;
+    if (box.isEmpty() || size.isEmpty()) return out;
+
+    // source column of every target column
+    std::vector<int> columns(size.width());
+    for (int x = 0; x < size.width(); x++) columns[x] = static_cast<int>(static_cast<qint64>(x) * box.width() / size.width());
+
+    // source rows come in order and target rows map back to them in order, so each
+    // source row is used (or skipped) as it arrives
+    Scanlines rows(layer, box);
+    BandLoader loader(out, nullptr, QPoint(0, 0), size.width());
+    int y = 0;
+    for (qint64 source = 0; const QRgb* row = rows.next(); source++) {
+        for (; y < size.height() && static_cast<qint64>(y) * box.height() / size.height() == source; y++) {
+            QRgb* target = loader.row();
+            for (int x = 0; x < size.width(); x++) target[x] = row[columns[x]];
+            loader.push();
+        }
+    }
+    loader.flush();
+    return out;
+}
+
+int LayerOps::recolor(RasterLayer& layer, const QRect& box, const ColorMap& colors) {
+    if (colors.empty()) return 0;
+
+    // gathered first, as the layer cannot change under its own walk
+    QVector<PixelRef> changed;
+    QVector<QPoint> removed;
+    layer.forEachInRect(box, [&](QPoint loc, Pixel p) {
+        const auto it = colors.find(p.argb);
+        if (it == colors.end() || it->second == p.argb) return;
+        if (qAlpha(it->second) == 0) {
+            removed.append(loc);
+        } else {
+            changed.emplaceBack(loc, Pixel::fromPremultiplied(it->second));
+        }
+    });
+
+    const int count = static_cast<int>(changed.size() + removed.size());
+    layer.upsertMany(std::move(changed));
+    layer.removeMany(std::move(removed));
+    return count;
+}
@@ -0,0 +1,35 @@
+#ifndef LAYEROPS_H
+#define LAYEROPS_H
+
+#include <rasterlayer.h>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+#include <unordered_map>
+
+// Whole-layer operations for batch work on finished images, such as the
+// pipeline of pixelair-cli. Each reads its source a band of rows at a time
+// through Scanlines and builds its result through a BandLoader, so no step
+// holds a full image besides the layers themselves.
+class LayerOps
+{
+public:
+    // premultiplied color to premultiplied color, 0 for transparent
+    typedef std::unordered_map<QRgb, QRgb> ColorMap;
+
+    // other functions ---------------------------
+
+    // return the layers flattened over box into one layer, as the Compositor draws
+    // them. Pixels keep their canvas locations
+    static RasterLayer flattened(const QVector<RasterLayer>& layers, const QRect& box);
+
+    // return box of layer scaled to size by nearest neighbour, which keeps pixel art
+    // crisp, with the top left at (0, 0)
+    static RasterLayer resized(const RasterLayer& layer, const QRect& box, const QSize& size);
+
+    // replace the colors of the pixels inside box that appear in colors, removing
+    // those mapped to transparent. Returns the number of pixels changed
+    static int recolor(RasterLayer& layer, const QRect& box, const ColorMap& colors);
+};
+
+#endif // LAYEROPS_H
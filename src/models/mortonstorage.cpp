@@ -0,0 +1,225 @@
+#include "mortonstorage.h"
+#include <avltreeimpl.h>
+#include <algorithm>
+#include <sstream>
+
+// the bits of x and of y within a code
+static constexpr quint64 XBits = 0x5555555555555555ull;
+static constexpr quint64 YBits = 0xaaaaaaaaaaaaaaaaull;
+
+// spread the 32 bits of v over the even bits of a word, and back
+static quint64 spread(quint32 v) {
+    quint64 w = v;
+    w = (w | (w << 16)) & 0x0000ffff0000ffffull;
+    w = (w | (w << 8)) & 0x00ff00ff00ff00ffull;
+    w = (w | (w << 4)) & 0x0f0f0f0f0f0f0f0full;
+    w = (w | (w << 2)) & 0x3333333333333333ull;
+    w = (w | (w << 1)) & XBits;
+    return w;
+}
+
+static quint32 compact(quint64 w) {
+    w &= XBits;
+    w = (w | (w >> 1)) & 0x3333333333333333ull;
+    w = (w | (w >> 2)) & 0x0f0f0f0f0f0f0f0full;
+    w = (w | (w >> 4)) & 0x00ff00ff00ff00ffull;
+    w = (w | (w >> 8)) & 0x0000ffff0000ffffull;
+    w = (w | (w >> 16)) & 0x00000000ffffffffull;
+    return static_cast<quint32>(w);
+}
+
+// constructor destructor ---------------------------
+
+MortonStorage::MortonStorage() {}
+
+MortonStorage::MortonStorage(const MortonStorage& other)
+    : pixels_(other.pixels_) {}
+
+PixelStorage* MortonStorage::clone() const {
+    return new MortonStorage(*this);
+}
+
+// helper functions ---------------------------
+
+quint64 MortonStorage::encode(const QPoint loc) {
+    return spread(static_cast<quint32>(loc.x()) ^ 0x80000000u) | (spread(static_cast<quint32>(loc.y()) ^ 0x80000000u) << 1);
+}
+
+QPoint MortonStorage::decode(const quint64 code) {
+    return QPoint(static_cast<int>(compact(code) ^ 0x80000000u), static_cast<int>(compact(code >> 1) ^ 0x80000000u));
+}
+
+quint64 MortonStorage::nextInBox(const quint64 code, quint64 low, quint64 high) {
+    // Tropf and Herzog's BIGMIN: walk the bits from the top, narrowing the box to the
+    // half the answer must lie in. Loading a corner sets (or clears) a bit and clears
+    // (or sets) the lower bits of the same coordinate
+    quint64 best = 0;
+    for (int bit = 63; bit >= 0; bit--) {
+        const quint64 mask = 1ull << bit;
+        const quint64 below = ((bit & 1) ? YBits : XBits) & (mask - 1);
+        const int state = ((code & mask) ? 4 : 0) | ((low & mask) ? 2 : 0) | ((high & mask) ? 1 : 0);
+        switch (state) {
+        case 0b001: // the box straddles the bit and code is in its lower half
+            best = (low | mask) & ~below;
+            high = (high & ~mask) | below;
+            break;
+        case 0b011: // the box lies wholly above code
+            return low;
+        case 0b100: // the box lies wholly below code
+            return best;
+        case 0b101: // the box straddles the bit and code is in its upper half
+            low = (low | mask) & ~below;
+            break;
+        default: // 000 and 111 follow code down; 010 and 110 can't happen with low <= high
+            break;
+        }
+    }
+    return best;
+}
+
+int MortonStorage::upsertBatch(Batch& batch) {
+    if (batch.empty()) return 0;
+    const int before = pixels_.size();
+
+    if (batch.size() < static_cast<size_t>(before)) {
+        // into a bigger tree: plain upserts are cheaper than a rebuild
+        for (const auto& [code, p] : batch) pixels_.upsert(code, p);
+    } else {
+        // merge the tree with the batch (the batch wins on equal codes) and rebuild in O(n)
+        std::sort(batch.begin(), batch.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        Batch merged;
+        merged.reserve(before + batch.size());
+        auto b = batch.begin();
+        for (const auto& [code, p] : pixels_) {
+            for (; b != batch.end() && b->first < code; ++b) merged.push_back(*b);
+            if (b != batch.end() && b->first == code) merged.push_back(*b++);
+            else merged.push_back({code, p});
+        }
+        merged.insert(merged.end(), b, batch.end());
+        pixels_.buildFromSorted(merged.begin(), merged.end());
+    }
+    return pixels_.size() - before;
+}
+
+// accessors ---------------------------
+
+int MortonStorage::size() const { return pixels_.size(); }
+
+bool MortonStorage::contains(const QPoint loc) const {
+    return pixels_.contains(encode(loc));
+}
+
+std::optional<Pixel> MortonStorage::get(const QPoint loc) const {
+    auto p = pixels_.get(encode(loc));
+    if (!p.has_value()) return std::nullopt;
+    return p.value().get();
+}
+
+bool MortonStorage::forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const {
+    if (box.isEmpty()) return true;
+
+    // the box's corners bound its codes, though most codes between them lie outside it
+    const quint64 low = encode(box.topLeft()), high = encode(box.bottomRight());
+    quint64 start = low;
+    if (after != nullptr) {
+        const quint64 last = encode(*after);
+        if (last >= high) return true; // nothing comes after it
+        start = std::max(low, last + 1);
+    }
+
+    auto it = pixels_.lowerBound(start);
+    while (it != pixels_.end() && it.key() <= high) {
+        const QPoint loc = decode(it.key());
+        if (box.contains(loc)) {
+            if (!visit(loc, it.value())) return false;
+            ++it;
+            continue;
+        }
+
+        // left the box: skip ahead to the next code back inside it
+        const quint64 next = nextInBox(it.key(), low, high);
+        if (next == 0) break;
+        it = pixels_.lowerBound(next);
+    }
+    return true;
+}
+
+void MortonStorage::collectCells(const int shift, std::vector<QPoint>& out) const {
+    // a cell is an aligned square, whose codes share every bit above the low 2 * shift
+    bool first = true;
+    quint64 cell = 0;
+    for (const auto& [code, p] : pixels_) {
+        if (!first && code >> (2 * shift) == cell) continue;
+        first = false;
+        cell = code >> (2 * shift);
+        const QPoint loc = decode(code);
+        out.emplace_back(loc.x() >> shift, loc.y() >> shift);
+    }
+}
+
+// mutators ---------------------------
+
+void MortonStorage::clear() {
+    pixels_.clear();
+}
+
+bool MortonStorage::update(const QPoint loc, const Pixel p) {
+    const quint64 code = encode(loc);
+    if (!pixels_.contains(code)) return false; // do nothing
+    pixels_.update(code, p);
+    return true;
+}
+
+bool MortonStorage::upsert(const QPoint loc, const Pixel p) {
+    const int before = pixels_.size();
+    pixels_.upsert(encode(loc), p);
+    return pixels_.size() > before;
+}
+
+bool MortonStorage::remove(const QPoint loc) {
+    const int before = pixels_.size();
+    pixels_.remove(encode(loc));
+    return pixels_.size() < before;
+}
+
+int MortonStorage::upsertSorted(const PixelRef* first, const PixelRef* last) {
+    Batch batch;
+    batch.reserve(last - first);
+    for (; first != last; ++first) batch.push_back({encode(first->location), first->value});
+    return upsertBatch(batch);
+}
+
+int MortonStorage::fillRect(const QRect& box, const Pixel p) {
+    if (box.isEmpty()) return 0;
+
+    Batch batch;
+    batch.reserve(static_cast<size_t>(box.width()) * box.height());
+    for (qint64 x = box.left(); x <= box.right(); x++)
+        for (qint64 y = box.top(); y <= box.bottom(); y++) batch.push_back({encode(QPoint(int(x), int(y))), p});
+    return upsertBatch(batch);
+}
+
+int MortonStorage::fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) {
+    Batch batch;
+    for (; first != last; ++first)
+        for (qint64 y = first->y; y < static_cast<qint64>(first->y) + first->length; y++)
+            batch.push_back({encode(QPoint(first->x, int(y))), p});
+    return upsertBatch(batch);
+}
+
+// other functions ---------------------------
+
+// prints out the tree, keys as the locations they encode
+std::string MortonStorage::toString() const {
+    std::ostringstream oss;
+
+    oss << "Pixel Data [Z-order]: " << std::endl;
+    oss << pixels_.toString([](const quint64& k) -> std::string {
+        const QPoint loc = decode(k);
+        return "(" + std::to_string(loc.x()) + "," + std::to_string(loc.y()) + ")";
+    }) << std::endl;
+
+    return oss.str();
+}
+
+template class AVLTree<quint64, Pixel>;
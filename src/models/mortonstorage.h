@@ -0,0 +1,66 @@
+#ifndef MORTONSTORAGE_H
+#define MORTONSTORAGE_H
+
+#include <avltree.h>
+#include <pixelstorage.h>
+#include <utility>
+#include <vector>
+
+// Pixels kept in a single AVL tree keyed by the 64 bit Morton (Z-order) code
+// of their location: the bits of x and y interleaved, so pixels close in 2-D
+// are mostly close in key order. There is one node per pixel and no per-column
+// trees, so a wide, short region doesn't pay a column lookup per x. A region
+// walk follows the keys of the box's Z-order range and, when it steps outside
+// the box, jumps straight to the next code inside it (BIGMIN), so it visits the
+// box as a handful of key ranges rather than every pixel between its corners.
+class MortonStorage : public PixelStorage
+{
+    typedef std::vector<std::pair<quint64, Pixel>> Batch; // (code, pixel), no code twice
+
+private:
+    AVLTree<quint64, Pixel> pixels_;
+
+    // return the code of loc. Coordinates are biased so that codes of negative
+    // coordinates sort before positive ones
+    static quint64 encode(const QPoint loc);
+    static QPoint decode(const quint64 code);
+
+    // return the smallest code after code that lies inside the box with corner codes
+    // low and high, or 0 if there is none. code must be between them but outside the box
+    static quint64 nextInBox(const quint64 code, quint64 low, quint64 high);
+
+    // upsert a batch of pixels, sorting it only if the tree is rebuilt. Returns how many
+    // were new
+    int upsertBatch(Batch& batch);
+
+public:
+    // constructor destructor ---------------------------
+    MortonStorage();
+    MortonStorage(const MortonStorage& other);
+
+    PixelStorage* clone() const override;
+
+    // accessors ---------------------------
+    int size() const override;
+    bool contains(const QPoint loc) const override;
+    std::optional<Pixel> get(const QPoint loc) const override;
+    // visits the box in Z-order
+    bool forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const override;
+
+    // the pixels of a cell are one range of codes, so cells come out without a lookup
+    void collectCells(const int shift, std::vector<QPoint>& out) const override;
+
+    // mutators ---------------------------
+    void clear() override;
+    bool update(const QPoint loc, const Pixel p) override;
+    bool upsert(const QPoint loc, const Pixel p) override;
+    bool remove(const QPoint loc) override;
+    int upsertSorted(const PixelRef* first, const PixelRef* last) override;
+    int fillRect(const QRect& box, const Pixel p) override;
+    int fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) override;
+
+    // other functions ---------------------------
+    std::string toString() const override;
+};
+
+#endif // MORTONSTORAGE_H
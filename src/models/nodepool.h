@@ -0,0 +1,158 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// A slab allocator for fixed-size tree nodes.
+//
+// Nodes are carved out of slabs that double in size up to maxSlabSize slots and
+// are recycled through an intrusive free list, so filling a tree with n nodes
+// costs about n / maxSlabSize heap allocations (plus a few while the slabs
+// grow) instead of n. Slabs are only handed back to the heap by release(),
+// which is what lets AVLTree::clear() drop a whole tree in a handful of frees.
+//
+// The pool does not track which slots are live: callers must destroy every
+// object they created before calling release() (or skip that step when T is
+// trivially destructible).
+template <typename T>
+class NodePool {
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct Slab {
+        Slab* next;
+        int capacity;
+        // Slot[capacity] follows
+    };
+
+    static_assert(alignof(Slot) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "over-aligned nodes are not supported");
+
+    static constexpr int minSlabSize = 8;
+    static constexpr int maxSlabSize = 1024;
+
+    Slab* slabs_;       // singly linked list of owned slabs
+    Slot* freeList_;    // recycled slots
+    Slot* cursor_;      // next never-used slot in the newest slab
+    Slot* end_;         // one past the last slot in the newest slab
+    int nextSlabSize_;
+    int live_;
+    int allocations_;
+
+    // slots start right after the (suitably padded) slab header
+    static constexpr std::size_t headerSize() {
+        return (sizeof(Slab) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+    }
+
+    // grab a new slab from the heap and make it the bump region
+    void grow() {
+        const int capacity = nextSlabSize_;
+        void* raw = ::operator new(headerSize() + sizeof(Slot) * capacity);
+
+        Slab* slab = static_cast<Slab*>(raw);
+        slab->next = slabs_;
+        slab->capacity = capacity;
+        slabs_ = slab;
+
+        cursor_ = reinterpret_cast<Slot*>(static_cast<unsigned char*>(raw) + headerSize());
+        end_ = cursor_ + capacity;
+
+        if (nextSlabSize_ < maxSlabSize) nextSlabSize_ *= 2;
+        allocations_++;
+    }
+
+public:
+    // constructor destructor ---------------------------
+    NodePool()
+        : slabs_(nullptr), freeList_(nullptr), cursor_(nullptr), end_(nullptr),
+          nextSlabSize_(minSlabSize), live_(0), allocations_(0) {}
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    NodePool(NodePool&& other) noexcept
+        : slabs_(other.slabs_), freeList_(other.freeList_), cursor_(other.cursor_), end_(other.end_),
+          nextSlabSize_(other.nextSlabSize_), live_(other.live_), allocations_(other.allocations_) {
+        other.slabs_ = nullptr;
+        other.freeList_ = nullptr;
+        other.cursor_ = nullptr;
+        other.end_ = nullptr;
+        other.nextSlabSize_ = minSlabSize;
+        other.live_ = 0;
+    }
+
+    NodePool& operator=(NodePool&& other) noexcept {
+        if (this == &other) return *this;
+        release();
+        slabs_ = std::exchange(other.slabs_, nullptr);
+        freeList_ = std::exchange(other.freeList_, nullptr);
+        cursor_ = std::exchange(other.cursor_, nullptr);
+        end_ = std::exchange(other.end_, nullptr);
+        nextSlabSize_ = std::exchange(other.nextSlabSize_, minSlabSize);
+        live_ = std::exchange(other.live_, 0);
+        allocations_ = other.allocations_;
+        return *this;
+    }
+
+    ~NodePool() { release(); }
+
+    // accessors ---------------------------
+
+    // return the number of objects currently handed out
+    int live() const { return live_; }
+
+    // return the number of slabs requested from the heap over the pool's lifetime
+    int allocations() const { return allocations_; }
+
+    // mutators ---------------------------
+
+    // construct a T in a pooled slot
+    template <typename... Args>
+    T* create(Args&&... args) {
+        Slot* slot;
+        if (freeList_ != nullptr) { // reuse a freed slot first
+            slot = freeList_;
+            freeList_ = slot->next;
+        } else {
+            if (cursor_ == end_) grow();
+            slot = cursor_++;
+        }
+
+        T* obj = ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+        live_++;
+        return obj;
+    }
+
+    // destroy a T and put its slot back on the free list
+    void destroy(T* obj) {
+        if (obj == nullptr) return;
+        obj->~T();
+
+        Slot* slot = reinterpret_cast<Slot*>(obj);
+        slot->next = freeList_;
+        freeList_ = slot;
+        live_--;
+    }
+
+    // hand every slab back to the heap. Objects still alive are NOT destroyed
+    void release() {
+        while (slabs_ != nullptr) {
+            Slab* next = slabs_->next;
+            ::operator delete(static_cast<void*>(slabs_));
+            slabs_ = next;
+        }
+
+        freeList_ = nullptr;
+        cursor_ = nullptr;
+        end_ = nullptr;
+        nextSlabSize_ = minSlabSize;
+        live_ = 0;
+    }
+};
+
+#endif // NODEPOOL_H
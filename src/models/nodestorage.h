@@ -0,0 +1,118 @@
+#ifndef NODESTORAGE_H
+#define NODESTORAGE_H
+
+#include <nodepool.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Node storage policies for AVLTree.
+//
+// A policy decides where nodes live and how they point at each other. The tree
+// never touches a node directly, it holds Links and resolves them through the
+// policy's Store, so both layouts share one implementation of the algorithms.
+
+// PooledNodes
+// Nodes are individual objects carved out of a NodePool and linked by raw
+// pointers. References to values stay valid until the node is removed.
+struct PooledNodes {
+    template <typename Node>
+    using Link = Node*;
+
+    template <typename Node>
+    class Store {
+    private:
+        NodePool<Node> pool_;
+
+    public:
+        static constexpr Node* nil = nullptr;
+        static constexpr bool releaseDestroysNodes = false;
+
+        Node& at(Node* l) const { return *l; }
+
+        template <typename... Args>
+        Node* create(Args&&... args) { return pool_.create(std::forward<Args>(args)...); }
+
+        void destroy(Node* l) { pool_.destroy(l); }
+
+        // free all storage. Live nodes are NOT destroyed
+        void release() { pool_.release(); }
+
+        int allocations() const { return pool_.allocations(); }
+    };
+};
+
+// IndexedNodes
+// Nodes are packed into one contiguous vector and linked by 32-bit indices,
+// which halves the link overhead on 64-bit targets and keeps a search inside a
+// single allocation. Like std::vector, inserting may move every node, so
+// references returned by get() are only valid until the next insertion.
+// Keys and values must be default constructible (freed slots are reset).
+struct IndexedNodes {
+    template <typename Node>
+    using Link = std::uint32_t;
+
+    template <typename Node>
+    class Store {
+    private:
+        mutable std::vector<Node> nodes_; // constness of the tree is shallow, as with pointers
+        std::uint32_t freeList_;          // freed slots, chained through their left link
+        int allocations_;
+
+    public:
+        static constexpr std::uint32_t nil = UINT32_MAX;
+        static constexpr bool releaseDestroysNodes = true;
+
+        Store() : freeList_(nil), allocations_(0) {}
+
+        Store(Store&& other) noexcept
+            : nodes_(std::move(other.nodes_)),
+              freeList_(std::exchange(other.freeList_, nil)),
+              allocations_(other.allocations_) {
+            other.nodes_.clear();
+        }
+
+        Store& operator=(Store&& other) noexcept {
+            if (this == &other) return *this;
+            nodes_ = std::move(other.nodes_);
+            freeList_ = std::exchange(other.freeList_, nil);
+            allocations_ = other.allocations_;
+            other.nodes_.clear();
+            return *this;
+        }
+
+        Node& at(std::uint32_t l) const { return nodes_[l]; }
+
+        template <typename... Args>
+        std::uint32_t create(Args&&... args) {
+            if (freeList_ != nil) { // reuse a freed slot first
+                std::uint32_t l = freeList_;
+                freeList_ = nodes_[l].left;
+                nodes_[l] = Node(std::forward<Args>(args)...);
+                return l;
+            }
+
+            if (nodes_.size() == nodes_.capacity()) allocations_++;
+            nodes_.emplace_back(std::forward<Args>(args)...);
+            return static_cast<std::uint32_t>(nodes_.size() - 1);
+        }
+
+        void destroy(std::uint32_t l) {
+            Node& n = nodes_[l];
+            n.key = decltype(n.key)();
+            n.val = decltype(n.val)(); // drop whatever the value owns
+            n.left = freeList_;
+            freeList_ = l;
+        }
+
+        // free all storage, destroying every node
+        void release() {
+            std::vector<Node>().swap(nodes_);
+            freeList_ = nil;
+        }
+
+        int allocations() const { return allocations_; }
+    };
+};
+
+#endif // NODESTORAGE_H
@@ -0,0 +1,52 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <QColor>
+#include <QRgb>
+#include <QRgba64>
+
+// A color as stored in a RasterLayer: premultiplied RGBA, 8 bits per channel,
+// packed into a single QRgb word (0xAARRGGBB). This is the same layout as
+// QImage::Format_ARGB32_Premultiplied, so runs of pixels can be memcpy'd in
+// and out of images and textures without touching each value.
+//
+// QColor converts implicitly so call sites can keep passing colors around;
+// turning a Pixel back into a QColor is explicit (toColor()) and is meant to
+// happen at the UI boundary only.
+struct Pixel {
+    QRgb argb;
+
+    constexpr Pixel() : argb(0) {}
+    Pixel(const QColor& c) : argb(qPremultiply(c.rgba())) {}
+
+    // wrap a word that is already premultiplied
+    static constexpr Pixel fromPremultiplied(QRgb premultiplied) {
+        Pixel p;
+        p.argb = premultiplied;
+        return p;
+    }
+
+    // narrow a premultiplied 16 bit per channel color
+    static constexpr Pixel fromRgba64(QRgba64 premultiplied) {
+        return fromPremultiplied(premultiplied.toArgb32());
+    }
+
+    // premultiplied channels
+    constexpr int red() const { return qRed(argb); }
+    constexpr int green() const { return qGreen(argb); }
+    constexpr int blue() const { return qBlue(argb); }
+    constexpr int alpha() const { return qAlpha(argb); }
+
+    // widen to a premultiplied 16 bit per channel color
+    constexpr QRgba64 toRgba64() const { return QRgba64::fromArgb32(argb); }
+
+    QColor toColor() const { return QColor::fromRgba(qUnpremultiply(argb)); }
+
+    friend constexpr bool operator==(Pixel a, Pixel b) { return a.argb == b.argb; }
+    friend constexpr bool operator!=(Pixel a, Pixel b) { return a.argb != b.argb; }
+};
+
+// every layer and tile buffer relies on this being a plain 32 bit word
+static_assert(sizeof(Pixel) == sizeof(QRgb), "Pixel must stay a packed 32 bit word");
+
+#endif // PIXEL_H
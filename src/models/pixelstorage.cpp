@@ -0,0 +1,102 @@
+#include "pixelstorage.h"
+#include <climits>
+#include <unordered_set>
+
+// PixelStorage ---------------------------
+
+void PixelStorage::collectCells(const int shift, std::vector<QPoint>& out) const {
+    std::unordered_set<quint64> seen;
+    const QRect everything(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX));
+    forEachInRect(everything, [&](QPoint loc, Pixel) {
+        const QPoint cell(loc.x() >> shift, loc.y() >> shift);
+        const quint64 key = (static_cast<quint64>(static_cast<quint32>(cell.y())) << 32) | static_cast<quint32>(cell.x());
+        if (seen.insert(key).second) out.push_back(cell);
+    }, nullptr);
+}
+
+bool PixelStorage::forEachRunInRect(const QRect& box, RunVisitor visit) const {
+    ColumnRun run{0, 0, 0};
+    Pixel value;
+    const bool finished = forEachInRect(box, [&](QPoint loc, Pixel p) {
+        if (run.length > 0 && loc.x() == run.x && loc.y() == static_cast<qint64>(run.y) + run.length && p == value) {
+            run.length++;
+            return true;
+        }
+        if (run.length > 0 && !visit(run, value)) return false;
+        run = {loc.x(), loc.y(), 1};
+        value = p;
+        return true;
+    }, nullptr);
+    if (!finished) return false;
+    return run.length == 0 || visit(run, value);
+}
+
+int PixelStorage::upsertSorted(const PixelRef* first, const PixelRef* last) {
+    int added = 0;
+    for (; first != last; ++first) added += upsert(first->location, first->value);
+    return added;
+}
+
+int PixelStorage::removeSorted(const QPoint* first, const QPoint* last) {
+    int removed = 0;
+    for (; first != last; ++first) removed += remove(*first);
+    return removed;
+}
+
+int PixelStorage::fillRect(const QRect& box, const Pixel p) {
+    int added = 0;
+    for (qint64 x = box.left(); x <= box.right(); x++)
+        for (qint64 y = box.top(); y <= box.bottom(); y++) added += upsert(QPoint(int(x), int(y)), p);
+    return added;
+}
+
+int PixelStorage::eraseRect(const QRect& box) {
+    QVector<QPoint> doomed;
+    forEachInRect(box, [&doomed](QPoint loc, Pixel) { doomed.append(loc); }, nullptr);
+    for (const QPoint& loc : doomed) remove(loc);
+    return static_cast<int>(doomed.size());
+}
+
+int PixelStorage::fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) {
+    int added = 0;
+    for (; first != last; ++first) added += fillRect(QRect(first->x, first->y, 1, first->length), p);
+    return added;
+}
+
+int PixelStorage::eraseRuns(const ColumnRun* first, const ColumnRun* last) {
+    int removed = 0;
+    for (; first != last; ++first) removed += eraseRect(QRect(first->x, first->y, 1, first->length));
+    return removed;
+}
+
+// PixelRegion::iterator ---------------------------
+
+PixelRegion::iterator::iterator()
+    : storage_(nullptr), count_(0), pos_(0), finished_(true) {}
+
+PixelRegion::iterator::iterator(const PixelStorage* storage, const QRect& box)
+    : storage_(storage), box_(box), count_(0), pos_(0), finished_(box.isEmpty()) {
+    refill();
+}
+
+void PixelRegion::iterator::refill() {
+    pos_ = 0;
+    if (finished_) {
+        count_ = 0;
+        return;
+    }
+
+    // the buffer is about to be overwritten, so keep the resume point aside
+    const bool resume = count_ > 0;
+    const QPoint last = resume ? buffer_[count_ - 1].location : QPoint();
+
+    int filled = 0;
+    auto fill = [this, &filled](QPoint loc, Pixel p) {
+        buffer_[filled++] = PixelRef(loc, p);
+        return filled < ChunkSize;
+    };
+
+    // a walk that ran to completion has nothing more for the next refill
+    finished_ = storage_->forEachInRect(box_, fill, resume ? &last : nullptr);
+    count_ = filled;
+}
@@ -0,0 +1,237 @@
+#ifndef PIXELSTORAGE_H
+#define PIXELSTORAGE_H
+
+#include <pixel.h>
+#include <QRect>
+#include <QVector>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// A single pixel (without any of the node shit). Holds a copy of the value.
+struct PixelRef {
+    QPoint location;
+    Pixel value;
+
+    PixelRef() {}
+
+    PixelRef(int x, int y, Pixel p)
+        : location{x, y}, value{p} {}
+
+    PixelRef(QPoint l, Pixel p)
+        : location{l}, value{p} {}
+};
+
+// A vertical run of pixels: rows y to y + length - 1 of column x. Brush
+// strokes are kept as lists of these, sorted by (x, y) and not overlapping,
+// which is also the order the batch mutators below take pixels in.
+struct ColumnRun {
+    int x, y;
+    int length;
+};
+
+// A borrowed reference to a callable taking (QPoint, Pixel) and returning void
+// or bool (false stops the walk). Lets region walks cross the virtual storage
+// interface without the allocation std::function may need. The callable must
+// outlive the visitor.
+class PixelVisitor
+{
+    void* callable_;
+    bool (*invoke_)(void*, QPoint, Pixel);
+
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, PixelVisitor>>>
+    PixelVisitor(F&& f)
+        : callable_(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+          invoke_([](void* c, QPoint loc, Pixel p) -> bool {
+              auto& fn = *static_cast<std::remove_reference_t<F>*>(c);
+              if constexpr (std::is_void_v<decltype(fn(loc, p))>) {
+                  fn(loc, p);
+                  return true;
+              } else {
+                  return static_cast<bool>(fn(loc, p));
+              }
+          }) {}
+
+    bool operator()(QPoint loc, Pixel p) const { return invoke_(callable_, loc, p); }
+};
+
+// Same as PixelVisitor for a callable taking (const ColumnRun&, Pixel): a run
+// of pixels of one color, for walks that hand out spans rather than pixels.
+class RunVisitor
+{
+    void* callable_;
+    bool (*invoke_)(void*, const ColumnRun&, Pixel);
+
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, RunVisitor>>>
+    RunVisitor(F&& f)
+        : callable_(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+          invoke_([](void* c, const ColumnRun& run, Pixel p) -> bool {
+              auto& fn = *static_cast<std::remove_reference_t<F>*>(c);
+              if constexpr (std::is_void_v<decltype(fn(run, p))>) {
+                  fn(run, p);
+                  return true;
+              } else {
+                  return static_cast<bool>(fn(run, p));
+              }
+          }) {}
+
+    bool operator()(const ColumnRun& run, Pixel p) const { return invoke_(callable_, run, p); }
+};
+
+// Backing store for the pixels of a RasterLayer.
+//
+// RasterLayer owns exactly one of these and may swap it for a different backend
+// at any time, so implementations hold nothing but pixels. Values go in and out
+// as premultiplied Pixels; the *Wide variants carry premultiplied 16 bit per
+// channel colors and by default round through 8 bits, backends with deeper
+// storage override them.
+class PixelStorage
+{
+public:
+    virtual ~PixelStorage() = default;
+
+    // return a deep copy of this storage
+    virtual PixelStorage* clone() const = 0;
+
+    // accessors ---------------------------
+
+    // return the number of pixels stored
+    virtual int size() const = 0;
+
+    // return if there is a pixel at location loc
+    virtual bool contains(const QPoint loc) const = 0;
+
+    // return the value at location loc. If there is no pixel there, return nil
+    virtual std::optional<Pixel> get(const QPoint loc) const = 0;
+    virtual std::optional<QRgba64> getWide(const QPoint loc) const {
+        auto p = get(loc);
+        if (!p.has_value()) return std::nullopt;
+        return p->toRgba64();
+    }
+
+    // call visit for every pixel inside box, in place. The order is fixed by the
+    // backend and total: if after is given, the walk starts at the first pixel
+    // that comes after that location, which is how PixelRegion resumes.
+    // Returns false if visit stopped the walk
+    virtual bool forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const = 0;
+
+    // call visit for runs of one color covering every pixel inside box, once each,
+    // clipped to box. The default joins neighbouring pixels of forEachInRect, so its
+    // runs break wherever that walk leaves a column; backends that keep runs hand
+    // them out whole. Returns false if visit stopped the walk
+    virtual bool forEachRunInRect(const QRect& box, RunVisitor visit) const;
+
+    // append every square cell of side 2^shift holding at least one pixel, once each and
+    // in no particular order. Cell (cx, cy) holds the pixels with x >> shift == cx and
+    // y >> shift == cy
+    virtual void collectCells(const int shift, std::vector<QPoint>& out) const;
+
+    // mutators ---------------------------
+
+    // remove every pixel
+    virtual void clear() = 0;
+
+    // set the pixel at loc if it exists. Returns false if there was no pixel
+    virtual bool update(const QPoint loc, const Pixel p) = 0;
+
+    // set the pixel at loc. Returns true if the pixel is new
+    virtual bool upsert(const QPoint loc, const Pixel p) = 0;
+    virtual bool upsertWide(const QPoint loc, const QRgba64 c) {
+        return upsert(loc, Pixel::fromRgba64(c));
+    }
+
+    // remove the pixel at loc. Returns true if there was a pixel
+    virtual bool remove(const QPoint loc) = 0;
+
+    // batch versions of the above. Runs are sorted by (x, y) with no location twice,
+    // so backends can take each column or tile once. The defaults go pixel by pixel
+
+    // upsert every pixel of [first, last). Returns how many were new
+    virtual int upsertSorted(const PixelRef* first, const PixelRef* last);
+
+    // remove every location of [first, last). Returns how many were removed
+    virtual int removeSorted(const QPoint* first, const QPoint* last);
+
+    // set every pixel inside box to p. Returns how many were new
+    virtual int fillRect(const QRect& box, const Pixel p);
+
+    // remove every pixel inside box. Returns how many were removed
+    virtual int eraseRect(const QRect& box);
+
+    // set every pixel of the runs [first, last), sorted and not overlapping, to p.
+    // Returns how many were new. The default fills each as a one column rect
+    virtual int fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p);
+
+    // remove every pixel of the runs [first, last). Returns how many were removed
+    virtual int eraseRuns(const ColumnRun* first, const ColumnRun* last);
+
+    // other functions ---------------------------
+
+    // write the internal structure in string format (debug use)
+    virtual std::string toString() const = 0;
+};
+
+// The pixels of a PixelStorage inside a box, for range-for. Iterators copy the
+// pixels out a small chunk at a time into an inline buffer and resume the walk
+// from the last one, so nothing is allocated and the storage is never copied.
+// Any change to the storage invalidates the iterators.
+class PixelRegion
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = PixelRef;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const PixelRef*;
+        using reference = const PixelRef&;
+
+        static constexpr int ChunkSize = 64;
+
+        iterator(); // end
+        iterator(const PixelStorage* storage, const QRect& box);
+
+        reference operator*() const { return buffer_[pos_]; }
+        pointer operator->() const { return &buffer_[pos_]; }
+
+        iterator& operator++() {
+            if (++pos_ == count_) refill();
+            return *this;
+        }
+
+        // iterators only compare meaningfully against end()
+        bool operator==(const iterator& other) const { return atEnd() == other.atEnd(); }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        const PixelStorage* storage_;
+        QRect box_;
+        PixelRef buffer_[ChunkSize];
+        int count_;      // pixels in buffer_
+        int pos_;        // current pixel in buffer_
+        bool finished_;  // the walk has nothing left after buffer_
+
+        bool atEnd() const { return pos_ >= count_; }
+
+        // load the next chunk, following the last pixel of the current one
+        void refill();
+    };
+
+    PixelRegion(const PixelStorage* storage, const QRect& box)
+        : storage_(storage), box_(box) {}
+
+    iterator begin() const { return iterator(storage_, box_); }
+    iterator end() const { return iterator(); }
+
+private:
+    const PixelStorage* storage_;
+    QRect box_;
+};
+
+#endif // PIXELSTORAGE_H
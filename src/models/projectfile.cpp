@@ -0,0 +1,263 @@
+#include "projectfile.h"
+#include <tiledstorage.h>
+#include <QByteArray>
+#include <QFile>
+#include <QSaveFile>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// on disk records, see the layout in projectfile.h
+struct FileHeader {
+    char magic[4];
+    quint32 version;
+    qint32 width, height;
+    quint32 layerCount;
+    quint32 tileBytes;     // stride of an Rgba8 tile, to refuse files from a build that lays tiles out differently
+    quint32 wideTileBytes; // same for Rgba16
+    quint32 reserved;
+};
+
+struct LayerRecord {
+    quint64 nameOffset;
+    quint64 indexOffset;
+    quint32 nameBytes;
+    quint32 tileCount;
+    float opacity;
+    quint8 visible;
+    quint8 blendMode;
+    quint8 format;
+    quint8 storageMode;
+};
+
+struct TileEntry {
+    qint32 tx, ty;
+    quint64 offset;
+    qint32 count; // pixels in the tile, so loading never has to read the tile itself
+    quint32 reserved;
+};
+
+static_assert(sizeof(FileHeader) == 32 && sizeof(LayerRecord) == 32 && sizeof(TileEntry) == 24,
+              "records must not pick up padding");
+
+static const char Magic[4] = {'P', 'X', 'A', '1'};
+
+// tiles start past the header and indexes on a boundary of this, so the first
+// tile of a file does not share a page with anything else
+static constexpr qint64 PageSize = 4096;
+
+static qint64 alignUp(qint64 offset, qint64 alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+// the part of a tile worth writing: everything up to the count, but none of the
+// padding after it
+template <typename Tile>
+static constexpr size_t tilePayload() { return offsetof(Tile, count) + sizeof(int); }
+
+// bytes from one tile to the next in the file
+template <typename Tile>
+static constexpr qint64 tileStride() { return alignUp(sizeof(Tile), ProjectFile::TileAlign); }
+
+static bool fail(QString* error, const QString& message) {
+    if (error) *error = message;
+    return false;
+}
+
+// point a storage's tiles at the mapped file. The tiles share ownership of the
+// file, which unmaps once the last of them is gone. Everything is checked and
+// sized from the index, so no tile is paged in
+template <typename Storage>
+static std::shared_ptr<PixelStorage> mapTiles(const std::shared_ptr<QFile>& file, const uchar* data, qint64 size,
+                                              const TileEntry* entries, quint32 count, QString* error) {
+    typedef typename Storage::Tile Tile;
+    auto storage = std::make_shared<Storage>();
+    for (quint32 i = 0; i < count; i++) {
+        TileEntry entry;
+        memcpy(&entry, entries + i, sizeof(entry));
+        if (entry.offset % ProjectFile::TileAlign != 0 || size < tileStride<Tile>()
+            || entry.offset > static_cast<quint64>(size - tileStride<Tile>())) {
+            fail(error, "tile outside the file");
+            return nullptr;
+        }
+
+        if (entry.count <= 0 || entry.count > Storage::TileSize * Storage::TileSize) {
+            fail(error, "corrupt tile");
+            return nullptr;
+        }
+        Tile* tile = reinterpret_cast<Tile*>(const_cast<uchar*>(data) + entry.offset);
+        storage->adoptTile(entry.tx, entry.ty, std::shared_ptr<Tile>(file, tile), entry.count);
+    }
+    return storage;
+}
+
+// other functions ---------------------------
+
+bool ProjectFile::save(const QString& path, const QSize& size, const QVector<RasterLayer>& layers, QString* error) {
+    // everything is laid out before anything is written, so the file goes out front
+    // to back in one pass
+    struct Part {
+        std::shared_ptr<const PixelStorage> tiles;
+        QByteArray name;
+        LayerRecord record;
+    };
+    std::vector<Part> parts(layers.size());
+
+    qint64 offset = sizeof(FileHeader) + static_cast<qint64>(layers.size()) * sizeof(LayerRecord);
+    for (qsizetype i = 0; i < layers.size(); i++) {
+        const RasterLayer& layer = layers[i];
+        Part& part = parts[i];
+        part.tiles = layer.tiledPixels();
+        part.name = layer.name().toUtf8();
+
+        const bool wide = layer.format() == RasterLayer::PixelFormat::Rgba16;
+        LayerRecord& record = part.record;
+        record.tileCount = wide ? static_cast<const WideTiledStorage*>(part.tiles.get())->tileCount()
+                                : static_cast<const TiledStorage*>(part.tiles.get())->tileCount();
+        record.nameOffset = offset;
+        record.nameBytes = static_cast<quint32>(part.name.size());
+        record.indexOffset = alignUp(offset + part.name.size(), alignof(TileEntry));
+        record.opacity = layer.opacity();
+        record.visible = layer.isVisible();
+        record.blendMode = static_cast<quint8>(layer.blendMode());
+        record.format = static_cast<quint8>(layer.format());
+        record.storageMode = static_cast<quint8>(layer.storageMode());
+        offset = record.indexOffset + static_cast<qint64>(record.tileCount) * sizeof(TileEntry);
+    }
+    const qint64 tilesStart = alignUp(offset, PageSize);
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return fail(error, file.errorString());
+
+    qint64 written = 0;
+    bool ok = true;
+    auto put = [&](const void* bytes, qint64 count) {
+        ok = ok && file.write(static_cast<const char*>(bytes), count) == count;
+        written += count;
+    };
+    auto padTo = [&](qint64 target) {
+        static const char zeros[PageSize] = {};
+        while (written < target) put(zeros, std::min(target - written, PageSize));
+    };
+
+    FileHeader header;
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.width = size.width();
+    header.height = size.height();
+    header.layerCount = static_cast<quint32>(layers.size());
+    header.tileBytes = static_cast<quint32>(tileStride<TiledStorage::Tile>());
+    header.wideTileBytes = static_cast<quint32>(tileStride<WideTiledStorage::Tile>());
+    header.reserved = 0;
+    put(&header, sizeof(header));
+    for (const Part& part : parts) put(&part.record, sizeof(LayerRecord));
+
+    // names and indexes, with tile offsets handed out in the order the tiles follow
+    qint64 tileOffset = tilesStart;
+    for (size_t i = 0; i < parts.size(); i++) {
+        const Part& part = parts[i];
+        put(part.name.constData(), part.name.size());
+        padTo(part.record.indexOffset);
+
+        auto index = [&](int tx, int ty, int count, qint64 stride) {
+            const TileEntry entry{tx, ty, static_cast<quint64>(tileOffset), count, 0};
+            put(&entry, sizeof(entry));
+            tileOffset += stride;
+        };
+        if (layers[i].format() == RasterLayer::PixelFormat::Rgba16) {
+            static_cast<const WideTiledStorage*>(part.tiles.get())->forEachTile(
+                [&](int tx, int ty, const WideTiledStorage::Tile& tile) {
+                    index(tx, ty, tile.count, tileStride<WideTiledStorage::Tile>());
+                });
+        } else {
+            static_cast<const TiledStorage*>(part.tiles.get())->forEachTile(
+                [&](int tx, int ty, const TiledStorage::Tile& tile) {
+                    index(tx, ty, tile.count, tileStride<TiledStorage::Tile>());
+                });
+        }
+    }
+
+    // the tiles, raw
+    padTo(tilesStart);
+    for (size_t i = 0; i < parts.size() && ok; i++) {
+        const Part& part = parts[i];
+        if (layers[i].format() == RasterLayer::PixelFormat::Rgba16) {
+            static_cast<const WideTiledStorage*>(part.tiles.get())->forEachTile(
+                [&](int, int, const WideTiledStorage::Tile& tile) {
+                    const qint64 start = written;
+                    put(&tile, tilePayload<WideTiledStorage::Tile>());
+                    padTo(start + tileStride<WideTiledStorage::Tile>());
+                });
+        } else {
+            static_cast<const TiledStorage*>(part.tiles.get())->forEachTile(
+                [&](int, int, const TiledStorage::Tile& tile) {
+                    const qint64 start = written;
+                    put(&tile, tilePayload<TiledStorage::Tile>());
+                    padTo(start + tileStride<TiledStorage::Tile>());
+                });
+        }
+    }
+
+    if (!ok) {
+        const QString reason = file.errorString();
+        file.cancelWriting();
+        return fail(error, reason);
+    }
+    if (!file.commit()) return fail(error, file.errorString());
+    return true;
+}
+
+bool ProjectFile::load(const QString& path, QSize* size, QVector<RasterLayer>* layers, QString* error) {
+    auto file = std::make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly)) return fail(error, file->errorString());
+
+    const qint64 bytes = file->size();
+    if (bytes < static_cast<qint64>(sizeof(FileHeader))) return fail(error, "not a PixelAir project");
+
+    // private: pages written to (there should be none) never go back to the file
+    const uchar* data = file->map(0, bytes, QFileDevice::MapPrivateOption);
+    if (!data) return fail(error, file->errorString());
+
+    FileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, Magic, sizeof(Magic)) != 0) return fail(error, "not a PixelAir project");
+    if (header.version != Version) return fail(error, "unsupported project version");
+    if (header.tileBytes != tileStride<TiledStorage::Tile>() || header.wideTileBytes != tileStride<WideTiledStorage::Tile>())
+        return fail(error, "project written by an incompatible build");
+    if (header.layerCount > (bytes - sizeof(FileHeader)) / sizeof(LayerRecord)) return fail(error, "truncated project");
+
+    QVector<RasterLayer> loaded;
+    loaded.reserve(header.layerCount);
+    for (quint32 i = 0; i < header.layerCount; i++) {
+        LayerRecord record;
+        memcpy(&record, data + sizeof(FileHeader) + i * sizeof(LayerRecord), sizeof(record));
+        if (record.nameOffset > static_cast<quint64>(bytes) || record.nameBytes > bytes - record.nameOffset
+            || record.indexOffset > static_cast<quint64>(bytes) || record.indexOffset % alignof(TileEntry) != 0
+            || record.tileCount > (bytes - record.indexOffset) / sizeof(TileEntry))
+            return fail(error, "truncated project");
+        if (record.blendMode > static_cast<quint8>(RasterLayer::BlendMode::Add)
+            || record.format > static_cast<quint8>(RasterLayer::PixelFormat::Rgba16)
+            || record.storageMode > static_cast<quint8>(RasterLayer::StorageMode::Morton)
+            || !(record.opacity >= 0 && record.opacity <= 1))
+            return fail(error, "corrupt layer");
+
+        const auto format = static_cast<RasterLayer::PixelFormat>(record.format);
+        const TileEntry* entries = reinterpret_cast<const TileEntry*>(data + record.indexOffset);
+        std::shared_ptr<PixelStorage> tiles =
+            format == RasterLayer::PixelFormat::Rgba16
+                ? mapTiles<WideTiledStorage>(file, data, bytes, entries, record.tileCount, error)
+                : mapTiles<TiledStorage>(file, data, bytes, entries, record.tileCount, error);
+        if (!tiles) return false;
+
+        // built in place: a copy would start with nothing dirty
+        RasterLayer& layer = loaded.emplaceBack(static_cast<RasterLayer::StorageMode>(record.storageMode), format);
+        layer.setName(QString::fromUtf8(reinterpret_cast<const char*>(data + record.nameOffset), record.nameBytes));
+        layer.setVisible(record.visible != 0);
+        layer.setBlendMode(static_cast<RasterLayer::BlendMode>(record.blendMode));
+        layer.setOpacity(record.opacity);
+        layer.setTiledPixels(std::move(tiles));
+    }
+
+    *size = QSize(header.width, header.height);
+    *layers = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef PROJECTFILE_H
+#define PROJECTFILE_H
+
+#include <rasterlayer.h>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+// Reads and writes .pxa project files: the canvas size and every RasterLayer,
+// with its name, visibility, opacity, blend mode and pixels.
+//
+// Layout, in the byte order of the machine (little endian everywhere PixelAir
+// runs; a file from elsewhere is refused by its magic):
+//   header       magic "PXA1", version, canvas size, layer count, tile sizes
+//   layer table  per layer: where its name and tile index are, tile count,
+//                opacity, visibility, blend mode, format and storage mode
+//   per layer    the name in UTF-8, then the tile index, (tx, ty, offset,
+//                pixel count) per tile, row by row
+//   tiles        from a page boundary on, every tile exactly as the tiled
+//                storage keeps it in memory (pixels, occupancy masks, count),
+//                each TileAlign aligned
+//
+// Since tiles are stored in their in-memory form, loading maps the file and
+// points the layers' tiles straight into the mapping: opening reads only the
+// header and the indexes, which hold all the layers need to check and count
+// their tiles, and a tile is paged in the first time something reads it.
+// Layers saved with a tree backend (Sparse, Runs, Morton) load as tiles too
+// and only convert on their first edit, so they load just as lazily. Mapped
+// tiles are held like tiles shared with a copy, so a write copies the tile out
+// first, and the mapping is private, so nothing ever reaches the file. The file
+// stays mapped until its last tile is written over or dropped.
+//
+// Saving writes tiles out as they are, with no encoding, so the tiles of a
+// loaded project that were never touched go straight from the page cache back
+// to disk. The file is written to a temporary and renamed over the old one,
+// which lets a project be saved over the file its tiles are still mapped from.
+class ProjectFile
+{
+public:
+    static constexpr quint32 Version = 2;
+
+    // tiles start on multiples of this in the file, and so in the mapping
+    static constexpr int TileAlign = 64;
+
+    // write size and layers to path. Returns false on failure, with the reason in
+    // error if given
+    static bool save(const QString& path, const QSize& size, const QVector<RasterLayer>& layers,
+                     QString* error = nullptr);
+
+    // read the project at path into size and layers, whose tiles stay mapped from the
+    // file until written. Returns false on failure, with the reason in error if given,
+    // and leaves size and layers alone
+    static bool load(const QString& path, QSize* size, QVector<RasterLayer>* layers, QString* error = nullptr);
+};
+
+#endif // PROJECTFILE_H
@@ -1,63 +1,278 @@
 #include "rasterlayer.h"
+#include <mortonstorage.h>
+#include <runstorage.h>
+#include <sparsestorage.h>
+#include <tiledstorage.h>
 #include <QtCore/qdebug.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <sstream>
 
+// in Auto mode the backend is first reconsidered at this many pixels, then
+// every time the pixel count doubles
+static constexpr int FirstDensityCheck = TiledStorage::TileSize * TiledStorage::TileSize;
+
+// a tile costs ~4 bytes per slot whether the slot is used or not, while a
+// sparse pixel costs ~60-100 bytes in its trees: tiles win well before they
+// are full, one pixel in 16 is a conservative break-even
+static constexpr int DenseFraction = 16;
+
+// covers every representable pixel
+static const QRect Everything(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX));
+
+// what moved-from layers hold, so moving never allocates. Shared, so detach()
+// copies it on the first write
+static const std::shared_ptr<PixelStorage> EmptyStorage(new SparseStorage());
+
+// dirty_ is first compacted at this many entries, then whenever it doubles
+static constexpr size_t FirstDirtyCompact = 1024;
+
+// an erase over more tiles than this marks only the tiles holding pixels
+static constexpr qint64 MaxEraseTiles = 4096;
+
 // constructor destructor ---------------------------
 
-RasterLayer::RasterLayer() {
-    pixelData_ = AVLTree<int, Column>();
-    size_ = 0;
+RasterLayer::RasterLayer(StorageMode mode, PixelFormat format) {
+    if (format == PixelFormat::Rgba16) mode = StorageMode::Tiled; // there is no 16 bit tree backend
+
+    backend_ = mode == StorageMode::Auto ? StorageMode::Sparse : mode;
+    mode_ = mode;
+    format_ = format;
+    storage_.reset(newStorage(backend_));
+    nextDensityCheck_ = FirstDensityCheck;
     name_ = "New Layer";
     visible_ = true;
+    blendMode_ = BlendMode::Normal;
+    opacity_ = 1.0f;
+    dirtyCompactAt_ = FirstDirtyCompact;
 }
 
 RasterLayer::RasterLayer(const RasterLayer& other)
-    : pixelData_(other.pixelData_){
-    size_ = other.size_;
+    : storage_(other.storage_){ // shared until one side writes
+    mode_ = other.mode_;
+    format_ = other.format_;
+    backend_ = other.backend_;
+    nextDensityCheck_ = other.nextDensityCheck_;
+    name_ = other.name_;
+    visible_ = other.visible_;
+    blendMode_ = other.blendMode_;
+    opacity_ = other.opacity_;
+    dirtyCompactAt_ = FirstDirtyCompact; // nothing has changed for the copy yet
+}
+
+RasterLayer::RasterLayer(RasterLayer&& other) noexcept
+    : storage_(std::move(other.storage_)){
+    mode_ = other.mode_;
+    format_ = other.format_;
+    backend_ = other.backend_;
+    nextDensityCheck_ = other.nextDensityCheck_;
+    name_ = std::move(other.name_);
+    visible_ = other.visible_;
+    blendMode_ = other.blendMode_;
+    opacity_ = other.opacity_;
+    dirty_ = std::move(other.dirty_);
+    dirtyCompactAt_ = other.dirtyCompactAt_;
+    replaced_ = std::move(other.replaced_);
+
+    // leave the moved-from layer empty but usable
+    other.storage_ = EmptyStorage;
+    other.mode_ = StorageMode::Auto;
+    other.format_ = PixelFormat::Rgba8;
+    other.backend_ = StorageMode::Sparse;
+    other.nextDensityCheck_ = FirstDensityCheck;
+    other.dirty_.clear();
+    other.dirtyCompactAt_ = FirstDirtyCompact;
+}
+
+RasterLayer::~RasterLayer() = default;
+
+RasterLayer& RasterLayer::operator=(const RasterLayer& other) {
+    if (this == &other) return *this;
+
+    // what goes away is marked along with what comes in by the next takeDirtyRects(),
+    // as for a move
+    if (!replaced_) replaced_ = storage_;
+    storage_ = other.storage_; // shared until one side writes
+    mode_ = other.mode_;
+    format_ = other.format_;
+    backend_ = other.backend_;
+    nextDensityCheck_ = other.nextDensityCheck_;
     name_ = other.name_;
     visible_ = other.visible_;
+    blendMode_ = other.blendMode_;
+    opacity_ = other.opacity_;
+    return *this;
+}
+
+RasterLayer& RasterLayer::operator=(RasterLayer&& other) noexcept {
+    if (this == &other) return *this;
+
+    // what goes away is marked along with what comes in by the next takeDirtyRects().
+    // An earlier replacement still pending covers what was last taken already
+    if (!replaced_) replaced_ = storage_;
+    std::swap(storage_, other.storage_);
+    std::swap(mode_, other.mode_);
+    std::swap(format_, other.format_);
+    std::swap(backend_, other.backend_);
+    std::swap(nextDensityCheck_, other.nextDensityCheck_);
+    std::swap(name_, other.name_);
+    std::swap(visible_, other.visible_);
+    std::swap(blendMode_, other.blendMode_);
+    std::swap(opacity_, other.opacity_);
+    return *this;
+}
+
+// helper functions ---------------------------
+
+void RasterLayer::detach() {
+    // tiles handed to setTiledPixels take the backend asked for on the first write,
+    // into storage of their own
+    if (mode_ != StorageMode::Auto && backend_ != mode_) {
+        convertStorage(mode_);
+        return;
+    }
+    if (storage_.use_count() > 1) {
+        storage_.reset(storage_->clone());
+    } else {
+        // use_count() is a relaxed load. A copy may have been dropped on another
+        // thread (a Compositor worker) just now: order its reads before our writes
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+}
+
+PixelStorage* RasterLayer::newStorage(StorageMode backend) const {
+    if (format_ == PixelFormat::Rgba16) return new WideTiledStorage();
+    switch (backend) {
+    case StorageMode::Tiled:
+        return new TiledStorage();
+    case StorageMode::Runs:
+        return new RunStorage();
+    case StorageMode::Morton:
+        return new MortonStorage();
+    default:
+        return new SparseStorage();
+    }
+}
+
+void RasterLayer::convertStorage(StorageMode backend) {
+    if (backend == backend_ || format_ == PixelFormat::Rgba16) return;
+
+    std::unique_ptr<PixelStorage> target(newStorage(backend));
+
+    // gathered and sorted by (x, y) so the target bulk loads each column or tile once
+    QVector<PixelRef> pixels;
+    pixels.reserve(storage_->size());
+    storage_->forEachInRect(Everything, [&pixels](QPoint loc, Pixel p) {
+        pixels.emplaceBack(loc, p);
+    }, nullptr);
+    auto byColumn = [](const PixelRef& a, const PixelRef& b) {
+        return a.location.x() != b.location.x() ? a.location.x() < b.location.x() : a.location.y() < b.location.y();
+    };
+    if (!std::is_sorted(pixels.cbegin(), pixels.cend(), byColumn)) std::sort(pixels.begin(), pixels.end(), byColumn);
+    target->upsertSorted(pixels.constData(), pixels.constData() + pixels.size());
+
+    storage_ = std::move(target);
+    backend_ = backend;
 }
 
-RasterLayer::~RasterLayer() {
-    clear();
+void RasterLayer::checkDensity() {
+    if (mode_ != StorageMode::Auto || backend_ != StorageMode::Sparse || storage_->size() < nextDensityCheck_) return;
+
+    // only look again once the layer has doubled, keeps the scan amortised O(1)
+    nextDensityCheck_ = storage_->size() * 2;
+
+    const int tiles = static_cast<const SparseStorage*>(storage_.get())->occupiedTiles(TiledStorage::TileSize);
+    if (isDense(storage_->size(), tiles)) convertStorage(StorageMode::Tiled);
 }
 
-int RasterLayer::size() const { return size_; }
+bool RasterLayer::isDense(const qint64 pixels, const qint64 tiles) {
+    const qint64 tileArea = TiledStorage::TileSize * TiledStorage::TileSize;
+    return pixels * DenseFraction >= tiles * tileArea;
+}
+
+void RasterLayer::markDirty(const QPoint loc) {
+    const quint64 key = dirtyKey(loc.x() >> DirtyShift, loc.y() >> DirtyShift);
+    if (!dirty_.empty() && dirty_.back() == key) return; // strokes stay on one tile for a while
+    dirty_.push_back(key);
+    if (dirty_.size() >= dirtyCompactAt_) compactDirty();
+}
+
+void RasterLayer::markDirty(const QRect& box) {
+    if (box.isEmpty()) return;
+    for (int ty = box.top() >> DirtyShift; ty <= box.bottom() >> DirtyShift; ty++)
+        for (int tx = box.left() >> DirtyShift; tx <= box.right() >> DirtyShift; tx++) dirty_.push_back(dirtyKey(tx, ty));
+    if (dirty_.size() >= dirtyCompactAt_) compactDirty();
+}
+
+void RasterLayer::markOccupied(const QRect& box) {
+    if (box.isEmpty() || storage_->size() == 0) return;
+
+    std::vector<QPoint> cells;
+    storage_->collectCells(DirtyShift, cells);
+    const int tx0 = box.left() >> DirtyShift, tx1 = box.right() >> DirtyShift;
+    const int ty0 = box.top() >> DirtyShift, ty1 = box.bottom() >> DirtyShift;
+    for (const QPoint& cell : cells) {
+        if (cell.x() >= tx0 && cell.x() <= tx1 && cell.y() >= ty0 && cell.y() <= ty1) dirty_.push_back(dirtyKey(cell.x(), cell.y()));
+    }
+    if (dirty_.size() >= dirtyCompactAt_) compactDirty();
+}
+
+void RasterLayer::compactDirty() {
+    std::sort(dirty_.begin(), dirty_.end());
+    dirty_.erase(std::unique(dirty_.begin(), dirty_.end()), dirty_.end());
+    dirtyCompactAt_ = std::max(FirstDirtyCompact, dirty_.size() * 2);
+}
+
+// accessors ---------------------------
+
+int RasterLayer::size() const { return storage_->size(); }
+
+RasterLayer::StorageMode RasterLayer::storageMode() const { return mode_; }
+
+RasterLayer::StorageMode RasterLayer::backend() const { return backend_; }
+
+bool RasterLayer::isTiled() const { return backend_ == StorageMode::Tiled; }
+
+RasterLayer::PixelFormat RasterLayer::format() const { return format_; }
+
+QString RasterLayer::name() const { return name_; }
+
+bool RasterLayer::isVisible() const { return visible_; }
+
+RasterLayer::BlendMode RasterLayer::blendMode() const { return blendMode_; }
+
+float RasterLayer::opacity() const { return opacity_; }
+
+bool RasterLayer::isDirty() const { return !dirty_.empty() || replaced_ != nullptr; }
+
+bool RasterLayer::sharesPixelsWith(const RasterLayer& other) const {
+    return storage_ == other.storage_;
+}
 
 bool RasterLayer::contains(const QPoint loc) const {
-    auto column = pixelData_.get(loc.x());
-    if (!column.has_value())
-        return false;
-    return column.value().get().contains(loc.y());
+    return storage_->contains(loc);
 }
 
 std::optional<PixelRef> RasterLayer::get(const QPoint loc) const {
-    auto column = pixelData_.get(loc.x());
-    if (!column.has_value())
-        return std::nullopt;
-
-    auto c = column.value().get().get(loc.y());
+    auto c = storage_->get(loc);
     if (!c.has_value())
         return std::nullopt;
 
-    return PixelRef(loc, std::ref(c.value()));
+    return PixelRef(loc, c.value());
+}
+
+std::optional<QRgba64> RasterLayer::getWide(const QPoint loc) const {
+    return storage_->getWide(loc);
 }
 
 QVector<PixelRef> RasterLayer::get(const int x1, const int x2, const int y1, const int y2) const {
     if (x1 > x2 || y1 > y2) return {}; // invalid bounding box
     QVector<PixelRef> pixels;
 
-    auto columns = pixelData_.getRange(x1, x2);
-    for (int i = 0; i < columns.length(); i++) {
-        int x = columns[i].first;
-        auto yPixels = columns[i].second.get().getRange(y1, y2);
-        for (int j = 0; j < yPixels.length(); j++) {
-            int y = yPixels[j].first;
-            QColor c = yPixels[j].second;
-            pixels.emplaceBack(QPoint(x, y), std::ref(c));
-        }
-    }
-
+    forEachInRect(QRect(QPoint(x1, y1), QPoint(x2, y2)), [&pixels](QPoint loc, Pixel p) {
+        pixels.emplaceBack(loc, p);
+    });
     return pixels;
 }
 
@@ -71,44 +286,247 @@ QVector<PixelRef> RasterLayer::get(const QRect boundingBox) const {
         boundingBox.bottom());
 }
 
+PixelRegion RasterLayer::pixels(const QRect boundingBox) const {
+    return PixelRegion(storage_.get(), boundingBox);
+}
+
+std::shared_ptr<const PixelStorage> RasterLayer::tiledPixels() const {
+    if (backend_ == StorageMode::Tiled) return storage_;
+
+    auto tiles = std::make_shared<TiledStorage>();
+    storage_->forEachInRect(Everything, [&tiles](QPoint loc, Pixel p) {
+        tiles->upsert(loc, p);
+    }, nullptr);
+    return tiles;
+}
+
+// mutators ---------------------------
+
+void RasterLayer::setName(const QString& name) { name_ = name; }
+
+// these change how every pixel of the layer looks, so all of them are dirty
+
+void RasterLayer::setVisible(const bool visible) {
+    if (visible == visible_) return;
+    visible_ = visible;
+    markOccupied(Everything);
+}
+
+void RasterLayer::setBlendMode(const BlendMode mode) {
+    if (mode == blendMode_) return;
+    blendMode_ = mode;
+    markOccupied(Everything);
+}
+
+void RasterLayer::setOpacity(const float opacity) {
+    const float clamped = std::clamp(opacity, 0.0f, 1.0f);
+    if (clamped == opacity_) return;
+    opacity_ = clamped;
+    markOccupied(Everything);
+}
+
+void RasterLayer::setStorageMode(StorageMode mode) {
+    if (format_ == PixelFormat::Rgba16) return; // always tiled
+    mode_ = mode;
+    nextDensityCheck_ = FirstDensityCheck;
+
+    if (mode == StorageMode::Auto) checkDensity();
+    else convertStorage(mode);
+}
+
 void RasterLayer::clear() {
-    pixelData_.clear();
-    size_ = 0;
+    markOccupied(Everything);
+
+    // an empty layer starts over as sparse
+    if (mode_ == StorageMode::Auto && backend_ == StorageMode::Tiled) {
+        backend_ = StorageMode::Sparse;
+        storage_.reset(newStorage(backend_));
+    } else if (mode_ != StorageMode::Auto && backend_ != mode_) { // loaded tiles, never converted
+        backend_ = mode_;
+        storage_.reset(newStorage(backend_));
+    } else if (storage_.use_count() > 1) { // no point copying what is about to be dropped
+        storage_.reset(newStorage(backend_));
+    } else {
+        std::atomic_thread_fence(std::memory_order_acquire); // as in detach()
+        storage_->clear();
+    }
+    nextDensityCheck_ = FirstDensityCheck;
 }
 
-void RasterLayer::update(const QPoint loc, const QColor c) {
-    auto column = pixelData_.get(loc.x());
-    if (!column.has_value()) return; // do nothing
+void RasterLayer::setTiledPixels(std::shared_ptr<PixelStorage> storage) {
+    markOccupied(Everything); // what goes away
+    storage_ = std::move(storage);
+    backend_ = StorageMode::Tiled;
+    nextDensityCheck_ = FirstDensityCheck;
+    markOccupied(Everything); // what comes in
+}
 
-    column.value().get().update(loc.y(), c);
+void RasterLayer::update(const QPoint loc, const Pixel p) {
+    if (!storage_->contains(loc)) return; // don't detach for nothing
+    detach();
+    storage_->update(loc, p);
+    markDirty(loc);
 }
 
-void RasterLayer::upsert(const QPoint loc, const QColor c) {
-    auto column = pixelData_.get(loc.x());
-    if (!column.has_value()) { // if the col doesnt exist yet, make a new one
-        Column newColumn = AVLTree<int, QColor>();
-        newColumn.upsert(loc.y(), c);
-        pixelData_.upsert(loc.x(), newColumn);
-        size_++; // increment size since we added a new pixel
-        return;
+void RasterLayer::upsert(const QPoint loc, const Pixel p) {
+    detach();
+    markDirty(loc);
+    if (storage_->upsert(loc, p)) checkDensity();
+}
+
+void RasterLayer::upsertWide(const QPoint loc, const QRgba64 c) {
+    detach();
+    markDirty(loc);
+    if (storage_->upsertWide(loc, c)) checkDensity();
+}
+
+void RasterLayer::remove(const QPoint loc) {
+    if (!storage_->contains(loc)) return; // don't detach for nothing
+    detach();
+    storage_->remove(loc);
+    markDirty(loc);
+}
+
+void RasterLayer::upsertMany(QVector<PixelRef> pixels) {
+    if (pixels.isEmpty()) return;
+
+    // stable, so that among repeats of a location the last one given stays last.
+    // Strokes built column by column often arrive sorted already
+    auto byColumn = [](const PixelRef& a, const PixelRef& b) {
+        return a.location.x() != b.location.x() ? a.location.x() < b.location.x() : a.location.y() < b.location.y();
+    };
+    if (!std::is_sorted(pixels.cbegin(), pixels.cend(), byColumn)) {
+        std::stable_sort(pixels.begin(), pixels.end(), byColumn);
     }
 
-    if(!column.value().get().contains(loc.y())){
-        size_++; // if the pixel is new, increment
+    // keep only the last of each location
+    auto out = pixels.begin();
+    for (auto it = pixels.begin(); it != pixels.end(); ++it) {
+        if (it + 1 != pixels.end() && (it + 1)->location == it->location) continue;
+        *out++ = *it;
     }
-    column.value().get().upsert(loc.y(), c); // normal upsert
+    pixels.erase(out, pixels.end());
+    for (const PixelRef& p : pixels) markDirty(p.location);
+
+    detach();
+    if (storage_->upsertSorted(pixels.constData(), pixels.constData() + pixels.size()) > 0) checkDensity();
 }
 
-void RasterLayer::remove(const QPoint loc) {
-    auto column = pixelData_.get(loc.x());
-    if (!column.has_value()) return; // do nothing
+void RasterLayer::removeMany(QVector<QPoint> locs) {
+    if (locs.isEmpty()) return;
 
-    if(column.value().get().contains(loc.y())) size_--; // if the pixel exists, decrement)
-    column.value().get().remove(loc.y());
+    auto byColumn = [](const QPoint& a, const QPoint& b) {
+        return a.x() != b.x() ? a.x() < b.x() : a.y() < b.y();
+    };
+    if (!std::is_sorted(locs.cbegin(), locs.cend(), byColumn)) std::sort(locs.begin(), locs.end(), byColumn);
+    locs.erase(std::unique(locs.begin(), locs.end()), locs.end());
+    for (const QPoint& loc : locs) markDirty(loc);
 
-    if (column.value().get().size() == 0) { // if the col becomes empty, delete it
-        pixelData_.remove(loc.x());
+    detach();
+    storage_->removeSorted(locs.constData(), locs.constData() + locs.size());
+}
+
+void RasterLayer::fillRect(const QRect boundingBox, const Pixel p) {
+    if (boundingBox.isEmpty()) return;
+
+    // a big solid fill would only be built sparse to get converted right after, so
+    // run the density test ahead of time, counting every tile the fill touches
+    const qint64 width = static_cast<qint64>(boundingBox.right()) - boundingBox.left() + 1;
+    const qint64 height = static_cast<qint64>(boundingBox.bottom()) - boundingBox.top() + 1;
+    if (mode_ == StorageMode::Auto && backend_ == StorageMode::Sparse && width * height >= FirstDensityCheck) {
+        const qint64 fillTiles = ((width + TiledStorage::TileMask) / TiledStorage::TileSize + 1)
+                                 * ((height + TiledStorage::TileMask) / TiledStorage::TileSize + 1);
+        const int tiles = static_cast<const SparseStorage*>(storage_.get())->occupiedTiles(TiledStorage::TileSize);
+        if (isDense(storage_->size() + width * height, tiles + fillTiles)) convertStorage(StorageMode::Tiled);
+    }
+
+    detach();
+    markDirty(boundingBox);
+    if (storage_->fillRect(boundingBox, p) > 0) checkDensity();
+}
+
+void RasterLayer::fillSpan(const int y, const int x1, const int x2, const Pixel p) {
+    if (x1 > x2) return; // invalid span
+    fillRect(QRect(QPoint(x1, y), QPoint(x2, y)), p);
+}
+
+void RasterLayer::eraseRect(const QRect boundingBox) {
+    if (boundingBox.isEmpty()) return;
+
+    // an erase may span far more of the canvas than is painted
+    const qint64 tilesWide = (boundingBox.right() >> DirtyShift) - (boundingBox.left() >> DirtyShift) + 1;
+    const qint64 tilesHigh = (boundingBox.bottom() >> DirtyShift) - (boundingBox.top() >> DirtyShift) + 1;
+    if (tilesWide * tilesHigh <= MaxEraseTiles) markDirty(boundingBox);
+    else markOccupied(boundingBox);
+
+    detach();
+    storage_->eraseRect(boundingBox);
+}
+
+void RasterLayer::fillRuns(QVector<ColumnRun> runs, const Pixel p) {
+    uniteRuns(runs);
+    if (runs.isEmpty()) return;
+    for (const ColumnRun& run : runs) markDirty(QRect(run.x, run.y, 1, run.length));
+
+    detach();
+    if (storage_->fillRuns(runs.constData(), runs.constData() + runs.size(), p) > 0) checkDensity();
+}
+
+void RasterLayer::eraseRuns(QVector<ColumnRun> runs) {
+    uniteRuns(runs);
+    if (runs.isEmpty() || storage_->size() == 0) return; // don't detach for nothing
+    for (const ColumnRun& run : runs) markDirty(QRect(run.x, run.y, 1, run.length));
+
+    detach();
+    storage_->eraseRuns(runs.constData(), runs.constData() + runs.size());
+}
+
+QVector<QRect> RasterLayer::takeDirtyRects() {
+    if (replaced_) { // one pass over the tiles of the pixels replaced and the current ones
+        std::vector<QPoint> cells;
+        replaced_->collectCells(DirtyShift, cells);
+        storage_->collectCells(DirtyShift, cells);
+        for (const QPoint& cell : cells) dirty_.push_back(dirtyKey(cell.x(), cell.y()));
+        replaced_.reset();
+    }
+    compactDirty();
+
+    QVector<QRect> rects;
+    for (size_t i = 0; i < dirty_.size();) {
+        // keys of one row are consecutive, so a run of +1 keys is a run of tiles
+        size_t end = i + 1;
+        while (end < dirty_.size() && dirty_[end] == dirty_[end - 1] + 1) end++;
+
+        const int tx = static_cast<int>(static_cast<quint32>(dirty_[i]) ^ 0x80000000u);
+        const int ty = static_cast<int>(static_cast<quint32>(dirty_[i] >> 32) ^ 0x80000000u);
+        rects.append(QRect(tx * DirtyTileSize, ty * DirtyTileSize, static_cast<int>(end - i) * DirtyTileSize, DirtyTileSize));
+        i = end;
+    }
+
+    std::vector<quint64>().swap(dirty_);
+    dirtyCompactAt_ = FirstDirtyCompact;
+    return rects;
+}
+
+void RasterLayer::uniteRuns(QVector<ColumnRun>& runs) {
+    auto byColumn = [](const ColumnRun& a, const ColumnRun& b) { return a.x != b.x ? a.x < b.x : a.y < b.y; };
+    if (!std::is_sorted(runs.cbegin(), runs.cend(), byColumn)) std::sort(runs.begin(), runs.end(), byColumn);
+
+    // fold each run into the last one kept when they meet, in 64 bits as y + length may pass INT_MAX
+    auto out = runs.begin();
+    for (auto it = runs.begin(); it != runs.end(); ++it) {
+        if (it->length <= 0) continue;
+        if (out != runs.begin()) {
+            ColumnRun& last = *(out - 1);
+            const qint64 end = static_cast<qint64>(last.y) + last.length;
+            if (last.x == it->x && it->y <= end) {
+                last.length = static_cast<int>(std::max(end, static_cast<qint64>(it->y) + it->length) - last.y);
+                continue;
+            }
+        }
+        *out++ = *it;
     }
+    runs.erase(out, runs.end());
 }
 
 // mainly for debug use. Prints out the tree structure
@@ -116,30 +534,14 @@ std::string RasterLayer::toString() const {
     std::ostringstream oss;
 
     oss << "RasterLayer: " << name_.toStdString() << std::endl;
-    oss << "Pixel Count: " << size_ << std::endl;
+    oss << "Pixel Count: " << storage_->size() << std::endl;
     oss << "Visible: " << (visible_ ? "true" : "false") << std::endl;
+    const char* backends[] = {"sparse", "tiled", "auto", "runs", "morton"};
+    oss << "Storage: " << backends[static_cast<int>(backend_)]
+        << (format_ == PixelFormat::Rgba16 ? ", 16 bit" : ", 8 bit") << std::endl;
     oss << std::endl << "====================================" << std::endl << std::endl;
-    oss << "Pixel Data [Columns]: " << std::endl;
-
-    // print out the column tree structure
-    oss << pixelData_.toString([](const int& k) -> std::string {
-        return "x=" + std::to_string(k);
-    }) << std::endl;
-
-    oss << "Pixel Data [Per Column]: " << std::endl;
-
-    // get all columns and print out the pixel tree structure
-    auto columns = pixelData_.getRange(INT_MIN, INT_MAX);
-    for (int i = 0; i < columns.length(); i++) {
-        int x = columns[i].first;
-        auto c = columns[i].second;
-        oss << "Column x=" << std::to_string(x) << " [size=" << c.get().size() << "] : " << std::endl;
-        oss << c.get().toString([](const int& k) -> std::string {
-            return "y=" + std::to_string(k);
-        }) << std::endl;
-    }
+
+    oss << storage_->toString();
 
     return oss.str();
 }
-
-
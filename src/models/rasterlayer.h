@@ -1,72 +1,249 @@
 #ifndef RASTERLAYER_H
 #define RASTERLAYER_H
 
-#include <avltree.h>
-#include <QColor>
+#include <pixelstorage.h>
 #include <QVector2D>
+#include <memory>
 
-// A single pixel (without any of the node shit)
-struct PixelRef {
-    QPoint location;
-    std::reference_wrapper<QColor> value;
-
-    PixelRef(int x, int y, QColor& color)
-        : location{x, y}, value{color} {}
-
-    PixelRef(QPoint l, QColor& color)
-        : location{l}, value{color} {}
-};
-
+// A layer of pixels. Copies are cheap: they share storage until one side
+// writes, and tiled storage then copies only the tiles that actually change.
+// That makes snapshots for undo, export or rendering O(1) to take.
 class RasterLayer
 {
-
-    typedef AVLTree<int, QColor> Column;
+public:
+    // how pixels are kept in memory
+    enum class StorageMode {
+        Sparse, // AVL tree of columns, best for a few scattered pixels
+        Tiled,  // 64x64 RGBA8 tiles, best for painted areas
+        Auto,   // start sparse, switch to tiles once the layer gets dense
+        Runs,   // AVL tree of columns of one color runs, best for flat shapes and lines
+        Morton, // one AVL tree keyed by Z-order code, for 2-D region queries on scattered pixels
+    };
+
+    // how many bits each channel is stored with
+    enum class PixelFormat {
+        Rgba8,  // premultiplied 8 bit per channel (Pixel)
+        Rgba16, // premultiplied 16 bit per channel (QRgba64), always tiled
+    };
+
+    // how the layer is combined with the ones below it
+    enum class BlendMode {
+        Normal,   // source over
+        Multiply, // darkens: colors multiply where both layers are opaque
+        Screen,   // lightens: the inverse of multiplying the inverses
+        Add,      // sums the layers, clamped to white
+    };
 
 private:
-    // stores essentially "columns" of pixels
-    AVLTree<int, Column> pixelData_;
-    int size_;
+    std::shared_ptr<PixelStorage> storage_; // shared between copies until written
+    StorageMode mode_;
+    PixelFormat format_;
+    StorageMode backend_;  // which backend storage_ currently is, never Auto
+    int nextDensityCheck_; // in Auto mode, pixel count at which to reconsider the backend
     QString name_;
     bool visible_;
+    BlendMode blendMode_;
+    float opacity_; // 0 to 1, applied on top of the pixels' own alpha
+
+    // tiles written since the last takeDirtyRects(), as dirtyKey()s. May hold repeats
+    // until compacted
+    std::vector<quint64> dirty_;
+    size_t dirtyCompactAt_; // size at which dirty_ is next sorted and deduplicated
+    // pixels an assignment replaced since the last takeDirtyRects(). Their tiles and
+    // the current ones are marked there, so the assignment itself does not walk them
+    std::shared_ptr<const PixelStorage> replaced_;
+
+    // give this layer its own storage if it shares it with a copy. Called before
+    // every write
+    void detach();
+
+    // return an empty backend of the given kind, wide tiles for Rgba16 layers
+    PixelStorage* newStorage(StorageMode backend) const;
+
+    // move every pixel into a fresh backend of the given kind
+    void convertStorage(StorageMode backend);
+
+    // in Auto mode, switch to tiles if the layer has become dense enough
+    void checkDensity();
+
+    // would this many pixels spread over this many tiles be cheaper tiled
+    static bool isDense(const qint64 pixels, const qint64 tiles);
+
+    // key of dirty tile (tx, ty). Biased so keys sort by row, then column
+    static quint64 dirtyKey(int tx, int ty) {
+        return (static_cast<quint64>(static_cast<quint32>(ty) ^ 0x80000000u) << 32)
+               | (static_cast<quint32>(tx) ^ 0x80000000u);
+    }
+
+    // note that the tile holding loc changed
+    void markDirty(const QPoint loc);
+    // note that every tile overlapping box changed
+    void markDirty(const QRect& box);
+    // note that every tile holding pixels within box changed, for edits that only
+    // touch existing pixels
+    void markOccupied(const QRect& box);
+
+    // sort dirty_ and drop repeats
+    void compactDirty();
 
 public:
+    // changes are tracked in tiles of this side, matching the tiled backend
+    static constexpr int DirtyShift = 6;
+    static constexpr int DirtyTileSize = 1 << DirtyShift;
+
     // constructor destructor ---------------------------
-    RasterLayer();
+    RasterLayer(StorageMode mode = StorageMode::Auto, PixelFormat format = PixelFormat::Rgba8);
     RasterLayer(const RasterLayer& other);
+    RasterLayer(RasterLayer&& other) noexcept;
     ~RasterLayer();
 
+    RasterLayer& operator=(const RasterLayer& other);
+    RasterLayer& operator=(RasterLayer&& other) noexcept;
+
     // accessors ---------------------------
 
     // return the number of pixels in the layer
     int size() const;
 
+    // return the requested storage mode
+    StorageMode storageMode() const;
+
+    // return which backend pixels currently live in, never Auto
+    StorageMode backend() const;
+
+    // return if pixels currently live in tiles (as opposed to one of the trees)
+    bool isTiled() const;
+
+    // return the per channel depth pixels are stored at
+    PixelFormat format() const;
+
+    // return the layer name
+    QString name() const;
+
+    // return if the layer is drawn
+    bool isVisible() const;
+
+    // return how the layer is combined with the ones below it
+    BlendMode blendMode() const;
+
+    // return the layer opacity, 0 to 1
+    float opacity() const;
+
+    // return if pixels changed since the last takeDirtyRects()
+    bool isDirty() const;
+
+    // return if this layer and other still share their pixels (neither has written since copying)
+    bool sharesPixelsWith(const RasterLayer& other) const;
+
     // return if there is a pixel at location k
     bool contains(const QPoint loc) const;
 
     // return the pixel at location. If there is no pixel at location k, return nil
     std::optional<PixelRef> get(const QPoint loc) const;
+    // same, as a premultiplied 16 bit per channel color (exact for Rgba16 layers)
+    std::optional<QRgba64> getWide(const QPoint loc) const;
     // return all pixels within a given region. If there are no pixels in the region, return an empty vector
     QVector<PixelRef> get(const int x1, const int x2, const int y1, const int y2) const;
     QVector<PixelRef> get(const QRect boundingBox) const;
 
+    // call visit(QPoint, Pixel) for every pixel within a given region, walking the storage
+    // in place without building a vector. visit may return false to stop early, in which
+    // case this returns false too
+    template <typename F>
+    bool forEachInRect(const QRect boundingBox, F&& visit) const {
+        return storage_->forEachInRect(boundingBox, PixelVisitor(visit), nullptr);
+    }
+
+    // call visit(const ColumnRun&, Pixel) for runs of one color covering every pixel within
+    // a given region, clipped to it. A Runs layer hands out the runs it keeps, the others
+    // join neighbouring pixels. visit may return false to stop early, in which case this
+    // returns false too
+    template <typename F>
+    bool forEachRunInRect(const QRect boundingBox, F&& visit) const {
+        return storage_->forEachRunInRect(boundingBox, RunVisitor(visit));
+    }
+
+    // the pixels within a given region, for range-for. Same walk as forEachInRect, so
+    // nothing is copied up front. Invalidated by any change to the layer
+    PixelRegion pixels(const QRect boundingBox) const;
+
+    // return the pixels as 64x64 tiles, a TiledStorage (WideTiledStorage for Rgba16),
+    // for writing them out whole. A tiled layer hands out its own storage, shared until
+    // either side writes; any other is copied into tiles
+    std::shared_ptr<const PixelStorage> tiledPixels() const;
+
     // mutators ---------------------------
 
+    // rename the layer
+    void setName(const QString& name);
+
+    // show or hide the layer
+    void setVisible(const bool visible);
+
+    // change how the layer is combined with the ones below it
+    void setBlendMode(const BlendMode mode);
+
+    // set the layer opacity, clamped to 0 to 1
+    void setOpacity(const float opacity);
+
+    // change how pixels are stored, converting the existing ones. Rgba16 layers stay tiled
+    void setStorageMode(StorageMode mode);
+
     // clear the layer
     void clear();
 
+    // replace every pixel with tiles made elsewhere, such as a loaded file. storage
+    // must be a TiledStorage, or a WideTiledStorage for Rgba16 layers. A layer set to
+    // another backend keeps the tiles until its first write, so nothing is read now
+    void setTiledPixels(std::shared_ptr<PixelStorage> storage);
+
     // update the pixel at location k with value v. If the pixel does not exist, do nothing
-    void update(const QPoint loc, const QColor c);
+    void update(const QPoint loc, const Pixel p);
 
     // insert a pixel at location k with value v. If the pixel already exists, update the pixel
-    void upsert(const QPoint loc, const QColor c);
+    void upsert(const QPoint loc, const Pixel p);
+    // same, from a premultiplied 16 bit per channel color
+    void upsertWide(const QPoint loc, const QRgba64 c);
 
     // remove the pixel at location k. If the pixel does not exist, do nothing
     void remove(const QPoint loc);
 
+    // batch mutators, for brush strokes and fills. Input is sorted by column first, so
+    // each column (or tile) is looked up once for its whole run rather than per pixel
+
+    // insert or update every pixel. If a location is given twice, the last one wins
+    void upsertMany(QVector<PixelRef> pixels);
+
+    // remove every location. Locations without a pixel are skipped
+    void removeMany(QVector<QPoint> locs);
+
+    // set every pixel within a given region to p
+    void fillRect(const QRect boundingBox, const Pixel p);
+
+    // set pixels x1..x2 (inclusive) of row y to p
+    void fillSpan(const int y, const int x1, const int x2, const Pixel p);
+
+    // remove every pixel within a given region
+    void eraseRect(const QRect boundingBox);
+
+    // set every pixel of the runs to p, or remove them. Runs may come in any order and
+    // overlap; brush strokes arrive as these
+    void fillRuns(QVector<ColumnRun> runs, const Pixel p);
+    void eraseRuns(QVector<ColumnRun> runs);
+
+    // return the tiles changed since the last call, as rects sorted top to bottom, then
+    // left to right, with neighbouring tiles of a row merged, and start tracking afresh.
+    // A copy starts with nothing dirty; assigning to a layer dirties its old and new pixels
+    QVector<QRect> takeDirtyRects();
+
     // other functions ---------------------------
 
     // write the tree in string format
     std::string toString() const;
+
+    // sort runs by (x, y) and merge the ones that overlap or touch, the form the
+    // storages and LayerDelta::recordRuns take them in
+    static void uniteRuns(QVector<ColumnRun>& runs);
 };
 
 #endif // RASTERLAYER_H
@@ -0,0 +1,297 @@
+#include "runstorage.h"
+#include <avltreeimpl.h>
+#include <algorithm>
+#include <climits>
+#include <sstream>
+#include <unordered_set>
+
+// constructor destructor ---------------------------
+
+RunStorage::RunStorage()
+    : size_(0) {}
+
+RunStorage::RunStorage(const RunStorage& other)
+    : columns_(other.columns_), size_(other.size_) {}
+
+PixelStorage* RunStorage::clone() const {
+    return new RunStorage(*this);
+}
+
+// helper functions ---------------------------
+
+RunStorage::Column::iterator RunStorage::firstRun(const Column& column, const int y) {
+    auto it = column.upperBound(y);
+    if (it == column.begin()) return it;
+
+    auto before = it;
+    --before; // starts at or above y
+    return before.value().last >= y ? before : it;
+}
+
+int RunStorage::paint(const int x, const int top, const int bottom, const std::optional<Pixel> p) {
+    const qint64 rows = static_cast<qint64>(bottom) - top + 1;
+
+    auto existing = columns_.get(x);
+    if (!existing.has_value()) { // new column, a single run
+        if (!p.has_value()) return 0;
+        columns_.upsert(x, Column());
+        columns_.get(x)->get().upsert(top, {bottom, *p});
+        size_ += static_cast<int>(rows);
+        return 0;
+    }
+    Column& column = existing.value().get();
+
+    // the runs that overlap the rows, plus the ones just above and below that could
+    // merge with them
+    std::vector<std::pair<int, Run>> met;
+    for (auto it = firstRun(column, top == INT_MIN ? top : top - 1); it != column.end(); ++it) {
+        if (it.key() > static_cast<qint64>(bottom) + 1) break;
+        met.emplace_back(it.key(), it.value());
+    }
+
+    // painting inside a run of the same color changes nothing
+    if (p.has_value() && std::any_of(met.begin(), met.end(), [&](const std::pair<int, Run>& m) {
+            return m.first <= top && m.second.last >= bottom && m.second.value == *p;
+        })) {
+        return static_cast<int>(rows);
+    }
+
+    qint64 covered = 0;
+    int first = top, last = bottom; // of the new run, once merged with its neighbours
+    std::vector<std::pair<int, int>> trimmed; // (key, new last) of runs cut off below
+    std::vector<int> dropped;
+    std::vector<std::pair<int, Run>> added;
+    for (const auto& [key, run] : met) {
+        const int from = std::max(key, top), to = std::min(run.last, bottom);
+        const bool overlaps = from <= to;
+        if (overlaps) covered += static_cast<qint64>(to) - from + 1;
+
+        if (p.has_value() && run.value == *p) { // one color: fold it into the new run
+            first = std::min(first, key);
+            last = std::max(last, run.last);
+            dropped.push_back(key);
+            continue;
+        }
+        if (!overlaps) continue; // only touches, and another color
+
+        // keep what lies outside the rows
+        if (key < top) trimmed.emplace_back(key, top - 1);
+        else dropped.push_back(key);
+        if (run.last > bottom) added.emplace_back(bottom + 1, Run{run.last, run.value});
+    }
+    if (p.has_value()) added.emplace_back(first, Run{last, *p});
+
+    // the new run may start where a dropped one did, so drop before adding
+    for (const auto& [key, end] : trimmed) column.get(key)->get().last = end;
+    for (const int key : dropped) column.remove(key);
+    for (const auto& [key, run] : added) column.upsert(key, run);
+    if (column.size() == 0) columns_.remove(x); // if the col becomes empty, delete it
+
+    size_ += static_cast<int>(p.has_value() ? rows - covered : -covered);
+    return static_cast<int>(covered);
+}
+
+// accessors ---------------------------
+
+int RunStorage::size() const { return size_; }
+
+bool RunStorage::contains(const QPoint loc) const {
+    return get(loc).has_value();
+}
+
+std::optional<Pixel> RunStorage::get(const QPoint loc) const {
+    auto column = columns_.get(loc.x());
+    if (!column.has_value()) return std::nullopt;
+
+    const Column& c = column.value().get();
+    auto it = firstRun(c, loc.y());
+    if (it == c.end() || it.key() > loc.y()) return std::nullopt;
+    return it.value().value;
+}
+
+bool RunStorage::forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const {
+    if (box.isEmpty()) return true;
+
+    // rows top to bottom of a column, run by run
+    auto walk = [&box, &visit](const int x, const Column& column, const int top) {
+        for (auto it = firstRun(column, top); it != column.end() && it.key() <= box.bottom(); ++it) {
+            const Pixel p = it.value().value;
+            const qint64 to = std::min(it.value().last, box.bottom());
+            for (qint64 y = std::max(it.key(), top); y <= to; y++)
+                if (!visit(QPoint(x, static_cast<int>(y)), p)) return false;
+        }
+        return true;
+    };
+    int firstX = box.left();
+
+    if (after != nullptr) {
+        if (after->x() > box.right()) return true; // nothing comes after it
+
+        // finish the column the walk stopped in
+        if (after->x() >= box.left() && after->y() < box.bottom()) {
+            auto column = columns_.get(after->x());
+            if (column.has_value() && !walk(after->x(), column.value().get(), std::max(after->y() + 1, box.top())))
+                return false;
+        }
+
+        if (after->x() == INT_MAX) return true;
+        firstX = std::max(box.left(), after->x() + 1);
+    }
+
+    return columns_.forEachInRange(firstX, box.right(), [&](const int& x, const Column& column) {
+        return walk(x, column, box.top());
+    });
+}
+
+bool RunStorage::forEachRunInRect(const QRect& box, RunVisitor visit) const {
+    if (box.isEmpty()) return true;
+
+    return columns_.forEachInRange(box.left(), box.right(), [&box, &visit](const int& x, const Column& column) {
+        for (auto it = firstRun(column, box.top()); it != column.end() && it.key() <= box.bottom(); ++it) {
+            const int from = std::max(it.key(), box.top()), to = std::min(it.value().last, box.bottom());
+            if (!visit(ColumnRun{x, from, to - from + 1}, it.value().value)) return false;
+        }
+        return true;
+    });
+}
+
+void RunStorage::collectCells(const int shift, std::vector<QPoint>& out) const {
+    // a column lies in one column of cells, so cells only repeat between columns that share it
+    int cellX = 0;
+    std::unordered_set<int> seen; // cell rows found in the current column of cells
+    columns_.forEachInRange(INT_MIN, INT_MAX, [&](const int& x, const Column& column) {
+        if (seen.empty() || (x >> shift) != cellX) {
+            seen.clear();
+            cellX = x >> shift;
+        }
+        column.forEachInRange(INT_MIN, INT_MAX, [&](const int& y, const Run& run) {
+            for (qint64 cy = y >> shift; cy <= run.last >> shift; cy++)
+                if (seen.insert(static_cast<int>(cy)).second) out.emplace_back(cellX, static_cast<int>(cy));
+        });
+    });
+}
+
+int RunStorage::runCount() const {
+    int runs = 0;
+    for (const auto& [x, column] : columns_) runs += column.size();
+    return runs;
+}
+
+// mutators ---------------------------
+
+void RunStorage::clear() {
+    columns_.clear();
+    size_ = 0;
+}
+
+bool RunStorage::update(const QPoint loc, const Pixel p) {
+    if (!contains(loc)) return false; // do nothing
+    paint(loc.x(), loc.y(), loc.y(), p);
+    return true;
+}
+
+bool RunStorage::upsert(const QPoint loc, const Pixel p) {
+    return paint(loc.x(), loc.y(), loc.y(), p) == 0;
+}
+
+bool RunStorage::remove(const QPoint loc) {
+    return paint(loc.x(), loc.y(), loc.y(), std::nullopt) > 0;
+}
+
+int RunStorage::upsertSorted(const PixelRef* first, const PixelRef* last) {
+    int added = 0;
+    while (first != last) {
+        // gather the pixels that follow on down the column in one color
+        const PixelRef* end = first + 1;
+        while (end != last && end->location.x() == first->location.x() && end->value == first->value
+               && end->location.y() == static_cast<qint64>((end - 1)->location.y()) + 1)
+            ++end;
+
+        const int rows = static_cast<int>(end - first);
+        added += rows - paint(first->location.x(), first->location.y(), (end - 1)->location.y(), first->value);
+        first = end;
+    }
+    return added;
+}
+
+int RunStorage::removeSorted(const QPoint* first, const QPoint* last) {
+    int removed = 0;
+    while (first != last) {
+        const QPoint* end = first + 1;
+        while (end != last && end->x() == first->x() && end->y() == static_cast<qint64>((end - 1)->y()) + 1) ++end;
+
+        removed += paint(first->x(), first->y(), (end - 1)->y(), std::nullopt);
+        first = end;
+    }
+    return removed;
+}
+
+int RunStorage::fillRect(const QRect& box, const Pixel p) {
+    if (box.isEmpty()) return 0;
+
+    // every column gets the same run
+    const qint64 rows = static_cast<qint64>(box.bottom()) - box.top() + 1;
+    int added = 0;
+    for (qint64 x = box.left(); x <= box.right(); x++)
+        added += static_cast<int>(rows - paint(static_cast<int>(x), box.top(), box.bottom(), p));
+    return added;
+}
+
+int RunStorage::eraseRect(const QRect& box) {
+    if (box.isEmpty()) return 0;
+
+    // erasing can delete columns, so find them before touching any
+    std::vector<int> xs;
+    columns_.forEachInRange(box.left(), box.right(), [&xs](const int& x, const Column&) { xs.push_back(x); });
+
+    int removed = 0;
+    for (const int x : xs) removed += paint(x, box.top(), box.bottom(), std::nullopt);
+    return removed;
+}
+
+int RunStorage::fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) {
+    int added = 0;
+    for (; first != last; ++first) {
+        if (first->length <= 0) continue;
+        added += first->length - paint(first->x, first->y, first->y + first->length - 1, p);
+    }
+    return added;
+}
+
+int RunStorage::eraseRuns(const ColumnRun* first, const ColumnRun* last) {
+    int removed = 0;
+    for (; first != last; ++first) {
+        if (first->length <= 0) continue;
+        removed += paint(first->x, first->y, first->y + first->length - 1, std::nullopt);
+    }
+    return removed;
+}
+
+// other functions ---------------------------
+
+// prints out the column tree, then the runs of every column
+std::string RunStorage::toString() const {
+    std::ostringstream oss;
+
+    oss << "Pixel Data [Columns]: " << std::endl;
+
+    // print out the column tree structure
+    oss << columns_.toString([](const int& k) -> std::string {
+        return "x=" + std::to_string(k);
+    }) << std::endl;
+
+    oss << "Pixel Data [Per Column]: " << std::endl;
+
+    // get all columns and print out the run tree structure
+    for (const auto& [x, c] : columns_) {
+        oss << "Column x=" << std::to_string(x) << " [runs=" << c.size() << "] : " << std::endl;
+        oss << c.toString([](const int& k) -> std::string {
+            return "y=" + std::to_string(k);
+        }) << std::endl;
+    }
+
+    return oss.str();
+}
+
+template class AVLTree<int, RunStorage::Run>;
+template class AVLTree<int, AVLTree<int, RunStorage::Run>>;
@@ -0,0 +1,79 @@
+#ifndef RUNSTORAGE_H
+#define RUNSTORAGE_H
+
+#include <avltree.h>
+#include <pixelstorage.h>
+#include <optional>
+#include <vector>
+
+// Pixels kept as an AVL tree of columns (keyed by x), each an AVL tree of
+// vertical runs of one color keyed by their first row. Edits split the runs
+// they cut and merge runs that end up touching with the same color, so no two
+// neighbouring runs of a column share a color. Flat shapes and lines cost a
+// node per run rather than one per pixel as in SparseStorage, region walks can
+// hand out whole runs, and contains / get find the run holding a row in
+// O(log runs).
+class RunStorage : public PixelStorage
+{
+public:
+    // rows key to last (inclusive) of a column, all of one value
+    struct Run {
+        int last;
+        Pixel value;
+    };
+
+private:
+    typedef AVLTree<int, Run> Column;
+
+    AVLTree<int, Column> columns_;
+    int size_;
+
+    // return the run of column holding row y or, if none does, the first run below y
+    static Column::iterator firstRun(const Column& column, const int y);
+
+    // set rows top to bottom of column x to p, or remove them if p is nil, splitting
+    // the runs they cut and merging the ones they meet. Returns how many of those
+    // rows held a pixel before
+    int paint(const int x, const int top, const int bottom, const std::optional<Pixel> p);
+
+public:
+    // constructor destructor ---------------------------
+    RunStorage();
+    RunStorage(const RunStorage& other);
+
+    PixelStorage* clone() const override;
+
+    // accessors ---------------------------
+    int size() const override;
+    bool contains(const QPoint loc) const override;
+    std::optional<Pixel> get(const QPoint loc) const override;
+    // visits columns left to right, each top to bottom
+    bool forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const override;
+    // hands out the stored runs, clipped to box
+    bool forEachRunInRect(const QRect& box, RunVisitor visit) const override;
+
+    // takes each run once
+    void collectCells(const int shift, std::vector<QPoint>& out) const override;
+
+    // return the number of runs, the nodes the pixels take
+    int runCount() const;
+
+    // mutators ---------------------------
+    void clear() override;
+    bool update(const QPoint loc, const Pixel p) override;
+    bool upsert(const QPoint loc, const Pixel p) override;
+    bool remove(const QPoint loc) override;
+    // pixels of a column that follow on in one color go in as one run
+    int upsertSorted(const PixelRef* first, const PixelRef* last) override;
+    int removeSorted(const QPoint* first, const QPoint* last) override;
+    // a run per column
+    int fillRect(const QRect& box, const Pixel p) override;
+    int eraseRect(const QRect& box) override;
+    int fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) override;
+    int eraseRuns(const ColumnRun* first, const ColumnRun* last) override;
+
+    // other functions ---------------------------
+    std::string toString() const override;
+};
+
+#endif // RUNSTORAGE_H
@@ -0,0 +1,331 @@
+#include "selectionmask.h"
+#include <rasterlayer.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <unordered_set>
+
+// bits lo to hi of a word, inclusive
+static quint64 bitRange(int lo, int hi) { return (~quint64(0) >> (63 - (hi - lo))) << lo; }
+
+// constructor destructor ---------------------------
+
+SelectionMask::SelectionMask() : bitmap_(false), area_(0) {}
+
+SelectionMask::SelectionMask(QVector<ColumnRun> runs) : runs_(std::move(runs)), bitmap_(false), area_(0) {
+    for (const ColumnRun& run : runs_) area_ += run.length;
+}
+
+SelectionMask SelectionMask::rect(const QRect& box) {
+    QVector<ColumnRun> runs;
+    if (box.isEmpty()) return SelectionMask();
+    runs.reserve(box.width());
+    for (int x = box.left(); x <= box.right(); x++) runs.append({x, box.top(), box.height()});
+    return SelectionMask(std::move(runs));
+}
+
+SelectionMask SelectionMask::ellipse(const QRect& box) {
+    QVector<ColumnRun> runs;
+    if (box.isEmpty()) return SelectionMask();
+
+    // pixel centers within the ellipse inscribed in box, column by column
+    const double rx = box.width() / 2.0, ry = box.height() / 2.0;
+    for (int i = 0; i < box.width(); i++) {
+        const double dx = (i + 0.5 - rx) / rx;
+        const double h = ry * std::sqrt(std::max(0.0, 1 - dx * dx));
+        const int top = static_cast<int>(std::ceil(ry - 0.5 - h)), bottom = static_cast<int>(std::floor(ry - 0.5 + h));
+        if (top <= bottom) runs.append({box.left() + i, box.top() + top, bottom - top + 1});
+    }
+    return SelectionMask(std::move(runs));
+}
+
+SelectionMask SelectionMask::lasso(const QVector<QPointF>& points) {
+    if (points.size() < 3) return SelectionMask();
+    double left = points[0].x(), right = left;
+    for (const QPointF& p : points) {
+        left = std::min(left, p.x());
+        right = std::max(right, p.x());
+    }
+
+    // down each column through the middle of its pixels: where the edges cross it,
+    // sorted, bound the spans inside in pairs. A pixel is in if its center is
+    QVector<ColumnRun> runs;
+    std::vector<double> crossings;
+    for (int x = static_cast<int>(std::floor(left)); x < static_cast<int>(std::ceil(right)); x++) {
+        const double cx = x + 0.5;
+        crossings.clear();
+        for (qsizetype i = 0; i < points.size(); i++) {
+            const QPointF& p = points[i];
+            const QPointF& q = points[(i + 1) % points.size()];
+            if ((p.x() <= cx) == (q.x() <= cx)) continue;
+            crossings.push_back(p.y() + (cx - p.x()) * (q.y() - p.y()) / (q.x() - p.x()));
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+            const int top = static_cast<int>(std::ceil(crossings[i] - 0.5));
+            const int bottom = static_cast<int>(std::ceil(crossings[i + 1] - 0.5));
+            if (top < bottom) runs.append({x, top, bottom - top});
+        }
+    }
+    return fromRuns(std::move(runs));
+}
+
+SelectionMask SelectionMask::magicWand(const RasterLayer& layer, const QRect& bounds, const QPoint seed, int tolerance,
+                                       FloodFill::Mode mode, WorkerPool& pool) {
+    SelectionMask mask(FloodFill::region(layer, bounds, seed, tolerance, mode, pool));
+    mask.compact();
+    return mask;
+}
+
+SelectionMask SelectionMask::fromRuns(QVector<ColumnRun> runs) {
+    RasterLayer::uniteRuns(runs);
+    SelectionMask mask(std::move(runs));
+    mask.compact();
+    return mask;
+}
+
+// accessors ---------------------------
+
+bool SelectionMask::isEmpty() const { return area_ == 0; }
+
+qint64 SelectionMask::area() const { return area_; }
+
+QRect SelectionMask::boundingRect() const {
+    if (isEmpty()) return QRect();
+    const QVector<ColumnRun> all = bitmap_ ? runsOf(tiles_) : QVector<ColumnRun>();
+    const QVector<ColumnRun>& runs = bitmap_ ? all : runs_;
+    int top = runs.front().y, bottom = runs.front().y + runs.front().length - 1;
+    for (const ColumnRun& run : runs) {
+        top = std::min(top, run.y);
+        bottom = std::max(bottom, run.y + run.length - 1);
+    }
+    return QRect(QPoint(runs.front().x, top), QPoint(runs.back().x, bottom));
+}
+
+bool SelectionMask::contains(const QPoint loc) const {
+    if (bitmap_) {
+        const auto it = tiles_.find(tileKey(loc.x() >> TileShift, loc.y() >> TileShift));
+        return it != tiles_.end() && (it->second.columns[loc.x() & TileMask] >> (loc.y() & TileMask) & 1);
+    }
+
+    // the last run starting at or before loc
+    auto it = std::upper_bound(runs_.cbegin(), runs_.cend(), loc, [](const QPoint p, const ColumnRun& run) {
+        return p.x() < run.x || (p.x() == run.x && p.y() < run.y);
+    });
+    if (it == runs_.cbegin()) return false;
+    --it;
+    return it->x == loc.x() && loc.y() - it->y < it->length;
+}
+
+bool SelectionMask::isBitmap() const { return bitmap_; }
+
+qint64 SelectionMask::bytes() const {
+    // a map node is the value and about four pointers
+    return static_cast<qint64>(sizeof(SelectionMask) + runs_.capacity() * sizeof(ColumnRun)
+                               + tiles_.size() * (sizeof(Bits) + sizeof(quint64) + 4 * sizeof(void*)));
+}
+
+QVector<ColumnRun> SelectionMask::runs() const { return bitmap_ ? runsOf(tiles_) : runs_; }
+
+QVector<ColumnRun> SelectionMask::clip(QVector<ColumnRun> runs) const {
+    RasterLayer::uniteRuns(runs);
+    if (!bitmap_) return combine(runs, runs_, Combine::Intersection);
+    return combine(SelectionMask(std::move(runs)), *this, Combine::Intersection).runs();
+}
+
+QVector<ColumnRun> SelectionMask::clip(const QRect& box) const {
+    if (box.isEmpty() || isEmpty()) return QVector<ColumnRun>();
+    return clip(rect(box).runs_);
+}
+
+// mutators ---------------------------
+
+void SelectionMask::compact() {
+    // bits: a word per column of a tile. Runs: one per run of consecutive pixels, so
+    // one per start bit in a word of a bitmap; a run across a tile edge counts twice,
+    // which is close enough to choose by
+    if (!bitmap_) {
+        area_ = 0;
+        for (const ColumnRun& run : runs_) area_ += run.length;
+        if (static_cast<size_t>(runs_.size()) * sizeof(ColumnRun) <= sizeof(Bits)) return; // too few to matter
+
+        std::unordered_set<quint64> touched;
+        for (const ColumnRun& run : runs_)
+            for (int ty = run.y >> TileShift; ty <= (run.y + run.length - 1) >> TileShift; ty++)
+                touched.insert(tileKey(run.x >> TileShift, ty));
+        if (static_cast<size_t>(runs_.size()) * sizeof(ColumnRun) <= touched.size() * sizeof(Bits)) return;
+
+        tiles_ = tilesOf(runs_);
+        QVector<ColumnRun>().swap(runs_);
+        bitmap_ = true;
+        return;
+    }
+
+    area_ = 0;
+    size_t runs = 0;
+    for (const auto& [key, bits] : tiles_) {
+        for (const quint64 word : bits.columns) {
+            area_ += qPopulationCount(word);
+            runs += qPopulationCount(word & ~(word << 1));
+        }
+    }
+    if (runs * sizeof(ColumnRun) > tiles_.size() * sizeof(Bits)) return;
+
+    runs_ = runsOf(tiles_);
+    tiles_.clear();
+    bitmap_ = false;
+}
+
+// other functions ---------------------------
+
+SelectionMask SelectionMask::united(const SelectionMask& other) const { return combine(*this, other, Combine::Union); }
+
+SelectionMask SelectionMask::intersected(const SelectionMask& other) const {
+    return combine(*this, other, Combine::Intersection);
+}
+
+SelectionMask SelectionMask::subtracted(const SelectionMask& other) const {
+    return combine(*this, other, Combine::Difference);
+}
+
+QVector<ColumnRun> SelectionMask::runsOf(const std::map<quint64, Bits>& tiles) {
+    // the tiles of one tile column at a time, which the keys keep together, walked
+    // pixel column by pixel column from the top tile down
+    QVector<ColumnRun> runs;
+    for (auto group = tiles.cbegin(); group != tiles.cend();) {
+        const int tx = keyX(group->first);
+        auto end = group;
+        while (end != tiles.cend() && keyX(end->first) == tx) ++end;
+
+        for (int lx = 0; lx < TileSize; lx++) {
+            const int x = tx * TileSize + lx;
+            const qsizetype first = runs.size();
+            for (auto it = group; it != end; ++it) {
+                const int top = keyY(it->first) * TileSize;
+                quint64 word = it->second.columns[lx];
+                while (word) {
+                    const int start = static_cast<int>(qCountTrailingZeroBits(word));
+                    const quint64 rest = ~(word >> start);
+                    const int length = rest ? static_cast<int>(qCountTrailingZeroBits(rest)) : TileSize - start;
+                    word &= ~bitRange(start, start + length - 1);
+
+                    const int y = top + start;
+                    if (runs.size() > first && runs.back().y + runs.back().length == y) {
+                        runs.back().length += length; // continues from the tile above
+                    } else {
+                        runs.append({x, y, length});
+                    }
+                }
+            }
+        }
+        group = end;
+    }
+    return runs;
+}
+
+std::map<quint64, SelectionMask::Bits> SelectionMask::tilesOf(const QVector<ColumnRun>& runs) {
+    std::map<quint64, Bits> tiles;
+    auto hint = tiles.end();
+    for (const ColumnRun& run : runs) {
+        const int lx = run.x & TileMask;
+        const qint64 last = static_cast<qint64>(run.y) + run.length - 1;
+        for (qint64 y = run.y; y <= last;) {
+            const int ty = static_cast<int>(y >> TileShift);
+            const qint64 end = std::min(last, static_cast<qint64>(ty) * TileSize + TileMask);
+            hint = tiles.try_emplace(hint, tileKey(run.x >> TileShift, ty), Bits{});
+            hint->second.columns[lx] |= bitRange(static_cast<int>(y & TileMask), static_cast<int>(end & TileMask));
+            y = end + 1;
+        }
+    }
+    return tiles;
+}
+
+QVector<ColumnRun> SelectionMask::combine(const QVector<ColumnRun>& a, const QVector<ColumnRun>& b, Combine op) {
+    auto keep = [op](bool inA, bool inB) {
+        switch (op) {
+        case Combine::Union: return inA || inB;
+        case Combine::Intersection: return inA && inB;
+        case Combine::Difference: return inA && !inB;
+        }
+        return false;
+    };
+
+    QVector<ColumnRun> out;
+    const ColumnRun *ia = a.constData(), *ib = b.constData();
+    const ColumnRun *const lastA = ia + a.size(), *const lastB = ib + b.size();
+    while (ia != lastA || ib != lastB) {
+        // the runs of the next column in either list
+        const int x = ib == lastB ? ia->x : ia == lastA ? ib->x : std::min(ia->x, ib->x);
+        const ColumnRun *endA = ia, *endB = ib;
+        while (endA != lastA && endA->x == x) ++endA;
+        while (endB != lastB && endB->x == x) ++endB;
+
+        // down the column from edge to edge of either list's runs, starting a run of
+        // the result where keep turns true and ending it where it turns false
+        bool inA = false, inB = false;
+        qint64 start = 0;
+        while (ia != endA || ib != endB) {
+            const qint64 edgeA = ia == endA ? LLONG_MAX : inA ? static_cast<qint64>(ia->y) + ia->length : ia->y;
+            const qint64 edgeB = ib == endB ? LLONG_MAX : inB ? static_cast<qint64>(ib->y) + ib->length : ib->y;
+            const qint64 y = std::min(edgeA, edgeB);
+            const bool before = keep(inA, inB);
+            if (edgeA == y) {
+                if (inA) ++ia;
+                inA = !inA;
+            }
+            if (edgeB == y) {
+                if (inB) ++ib;
+                inB = !inB;
+            }
+            const bool after = keep(inA, inB);
+            if (!before && after) start = y;
+            if (before && !after) out.append({x, static_cast<int>(start), static_cast<int>(y - start)});
+        }
+    }
+    return out;
+}
+
+SelectionMask SelectionMask::combine(const SelectionMask& a, const SelectionMask& b, Combine op) {
+    if (!a.bitmap_ && !b.bitmap_) {
+        SelectionMask mask(combine(a.runs_, b.runs_, op));
+        mask.compact();
+        return mask;
+    }
+
+    // a word at a time, the run form made into tiles first
+    const std::map<quint64, Bits> convertedA = a.bitmap_ ? std::map<quint64, Bits>() : tilesOf(a.runs_);
+    const std::map<quint64, Bits> convertedB = b.bitmap_ ? std::map<quint64, Bits>() : tilesOf(b.runs_);
+    const std::map<quint64, Bits>& tilesA = a.bitmap_ ? a.tiles_ : convertedA;
+    const std::map<quint64, Bits>& tilesB = b.bitmap_ ? b.tiles_ : convertedB;
+
+    SelectionMask mask;
+    mask.bitmap_ = true;
+    auto put = [&mask](quint64 key, const Bits& bits) {
+        for (const quint64 word : bits.columns)
+            if (word) {
+                mask.tiles_.emplace_hint(mask.tiles_.end(), key, bits);
+                return;
+            }
+    };
+    auto ia = tilesA.cbegin(), ib = tilesB.cbegin();
+    while (ia != tilesA.cend() || ib != tilesB.cend()) {
+        const bool hasA = ia != tilesA.cend() && (ib == tilesB.cend() || ia->first <= ib->first);
+        const bool hasB = ib != tilesB.cend() && (ia == tilesA.cend() || ib->first <= ia->first);
+        if (hasA && hasB) {
+            Bits bits;
+            for (int i = 0; i < TileSize; i++) {
+                const quint64 x = ia->second.columns[i], y = ib->second.columns[i];
+                bits.columns[i] = op == Combine::Union ? x | y : op == Combine::Intersection ? x & y : x & ~y;
+            }
+            put(ia->first, bits);
+        } else if (hasA && op != Combine::Intersection) {
+            put(ia->first, ia->second);
+        } else if (hasB && op == Combine::Union) {
+            put(ib->first, ib->second);
+        }
+        if (hasA) ++ia;
+        if (hasB) ++ib;
+    }
+    mask.compact();
+    return mask;
+}
@@ -0,0 +1,126 @@
+#ifndef SELECTIONMASK_H
+#define SELECTIONMASK_H
+
+#include <floodfill.h>
+#include <pixelstorage.h>
+#include <QPointF>
+#include <QRect>
+#include <QVector>
+#include <map>
+
+// A set of canvas pixels that edits are limited to: the selection.
+//
+// A mask is held in whichever of two forms is smaller. Shapes drawn with a
+// tool, rectangles, ellipses and lassos, are a run or two per column, so they
+// are kept as column runs, sorted and united, the same runs
+// RasterLayer::fillRuns and LayerDelta::recordRuns take. A magic wand over
+// noisy pixels can break into runs of a pixel or two, so a mask whose runs
+// would take more room than bitmaps of the 64 x 64 tiles they touch is kept
+// as those bitmaps instead, a bit per pixel.
+//
+// Union, intersection and difference merge the runs of the two masks column
+// by column in one pass, so they take time in proportion to the number of
+// runs. Where either mask is a bitmap they combine the tiles a word at a
+// time. clip() cuts the runs of an edit down to the mask the same way, which
+// is how the controller limits fills, strokes and erases to the selection
+// without looking each pixel up.
+class SelectionMask
+{
+private:
+    static constexpr int TileShift = 6;
+    static constexpr int TileSize = 1 << TileShift;
+    static constexpr int TileMask = TileSize - 1;
+
+    // bit ly of columns[lx] is set if the pixel at (lx, ly) of the tile is selected
+    struct Bits {
+        quint64 columns[TileSize];
+    };
+
+    enum class Combine {
+        Union,
+        Intersection,
+        Difference,
+    };
+
+    QVector<ColumnRun> runs_;       // when not a bitmap: sorted and united
+    std::map<quint64, Bits> tiles_; // when a bitmap: no empty tiles
+    bool bitmap_;
+    qint64 area_;
+
+    // key of the tile at tile coordinates (tx, ty). Biased so that keys sort by tx,
+    // then ty, column by column as runs do
+    static quint64 tileKey(int tx, int ty) {
+        return (static_cast<quint64>(static_cast<quint32>(tx) ^ 0x80000000u) << 32)
+               | (static_cast<quint32>(ty) ^ 0x80000000u);
+    }
+    static int keyX(quint64 key) { return static_cast<int>(static_cast<quint32>(key >> 32) ^ 0x80000000u); }
+    static int keyY(quint64 key) { return static_cast<int>(static_cast<quint32>(key) ^ 0x80000000u); }
+
+    // a mask of united runs, in run form whatever its size
+    explicit SelectionMask(QVector<ColumnRun> runs);
+
+    // return the runs of a bitmap
+    static QVector<ColumnRun> runsOf(const std::map<quint64, Bits>& tiles);
+    // return the bitmap of united runs
+    static std::map<quint64, Bits> tilesOf(const QVector<ColumnRun>& runs);
+
+    // return op applied to two lists of united runs
+    static QVector<ColumnRun> combine(const QVector<ColumnRun>& a, const QVector<ColumnRun>& b, Combine op);
+    // return op applied to two masks, in whichever form fits the result
+    static SelectionMask combine(const SelectionMask& a, const SelectionMask& b, Combine op);
+
+    // count the area and switch to the smaller form
+    void compact();
+
+public:
+    // constructor destructor ---------------------------
+
+    // an empty mask
+    SelectionMask();
+
+    // masks from the selection tools. rect and ellipse fill box; ellipse takes the
+    // pixels whose centers are inside, as a round brush does. lasso takes the pixels
+    // whose centers are inside the polygon through points (even-odd, closed back to
+    // the first point). magicWand is FloodFill::region as a mask
+    static SelectionMask rect(const QRect& box);
+    static SelectionMask ellipse(const QRect& box);
+    static SelectionMask lasso(const QVector<QPointF>& points);
+    static SelectionMask magicWand(const RasterLayer& layer, const QRect& bounds, const QPoint seed, int tolerance,
+                                   FloodFill::Mode mode, WorkerPool& pool);
+    // the pixels runs cover, which need not be united
+    static SelectionMask fromRuns(QVector<ColumnRun> runs);
+
+    // accessors ---------------------------
+
+    bool isEmpty() const;
+
+    // return the number of selected pixels
+    qint64 area() const;
+
+    // return the smallest rectangle holding every selected pixel
+    QRect boundingRect() const;
+
+    // return if loc is selected
+    bool contains(const QPoint loc) const;
+
+    // return if the mask is held as tile bitmaps rather than runs
+    bool isBitmap() const;
+
+    // return the approximate number of bytes the mask occupies
+    qint64 bytes() const;
+
+    // return the selected pixels as united runs
+    QVector<ColumnRun> runs() const;
+
+    // return the parts of runs, or of box, that are selected, as united runs
+    QVector<ColumnRun> clip(QVector<ColumnRun> runs) const;
+    QVector<ColumnRun> clip(const QRect& box) const;
+
+    // other functions ---------------------------
+
+    SelectionMask united(const SelectionMask& other) const;
+    SelectionMask intersected(const SelectionMask& other) const;
+    SelectionMask subtracted(const SelectionMask& other) const;
+};
+
+#endif // SELECTIONMASK_H
@@ -0,0 +1,271 @@
+#include "sparsestorage.h"
+#include <avltreeimpl.h>
+#include <algorithm>
+#include <climits>
+#include <sstream>
+#include <unordered_set>
+
+// constructor destructor ---------------------------
+
+SparseStorage::SparseStorage()
+    : size_(0) {}
+
+SparseStorage::SparseStorage(const SparseStorage& other)
+    : pixelData_(other.pixelData_), size_(other.size_) {}
+
+PixelStorage* SparseStorage::clone() const {
+    return new SparseStorage(*this);
+}
+
+// accessors ---------------------------
+
+int SparseStorage::size() const { return size_; }
+
+bool SparseStorage::contains(const QPoint loc) const {
+    auto column = pixelData_.get(loc.x());
+    if (!column.has_value())
+        return false;
+    return column.value().get().contains(loc.y());
+}
+
+std::optional<Pixel> SparseStorage::get(const QPoint loc) const {
+    auto column = pixelData_.get(loc.x());
+    if (!column.has_value())
+        return std::nullopt;
+
+    auto c = column.value().get().get(loc.y());
+    if (!c.has_value())
+        return std::nullopt;
+
+    return c.value().get();
+}
+
+bool SparseStorage::forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const {
+    if (box.isEmpty()) return true;
+    int firstX = box.left();
+
+    if (after != nullptr) {
+        if (after->x() > box.right()) return true; // nothing comes after it
+
+        // finish the column the walk stopped in
+        if (after->x() >= box.left() && after->y() < box.bottom()) {
+            auto column = pixelData_.get(after->x());
+            if (column.has_value()) {
+                const int x = after->x();
+                bool more = column.value().get().forEachInRange(std::max(after->y() + 1, box.top()), box.bottom(),
+                    [x, &visit](const int& y, const Pixel& p) { return visit(QPoint(x, y), p); });
+                if (!more) return false;
+            }
+        }
+
+        if (after->x() == INT_MAX) return true;
+        firstX = std::max(box.left(), after->x() + 1);
+    }
+
+    return pixelData_.forEachInRange(firstX, box.right(), [&box, &visit](const int& x, const Column& column) {
+        return column.forEachInRange(box.top(), box.bottom(),
+            [x, &visit](const int& y, const Pixel& p) { return visit(QPoint(x, y), p); });
+    });
+}
+
+int SparseStorage::occupiedTiles(const int tileSize) const {
+    // floor division, so negative coordinates land in the right cell
+    auto cell = [tileSize](int v) -> quint32 {
+        return static_cast<quint32>(v >= 0 ? v / tileSize : -((-(qint64)v + tileSize - 1) / tileSize));
+    };
+
+    std::unordered_set<quint64> tiles;
+    pixelData_.forEachInRange(INT_MIN, INT_MAX, [&](const int& x, const Column& column) {
+        const quint64 tx = cell(x);
+        column.forEachInRange(INT_MIN, INT_MAX, [&](const int& y, const Pixel&) {
+            tiles.insert((tx << 32) | cell(y));
+        });
+    });
+    return static_cast<int>(tiles.size());
+}
+
+void SparseStorage::collectCells(const int shift, std::vector<QPoint>& out) const {
+    // a column lies in one column of cells, so cells only repeat between columns that share it
+    int cellX = 0;
+    std::unordered_set<int> seen; // cell rows found in the current column of cells
+    pixelData_.forEachInRange(INT_MIN, INT_MAX, [&](const int& x, const Column& column) {
+        if (seen.empty() || (x >> shift) != cellX) {
+            seen.clear();
+            cellX = x >> shift;
+        }
+        column.forEachInRange(INT_MIN, INT_MAX, [&](const int& y, const Pixel&) {
+            if (seen.insert(y >> shift).second) out.emplace_back(cellX, y >> shift);
+        });
+    });
+}
+
+// helper functions ---------------------------
+
+int SparseStorage::upsertRun(const int x, const Run& run) {
+    if (run.empty()) return 0;
+
+    auto existing = pixelData_.get(x);
+    if (!existing.has_value()) { // new column, build it straight from the run
+        pixelData_.upsert(x, Column());
+        pixelData_.get(x)->get().buildFromSorted(run.begin(), run.end());
+        size_ += static_cast<int>(run.size());
+        return static_cast<int>(run.size());
+    }
+
+    Column& column = existing.value().get();
+    const int before = column.size();
+
+    if (run.size() < static_cast<size_t>(before)) {
+        // into a bigger column: plain upserts are cheaper than a rebuild
+        for (const auto& [y, p] : run) column.upsert(y, p);
+    } else {
+        // merge the column with the run (the run wins on equal y) and rebuild in O(n)
+        Run merged;
+        merged.reserve(before + run.size());
+        auto r = run.begin();
+        for (const auto& [y, p] : column) {
+            for (; r != run.end() && r->first < y; ++r) merged.push_back(*r);
+            if (r != run.end() && r->first == y) merged.push_back(*r++);
+            else merged.push_back({y, p});
+        }
+        merged.insert(merged.end(), r, run.end());
+        column.buildFromSorted(merged.begin(), merged.end());
+    }
+
+    const int added = column.size() - before;
+    size_ += added;
+    return added;
+}
+
+// mutators ---------------------------
+
+void SparseStorage::clear() {
+    pixelData_.clear();
+    size_ = 0;
+}
+
+bool SparseStorage::update(const QPoint loc, const Pixel p) {
+    auto column = pixelData_.get(loc.x());
+    if (!column.has_value()) return false; // do nothing
+    if (!column.value().get().contains(loc.y())) return false;
+
+    column.value().get().update(loc.y(), p);
+    return true;
+}
+
+bool SparseStorage::upsert(const QPoint loc, const Pixel p) {
+    auto column = pixelData_.get(loc.x());
+    if (!column.has_value()) { // if the col doesnt exist yet, make a new one
+        pixelData_.upsert(loc.x(), Column());
+        pixelData_.get(loc.x())->get().upsert(loc.y(), p);
+        size_++; // increment size since we added a new pixel
+        return true;
+    }
+
+    bool isNew = !column.value().get().contains(loc.y());
+    if (isNew) size_++; // if the pixel is new, increment
+    column.value().get().upsert(loc.y(), p); // normal upsert
+    return isNew;
+}
+
+bool SparseStorage::remove(const QPoint loc) {
+    auto column = pixelData_.get(loc.x());
+    if (!column.has_value()) return false; // do nothing
+
+    if (!column.value().get().contains(loc.y())) return false;
+    column.value().get().remove(loc.y());
+    size_--;
+
+    if (column.value().get().size() == 0) { // if the col becomes empty, delete it
+        pixelData_.remove(loc.x());
+    }
+    return true;
+}
+
+int SparseStorage::upsertSorted(const PixelRef* first, const PixelRef* last) {
+    int added = 0;
+    Run run;
+    while (first != last) { // one run per column
+        const int x = first->location.x();
+        run.clear();
+        for (; first != last && first->location.x() == x; ++first) run.push_back({first->location.y(), first->value});
+        added += upsertRun(x, run);
+    }
+    return added;
+}
+
+int SparseStorage::removeSorted(const QPoint* first, const QPoint* last) {
+    int removed = 0;
+    while (first != last) { // one column lookup per run
+        const int x = first->x();
+        auto column = pixelData_.get(x);
+        if (!column.has_value()) {
+            while (first != last && first->x() == x) ++first;
+            continue;
+        }
+
+        Column& c = column.value().get();
+        const int before = c.size();
+        for (; first != last && first->x() == x; ++first) c.remove(first->y());
+
+        removed += before - c.size();
+        if (c.size() == 0) pixelData_.remove(x); // if the col becomes empty, delete it
+    }
+    size_ -= removed;
+    return removed;
+}
+
+int SparseStorage::fillRect(const QRect& box, const Pixel p) {
+    if (box.isEmpty()) return 0;
+
+    Run run;
+    run.reserve(box.height());
+    for (qint64 y = box.top(); y <= box.bottom(); y++) run.push_back({static_cast<int>(y), p});
+
+    // every column gets the same run
+    int added = 0;
+    for (qint64 x = box.left(); x <= box.right(); x++) added += upsertRun(static_cast<int>(x), run);
+    return added;
+}
+
+int SparseStorage::fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) {
+    int added = 0;
+    Run run;
+    while (first != last) { // one column lookup for all its runs
+        const int x = first->x;
+        run.clear();
+        for (; first != last && first->x == x; ++first)
+            for (qint64 y = first->y; y < static_cast<qint64>(first->y) + first->length; y++) run.push_back({static_cast<int>(y), p});
+        added += upsertRun(x, run);
+    }
+    return added;
+}
+
+// other functions ---------------------------
+
+// prints out the column tree, then the tree of every column
+std::string SparseStorage::toString() const {
+    std::ostringstream oss;
+
+    oss << "Pixel Data [Columns]: " << std::endl;
+
+    // print out the column tree structure
+    oss << pixelData_.toString([](const int& k) -> std::string {
+        return "x=" + std::to_string(k);
+    }) << std::endl;
+
+    oss << "Pixel Data [Per Column]: " << std::endl;
+
+    // get all columns and print out the pixel tree structure
+    for (const auto& [x, c] : pixelData_) {
+        oss << "Column x=" << std::to_string(x) << " [size=" << c.size() << "] : " << std::endl;
+        oss << c.toString([](const int& k) -> std::string {
+            return "y=" + std::to_string(k);
+        }) << std::endl;
+    }
+
+    return oss.str();
+}
+
+template class AVLTree<int, Pixel>;
+template class AVLTree<int, AVLTree<int, Pixel>>;
@@ -0,0 +1,60 @@
+#ifndef SPARSESTORAGE_H
+#define SPARSESTORAGE_H
+
+#include <avltree.h>
+#include <pixelstorage.h>
+#include <vector>
+
+// Pixels kept as an AVL tree of columns (keyed by x), each an AVL tree of
+// packed pixels keyed by y. Cheap for a handful of scattered pixels, expensive
+// per pixel once a region is densely painted (see TiledStorage).
+class SparseStorage : public PixelStorage
+{
+    typedef AVLTree<int, Pixel> Column;
+    typedef std::vector<std::pair<int, Pixel>> Run; // (y, pixel), sorted by y
+
+private:
+    // stores essentially "columns" of pixels
+    AVLTree<int, Column> pixelData_;
+    int size_;
+
+    // upsert a sorted run of pixels into column x, looking the column up once.
+    // Returns how many were new
+    int upsertRun(const int x, const Run& run);
+
+public:
+    // constructor destructor ---------------------------
+    SparseStorage();
+    SparseStorage(const SparseStorage& other);
+
+    PixelStorage* clone() const override;
+
+    // accessors ---------------------------
+    int size() const override;
+    bool contains(const QPoint loc) const override;
+    std::optional<Pixel> get(const QPoint loc) const override;
+    // visits columns left to right, each top to bottom
+    bool forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const override;
+
+    // return how many tileSize x tileSize cells hold at least one pixel
+    int occupiedTiles(const int tileSize) const;
+
+    // takes each column once
+    void collectCells(const int shift, std::vector<QPoint>& out) const override;
+
+    // mutators ---------------------------
+    void clear() override;
+    bool update(const QPoint loc, const Pixel p) override;
+    bool upsert(const QPoint loc, const Pixel p) override;
+    bool remove(const QPoint loc) override;
+    int upsertSorted(const PixelRef* first, const PixelRef* last) override;
+    int removeSorted(const QPoint* first, const QPoint* last) override;
+    int fillRect(const QRect& box, const Pixel p) override;
+    // the runs of one column go into it together
+    int fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) override;
+
+    // other functions ---------------------------
+    std::string toString() const override;
+};
+
+#endif // SPARSESTORAGE_H
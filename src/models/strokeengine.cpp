@@ -0,0 +1,136 @@
+#include "strokeengine.h"
+#include <rasterlayer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// brushes are clamped to this, so a stamp stays a few thousand runs at most
+static constexpr int MaxBrushSize = 1024;
+
+// constructor destructor ---------------------------
+
+StrokeEngine::StrokeEngine()
+    : stamp_(nullptr), started_(false), sinceStamp_(0), hasStamp_(false) {
+    setBrush(Brush());
+}
+
+// accessors ---------------------------
+
+StrokeEngine::Brush StrokeEngine::brush() const { return brush_; }
+
+const std::vector<ColumnRun>& StrokeEngine::stamp() const { return *stamp_; }
+
+bool StrokeEngine::isStroking() const { return started_; }
+
+// mutators ---------------------------
+
+void StrokeEngine::setBrush(const Brush& brush) {
+    brush_ = brush;
+    brush_.size = std::clamp(brush.size, 1, MaxBrushSize);
+    if (!(brush_.spacing >= 0)) brush_.spacing = 0; // also catches NaN
+
+    const quint32 key = static_cast<quint32>(brush_.size) << 1 | (brush_.shape == Shape::Square ? 1 : 0);
+    auto it = stamps_.find(key);
+    if (it == stamps_.end()) it = stamps_.emplace(key, makeStamp(brush_.shape, brush_.size)).first;
+    stamp_ = &it->second;
+    hasStamp_ = false; // the last stamp was another shape
+}
+
+QVector<ColumnRun> StrokeEngine::moveTo(const QPointF& p) {
+    QVector<ColumnRun> out;
+    const QPoint target(static_cast<int>(std::floor(p.x())), static_cast<int>(std::floor(p.y())));
+    if (!started_) {
+        started_ = true;
+        last_ = target;
+        sinceStamp_ = 0;
+        stampAt(target, out);
+        return out;
+    }
+    if (target == last_) return out;
+
+    // Bresenham from the last pixel, which is covered already, to the new one
+    const int step = std::max(1, static_cast<int>(std::lround(brush_.spacing * brush_.size)));
+    const qint64 dx = std::abs(static_cast<qint64>(target.x()) - last_.x());
+    const qint64 dy = -std::abs(static_cast<qint64>(target.y()) - last_.y());
+    const int sx = last_.x() < target.x() ? 1 : -1, sy = last_.y() < target.y() ? 1 : -1;
+    qint64 error = dx + dy;
+    QPoint at = last_;
+    while (at != target) {
+        const qint64 twice = 2 * error;
+        if (twice >= dy) {
+            error += dy;
+            at.rx() += sx;
+        }
+        if (twice <= dx) {
+            error += dx;
+            at.ry() += sy;
+        }
+        if (++sinceStamp_ >= step || at == target) {
+            stampAt(at, out);
+            sinceStamp_ = 0;
+        }
+    }
+    last_ = target;
+
+    RasterLayer::uniteRuns(out);
+    return out;
+}
+
+void StrokeEngine::restamp() { hasStamp_ = false; }
+
+void StrokeEngine::reset() {
+    started_ = false;
+    hasStamp_ = false;
+}
+
+// other functions ---------------------------
+
+std::vector<ColumnRun> StrokeEngine::makeStamp(Shape shape, int size) {
+    // pixels 0..size-1 each way, with the pointer's pixel at size / 2
+    const int origin = size / 2;
+    std::vector<ColumnRun> runs;
+    if (shape == Shape::Square) {
+        for (int i = 0; i < size; i++) runs.push_back({i - origin, -origin, size});
+        return runs;
+    }
+
+    // the pixels whose centers are within size / 2 of the middle of the square
+    const double center = (size - 1) / 2.0, r2 = size * size / 4.0;
+    for (int i = 0; i < size; i++) {
+        const double h = std::sqrt(std::max(0.0, r2 - (i - center) * (i - center)));
+        const int top = static_cast<int>(std::ceil(center - h)), bottom = static_cast<int>(std::floor(center + h));
+        if (top <= bottom) runs.push_back({i - origin, top - origin, bottom - top + 1});
+    }
+    return runs;
+}
+
+void StrokeEngine::stampAt(const QPoint at, QVector<ColumnRun>& out) {
+    const std::vector<ColumnRun>& stamp = *stamp_;
+    const bool overlaps = hasStamp_ && std::abs(static_cast<qint64>(at.x()) - lastStamp_.x()) < brush_.size &&
+                          std::abs(static_cast<qint64>(at.y()) - lastStamp_.y()) < brush_.size;
+    hasStamp_ = true;
+    const QPoint last = lastStamp_;
+    lastStamp_ = at;
+    if (!overlaps) {
+        for (const ColumnRun& run : stamp) out.append({at.x() + run.x, at.y() + run.y, run.length});
+        return;
+    }
+
+    // the last stamp's run in the same column, if there is one: stamps have a run in
+    // every column, so it is found by offset
+    const int shift = at.x() - last.x();
+    for (size_t i = 0; i < stamp.size(); i++) {
+        const int x = at.x() + stamp[i].x, top = at.y() + stamp[i].y, bottom = top + stamp[i].length;
+        const qint64 j = static_cast<qint64>(i) + shift;
+        if (j < 0 || j >= static_cast<qint64>(stamp.size())) {
+            out.append({x, top, stamp[i].length});
+            continue;
+        }
+        const int coveredTop = last.y() + stamp[j].y, coveredBottom = coveredTop + stamp[j].length;
+        if (top < coveredTop) out.append({x, top, std::min(bottom, coveredTop) - top});
+        if (bottom > coveredBottom) {
+            const int from = std::max(top, coveredBottom);
+            out.append({x, from, bottom - from});
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef STROKEENGINE_H
+#define STROKEENGINE_H
+
+#include <pixelstorage.h>
+#include <QPointF>
+#include <QVector>
+#include <unordered_map>
+#include <vector>
+
+// Turns raw pointer samples into the pixels a brush covers, as column runs.
+//
+// Each sample lands on the pixel under it. Between two samples the engine
+// walks the pixel line (Bresenham) and puts a stamp of the brush down every
+// spacing pixels along it, and at the sample itself, so fast pointer motion
+// leaves no gaps. A 1 pixel brush stamps every pixel of the line: the hard
+// pixel line.
+//
+// A stamp is a span list, the brush's column runs around the pixel under the
+// pointer, built once per shape and size and cached. Both shapes have one run
+// per column, so a stamp leaves out what the stamp before it covered with one
+// interval subtraction per column: a slow drag emits the crescent the brush
+// moved into, not the whole disc again, and the cost of a sample follows the
+// distance moved rather than the area of the brush. What a sample covers comes
+// out united by RasterLayer::uniteRuns, ready for LayerDelta::recordRuns and
+// RasterLayer::fillRuns.
+class StrokeEngine
+{
+public:
+    enum class Shape {
+        Round,
+        Square,
+    };
+
+    struct Brush {
+        int size = 1;              // diameter in pixels
+        Shape shape = Shape::Round;
+        float spacing = 0.1f;      // distance between stamps, as a fraction of size, at least a pixel
+    };
+
+private:
+    Brush brush_;
+    std::unordered_map<quint32, std::vector<ColumnRun>> stamps_; // by shape and size
+    const std::vector<ColumnRun>* stamp_;                        // the one of brush_
+    bool started_;
+    QPoint last_;      // pixel of the last sample
+    int sinceStamp_;   // pixels walked since the last stamp
+    bool hasStamp_;    // if lastStamp_ is down with the current stamp
+    QPoint lastStamp_; // pixel of the last stamp
+
+    // build the stamp of a brush
+    static std::vector<ColumnRun> makeStamp(Shape shape, int size);
+
+    // append the stamp centered on pixel at to out, less what the last stamp covered
+    void stampAt(const QPoint at, QVector<ColumnRun>& out);
+
+public:
+    // constructor destructor ---------------------------
+    StrokeEngine();
+
+    // accessors ---------------------------
+
+    // return the current brush
+    Brush brush() const;
+
+    // return the stamp of the current brush, relative to the pixel under the pointer
+    const std::vector<ColumnRun>& stamp() const;
+
+    // return if a stroke is under way, so the next sample continues it
+    bool isStroking() const;
+
+    // mutators ---------------------------
+
+    // change the brush. A stroke under way goes on with the new one
+    void setBrush(const Brush& brush);
+
+    // return the runs newly covered going to the sample at p. The first sample of a
+    // stroke stamps only at its own pixel
+    QVector<ColumnRun> moveTo(const QPointF& p);
+
+    // the next stamp goes down in full, for when what the brush puts down changes in
+    // the middle of a stroke (another color, another layer, painting to erasing)
+    void restamp();
+
+    // end the stroke: the next sample starts a new one
+    void reset();
+};
+
+#endif // STROKEENGINE_H
@@ -0,0 +1,426 @@
+#include "tiledstorage.h"
+#include <QtCore/qalgorithms.h>
+#include <algorithm>
+#include <sstream>
+#include <type_traits>
+
+// conversions between tile words and the two value types of the interface
+static Pixel toPixel(Pixel p) { return p; }
+static Pixel toPixel(QRgba64 w) { return Pixel::fromRgba64(w); }
+static QRgba64 toWide(Pixel p) { return p.toRgba64(); }
+static QRgba64 toWide(QRgba64 w) { return w; }
+
+template <typename Word>
+static Word toWord(Pixel p) {
+    if constexpr (std::is_same_v<Word, Pixel>) return p;
+    else return p.toRgba64();
+}
+
+template <typename Word>
+static Word toWord(QRgba64 w) {
+    if constexpr (std::is_same_v<Word, Pixel>) return Pixel::fromRgba64(w);
+    else return w;
+}
+
+// constructor destructor ---------------------------
+
+template <typename Word>
+BasicTiledStorage<Word>::BasicTiledStorage()
+    : size_(0) {}
+
+template <typename Word>
+BasicTiledStorage<Word>::BasicTiledStorage(const BasicTiledStorage<Word>& other)
+    : tiles_(other.tiles_), order_(other.order_), size_(other.size_) {} // tiles are shared until written
+
+template <typename Word>
+PixelStorage* BasicTiledStorage<Word>::clone() const {
+    return new BasicTiledStorage<Word>(*this);
+}
+
+// helper functions ---------------------------
+
+template <typename Word>
+const typename BasicTiledStorage<Word>::Tile* BasicTiledStorage<Word>::tileAt(const QPoint loc) const {
+    auto it = tiles_.find(tileKey(loc.x() >> TileShift, loc.y() >> TileShift));
+    return it == tiles_.end() ? nullptr : it->second.get();
+}
+
+template <typename Word>
+const Word* BasicTiledStorage<Word>::wordAt(const QPoint loc) const {
+    const Tile* tile = tileAt(loc);
+    if (tile == nullptr) return nullptr;
+
+    const int lx = loc.x() & TileMask;
+    const int ly = loc.y() & TileMask;
+    if (!(tile->occupied[ly] >> lx & 1)) return nullptr;
+
+    return &tile->pixels[ly * TileSize + lx];
+}
+
+template <typename Word>
+typename BasicTiledStorage<Word>::Tile& BasicTiledStorage<Word>::tileFor(const quint64 key) {
+    auto& slot = tiles_[key];
+    if (!slot) { // first pixel in this tile
+        slot = std::make_shared<Tile>();
+        order_.insert(std::lower_bound(order_.begin(), order_.end(), key), key);
+    }
+    return writable(slot);
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::store(const QPoint loc, const Word w) {
+    Tile& tile = tileFor(tileKey(loc.x() >> TileShift, loc.y() >> TileShift));
+
+    const int lx = loc.x() & TileMask;
+    const int ly = loc.y() & TileMask;
+    tile.pixels[ly * TileSize + lx] = w;
+
+    const quint64 bit = quint64(1) << lx;
+    if (tile.occupied[ly] & bit) return false;
+
+    tile.occupied[ly] |= bit;
+    tile.count++;
+    size_++;
+    return true;
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::clip(quint64 key, const QRect& box, int& lx0, int& lx1, int& ly0, int& ly1) {
+    const qint64 ox = static_cast<qint64>(keyX(key)) * TileSize;
+    const qint64 oy = static_cast<qint64>(keyY(key)) * TileSize;
+
+    lx0 = static_cast<int>(std::max<qint64>(box.left() - ox, 0));
+    lx1 = static_cast<int>(std::min<qint64>(box.right() - ox, TileMask));
+    ly0 = static_cast<int>(std::max<qint64>(box.top() - oy, 0));
+    ly1 = static_cast<int>(std::min<qint64>(box.bottom() - oy, TileMask));
+    return lx0 <= lx1 && ly0 <= ly1;
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::visitTile(quint64 key, const Tile& tile, const QRect& box, PixelVisitor& visit,
+                                        bool resume, int rlx, int rly) {
+    const qint64 ox = static_cast<qint64>(keyX(key)) * TileSize;
+    const qint64 oy = static_cast<qint64>(keyY(key)) * TileSize;
+
+    int lx0, lx1, ly0, ly1;
+    if (!clip(key, box, lx0, lx1, ly0, ly1)) return true;
+    if (resume) ly0 = std::max(ly0, rly);
+    const quint64 columns = columnMask(lx0, lx1);
+
+    for (int ly = ly0; ly <= ly1; ly++) {
+        quint64 bits = tile.occupied[ly] & columns;
+        if (resume && ly == rly) bits &= ~((quint64(2) << rlx) - 1); // drop lx <= rlx (all of them for rlx 63)
+
+        while (bits) { // visit set bits only
+            const int lx = qCountTrailingZeroBits(bits);
+            bits &= bits - 1;
+            if (!visit(QPoint(static_cast<int>(ox + lx), static_cast<int>(oy + ly)),
+                       toPixel(tile.pixels[ly * TileSize + lx]))) return false;
+        }
+    }
+    return true;
+}
+
+// accessors ---------------------------
+
+template <typename Word>
+int BasicTiledStorage<Word>::size() const { return size_; }
+
+template <typename Word>
+int BasicTiledStorage<Word>::tileCount() const { return static_cast<int>(tiles_.size()); }
+
+template <typename Word>
+int BasicTiledStorage<Word>::sharedTileCount() const {
+    int shared = 0;
+    for (const auto& [key, tile] : tiles_) shared += tile.use_count() > 1;
+    return shared;
+}
+
+template <typename Word>
+void BasicTiledStorage<Word>::collectCells(const int shift, std::vector<QPoint>& out) const {
+    if (shift != TileShift) {
+        PixelStorage::collectCells(shift, out);
+        return;
+    }
+    out.reserve(out.size() + order_.size());
+    for (const quint64 key : order_) out.emplace_back(keyX(key), keyY(key));
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::contains(const QPoint loc) const {
+    return wordAt(loc) != nullptr;
+}
+
+template <typename Word>
+std::optional<Pixel> BasicTiledStorage<Word>::get(const QPoint loc) const {
+    const Word* w = wordAt(loc);
+    if (w == nullptr) return std::nullopt;
+    return toPixel(*w);
+}
+
+template <typename Word>
+std::optional<QRgba64> BasicTiledStorage<Word>::getWide(const QPoint loc) const {
+    const Word* w = wordAt(loc);
+    if (w == nullptr) return std::nullopt;
+    return toWide(*w);
+}
+
+template <typename Word>
+template <typename F>
+bool BasicTiledStorage<Word>::forEachTileIn(const QRect& box, quint64 start, F&& visit) const {
+    const int tx0 = box.left() >> TileShift, tx1 = box.right() >> TileShift;
+    const int ty0 = box.top() >> TileShift, ty1 = box.bottom() >> TileShift;
+    const quint64 last = tileKey(tx1, ty1);
+
+    auto it = std::lower_bound(order_.begin(), order_.end(), std::max(start, tileKey(tx0, ty0)));
+    while (it != order_.end() && *it <= last) {
+        const quint64 key = *it;
+        const int tx = keyX(key), ty = keyY(key);
+
+        if (tx < tx0) { // left of the box, jump to its left edge on this row
+            it = std::lower_bound(it, order_.end(), tileKey(tx0, ty));
+            continue;
+        }
+        if (tx > tx1) { // right of the box, jump to the next row
+            it = std::lower_bound(it, order_.end(), tileKey(tx0, ty + 1)); // ty < ty1 here, as key <= last
+            continue;
+        }
+
+        if (!visit(key)) return false;
+        ++it;
+    }
+    return true;
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const {
+    if (box.isEmpty() || order_.empty()) return true;
+
+    // the tile the walk resumes in, and where inside it
+    quint64 resumeKey = 0;
+    int rlx = 0, rly = 0;
+    if (after != nullptr) {
+        resumeKey = tileKey(after->x() >> TileShift, after->y() >> TileShift);
+        rlx = after->x() & TileMask;
+        rly = after->y() & TileMask;
+    }
+
+    return forEachTileIn(box, resumeKey, [&](quint64 key) {
+        const bool resume = after != nullptr && key == resumeKey;
+        return visitTile(key, *tiles_.at(key), box, visit, resume, rlx, rly);
+    });
+}
+
+// mutators ---------------------------
+
+template <typename Word>
+void BasicTiledStorage<Word>::clear() {
+    tiles_.clear();
+    order_.clear();
+    size_ = 0;
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::update(const QPoint loc, const Pixel p) {
+    if (wordAt(loc) == nullptr) return false;
+
+    auto it = tiles_.find(tileKey(loc.x() >> TileShift, loc.y() >> TileShift));
+    writable(it->second).pixels[(loc.y() & TileMask) * TileSize + (loc.x() & TileMask)] = toWord<Word>(p);
+    return true;
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::upsert(const QPoint loc, const Pixel p) {
+    return store(loc, toWord<Word>(p));
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::upsertWide(const QPoint loc, const QRgba64 c) {
+    return store(loc, toWord<Word>(c));
+}
+
+template <typename Word>
+bool BasicTiledStorage<Word>::remove(const QPoint loc) {
+    auto it = tiles_.find(tileKey(loc.x() >> TileShift, loc.y() >> TileShift));
+    if (it == tiles_.end()) return false;
+
+    const int lx = loc.x() & TileMask;
+    const int ly = loc.y() & TileMask;
+    const quint64 bit = quint64(1) << lx;
+    if (!(it->second->occupied[ly] & bit)) return false;
+
+    Tile& tile = writable(it->second);
+
+    tile.occupied[ly] &= ~bit;
+    tile.pixels[ly * TileSize + lx] = Word();
+    size_--;
+
+    if (--tile.count == 0) { // drop empty tiles
+        order_.erase(std::lower_bound(order_.begin(), order_.end(), it->first));
+        tiles_.erase(it);
+    }
+    return true;
+}
+
+template <typename Word>
+int BasicTiledStorage<Word>::upsertSorted(const PixelRef* first, const PixelRef* last) {
+    const int before = size_;
+    quint64 cachedKey = 0;
+    Tile* tile = nullptr; // sorted input stays in one tile for up to 64 pixels at a time
+
+    for (; first != last; ++first) {
+        const QPoint loc = first->location;
+        const quint64 key = tileKey(loc.x() >> TileShift, loc.y() >> TileShift);
+        if (tile == nullptr || key != cachedKey) {
+            tile = &tileFor(key);
+            cachedKey = key;
+        }
+
+        const int lx = loc.x() & TileMask;
+        const int ly = loc.y() & TileMask;
+        tile->pixels[ly * TileSize + lx] = toWord<Word>(first->value);
+
+        const quint64 bit = quint64(1) << lx;
+        if (!(tile->occupied[ly] & bit)) {
+            tile->occupied[ly] |= bit;
+            tile->count++;
+            size_++;
+        }
+    }
+    return size_ - before;
+}
+
+template <typename Word>
+int BasicTiledStorage<Word>::fillRect(const QRect& box, const Pixel p) {
+    if (box.isEmpty()) return 0;
+
+    const Word w = toWord<Word>(p);
+    const int before = size_;
+
+    // whole tile rows at a time: fill the words, then or in the row mask
+    for (qint64 ty = box.top() >> TileShift; ty <= box.bottom() >> TileShift; ty++) {
+        for (qint64 tx = box.left() >> TileShift; tx <= box.right() >> TileShift; tx++) {
+            const quint64 key = tileKey(static_cast<int>(tx), static_cast<int>(ty));
+            int lx0, lx1, ly0, ly1;
+            if (!clip(key, box, lx0, lx1, ly0, ly1)) continue;
+
+            Tile& tile = tileFor(key);
+            const quint64 columns = columnMask(lx0, lx1);
+            for (int ly = ly0; ly <= ly1; ly++) {
+                std::fill(tile.pixels + ly * TileSize + lx0, tile.pixels + ly * TileSize + lx1 + 1, w);
+
+                const int added = static_cast<int>(qPopulationCount(columns & ~tile.occupied[ly]));
+                tile.occupied[ly] |= columns;
+                tile.count += added;
+                size_ += added;
+            }
+        }
+    }
+    return size_ - before;
+}
+
+template <typename Word>
+int BasicTiledStorage<Word>::fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) {
+    const Word w = toWord<Word>(p);
+    const int before = size_;
+    quint64 cachedKey = 0;
+    Tile* tile = nullptr; // neighbouring runs mostly share their tiles
+
+    for (; first != last; ++first) {
+        const int lx = first->x & TileMask;
+        const quint64 bit = quint64(1) << lx;
+        const qint64 bottom = static_cast<qint64>(first->y) + first->length - 1;
+        for (qint64 y = first->y; y <= bottom;) {
+            const quint64 key = tileKey(first->x >> TileShift, static_cast<int>(y >> TileShift));
+            if (tile == nullptr || key != cachedKey) {
+                tile = &tileFor(key);
+                cachedKey = key;
+            }
+
+            // down the column to the end of the run or of the tile
+            const int ly1 = static_cast<int>(std::min<qint64>(bottom - (y & ~qint64(TileMask)), TileMask));
+            for (int ly = static_cast<int>(y & TileMask); ly <= ly1; ly++) {
+                tile->pixels[ly * TileSize + lx] = w;
+                if (!(tile->occupied[ly] & bit)) {
+                    tile->occupied[ly] |= bit;
+                    tile->count++;
+                    size_++;
+                }
+            }
+            y = (y | TileMask) + 1;
+        }
+    }
+    return size_ - before;
+}
+
+template <typename Word>
+int BasicTiledStorage<Word>::eraseRect(const QRect& box) {
+    if (box.isEmpty() || order_.empty()) return 0;
+
+    // collect the tiles first, erasing them from tiles_ while walking order_ would shift it
+    std::vector<quint64> touched;
+    forEachTileIn(box, 0, [&touched](quint64 key) {
+        touched.push_back(key);
+        return true;
+    });
+
+    const int before = size_;
+    for (const quint64 key : touched) {
+        auto it = tiles_.find(key);
+        int lx0, lx1, ly0, ly1;
+        clip(key, box, lx0, lx1, ly0, ly1);
+        const quint64 columns = columnMask(lx0, lx1);
+
+        Tile& tile = writable(it->second);
+        for (int ly = ly0; ly <= ly1; ly++) {
+            const quint64 gone = tile.occupied[ly] & columns;
+            if (!gone) continue;
+            std::fill(tile.pixels + ly * TileSize + lx0, tile.pixels + ly * TileSize + lx1 + 1, Word());
+            tile.occupied[ly] &= ~gone;
+
+            const int removed = static_cast<int>(qPopulationCount(gone));
+            tile.count -= removed;
+            size_ -= removed;
+        }
+
+        if (tile.count == 0) { // drop empty tiles
+            order_.erase(std::lower_bound(order_.begin(), order_.end(), key));
+            tiles_.erase(it);
+        }
+    }
+    return before - size_;
+}
+
+template <typename Word>
+void BasicTiledStorage<Word>::adoptTile(int tx, int ty, std::shared_ptr<Tile> tile, int count) {
+    const quint64 key = tileKey(tx, ty);
+    auto& slot = tiles_[key];
+    if (slot) {
+        size_ -= slot->count;
+    } else if (order_.empty() || order_.back() < key) { // files list their tiles in order
+        order_.push_back(key);
+    } else {
+        order_.insert(std::lower_bound(order_.begin(), order_.end(), key), key);
+    }
+    size_ += count;
+    slot = std::move(tile);
+}
+
+// other functions ---------------------------
+
+// lists the allocated tiles and how full they are
+template <typename Word>
+std::string BasicTiledStorage<Word>::toString() const {
+    std::ostringstream oss;
+
+    oss << "Pixel Data [Tiles " << TileSize << "x" << TileSize << ", "
+        << sizeof(Word) * 8 << " bpp]: " << tiles_.size() << std::endl;
+    for (const quint64 key : order_) {
+        oss << "Tile (" << keyX(key) << ", " << keyY(key) << ") [size=" << tiles_.at(key)->count << "]" << std::endl;
+    }
+
+    return oss.str();
+}
+
+template class BasicTiledStorage<Pixel>;
+template class BasicTiledStorage<QRgba64>;
@@ -0,0 +1,146 @@
+#ifndef TILEDSTORAGE_H
+#define TILEDSTORAGE_H
+
+#include <pixelstorage.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Pixels kept in fixed 64x64 tiles, with a bitmask per tile row recording
+// which pixels are set. Tiles are created on first write and dropped once
+// empty, so cost is proportional to painted area, and get() is one hash lookup
+// plus an array index. Region walks go tile row by tile row, left to right,
+// and top to bottom within a tile.
+//
+// Tiles are copy-on-write: a copy of the storage shares every tile with the
+// original, and whichever side writes to a shared tile first gets its own copy
+// of that one tile. Copying is O(tile count) and never touches pixel data.
+//
+// Word is the per-pixel value stored in a tile: Pixel (premultiplied RGBA8,
+// ~4 bytes per painted pixel) or QRgba64 (premultiplied RGBA16 for HDR work).
+template <typename Word>
+class BasicTiledStorage : public PixelStorage
+{
+public:
+    static constexpr int TileShift = 6;
+    static constexpr int TileSize = 1 << TileShift;
+    static constexpr int TileMask = TileSize - 1;
+
+    struct Tile {
+        Word pixels[TileSize * TileSize]; // row-major, index = ly * TileSize + lx
+        quint64 occupied[TileSize];       // bit lx of occupied[ly] is set if the pixel exists
+        int count;                        // number of set bits
+
+        Tile() : pixels{}, occupied{}, count(0) {}
+    };
+
+private:
+    std::unordered_map<quint64, std::shared_ptr<Tile>> tiles_; // possibly shared with copies
+    std::vector<quint64> order_; // keys of tiles_, sorted
+    int size_;
+
+    // key of the tile at tile coordinates (tx, ty). Biased so that keys sort
+    // by ty, then tx, the same as the signed coordinates
+    static quint64 tileKey(int tx, int ty) {
+        return (static_cast<quint64>(static_cast<quint32>(ty) ^ 0x80000000u) << 32)
+               | (static_cast<quint32>(tx) ^ 0x80000000u);
+    }
+    static int keyX(quint64 key) { return static_cast<int>(static_cast<quint32>(key) ^ 0x80000000u); }
+    static int keyY(quint64 key) { return static_cast<int>(static_cast<quint32>(key >> 32) ^ 0x80000000u); }
+
+    // return the tile holding loc, or nullptr
+    const Tile* tileAt(const QPoint loc) const;
+
+    // return the tile with the given key for writing, creating it if needed
+    Tile& tileFor(const quint64 key);
+
+    // clip box to the tile with the given key, in tile-local coordinates. Returns
+    // false if they do not overlap
+    static bool clip(quint64 key, const QRect& box, int& lx0, int& lx1, int& ly0, int& ly1);
+
+    // bits lx0..lx1 of a row mask
+    static quint64 columnMask(int lx0, int lx1) {
+        const quint64 high = lx1 == TileMask ? ~quint64(0) : (quint64(1) << (lx1 + 1)) - 1;
+        return high & ~((quint64(1) << lx0) - 1);
+    }
+
+    // return the stored word at loc, or nullptr
+    const Word* wordAt(const QPoint loc) const;
+
+    // return the tile in slot for writing, first copying it if another storage shares it.
+    // A sharer dropped on another thread is ordered before the write as in
+    // RasterLayer::detach()
+    static Tile& writable(std::shared_ptr<Tile>& slot) {
+        if (slot.use_count() > 1) slot = std::make_shared<Tile>(*slot);
+        else std::atomic_thread_fence(std::memory_order_acquire);
+        return *slot;
+    }
+
+    // set the word at loc. Returns true if the pixel is new
+    bool store(const QPoint loc, const Word w);
+
+    // call visit(key) for every tile overlapping box, in key order, starting at key start.
+    // visit returns false to stop, and so does this
+    template <typename F>
+    bool forEachTileIn(const QRect& box, quint64 start, F&& visit) const;
+
+    // visit the pixels of one tile that fall inside box, skipping those up to
+    // and including tile-local (rlx, rly) if resume is set
+    static bool visitTile(quint64 key, const Tile& tile, const QRect& box, PixelVisitor& visit,
+                          bool resume, int rlx, int rly);
+
+public:
+    // constructor destructor ---------------------------
+    BasicTiledStorage();
+    BasicTiledStorage(const BasicTiledStorage& other);
+
+    PixelStorage* clone() const override;
+
+    // accessors ---------------------------
+    int size() const override;
+    bool contains(const QPoint loc) const override;
+    std::optional<Pixel> get(const QPoint loc) const override;
+    std::optional<QRgba64> getWide(const QPoint loc) const override;
+    bool forEachInRect(const QRect& box, PixelVisitor visit, const QPoint* after) const override;
+
+    // return the number of allocated tiles
+    int tileCount() const;
+
+    // return the number of tiles also held by a copy of this storage
+    int sharedTileCount() const;
+
+    // straight from the tile keys when the cells are tiles
+    void collectCells(const int shift, std::vector<QPoint>& out) const override;
+
+    // call visit(tx, ty, tile) for every tile, row by row, to write tiles out whole
+    template <typename F>
+    void forEachTile(F&& visit) const {
+        for (const quint64 key : order_) visit(keyX(key), keyY(key), *tiles_.at(key));
+    }
+
+    // mutators ---------------------------
+    void clear() override;
+    bool update(const QPoint loc, const Pixel p) override;
+    bool upsert(const QPoint loc, const Pixel p) override;
+    bool upsertWide(const QPoint loc, const QRgba64 c) override;
+    bool remove(const QPoint loc) override;
+    int upsertSorted(const PixelRef* first, const PixelRef* last) override;
+    int fillRect(const QRect& box, const Pixel p) override;
+    int eraseRect(const QRect& box) override;
+    int fillRuns(const ColumnRun* first, const ColumnRun* last, const Pixel p) override;
+
+    // put a tile made elsewhere, such as one mapped from a file, at tile (tx, ty),
+    // replacing any there. count must be its count, taken on trust so the tile isn't
+    // read. It is held like a tile shared with a copy, so the first write to it
+    // normally makes a private copy
+    void adoptTile(int tx, int ty, std::shared_ptr<Tile> tile, int count);
+
+    // other functions ---------------------------
+    std::string toString() const override;
+};
+
+typedef BasicTiledStorage<Pixel> TiledStorage;
+typedef BasicTiledStorage<QRgba64> WideTiledStorage;
+
+#endif // TILEDSTORAGE_H
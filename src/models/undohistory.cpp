@@ -0,0 +1,118 @@
+#include "undohistory.h"
+
+// constructor destructor ---------------------------
+
+UndoHistory::UndoHistory(qint64 memoryLimit, qint64 mergeWindow)
+    : bytes_(0), memoryLimit_(memoryLimit), mergeWindow_(mergeWindow) {}
+
+// helper functions ---------------------------
+
+void UndoHistory::enforceLimits() {
+    // the newest entries may still be merged into or undone right away, keep them raw
+    for (int i = static_cast<int>(undo_.size()) - RawEntries - 1; i >= 0; i--) {
+        Entry& e = undo_[i];
+        if (e.delta.isCompressed()) break; // everything older is compressed already
+        bytes_ -= e.delta.bytes();
+        e.delta.compress();
+        bytes_ += e.delta.bytes();
+    }
+
+    // still over: compress the newest ones too, oldest first, rather than lose history
+    for (size_t i = 0; i < undo_.size() && bytes_ > memoryLimit_; i++) {
+        Entry& e = undo_[i];
+        if (e.delta.isCompressed()) continue;
+        bytes_ -= e.delta.bytes();
+        e.delta.compress();
+        bytes_ += e.delta.bytes();
+    }
+
+    // drop the oldest undo steps until we fit. The newest one always stays
+    while (bytes_ > memoryLimit_ && undo_.size() > 1) {
+        bytes_ -= undo_.front().delta.bytes();
+        undo_.pop_front();
+    }
+}
+
+// accessors ---------------------------
+
+bool UndoHistory::canUndo() const { return !undo_.empty(); }
+bool UndoHistory::canRedo() const { return !redo_.empty(); }
+
+int UndoHistory::undoCount() const { return static_cast<int>(undo_.size()); }
+int UndoHistory::redoCount() const { return static_cast<int>(redo_.size()); }
+
+qint64 UndoHistory::bytes() const { return bytes_; }
+
+qint64 UndoHistory::memoryLimit() const { return memoryLimit_; }
+qint64 UndoHistory::mergeWindow() const { return mergeWindow_; }
+
+// mutators ---------------------------
+
+void UndoHistory::push(const int layer, LayerDelta delta, const qint64 time) {
+    delta.seal();
+    if (delta.isEmpty()) return;
+
+    for (const Entry& e : redo_) bytes_ -= e.delta.bytes();
+    redo_.clear();
+
+    // coalesce with the newest entry if it is on the same layer and recent enough
+    if (!undo_.empty()) {
+        Entry& top = undo_.back();
+        if (top.open && top.layer == layer && time - top.time <= mergeWindow_) {
+            bytes_ -= top.delta.bytes();
+            top.delta.merge(delta);
+            top.time = time;
+            bytes_ += top.delta.bytes();
+            enforceLimits();
+            return;
+        }
+    }
+
+    bytes_ += delta.bytes();
+    undo_.push_back({layer, std::move(delta), time, true});
+    enforceLimits();
+}
+
+int UndoHistory::undo(QVector<RasterLayer>& layers) {
+    if (undo_.empty()) return -1;
+
+    Entry e = std::move(undo_.back());
+    undo_.pop_back();
+    if (e.layer >= 0 && e.layer < layers.size()) e.delta.revert(layers[e.layer]);
+
+    e.open = false; // never coalesce into a redone entry
+    redo_.push_back(std::move(e));
+    return redo_.back().layer;
+}
+
+int UndoHistory::redo(QVector<RasterLayer>& layers) {
+    if (redo_.empty()) return -1;
+
+    Entry e = std::move(redo_.back());
+    redo_.pop_back();
+    if (e.layer >= 0 && e.layer < layers.size()) e.delta.reapply(layers[e.layer]);
+
+    undo_.push_back(std::move(e));
+    const int layer = undo_.back().layer;
+    enforceLimits();
+    return layer;
+}
+
+void UndoHistory::clear() {
+    undo_.clear();
+    redo_.clear();
+    bytes_ = 0;
+}
+
+void UndoHistory::closeEntry() {
+    if (!undo_.empty()) undo_.back().open = false;
+}
+
+void UndoHistory::setMemoryLimit(const qint64 bytes) {
+    memoryLimit_ = bytes;
+    enforceLimits();
+}
+
+void UndoHistory::setMergeWindow(const qint64 ms) {
+    mergeWindow_ = ms;
+}
@@ -0,0 +1,80 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <layerdelta.h>
+#include <deque>
+#include <vector>
+
+// Undo/redo stacks of LayerDeltas, one entry per edit, for a list of layers.
+//
+// Edits pushed to the same layer within mergeWindow of each other are coalesced
+// into one entry, so a run of single pixel draws from QML undoes as one stroke.
+// Only the newest few entries stay raw; older ones are compressed. When the
+// total size goes over the memory limit, the newest are compressed as well, and
+// only if that isn't enough are the oldest undo entries dropped.
+class UndoHistory
+{
+public:
+    struct Entry {
+        int layer;        // index of the layer the delta applies to
+        LayerDelta delta;
+        qint64 time;      // when the last edit in it was pushed, in ms
+        bool open;        // later edits may still be coalesced into it
+    };
+
+    static constexpr qint64 DefaultMemoryLimit = 256ll * 1024 * 1024;
+    static constexpr qint64 DefaultMergeWindow = 300; // ms
+    static constexpr int RawEntries = 4;              // newest entries kept uncompressed
+
+private:
+    std::deque<Entry> undo_; // oldest first
+    std::vector<Entry> redo_; // most recently undone last
+    qint64 bytes_;
+    qint64 memoryLimit_;
+    qint64 mergeWindow_;
+
+    // compress entries past the newest RawEntries, then over the limit compress the rest
+    // and drop the oldest
+    void enforceLimits();
+
+public:
+    // constructor destructor ---------------------------
+    UndoHistory(qint64 memoryLimit = DefaultMemoryLimit, qint64 mergeWindow = DefaultMergeWindow);
+
+    // accessors ---------------------------
+
+    bool canUndo() const;
+    bool canRedo() const;
+
+    // return the number of entries on each stack
+    int undoCount() const;
+    int redoCount() const;
+
+    // return the approximate number of bytes held by both stacks
+    qint64 bytes() const;
+
+    qint64 memoryLimit() const;
+    qint64 mergeWindow() const;
+
+    // mutators ---------------------------
+
+    // record an edit already made to layer at time (ms, any monotonic clock). Clears
+    // the redo stack. Empty deltas are ignored
+    void push(const int layer, LayerDelta delta, const qint64 time);
+
+    // undo / redo the newest entry against layers. Returns the index of the layer
+    // that changed, or -1 if there was nothing to do
+    int undo(QVector<RasterLayer>& layers);
+    int redo(QVector<RasterLayer>& layers);
+
+    // forget everything
+    void clear();
+
+    // stop coalescing into the newest entry, e.g. when a stroke ends
+    void closeEntry();
+
+    void setMemoryLimit(const qint64 bytes);
+    void setMergeWindow(const qint64 ms);
+};
+
+#endif // UNDOHISTORY_H
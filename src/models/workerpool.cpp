@@ -0,0 +1,176 @@
+#include "workerpool.h"
+#include <algorithm>
+
+// A share of a batch is the item range [begin, end), packed into one word as
+// end << 32 | begin so it can be claimed from and stolen from atomically
+static quint64 packRange(quint32 begin, quint32 end) { return static_cast<quint64>(end) << 32 | begin; }
+static quint32 rangeBegin(quint64 range) { return static_cast<quint32>(range); }
+static quint32 rangeEnd(quint64 range) { return static_cast<quint32>(range >> 32); }
+
+struct WorkerPool::Batch {
+    std::function<void(int)> body;
+    std::function<void()> done;
+    std::unique_ptr<std::atomic<quint64>[]> shares; // one per slot: every worker, plus the caller of parallelFor
+    int slots;
+    std::atomic<int> remaining; // items not yet finished
+};
+
+// take the first item of a share. Only the share's own thread does this
+static bool popFront(std::atomic<quint64>& share, int& item) {
+    quint64 range = share.load(std::memory_order_acquire);
+    while (rangeBegin(range) < rangeEnd(range)) {
+        if (share.compare_exchange_weak(range, packRange(rangeBegin(range) + 1, rangeEnd(range)), std::memory_order_acq_rel)) {
+            item = static_cast<int>(rangeBegin(range));
+            return true;
+        }
+    }
+    return false;
+}
+
+// take the back half of another thread's share (all of it if one item is left)
+static bool stealHalf(std::atomic<quint64>& share, quint64& stolen) {
+    quint64 range = share.load(std::memory_order_acquire);
+    while (rangeBegin(range) < rangeEnd(range)) {
+        const quint32 mid = rangeBegin(range) + (rangeEnd(range) - rangeBegin(range)) / 2;
+        if (share.compare_exchange_weak(range, packRange(rangeBegin(range), mid), std::memory_order_acq_rel)) {
+            stolen = packRange(mid, rangeEnd(range));
+            return true;
+        }
+    }
+    return false;
+}
+
+// constructor destructor ---------------------------
+
+WorkerPool::WorkerPool(int threads)
+    : stopping_(false) {
+    for (int i = 0; i < threads; i++) threads_.emplace_back(&WorkerPool::workerLoop, this, i);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_) thread.join();
+}
+
+// helper functions ---------------------------
+
+std::shared_ptr<WorkerPool::Batch> WorkerPool::makeBatch(int count, int shares, std::function<void(int)> body,
+                                                         std::function<void()> done) const {
+    auto batch = std::make_shared<Batch>();
+    batch->body = std::move(body);
+    batch->done = std::move(done);
+    batch->slots = static_cast<int>(threads_.size()) + 1;
+    batch->shares.reset(new std::atomic<quint64>[batch->slots]);
+    batch->remaining.store(count);
+
+    for (int slot = 0; slot < batch->slots; slot++) {
+        const quint32 begin = slot < shares ? static_cast<quint32>(static_cast<qint64>(count) * slot / shares) : count;
+        const quint32 end = slot < shares ? static_cast<quint32>(static_cast<qint64>(count) * (slot + 1) / shares) : count;
+        batch->shares[slot].store(packRange(begin, end));
+    }
+    return batch;
+}
+
+void WorkerPool::runBatch(Batch& batch, int slot) {
+    for (;;) {
+        int item;
+        while (popFront(batch.shares[slot], item)) {
+            batch.body(item);
+            if (batch.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 && batch.done) batch.done();
+        }
+
+        // own share is used up: steal from the others, nearest slot first
+        bool stole = false;
+        for (int i = 1; i < batch.slots && !stole; i++) {
+            quint64 stolen;
+            if (stealHalf(batch.shares[(slot + i) % batch.slots], stolen)) {
+                batch.shares[slot].store(stolen, std::memory_order_release);
+                stole = true;
+            }
+        }
+        if (!stole) return; // every item is claimed
+    }
+}
+
+void WorkerPool::workerLoop(int slot) {
+    for (;;) {
+        std::shared_ptr<Batch> batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return; // stopping, and nothing left to do
+            batch = queue_.front();
+        }
+
+        runBatch(*batch, slot);
+
+        // nothing left to claim, so nobody else needs to find this batch
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!queue_.empty() && queue_.front() == batch) queue_.pop_front();
+    }
+}
+
+// accessors ---------------------------
+
+int WorkerPool::threadCount() const { return static_cast<int>(threads_.size()); }
+
+int WorkerPool::defaultThreadCount() {
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+}
+
+// other functions ---------------------------
+
+void WorkerPool::parallelFor(int count, const std::function<void(int)>& body) {
+    if (count <= 0) return;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool complete = false;
+    auto done = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        complete = true;
+        finished.notify_one();
+    };
+
+    const int callerSlot = static_cast<int>(threads_.size());
+    auto batch = makeBatch(count, callerSlot + 1, body, done);
+    if (!threads_.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(batch);
+        }
+        wake_.notify_all();
+    }
+    runBatch(*batch, callerSlot);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return complete; });
+}
+
+void WorkerPool::submit(int count, std::function<void(int)> body, std::function<void()> done) {
+    if (count <= 0) {
+        if (done) done();
+        return;
+    }
+    if (threads_.empty()) { // nobody to hand it to
+        for (int i = 0; i < count; i++) body(i);
+        if (done) done();
+        return;
+    }
+
+    auto batch = makeBatch(count, static_cast<int>(threads_.size()), std::move(body), std::move(done));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(batch));
+    }
+    wake_.notify_all();
+}
+
+WorkerPool& WorkerPool::global() {
+    static WorkerPool pool;
+    return pool;
+}
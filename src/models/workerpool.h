@@ -0,0 +1,75 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that run batches of independent, numbered items,
+// such as the tiles of a canvas.
+//
+// Each thread starts on its own contiguous share of a batch. When that runs
+// out it steals the back half of what is left of another thread's share, so
+// uneven items (an empty tile next to one under twenty painted layers) still
+// keep every thread busy until the batch is done. Claiming and stealing items
+// are single compare-and-swaps; the mutex is only taken to hand a batch over
+// and to let idle threads sleep.
+class WorkerPool
+{
+private:
+    struct Batch;
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;                        // guards queue_ and stopping_
+    std::condition_variable wake_;
+    std::deque<std::shared_ptr<Batch>> queue_; // batches that may still have items to claim
+    bool stopping_;
+
+    // split count items over the slots [0, shares) of a new batch
+    std::shared_ptr<Batch> makeBatch(int count, int shares, std::function<void(int)> body, std::function<void()> done) const;
+
+    void workerLoop(int slot);
+
+    // work on batch from slot until no item is left to claim
+    static void runBatch(Batch& batch, int slot);
+
+public:
+    // constructor destructor ---------------------------
+
+    // threads is the number of workers; 0 runs everything on the calling thread
+    explicit WorkerPool(int threads = defaultThreadCount());
+    // finishes the batches already submitted
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // accessors ---------------------------
+
+    // return the number of worker threads
+    int threadCount() const;
+
+    // one worker per core but one, leaving a core for the GUI and render threads
+    static int defaultThreadCount();
+
+    // other functions ---------------------------
+
+    // call body(i) for every i in [0, count) and return once all are done. The calling
+    // thread works on the batch too
+    void parallelFor(int count, const std::function<void(int)>& body);
+
+    // same, in the background: returns at once, and done runs on whichever thread
+    // finishes the last item. body and done must be safe to call from any thread
+    void submit(int count, std::function<void(int)> body, std::function<void()> done);
+
+    // return the process wide pool
+    static WorkerPool& global();
+};
+
+#endif // WORKERPOOL_H
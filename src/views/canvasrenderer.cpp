@@ -1,29 +1,280 @@
 #include "canvasrenderer.h"
 
-#include <QSGFlatColorMaterial>
-#include <QSGGeometry>
-#include <QSGSimpleRectNode>
+#include <QCoreApplication>
+#include <QPointer>
+#include <QQuickWindow>
+#include <QSGGeometryNode>
+#include <QSGRendererInterface>
+#include <QSGSimpleTextureNode>
+#include <QSGTransformNode>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
-CanvasRenderer::CanvasRenderer() {
+CanvasRenderer::CanvasRenderer()
+    : m_controller(nullptr), m_root(nullptr), m_level(0), m_quadNode(nullptr), m_allDirty(false) {
     setFlag(ItemHasContents, true);
 }
 
+CanvasController* CanvasRenderer::controller() const { return m_controller; }
+void CanvasRenderer::setController(CanvasController* controller) {
+    if (m_controller == controller) return;
+    if (m_controller) disconnect(m_controller, nullptr, this, nullptr);
+
+    m_controller = controller;
+    if (m_controller) {
+        // moving the view only changes the transform
+        connect(m_controller, &CanvasController::xChanged, this, &QQuickItem::update);
+        connect(m_controller, &CanvasController::yChanged, this, &QQuickItem::update);
+        connect(m_controller, &CanvasController::zoomChanged, this, &QQuickItem::update);
+        connect(m_controller, &CanvasController::regionChanged, this, &CanvasRenderer::markDirty);
+    }
+    markAllDirty();
+    emit controllerChanged();
+}
+
+void CanvasRenderer::markDirty(const QRegion& region) {
+    if (!m_allDirty) m_dirty += region;
+    update();
+}
+
+void CanvasRenderer::markAllDirty() {
+    m_allDirty = true;
+    m_dirty = QRegion();
+    update();
+}
+
+void CanvasRenderer::uploadTile(Tile& tile, int tx, int ty, const QRgb* pixels) {
+    if (!pixels) { // nothing to draw here (any more)
+        if (tile.node) {
+            m_root->removeChildNode(tile.node);
+            delete tile.node;
+            tile.node = nullptr;
+        }
+        return;
+    }
+
+    if (!tile.node) {
+        tile.node = new QSGSimpleTextureNode();
+        tile.node->setOwnsTexture(true);
+        tile.node->setFiltering(QSGTexture::Nearest); // hard pixel edges at any zoom
+        const qreal span = qreal(TileSize) * (1 << m_level); // canvas pixels across
+        tile.node->setRect(QRectF(tx * span, ty * span, span, span));
+        m_root->appendChildNode(tile.node);
+    }
+
+    // the compositor keeps its buffer, and some backends hold on to the image
+    // they were given, so the texture gets a copy
+    const QImage image = QImage(reinterpret_cast<const uchar*>(pixels), TileSize, TileSize, TileSize * sizeof(QRgb),
+                                QImage::Format_ARGB32_Premultiplied).copy();
+    tile.node->setTexture(window()->createTextureFromImage(image)); // frees the old one
+}
+
+void CanvasRenderer::dropTiles() {
+    for (Tile& tile : m_tiles) {
+        if (!tile.node) continue;
+        m_root->removeChildNode(tile.node);
+        delete tile.node;
+    }
+    m_tiles.clear();
+    m_waiting.clear();
+    m_visible = QRect();
+}
+
+void CanvasRenderer::chooseMode() {
+    qint64 pixels = 0;
+    for (const RasterLayer& layer : m_controller->layers())
+        if (layer.isVisible()) pixels += layer.size();
+    // the software backend can't draw the quads' custom material
+    const bool software = window()->rendererInterface()->graphicsApi() == QSGRendererInterface::Software;
+    const bool quads = !software && m_level == 0 && pixels <= (m_quadNode ? 2 * QuadPixels : QuadPixels);
+
+    if (quads && !m_quadNode) {
+        dropTiles();
+        m_quadNode = m_quads.createNode();
+        m_root->appendChildNode(m_quadNode);
+        m_quads.rebuild(m_controller->layers());
+    } else if (!quads && m_quadNode) {
+        m_root->removeChildNode(m_quadNode);
+        delete m_quadNode; // takes its geometry and material with it
+        m_quadNode = nullptr;
+        m_quads.detach();
+    }
+}
+
+void CanvasRenderer::markStale(quint64 key, Tile& tile) {
+    if (tile.stale) return; // waiting already
+    tile.stale = true;
+    m_waiting.push_back(key);
+}
+
 // render
 QSGNode *CanvasRenderer::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) {
-    QSGSimpleRectNode* node = static_cast<QSGSimpleRectNode*>(oldNode);
-    if(!oldNode) {
-        // QSGGeometry *geometry = new QSGGeometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 6);
-        // geometry->setDrawingMode(QSGGeometry::DrawTriangles);
-        // GradientMaterial *material = new GradientMaterial();
+    Q_UNUSED(data);
+
+    const qreal scale = m_controller ? m_controller->pixelSize() : 0;
+    if (!m_controller || scale <= 0 || width() <= 0 || height() <= 0) {
+        delete oldNode; // takes the tiles with it
+        m_root = nullptr;
+        m_tiles.clear();
+        m_waiting.clear();
+        m_visible = QRect();
+        m_quadNode = nullptr;
+        m_quads.detach();
+        m_compositor.invalidateAll();
+        return nullptr;
+    }
+
+    if (!oldNode) { // first frame, or the scene graph was rebuilt and our old nodes are gone
+        m_root = new QSGTransformNode();
+        m_tiles.clear();
+        m_waiting.clear();
+        m_visible = QRect();
+        m_quadNode = nullptr;
+        m_quads.detach();
+    }
 
-        // node = new QSGGeometryNode;
-        node = new QSGSimpleRectNode();
-        node->setColor("white");
+    // the coarsest level where a texel still covers a screen pixel
+    const qreal screenPixels = scale * window()->effectiveDevicePixelRatio(); // per canvas pixel
+    const int level = screenPixels >= 1 ? 0 : static_cast<int>(std::min(qreal(Compositor::MaxLevel), std::floor(std::log2(1 / screenPixels))));
+    if (level != m_level) {
+        dropTiles();
+        m_level = level;
     }
+    const int shift = TileShift + m_level;
+
+    // mark what changed since the last frame. The quads are brought up to date
+    // here too, before a switch to tiles could drop them
+    if (m_allDirty) {
+        m_compositor.invalidateAll();
+        if (m_quadNode) m_quads.rebuild(m_controller->layers());
+        for (auto it = m_tiles.begin(); it != m_tiles.end(); ++it) markStale(it.key(), *it);
+    } else {
+        for (const QRect& box : m_dirty) {
+            m_compositor.invalidate(box);
+            if (m_quadNode) m_quads.update(m_controller->layers(), box);
+
+            const int tx0 = box.left() >> shift, tx1 = box.right() >> shift;
+            const int ty0 = box.top() >> shift, ty1 = box.bottom() >> shift;
+
+            // look the few tiles of a small edit up, scan the cache for a large one
+            if (qint64(tx1 - tx0 + 1) * (ty1 - ty0 + 1) <= m_tiles.size()) {
+                for (int ty = ty0; ty <= ty1; ty++)
+                    for (int tx = tx0; tx <= tx1; tx++) {
+                        auto it = m_tiles.find(tileKey(tx, ty));
+                        if (it != m_tiles.end()) markStale(it.key(), *it);
+                    }
+                continue;
+            }
+            for (auto it = m_tiles.begin(); it != m_tiles.end(); ++it) {
+                const int tx = static_cast<qint32>(it.key()), ty = static_cast<qint32>(it.key() >> 32);
+                if (tx >= tx0 && tx <= tx1 && ty >= ty0 && ty <= ty1) markStale(it.key(), *it);
+            }
+        }
+    }
+    m_dirty = QRegion();
+    m_allDirty = false;
+    chooseMode();
+
+    // keep the tiles the workers finished since the last frame
+    m_compositor.collect();
+
+    // canvas to item coordinates: (x, y) lands on the center
+    const qreal cx = m_controller->x(), cy = m_controller->y();
+    QMatrix4x4 matrix;
+    matrix.translate(width() / 2, height() / 2);
+    matrix.scale(scale, scale);
+    matrix.translate(-cx, -cy);
+    m_root->setMatrix(matrix);
+    if (m_quadNode) return m_root; // nothing else to draw
+
+    // tiles on screen, clamped so a tiny zoom cannot overflow the tile range
+    const QRectF area = CanvasController::visibleArea(cx, cy, scale, QSizeF(width(), height()));
+    const qreal span = qreal(TileSize) * (1 << m_level);
+    auto tileOf = [span](qreal canvas) {
+        return static_cast<int>(std::clamp(std::floor(canvas / span), qreal(INT_MIN) / span, qreal(INT_MAX) / span));
+    };
+    const int tx0 = tileOf(area.left()), tx1 = tileOf(area.right());
+    const int ty0 = tileOf(area.top()), ty1 = tileOf(area.bottom());
+
+    const QRect visible(QPoint(tx0, ty0), QPoint(tx1, ty1));
+    if (visible != m_visible) {
+        // forget tiles more than one tile off screen, freeing their textures and the
+        // flattened tiles of every level under them
+        for (auto it = m_tiles.begin(); it != m_tiles.end();) {
+            const int tx = static_cast<qint32>(it.key()), ty = static_cast<qint32>(it.key() >> 32);
+            if (tx >= tx0 - 1 && tx <= tx1 + 1 && ty >= ty0 - 1 && ty <= ty1 + 1) {
+                ++it;
+                continue;
+            }
+            if (it->node) {
+                m_root->removeChildNode(it->node);
+                delete it->node;
+            }
+            it = m_tiles.erase(it);
+        }
+        auto canvas = [shift](int t) { return static_cast<int>(std::clamp(qint64(t) * (qint64(1) << shift), qint64(INT_MIN), qint64(INT_MAX))); };
+        m_compositor.trim(QRect(QPoint(canvas(tx0 - 1), canvas(ty0 - 1)), QPoint(canvas(tx1 + 2) - 1, canvas(ty1 + 2) - 1)));
+
+        // start on the tiles that just came into view. After a pan that is a strip
+        // along the edges, whatever the size of the screen
+        for (int ty = ty0; ty <= ty1; ty++) {
+            const bool rowWasVisible = !m_visible.isEmpty() && ty >= m_visible.top() && ty <= m_visible.bottom();
+            for (int tx = tx0; tx <= tx1; tx++) {
+                if (rowWasVisible && tx >= m_visible.left() && tx <= m_visible.right()) {
+                    tx = m_visible.right(); // skip the part seen last frame
+                    continue;
+                }
+                auto it = m_tiles.find(tileKey(tx, ty));
+                if (it == m_tiles.end()) {
+                    m_tiles.insert(tileKey(tx, ty), Tile{nullptr, true});
+                    m_waiting.push_back(tileKey(tx, ty));
+                }
+            }
+        }
+        m_visible = visible;
+    }
+
+    // upload the waiting tiles that are ready, up to the per frame budget, and
+    // request the full resolution tiles still needed for the rest
+    std::vector<QPoint> missing;
+    int uploads = 0;
+    bool pending = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < m_waiting.size(); i++) {
+        const quint64 key = m_waiting[i];
+        auto it = m_tiles.find(key);
+        if (it == m_tiles.end() || !it->stale) continue; // forgotten, or done already
+
+        const int tx = static_cast<qint32>(key), ty = static_cast<qint32>(key >> 32);
+        const QRgb* pixels;
+        bool ready = visible.contains(tx, ty) && m_compositor.tryTile(m_controller->layers(), tx, ty, m_level, &pixels, missing);
+        if (ready && pixels && uploads == UploadsPerFrame) {
+            pending = true;
+            ready = false;
+        }
+        if (!ready) { // off screen for now, still being flattened, or over budget
+            m_waiting[kept++] = key;
+            continue;
+        }
+
+        if (pixels) uploads++;
+        uploadTile(*it, tx, ty, pixels);
+        it->stale = false;
+    }
+    m_waiting.resize(kept);
+
+    // the workers ask for a frame once they are done. The item may be gone by then, so
+    // the request goes through the application object, to the GUI thread the item
+    // lives on, and is dropped there if the item was destroyed
+    m_compositor.requestMissing(m_controller->layers(), missing, WorkerPool::global(), [self = QPointer<CanvasRenderer>(this)] {
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self] {
+            if (self) self->update();
+        }, Qt::QueuedConnection);
+    });
 
-    int size = 100;
-    node->setRect(QRectF(width()/2-size/2, height()/2-size/2, size, size));
-    node->markDirty(QSGNode::DirtyGeometry | QSGNode::DirtyMaterial);
+    // come back for the rest of the uploads next frame
+    if (pending) QMetaObject::invokeMethod(this, &QQuickItem::update, Qt::QueuedConnection);
 
-    return node;
+    return m_root;
 }
@@ -1,21 +1,123 @@
 #ifndef CANVASRENDERER_H
 #define CANVASRENDERER_H
 
+#include <QHash>
 #include <QObject>
 #include <QQuickItem>
+#include <QRegion>
+#include <canvascontroller.h>
+#include <compositor.h>
+#include <pixelquads.h>
 
+class QSGGeometryNode;
+class QSGSimpleTextureNode;
+class QSGTransformNode;
+
+// Draws the controller's layers. The canvas is cut into 64x64 pixel tiles,
+// each flattened by a Compositor and uploaded once into its own texture, and
+// kept across frames; panning and zooming only change the transform above
+// them. Content changes mark the tiles they touch stale, and only those are
+// uploaded again, so the work per frame follows the edited area rather than
+// the canvas.
+//
+// Tiles are flattened on the global WorkerPool, never on the GUI or render
+// thread. A frame requests the tiles it is missing and draws what it has; the
+// workers hand their tiles back through the compositor's lock-free list and
+// ask for another frame, which picks them up.
+//
+// Each frame only looks at the tiles that changed or came into view: the
+// visible tile range of the last frame is kept, so a pan starts on the strip
+// it uncovered, and the rest of the screen costs nothing.
+//
+// Zoomed out, tiles come from the level of the compositor's mip pyramid where
+// a texel is at least one screen pixel, so a frame uploads about as many
+// pixels as the screen has however much of the canvas is in view.
+//
+// A sparse canvas seen at full resolution (at most QuadPixels pixels over the
+// visible layers) is drawn as PixelQuads instead: one colored quad per pixel in
+// a single geometry node, with no textures, where an edit rewrites only the
+// quads of the pixels it changed. It switches back to tiles at twice that, so
+// painting around the limit does not flip between the two. The quads use a
+// custom material, so the software scene graph backend always draws tiles.
+//
+// Canvas pixel (x, y) of the controller sits at the center of the item, and a
+// canvas pixel is pixelSize() item units wide.
 class CanvasRenderer : public QQuickItem
 {
     Q_OBJECT
     QML_ELEMENT
 
+    Q_PROPERTY(CanvasController* controller READ controller WRITE setController NOTIFY controllerChanged)
+
 public:
+    static constexpr int TileShift = Compositor::TileShift;
+    static constexpr int TileSize = 1 << TileShift;
+
+    // most tiles (re)uploaded per frame. The rest wait for the next frame, so a
+    // big change on screen costs a few frames rather than one long one
+    static constexpr int UploadsPerFrame = 64;
+
+    // most pixels drawn as quads rather than tiles
+    static constexpr int QuadPixels = 16384;
+
     CanvasRenderer();
 
+    CanvasController* controller() const;
+    void setController(CanvasController* controller);
+
 protected:
     QSGNode* updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
 
 signals:
+    void controllerChanged();
+
+private:
+    struct Tile {
+        QSGSimpleTextureNode* node; // nullptr while the tile is empty
+        bool stale;                 // content changed since the upload
+    };
+
+    CanvasController* m_controller;
+
+    // tiles of m_level uploaded so far, by tileKey(). Owned by the scene graph,
+    // so only touched in updatePaintNode
+    QHash<quint64, Tile> m_tiles;
+    QSGTransformNode* m_root;
+    int m_level;     // pyramid level drawn
+    QRect m_visible; // tiles of m_level on screen, as of the last frame
+    // keys of the stale tiles, each listed once; the others are up to date
+    std::vector<quint64> m_waiting;
+
+    // flattened layers per tile, likewise only used in updatePaintNode
+    Compositor m_compositor;
+
+    // the pixels as quads instead of tiles, while the canvas is sparse. The node
+    // is nullptr otherwise
+    PixelQuads m_quads;
+    QSGGeometryNode* m_quadNode;
+
+    // content changed since the last frame, in canvas pixels. Written on the GUI
+    // thread, read in updatePaintNode while the GUI thread is blocked
+    QRegion m_dirty;
+    bool m_allDirty;
+
+    static quint64 tileKey(int tx, int ty) {
+        return (static_cast<quint64>(static_cast<quint32>(ty)) << 32) | static_cast<quint32>(tx);
+    }
+
+    // mark the tiles under region stale
+    void markDirty(const QRegion& region);
+    // mark every tile stale
+    void markAllDirty();
+
+    // show a flattened tile of m_level, or remove it if pixels is nullptr (empty)
+    void uploadTile(Tile& tile, int tx, int ty, const QRgb* pixels);
+    // remove every tile from the scene
+    void dropTiles();
+    // switch between quads and tiles as the canvas fills up or empties
+    void chooseMode();
+    // queue a tile to be uploaded again
+    void markStale(quint64 key, Tile& tile);
 };
 
 #endif // CANVASRENDERER_H
@@ -0,0 +1,179 @@
+#include "pixelquads.h"
+
+#include <QSGGeometryNode>
+#include <blendkernels.h>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <pixelquadshader.h>
+
+// constructor destructor ---------------------------
+
+PixelQuads::PixelQuads()
+    : node_(nullptr), geometry_(nullptr), capacity_(0), used_(0), update_(0) {}
+
+// helper functions ---------------------------
+
+int PixelQuads::allocate(const QPoint loc) {
+    int quad;
+    if (!free_.empty()) {
+        quad = free_.back();
+        free_.pop_back();
+    } else {
+        if (used_ == capacity_) grow(std::max(MinCapacity, capacity_ * 2));
+        quad = used_++;
+    }
+    quads_.insert(pixelKey(loc), quad);
+    where_[quad] = loc;
+    colors_[quad] = 0;
+    seen_[quad] = 0;
+    return quad;
+}
+
+void PixelQuads::grow(int capacity) {
+    // allocate() drops the old buffer, so the quads written so far are set aside
+    std::vector<Vertex> vertices(static_cast<size_t>(used_) * 4);
+    if (used_) memcpy(vertices.data(), geometry_->vertexData(), vertices.size() * sizeof(Vertex));
+
+    geometry_->allocate(capacity * 4, capacity * 6);
+    Vertex* v = static_cast<Vertex*>(geometry_->vertexData());
+    if (used_) memcpy(v, vertices.data(), vertices.size() * sizeof(Vertex));
+    memset(v + used_ * 4, 0, static_cast<size_t>(capacity - used_) * 4 * sizeof(Vertex));
+
+    // two triangles per quad; this part never changes after
+    quint32* indices = geometry_->indexDataAsUInt();
+    for (int quad = 0; quad < capacity; quad++) {
+        const quint32 first = quad * 4;
+        const quint32 corners[6] = {first, first + 1, first + 2, first + 2, first + 1, first + 3};
+        memcpy(indices + quad * 6, corners, sizeof(corners));
+    }
+    geometry_->markIndexDataDirty();
+    geometry_->markVertexDataDirty();
+
+    capacity_ = capacity;
+    where_.resize(capacity);
+    colors_.resize(capacity);
+    seen_.resize(capacity);
+}
+
+void PixelQuads::writeQuad(int quad, QRgb color) {
+    Vertex* v = static_cast<Vertex*>(geometry_->vertexData()) + quad * 4;
+    if (!color) { // degenerate: drawn as nothing
+        memset(v, 0, 4 * sizeof(Vertex));
+        return;
+    }
+    const float x = where_[quad].x(), y = where_[quad].y();
+    v[0] = Vertex{x, y, color};
+    v[1] = Vertex{x + 1, y, color};
+    v[2] = Vertex{x, y + 1, color};
+    v[3] = Vertex{x + 1, y + 1, color};
+}
+
+void PixelQuads::composite(const QVector<RasterLayer>& layers, const QRect& box) {
+    update_++;
+    std::vector<int> touched;
+    auto touch = [&](int quad) {
+        if (seen_[quad] == update_) return;
+        seen_[quad] = update_;
+        colors_[quad] = 0; // composited again from scratch
+        touched.push_back(quad);
+    };
+
+    // what is drawn in box now starts over from transparent: look the pixels of a
+    // small box up, scan the quads for a large one
+    if (!quads_.isEmpty()) {
+        const qint64 area = (qint64(box.right()) - box.left() + 1) * (qint64(box.bottom()) - box.top() + 1);
+        if (area <= quads_.size()) {
+            for (int y = box.top(); y <= box.bottom(); y++)
+                for (int x = box.left(); x <= box.right(); x++) {
+                    auto it = quads_.constFind(pixelKey(QPoint(x, y)));
+                    if (it != quads_.constEnd()) touch(*it);
+                }
+        } else {
+            for (auto it = quads_.constBegin(); it != quads_.constEnd(); ++it)
+                if (box.contains(where_[*it])) touch(*it);
+        }
+    }
+
+    // blend the layers in, bottom first, the same way the compositor does
+    const BlendKernels& kernels = blendKernels();
+    for (const RasterLayer& layer : layers) {
+        const int opacity = static_cast<int>(std::lround(layer.opacity() * 255));
+        if (!layer.isVisible() || opacity == 0 || layer.size() == 0) continue;
+
+        layer.forEachInRect(box, [&](const QPoint loc, const Pixel p) {
+            auto it = quads_.constFind(pixelKey(loc));
+            const int quad = it != quads_.constEnd() ? *it : allocate(loc);
+            touch(quad);
+            kernels.blend(layer.blendMode(), &colors_[quad], &p.argb, 1, opacity);
+        });
+    }
+
+    // rewrite what changed, and give the quads of pixels blended away back
+    for (int quad : touched) {
+        writeQuad(quad, colors_[quad]);
+        if (colors_[quad]) continue;
+        quads_.remove(pixelKey(where_[quad]));
+        free_.push_back(quad);
+    }
+    if (!touched.empty()) {
+        geometry_->markVertexDataDirty();
+        node_->markDirty(QSGNode::DirtyGeometry);
+    }
+}
+
+// accessors ---------------------------
+
+int PixelQuads::count() const { return quads_.size(); }
+
+// other functions ---------------------------
+
+QSGGeometryNode* PixelQuads::createNode() {
+    static const QSGGeometry::Attribute attributes[] = {
+        QSGGeometry::Attribute::createWithAttributeType(0, 2, QSGGeometry::FloatType, QSGGeometry::PositionAttribute),
+        QSGGeometry::Attribute::createWithAttributeType(1, 4, QSGGeometry::UnsignedByteType, QSGGeometry::ColorAttribute),
+    };
+    static const QSGGeometry::AttributeSet attributeSet = {2, sizeof(Vertex), attributes};
+
+    detach();
+    geometry_ = new QSGGeometry(attributeSet, 0, 0, QSGGeometry::UnsignedIntType);
+    geometry_->setDrawingMode(QSGGeometry::DrawTriangles);
+    geometry_->setVertexDataPattern(QSGGeometry::DynamicPattern); // rewritten in place on edits
+    geometry_->setIndexDataPattern(QSGGeometry::StaticPattern);   // only when the buffer grows
+
+    node_ = new QSGGeometryNode();
+    node_->setGeometry(geometry_);
+    node_->setMaterial(new PixelQuadMaterial());
+    node_->setFlags(QSGNode::OwnsGeometry | QSGNode::OwnsMaterial);
+    return node_;
+}
+
+void PixelQuads::detach() {
+    node_ = nullptr;
+    geometry_ = nullptr;
+    capacity_ = 0;
+    used_ = 0;
+    quads_.clear();
+    where_.clear();
+    colors_.clear();
+    seen_.clear();
+    free_.clear();
+}
+
+void PixelQuads::rebuild(const QVector<RasterLayer>& layers) {
+    if (!node_) return;
+
+    // start from an empty buffer, keeping its room
+    if (used_) memset(geometry_->vertexData(), 0, static_cast<size_t>(used_) * 4 * sizeof(Vertex));
+    used_ = 0;
+    quads_.clear();
+    free_.clear();
+    composite(layers, QRect(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX)));
+    geometry_->markVertexDataDirty();
+    node_->markDirty(QSGNode::DirtyGeometry);
+}
+
+void PixelQuads::update(const QVector<RasterLayer>& layers, const QRect& box) {
+    if (!node_ || box.isEmpty()) return;
+    composite(layers, box);
+}
@@ -0,0 +1,86 @@
+#ifndef PIXELQUADS_H
+#define PIXELQUADS_H
+
+#include <QHash>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+#include <rasterlayer.h>
+#include <vector>
+
+class QSGGeometry;
+class QSGGeometryNode;
+
+// Draws a stack of layers as one flat colored quad per composited pixel, all
+// in the vertex buffer of a single geometry node, so a sparse canvas is one
+// draw call with no textures at all. Each pixel keeps its quad (four vertices,
+// six indices) for as long as it is drawn, so an edit rewrites the quads of
+// the pixels it touched and nothing else. Quads of erased pixels are collapsed
+// to nothing and handed to the next new pixel; the buffer only ever grows, by
+// doubling.
+//
+// Vertices are in canvas pixels, like the tile nodes of CanvasRenderer.
+class PixelQuads
+{
+public:
+    // quads the buffer starts with
+    static constexpr int MinCapacity = 1024;
+
+    struct Vertex {
+        float x, y;
+        QRgb color; // premultiplied, read by the shader as four normalized bytes
+    };
+
+private:
+    QSGGeometryNode* node_;      // owned by the scene graph, nullptr while detached
+    QSGGeometry* geometry_;      // owned by node_
+    int capacity_;               // quads the geometry has room for
+    int used_;                   // quads handed out so far, free ones included
+    QHash<quint64, int> quads_;  // pixel (pixelKey) -> its quad
+    std::vector<QPoint> where_;  // quad -> its pixel
+    std::vector<QRgb> colors_;   // quad -> composited color
+    std::vector<quint32> seen_;  // quad -> the update that last touched it
+    std::vector<int> free_;      // quads below used_ that no pixel has
+    quint32 update_;
+
+    static quint64 pixelKey(const QPoint loc) {
+        return (static_cast<quint64>(static_cast<quint32>(loc.y())) << 32) | static_cast<quint32>(loc.x());
+    }
+
+    // give loc a quad, growing the buffer if there is no free one
+    int allocate(const QPoint loc);
+    // make room for capacity quads, keeping the vertices written so far
+    void grow(int capacity);
+    // write the four vertices of quad, collapsed to a point if color is 0
+    void writeQuad(int quad, QRgb color);
+    // composite box over the layers into the quads, which must hold its current pixels
+    void composite(const QVector<RasterLayer>& layers, const QRect& box);
+
+public:
+    // constructor destructor ---------------------------
+
+    PixelQuads();
+
+    PixelQuads(const PixelQuads&) = delete;
+    PixelQuads& operator=(const PixelQuads&) = delete;
+
+    // accessors ---------------------------
+
+    // return the number of pixels drawn
+    int count() const;
+
+    // other functions ---------------------------
+
+    // return a new, empty geometry node with a PixelQuadMaterial, to be added to the
+    // scene graph (which then owns it). Forgets any node made before
+    QSGGeometryNode* createNode();
+    // forget the node, once the scene graph has deleted it or is about to
+    void detach();
+
+    // composite every pixel of the layers again
+    void rebuild(const QVector<RasterLayer>& layers);
+    // composite the pixels in box again, after an edit there
+    void update(const QVector<RasterLayer>& layers, const QRect& box);
+};
+
+#endif // PIXELQUADS_H
@@ -0,0 +1,8 @@
+#version 440
+layout(location = 0) in vec4 vertexColor;
+layout(location = 0) out vec4 fragColor;
+
+void main(void)
+{
+    fragColor = vertexColor;
+}
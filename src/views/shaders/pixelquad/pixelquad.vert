@@ -0,0 +1,16 @@
+#version 440
+layout(location = 0) in vec4 qt_Vertex;
+layout(location = 1) in vec4 color;
+layout(set = 0, binding = 0) uniform UniformBlock {
+    mat4 qt_ModelViewProjectionMatrix;
+    float qt_Opacity;
+};
+
+layout(location = 0) out vec4 vertexColor;
+
+void main(void)
+{
+    gl_Position = qt_ModelViewProjectionMatrix * qt_Vertex;
+    // the bytes of a little endian QRgb: blue, green, red, alpha. Premultiplied already
+    vertexColor = color.zyxw * qt_Opacity;
+}
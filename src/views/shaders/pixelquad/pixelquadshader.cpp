@@ -0,0 +1,55 @@
+#include "pixelquadshader.h"
+
+#include <QFile>
+#include <cstring>
+
+PixelQuadShader::PixelQuadShader() {
+    setShaderFileName(VertexStage, ":/shaders/src/views/shaders/pixelquad/pixelquad.vert.qsb");
+    setShaderFileName(FragmentStage, ":/shaders/src/views/shaders/pixelquad/pixelquad.frag.qsb");
+
+    if (!QFile::exists(":/shaders/src/views/shaders/pixelquad/pixelquad.vert.qsb")) {
+        qWarning() << "Vertex shader file not found.";
+    }
+    if (!QFile::exists(":/shaders/src/views/shaders/pixelquad/pixelquad.frag.qsb")) {
+        qWarning() << "Fragment shader file not found.";
+    }
+}
+
+bool PixelQuadShader::updateUniformData(RenderState &state, QSGMaterial *newMaterial, QSGMaterial *oldMaterial) {
+    Q_UNUSED(newMaterial);
+    Q_UNUSED(oldMaterial);
+
+    // the uniform block is the matrix followed by the opacity
+    QByteArray *uniformData = state.uniformData();
+    bool changed = false;
+    if (state.isMatrixDirty()) {
+        const QMatrix4x4 matrix = state.combinedMatrix();
+        memcpy(uniformData->data(), matrix.constData(), sizeof(float) * 16);
+        changed = true;
+    }
+    if (state.isOpacityDirty()) {
+        const float opacity = state.opacity();
+        memcpy(uniformData->data() + sizeof(float) * 16, &opacity, sizeof(float));
+        changed = true;
+    }
+    return changed;
+}
+
+PixelQuadMaterial::PixelQuadMaterial() {
+    setFlag(Blending); // pixels can be translucent
+}
+
+QSGMaterialType *PixelQuadMaterial::type() const {
+    static QSGMaterialType pixelQuadMaterialType; // shared by every PixelQuadMaterial
+    return &pixelQuadMaterialType;
+}
+
+int PixelQuadMaterial::compare(const QSGMaterial *other) const {
+    Q_UNUSED(other);
+    return 0; // no state of its own: any two batch together
+}
+
+QSGMaterialShader *PixelQuadMaterial::createShader(QSGRendererInterface::RenderMode mode) const {
+    Q_UNUSED(mode);
+    return new PixelQuadShader();
+}
@@ -0,0 +1,25 @@
+#ifndef PIXELQUADSHADER_H
+#define PIXELQUADSHADER_H
+
+#include <QSGMaterial>
+#include <QSGMaterialShader>
+
+// Flat colored quads, one color per vertex, as written by PixelQuads
+class PixelQuadShader : public QSGMaterialShader
+{
+public:
+    PixelQuadShader();
+    bool updateUniformData(RenderState &state, QSGMaterial *newMaterial, QSGMaterial *oldMaterial) override;
+};
+
+class PixelQuadMaterial : public QSGMaterial
+{
+public:
+    PixelQuadMaterial();
+
+    QSGMaterialShader* createShader(QSGRendererInterface::RenderMode mode) const override;
+    QSGMaterialType *type() const override;
+    int compare(const QSGMaterial *other) const override;
+};
+
+#endif // PIXELQUADSHADER_H
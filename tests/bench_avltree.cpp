@@ -0,0 +1,160 @@
+// Micro benchmarks for AVLTree. Not part of ctest: run BenchAVLTree by hand
+// (in a release build) and compare the numbers between revisions.
+
+#include <avltree.h>
+#include <QColor>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <vector>
+
+// count every heap allocation made by the process
+static std::atomic<long long> heapAllocations{0};
+
+void* operator new(std::size_t n) {
+    heapAllocations++;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+struct Result {
+    double fillMs;
+    double clearMs;
+    long long fillAllocations;
+};
+
+// fill a column-of-columns structure the same way RasterLayer does
+template <typename Fill, typename Clear>
+static Result run(Fill fill, Clear clear) {
+    Result r;
+    QElapsedTimer timer;
+
+    long long before = heapAllocations;
+    timer.start();
+    fill();
+    r.fillMs = timer.nsecsElapsed() / 1e6;
+    r.fillAllocations = heapAllocations - before;
+
+    timer.start();
+    clear();
+    r.clearMs = timer.nsecsElapsed() / 1e6;
+    return r;
+}
+
+static void print(const char* name, const Result& r, int pixels) {
+    std::printf("%-34s fill %9.2f ms  clear %8.2f ms  allocations %10lld (%.3f / pixel)\n",
+                name, r.fillMs, r.clearMs, r.fillAllocations, double(r.fillAllocations) / pixels);
+}
+
+int main(int argc, char* argv[]) {
+    const int side = argc > 1 ? std::atoi(argv[1]) : 1024;
+    const int pixels = side * side;
+    std::printf("filling a %d x %d layer (%d pixels)\n\n", side, side, pixels);
+
+    // before: one heap allocation per node, which is what AVLTree used to do
+    {
+        std::map<int, std::map<int, QColor>> layer;
+        Result r = run([&] {
+            for (int x = 0; x < side; x++) {
+                auto& column = layer[x];
+                for (int y = 0; y < side; y++) column.emplace(y, QColor(x & 0xff, y & 0xff, 0));
+            }
+        }, [&] { layer.clear(); });
+        print("std::map (one malloc per node)", r, pixels);
+    }
+
+    // after: pooled nodes
+    {
+        AVLTree<int, AVLTree<int, QColor>> layer;
+        Result r = run([&] {
+            for (int x = 0; x < side; x++) {
+                layer.upsert(x, AVLTree<int, QColor>());
+                auto& column = layer.get(x)->get();
+                for (int y = 0; y < side; y++) column.upsert(y, QColor(x & 0xff, y & 0xff, 0));
+            }
+        }, [&] { layer.clear(); });
+        print("AVLTree (pooled nodes)", r, pixels);
+    }
+
+    // single flat tree, no per-column overhead
+    {
+        AVLTree<int, int> tree;
+        Result r = run([&] {
+            for (int i = 0; i < pixels; i++) tree.upsert(i, i);
+        }, [&] { tree.clear(); });
+        print("AVLTree<int, int> flat", r, pixels);
+    }
+
+    // copying a layer: re-inserting every node (what the copy constructor used to
+    // do) vs the O(n) sorted bulk build it uses now
+    {
+        std::printf("\ncopying a %d x %d column-of-columns tree\n\n", side, side);
+
+        AVLTree<int, AVLTree<int, QColor>> layer;
+        for (int x = 0; x < side; x++) {
+            layer.upsert(x, AVLTree<int, QColor>());
+            auto& column = layer.get(x)->get();
+            for (int y = 0; y < side; y++) column.upsert(y, QColor(x & 0xff, y & 0xff, 0));
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        {
+            AVLTree<int, AVLTree<int, QColor>> copy;
+            for (const auto& [x, column] : layer) {
+                copy.upsert(x, AVLTree<int, QColor>());
+                auto& target = copy.get(x)->get();
+                for (const auto& [y, c] : column) target.upsert(y, c);
+            }
+            std::printf("%-34s %9.2f ms  (%d columns)\n", "re-upsert every node", timer.nsecsElapsed() / 1e6, copy.size());
+        }
+
+        timer.start();
+        {
+            AVLTree<int, AVLTree<int, QColor>> copy(layer);
+            std::printf("%-34s %9.2f ms  (%d columns)\n", "copy constructor (buildFromSorted)", timer.nsecsElapsed() / 1e6, copy.size());
+        }
+    }
+
+    // lookups: pooled pointers vs contiguous 32-bit indices
+    {
+        std::printf("\nlooking up %d random keys in a %d node tree\n\n", pixels, pixels);
+
+        std::vector<int> keys(pixels);
+        for (int i = 0; i < pixels; i++) keys[i] = i;
+        std::mt19937 rng(42);
+        std::shuffle(keys.begin(), keys.end(), rng);
+
+        AVLTree<int, int> pooled;
+        AVLTree<int, int, IndexedNodes> indexed;
+        for (int k : keys) {
+            pooled.upsert(k, k);
+            indexed.upsert(k, k);
+        }
+        std::shuffle(keys.begin(), keys.end(), rng);
+
+        auto lookups = [&](const char* name, auto& tree) {
+            QElapsedTimer timer;
+            timer.start();
+            long long sum = 0;
+            for (int k : keys) sum += tree.get(k)->get();
+            std::printf("%-34s %9.2f ms  (checksum %lld)\n", name, timer.nsecsElapsed() / 1e6, sum);
+        };
+
+        lookups("PooledNodes", pooled);
+        lookups("IndexedNodes", indexed);
+        pooled.compact();
+        indexed.compact();
+        lookups("PooledNodes after compact()", pooled);
+        lookups("IndexedNodes after compact()", indexed);
+    }
+
+    return 0;
+}
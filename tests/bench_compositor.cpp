@@ -0,0 +1,85 @@
+// Compositing throughput against thread count. Not part of ctest: run
+// BenchCompositor by hand (in a release build) and compare between revisions.
+//
+//   BenchCompositor [side] [layers] [max threads]
+
+#include <compositor.h>
+#include <QElapsedTimer>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include "benchhelpers.h"
+
+// a stack of layers with a dense background, scattered filled boxes and loose
+// pixels, over every blend mode, so tiles cost very different amounts
+static QVector<RasterLayer> makeLayers(int side, int count) {
+    std::mt19937 rng(11);
+    QVector<RasterLayer> layers(count);
+    layers[0].fillRect(QRect(0, 0, side, side), QColor(240, 240, 240));
+    for (int i = 1; i < count; i++) {
+        RasterLayer& layer = layers[i];
+        for (int b = 0; b < 12; b++) {
+            const int w = 16 + rng() % (side / 4), h = 16 + rng() % (side / 4);
+            layer.fillRect(QRect(rng() % (side - w), rng() % (side - h), w, h),
+                           QColor(rng() % 256, rng() % 256, rng() % 256, 64 + rng() % 192));
+        }
+        for (int p = 0; p < side * 4; p++)
+            layer.upsert(QPoint(rng() % side, rng() % side), QColor(rng() % 256, rng() % 256, rng() % 256));
+        layer.setBlendMode(static_cast<RasterLayer::BlendMode>(i % 4));
+        layer.setOpacity(0.5f + (i % 5) * 0.1f);
+    }
+    return layers;
+}
+
+int main(int argc, char* argv[]) {
+    const int side = argc > 1 ? std::atoi(argv[1]) : 2048;
+    const int count = argc > 2 ? std::atoi(argv[2]) : 20;
+    const int cores = argc > 3 ? std::atoi(argv[3]) : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    const QVector<RasterLayer> layers = makeLayers(side, count);
+    std::vector<QPoint> tiles;
+    for (int ty = 0; ty < side / Compositor::TileSize; ty++)
+        for (int tx = 0; tx < side / Compositor::TileSize; tx++) tiles.emplace_back(tx, ty);
+
+    std::printf("%d layers of %d x %d, %zu tiles, %d cores\n\n", count, side, side, tiles.size(), cores);
+
+    // best of three everywhere, the first round also warms the allocator up
+    QElapsedTimer timer;
+    double serial = 0;
+    for (int round = 0; round < 3; round++) {
+        Compositor compositor;
+        timer.start();
+        for (const QPoint& t : tiles) compositor.tile(layers, t.x(), t.y());
+        serial = round == 0 ? ms(timer) : std::min(serial, ms(timer));
+    }
+    std::printf("serial tile()        %9.2f ms\n", serial);
+
+    // the calling thread works too, so n threads is a pool of n - 1 workers
+    for (int threads = 1; threads <= cores; threads++) {
+        WorkerPool pool(threads - 1);
+        double best = 0;
+        for (int round = 0; round < 3; round++) {
+            Compositor compositor;
+            timer.start();
+            compositor.prefetch(layers, tiles, pool);
+            best = round == 0 ? ms(timer) : std::min(best, ms(timer));
+        }
+        std::printf("prefetch %3d threads %9.2f ms  speedup %5.2fx\n", threads, best, serial / best);
+    }
+
+    // the whole canvas in one tile of the mip pyramid, then again after a small edit
+    int top = 0;
+    while ((Compositor::TileSize << top) < side) top++;
+    Compositor compositor;
+    compositor.prefetch(layers, tiles, WorkerPool::global());
+    timer.start();
+    compositor.tile(layers, 0, 0, top);
+    const double build = ms(timer);
+    compositor.invalidate(QRect(side / 2, side / 2, 16, 16));
+    timer.start();
+    compositor.tile(layers, 0, 0, top);
+    std::printf("\nlevel %d pyramid   %9.2f ms  after a 16 x 16 edit %8.3f ms\n", top, build, ms(timer));
+
+    return 0;
+}
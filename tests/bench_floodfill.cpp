@@ -0,0 +1,108 @@
+// Bucket fill over a side x side canvas, 1M pixels by default. Not part of ctest:
+// run BenchFloodFill by hand (in a release build) and compare between revisions.
+// Times finding the region and then filling it as the controller does, with the
+// undo recording, against a search a pixel at a time through get.
+//
+//   BenchFloodFill [side]      default 1000
+
+#include <floodfill.h>
+#include <layerdelta.h>
+#include <QElapsedTimer>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include "benchhelpers.h"
+
+// the contiguous fill done a pixel at a time, two lookups per neighbour
+static qint64 naiveFill(const RasterLayer& layer, const QRect& bounds, QPoint seed) {
+    const auto target = layer.get(seed);
+    std::vector<bool> seen(static_cast<size_t>(bounds.width()) * bounds.height());
+    auto index = [&](QPoint p) { return static_cast<size_t>(p.y() - bounds.top()) * bounds.width() + (p.x() - bounds.left()); };
+    std::deque<QPoint> pending{seed};
+    seen[index(seed)] = true;
+    qint64 count = 0;
+    while (!pending.empty()) {
+        const QPoint p = pending.front();
+        pending.pop_front();
+        count++;
+        for (const QPoint next : {p + QPoint(1, 0), p - QPoint(1, 0), p + QPoint(0, 1), p - QPoint(0, 1)}) {
+            if (!bounds.contains(next) || seen[index(next)]) continue;
+            if (layer.contains(next) != target.has_value()) continue;
+            if (target && layer.get(next)->value != target->value) continue;
+            seen[index(next)] = true;
+            pending.push_back(next);
+        }
+    }
+    return count;
+}
+
+static qint64 pixelsOf(const QVector<ColumnRun>& runs) {
+    qint64 n = 0;
+    for (const ColumnRun& r : runs) n += r.length;
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    const int side = argc > 1 ? std::atoi(argv[1]) : 1000;
+    const QRect bounds(0, 0, side, side);
+    const Pixel wall(QColor(20, 20, 20)), paint(QColor(220, 60, 60));
+    std::printf("%d x %d canvas\n\n", side, side);
+    std::printf("                            pixels     spans   region ms    fill ms   naive ms\n");
+
+    for (const auto mode : {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled, RasterLayer::StorageMode::Runs}) {
+        const char* storage = mode == RasterLayer::StorageMode::Sparse ? "sparse" : mode == RasterLayer::StorageMode::Tiled ? "tiled " : "runs  ";
+
+        // empty canvas; a solid one; a maze of walls every 4 columns with a gap at
+        // alternating ends, a corridor that winds through every column; noise in a
+        // few close shades, filled globally within a tolerance
+        RasterLayer empty(mode), solid(mode), maze(mode), noise(mode);
+        solid.fillRect(bounds, wall);
+        for (int x = 3; x < side; x += 4) maze.fillRect(QRect(x, (x / 4) % 2 ? 0 : 1, 1, side - 1), wall);
+        std::mt19937 rng(3);
+        QVector<PixelRef> dots;
+        for (int x = 0; x < side; x++)
+            for (int y = 0; y < side; y++) dots.emplaceBack(x, y, QColor(100 + rng() % 16, 100, 100));
+        noise.upsertMany(std::move(dots));
+
+        const struct {
+            const char* name;
+            const RasterLayer& layer;
+            FloodFill::Mode fill;
+            int tolerance;
+            int threads; // -1 for the global pool
+        } cases[] = {
+            {"empty", empty, FloodFill::Mode::Contiguous, 0, 0},
+            {"solid", solid, FloodFill::Mode::Contiguous, 0, 0},
+            {"maze", maze, FloodFill::Mode::Contiguous, 0, 0},
+            {"noise global 1 thread", noise, FloodFill::Mode::Global, 8, 0},
+            {"noise global all", noise, FloodFill::Mode::Global, 8, -1},
+        };
+        for (const auto& c : cases) {
+            WorkerPool serial(0);
+            WorkerPool& pool = c.threads < 0 ? WorkerPool::global() : serial;
+
+            QElapsedTimer timer;
+            timer.start();
+            const QVector<ColumnRun> runs = FloodFill::region(c.layer, bounds, QPoint(0, 0), c.tolerance, c.fill, pool);
+            const double region = ms(timer);
+
+            RasterLayer target = c.layer;
+            LayerDelta delta;
+            timer.start();
+            delta.recordRuns(target, runs, paint);
+            target.fillRuns(runs, paint);
+            const double fill = ms(timer);
+
+            double naive = 0;
+            if (c.fill == FloodFill::Mode::Contiguous) {
+                timer.start();
+                naiveFill(c.layer, bounds, QPoint(0, 0));
+                naive = ms(timer);
+            }
+            std::printf("%s %-20s %9lld %9lld %11.2f %10.2f %10.2f\n", storage, c.name, static_cast<long long>(pixelsOf(runs)),
+                        static_cast<long long>(runs.size()), region, fill, naive);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Image export and import throughput, through files on disk. Not part of ctest:
+// run BenchImageIO by hand (in a release build) and compare between revisions.
+//
+//   BenchImageIO [side...]      default 4096 16384
+
+#include <imageio.h>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "benchhelpers.h"
+
+// a filled background with scattered boxes and loose pixels over it, so rows
+// neither compress to nothing nor are noise
+static RasterLayer makeLayer(int side) {
+    std::mt19937 rng(5);
+    RasterLayer layer(RasterLayer::StorageMode::Tiled);
+    layer.fillRect(QRect(0, 0, side, side), QColor(30, 40, 50));
+    for (int b = 0; b < 200; b++) {
+        const int w = 8 + rng() % (side / 8), h = 8 + rng() % (side / 8);
+        layer.fillRect(QRect(rng() % (side - w), rng() % (side - h), w, h), QColor(rng() % 256, rng() % 256, rng() % 256));
+    }
+    for (int p = 0; p < side * 16; p++)
+        layer.upsert(QPoint(rng() % side, rng() % side), QColor(rng() % 256, rng() % 256, rng() % 256, 128));
+    return layer;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> sides;
+    for (int i = 1; i < argc; i++) sides.push_back(std::atoi(argv[i]));
+    if (sides.empty()) sides = {4096, 16384};
+
+    QTemporaryDir dir;
+    const QString png = dir.filePath("bench.png"), raw = dir.filePath("bench.rgba");
+    for (int side : sides) {
+        const RasterLayer layer = makeLayer(side);
+        const QRect box(0, 0, side, side);
+        const double mb = 4.0 * side * side / (1 << 20); // as RGBA8
+        std::printf("%d x %d, %.0f MB as RGBA8\n", side, side, mb);
+
+        QElapsedTimer timer;
+        auto report = [&](const char* what, const QString& path) {
+            const double t = ms(timer);
+            QFile file(path);
+            file.open(QIODevice::ReadOnly);
+            std::printf("  %-12s %9.1f ms  %7.1f MB/s  file %7.1f MB\n", what, t, mb / t * 1000,
+                        file.size() / double(1 << 20));
+        };
+
+        for (const QString& path : {png, raw}) {
+            const bool isPng = path == png;
+            QString error;
+            {
+                QFile file(path);
+                file.open(QIODevice::WriteOnly);
+                Scanlines rows(layer, box);
+                timer.start();
+                const bool ok = isPng ? ImageIO::writePng(rows, &file, &error) : ImageIO::writeRaw(rows, &file, &error);
+                if (!ok) std::printf("  export failed: %s\n", qPrintable(error));
+            }
+            report(isPng ? "export png" : "export raw", path);
+
+            QFile file(path);
+            file.open(QIODevice::ReadOnly);
+            RasterLayer loaded(RasterLayer::StorageMode::Tiled);
+            timer.start();
+            const bool ok = isPng ? ImageIO::readImage(&file, QPoint(0, 0), loaded, nullptr, &error)
+                                  : ImageIO::readRaw(&file, side, QPoint(0, 0), loaded, nullptr, &error);
+            if (!ok) std::printf("  import failed: %s\n", qPrintable(error));
+            report(isPng ? "import png" : "import raw", path);
+            if (loaded.size() != layer.size()) std::printf("  imported %d pixels, expected %d\n", loaded.size(), layer.size());
+        }
+    }
+    return 0;
+}
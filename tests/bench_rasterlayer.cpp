@@ -0,0 +1,202 @@
+// Micro benchmarks for RasterLayer storage backends. Not part of ctest: run
+// BenchRasterLayer by hand (in a release build) and compare between revisions.
+
+#include <rasterlayer.h>
+#include <QElapsedTimer>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include "benchhelpers.h"
+
+// track live heap bytes so we can report what a layer costs. Every block
+// carries its requested size in a 16 byte header
+static std::atomic<long long> liveBytes{0};
+static std::atomic<long long> allocations{0};
+
+void* operator new(std::size_t n) {
+    char* p = static_cast<char*>(std::malloc(n + 16));
+    if (!p) throw std::bad_alloc();
+    *reinterpret_cast<std::size_t*>(p) = n;
+    liveBytes += n;
+    allocations++;
+    return p + 16;
+}
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    char* block = static_cast<char*>(p) - 16;
+    liveBytes -= *reinterpret_cast<std::size_t*>(block);
+    std::free(block);
+}
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+static void run(const char* name, RasterLayer::StorageMode mode, int side) {
+    const int pixels = side * side;
+    QElapsedTimer timer;
+
+    long long before = liveBytes;
+    RasterLayer layer(mode);
+
+    timer.start();
+    for (int x = 0; x < side; x++)
+        for (int y = 0; y < side; y++) layer.upsert(QPoint(x, y), QColor(x & 0xff, y & 0xff, 0));
+    double fill = ms(timer);
+    long long bytes = liveBytes - before;
+
+    std::mt19937 rng(7);
+    timer.start();
+    int hits = 0;
+    for (int i = 0; i < pixels; i++) hits += layer.contains(QPoint(rng() % side, rng() % side));
+    double lookups = ms(timer);
+
+    timer.start();
+    long long read = 0;
+    for (int y = 0; y < side; y += 64) read += layer.get(QRect(0, y, side, 64)).size();
+    double region = ms(timer);
+    long long regionAllocs = 0;
+    {
+        long long a = allocations;
+        for (int y = 0; y < side; y += 64) read += layer.get(QRect(0, y, side, 64)).size();
+        regionAllocs = allocations - a;
+    }
+
+    // the same strips, walked in place
+    long long a = allocations;
+    timer.start();
+    for (int y = 0; y < side; y += 64) layer.forEachInRect(QRect(0, y, side, 64), [&read](QPoint, Pixel) { read++; });
+    double visit = ms(timer);
+    long long visitAllocs = allocations - a;
+
+    a = allocations;
+    timer.start();
+    for (int y = 0; y < side; y += 64)
+        for (const PixelRef& p : layer.pixels(QRect(0, y, side, 64))) read += p.location.x() & 1;
+    double iterate = ms(timer);
+    long long iterateAllocs = allocations - a;
+
+    // snapshot, then one write to the live layer (what undo does per stroke)
+    timer.start();
+    RasterLayer snapshot(layer);
+    double copy = ms(timer);
+    layer.upsert(QPoint(side / 2, side / 2), QColor(1, 2, 3));
+    double copyAndWrite = ms(timer);
+    read += snapshot.size();
+
+    std::printf("%-8s fill %9.2f ms  lookup %9.2f ms  region %8.2f ms  memory %8.2f MiB (%6.1f B / pixel)  [%d %lld]\n",
+                name, fill, lookups, region, bytes / 1048576.0, double(bytes) / pixels, hits, read);
+    std::printf("%-8s region get() %lld allocs  forEachInRect %8.2f ms (%lld allocs)  range-for %8.2f ms (%lld allocs)\n",
+                "", regionAllocs, visit, visitAllocs, iterate, iterateAllocs);
+    std::printf("%-8s snapshot %8.4f ms  snapshot + first write %8.2f ms\n", "", copy, copyAndWrite);
+}
+
+// a brush stroke of 64x64 dabs along a diagonal, one upsert per pixel vs one
+// upsertMany per dab
+static void stroke(const char* name, RasterLayer::StorageMode mode, int dabs) {
+    QVector<QVector<PixelRef>> batches;
+    for (int d = 0; d < dabs; d++) {
+        QVector<PixelRef> dab;
+        for (int x = 0; x < 64; x++)
+            for (int y = 0; y < 64; y++) dab.emplaceBack(d * 8 + x, d * 8 + y, Pixel(QColor(d & 0xff, 0, 0)));
+        batches.append(dab);
+    }
+
+    QElapsedTimer timer;
+    RasterLayer single(mode);
+    timer.start();
+    for (const auto& dab : batches)
+        for (const PixelRef& p : dab) single.upsert(p.location, p.value);
+    double perPixel = ms(timer);
+
+    RasterLayer batched(mode);
+    timer.start();
+    for (const auto& dab : batches) batched.upsertMany(dab);
+    double perDab = ms(timer);
+
+    std::printf("%-8s %d dabs  upsert %9.2f ms  upsertMany %9.2f ms  [%d %d]\n",
+                name, dabs, perPixel, perDab, single.size(), batched.size());
+}
+
+// flat art: overlapping solid rects of a few colors, the case runs are made for.
+// Memory, then random lookups and a walk over every run
+static void flat(const char* name, RasterLayer::StorageMode mode, int side) {
+    long long before = liveBytes;
+    RasterLayer layer(mode);
+    std::mt19937 rng(11);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < 200; i++) {
+        const int x = rng() % side, y = rng() % side;
+        layer.fillRect(QRect(x, y, rng() % (side - x) + 1, rng() % (side - y) + 1), QColor(rng() % 4 * 60, 80, 80));
+    }
+    double fill = ms(timer);
+    long long bytes = liveBytes - before;
+
+    timer.start();
+    int hits = 0;
+    for (int i = 0; i < side * side; i++) hits += layer.contains(QPoint(rng() % side, rng() % side));
+    double lookups = ms(timer);
+
+    timer.start();
+    long long runs = 0;
+    layer.forEachRunInRect(QRect(0, 0, side, side), [&runs](const ColumnRun&, Pixel) { runs++; });
+    double walk = ms(timer);
+
+    std::printf("%-8s fill %9.2f ms  lookup %9.2f ms  runs %8.2f ms  memory %8.2f MiB  [%d pixels, %d hits, %lld runs]\n",
+                name, fill, lookups, walk, bytes / 1048576.0, layer.size(), hits, runs);
+}
+
+// scattered pixels read back through wide, short boxes (a row of sprites, a
+// selection strip): the per-column lookups of the column trees against Z-order
+static void strips(const char* name, RasterLayer::StorageMode mode) {
+    const int side = 4096;
+    long long before = liveBytes;
+    RasterLayer layer(mode);
+    std::mt19937 rng(13);
+    QVector<PixelRef> dots;
+    for (int i = 0; i < 100000; i++) dots.emplaceBack(rng() % side, rng() % side, Pixel(QColor(1, 2, 3)));
+    layer.upsertMany(dots);
+    long long bytes = liveBytes - before;
+
+    QElapsedTimer timer;
+    timer.start();
+    long long read = 0;
+    for (int i = 0; i < 500; i++) layer.forEachInRect(QRect(0, rng() % (side - 8), side, 8), [&read](QPoint, Pixel) { read++; });
+    double wide = ms(timer);
+
+    timer.start();
+    for (int i = 0; i < 500; i++) layer.forEachInRect(QRect(rng() % (side - 64), rng() % (side - 64), 64, 64), [&read](QPoint, Pixel) { read++; });
+    double square = ms(timer);
+
+    std::printf("%-8s 500 strips %8.2f ms  500 squares %8.2f ms  memory %8.2f MiB  [%lld]\n", name, wide, square,
+                bytes / 1048576.0, read);
+}
+
+int main(int argc, char* argv[]) {
+    const int side = argc > 1 ? std::atoi(argv[1]) : 1024;
+    std::printf("dense %d x %d layer (%d pixels)\n\n", side, side, side * side);
+
+    run("sparse", RasterLayer::StorageMode::Sparse, side);
+    run("tiled", RasterLayer::StorageMode::Tiled, side);
+    run("auto", RasterLayer::StorageMode::Auto, side);
+    run("runs", RasterLayer::StorageMode::Runs, side);
+    run("morton", RasterLayer::StorageMode::Morton, side);
+
+    std::printf("\nbrush stroke of 64 x 64 dabs\n\n");
+    stroke("sparse", RasterLayer::StorageMode::Sparse, 200);
+    stroke("tiled", RasterLayer::StorageMode::Tiled, 200);
+    stroke("runs", RasterLayer::StorageMode::Runs, 200);
+    stroke("morton", RasterLayer::StorageMode::Morton, 200);
+
+    std::printf("\n200 solid rects in 4 colors\n\n");
+    flat("sparse", RasterLayer::StorageMode::Sparse, side);
+    flat("tiled", RasterLayer::StorageMode::Tiled, side);
+    flat("runs", RasterLayer::StorageMode::Runs, side);
+    flat("morton", RasterLayer::StorageMode::Morton, side);
+
+    std::printf("\n100000 scattered pixels on 4096 x 4096, 4096 x 8 strips and 64 x 64 squares\n\n");
+    strips("sparse", RasterLayer::StorageMode::Sparse);
+    strips("morton", RasterLayer::StorageMode::Morton);
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Brush stroke cost per pointer sample. Not part of ctest: run BenchStrokeEngine
+// by hand (in a release build) and compare between revisions. At 1000 Hz input a
+// sample has 1000 us, all of it included: interpolation, undo recording and the
+// layer write.
+//
+//   BenchStrokeEngine [brush size] [samples] [pixels per sample]
+
+#include <layerdelta.h>
+#include <strokeengine.h>
+#include <QElapsedTimer>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// the pointer along a wavy line, speed pixels apart
+static QVector<QPointF> makePath(int samples, double speed) {
+    QVector<QPointF> path;
+    double x = 0;
+    for (int i = 0; i < samples; i++, x += speed) path.append(QPointF(x, 300 + 200 * std::sin(x / 150)));
+    return path;
+}
+
+struct Result {
+    double mean, worst; // us per sample
+};
+
+enum class Method {
+    Crescents, // as the controller does
+    Stamps,    // every stamp in full
+    Pixels,    // every stamp in full, pixel by pixel through upsertMany
+};
+
+static Result run(const QVector<QPointF>& path, int size, RasterLayer::StorageMode mode, Method method) {
+    StrokeEngine engine;
+    engine.setBrush({size, StrokeEngine::Shape::Round, 0.1f});
+    RasterLayer layer(mode);
+    LayerDelta delta;
+    const Pixel color(QColor(200, 40, 40));
+
+    QElapsedTimer timer;
+    double total = 0, worst = 0;
+    for (const QPointF& p : path) {
+        timer.start();
+        if (method != Method::Crescents) engine.restamp();
+        QVector<ColumnRun> runs = engine.moveTo(p);
+        if (method == Method::Pixels) {
+            QVector<PixelRef> pixels;
+            for (const ColumnRun& r : runs)
+                for (int y = r.y; y < r.y + r.length; y++) pixels.emplaceBack(r.x, y, color);
+            delta.recordUpserts(layer, pixels);
+            layer.upsertMany(std::move(pixels));
+        } else {
+            delta.recordRuns(layer, runs, color);
+            layer.fillRuns(std::move(runs), color);
+        }
+        const double us = timer.nsecsElapsed() / 1e3;
+        total += us;
+        worst = std::max(worst, us);
+    }
+    return {total / path.size(), worst};
+}
+
+int main(int argc, char* argv[]) {
+    const int size = argc > 1 ? std::atoi(argv[1]) : 64;
+    const int samples = argc > 2 ? std::atoi(argv[2]) : 1000;
+    const double speed = argc > 3 ? std::atof(argv[3]) : 2;
+
+    const QVector<QPointF> path = makePath(samples, speed);
+    std::printf("%d px round brush, %d samples %.1f px apart\n\n", size, samples, speed);
+    std::printf("                    mean us   worst us\n");
+
+    const struct {
+        const char* name;
+        RasterLayer::StorageMode mode;
+    } modes[] = {{"sparse", RasterLayer::StorageMode::Sparse}, {"tiled ", RasterLayer::StorageMode::Tiled}};
+    const struct {
+        const char* name;
+        Method method;
+    } methods[] = {{"crescents", Method::Crescents}, {"stamps", Method::Stamps}, {"pixels", Method::Pixels}};
+    for (const auto& m : modes) {
+        for (const auto& how : methods) {
+            const Result r = run(path, size, m.mode, how.method);
+            std::printf("%s %-10s  %9.1f  %9.1f\n", m.name, how.name, r.mean, r.worst);
+        }
+    }
+    return 0;
+}
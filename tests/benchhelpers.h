@@ -0,0 +1,11 @@
+#ifndef BENCHHELPERS_H
+#define BENCHHELPERS_H
+
+#include <QElapsedTimer>
+
+// Helpers shared by the benchmarks.
+
+// return the milliseconds since timer was started
+inline double ms(const QElapsedTimer& timer) { return timer.nsecsElapsed() / 1e6; }
+
+#endif // BENCHHELPERS_H
@@ -0,0 +1,43 @@
+#ifndef TESTHELPERS_H
+#define TESTHELPERS_H
+
+#include <rasterlayer.h>
+#include <algorithm>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Helpers shared by the test suites.
+
+typedef std::set<std::pair<int, int>> PixelSet;
+
+// return every pixel of a layer as (x, y, 16 bit color), sorted, for comparing
+// layers of either format
+inline std::vector<std::tuple<int, int, quint64>> contents(const RasterLayer& layer) {
+    std::vector<std::tuple<int, int, quint64>> out;
+    layer.forEachInRect(QRect(QPoint(-100000, -100000), QPoint(100000, 100000)), [&](QPoint loc, Pixel) {
+        out.emplace_back(loc.x(), loc.y(), static_cast<quint64>(*layer.getWide(loc)));
+    });
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+// return every pixel the runs cover
+inline PixelSet pixelsOf(const QVector<ColumnRun>& runs) {
+    PixelSet out;
+    for (const ColumnRun& run : runs)
+        for (int y = run.y; y < run.y + run.length; y++) out.emplace(run.x, y);
+    return out;
+}
+
+// return if runs are sorted by (x, y) and neither overlap nor touch
+inline bool isUnited(const QVector<ColumnRun>& runs) {
+    for (qsizetype i = 1; i < runs.size(); i++) {
+        const ColumnRun &a = runs[i - 1], &b = runs[i];
+        if (a.x > b.x || (a.x == b.x && a.y + a.length >= b.y)) return false;
+    }
+    return true;
+}
+
+#endif // TESTHELPERS_H
@@ -1,6 +1,9 @@
 #include <avltree.h>
 #include <gmock/gmock-matchers.h>
 #include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <vector>
 
 using namespace testing;
 
@@ -39,6 +42,39 @@ TEST(ConstructorDestructor, CopyConstructorNonEmpty) {
     ASSERT_TRUE(copy.contains(10));
 }
 
+TEST(ConstructorDestructor, CopyAssignment) {
+    AVLTree<int, std::string> original;
+    original.upsert(10, "ten");
+    original.upsert(20, "twenty");
+
+    AVLTree<int, std::string> copy;
+    copy.upsert(30, "thirty");
+    copy = original;
+
+    ASSERT_EQ(copy.size(), 2);
+    ASSERT_TRUE(copy.contains(10));
+    ASSERT_FALSE(copy.contains(30));
+
+    // modifying one shouldnt affect the other
+    original.upsert(10, "changed");
+    ASSERT_EQ(copy.get(10)->get(), "ten");
+}
+
+TEST(ConstructorDestructor, MoveConstructor) {
+    AVLTree<int, std::string> original;
+    original.upsert(10, "ten");
+    original.upsert(20, "twenty");
+
+    AVLTree<int, std::string> moved(std::move(original));
+    ASSERT_EQ(moved.size(), 2);
+    ASSERT_EQ(moved.get(20)->get(), "twenty");
+
+    // the moved-from tree is empty but still usable
+    ASSERT_EQ(original.size(), 0);
+    original.upsert(1, "one");
+    ASSERT_TRUE(original.contains(1));
+}
+
 TEST(ConstructorDestructor, DestructorBasicCheck) {
     // we cannot directly test the destructor from user code,
     // but we can put an instance in a scope to ensure no crashes, etc.
@@ -75,6 +111,34 @@ TEST(size, AfterMultipleUpserts) {
     ASSERT_EQ(tree.size(), 3);
 }
 
+// Accessory test: ALLOCATIONS ---------------------------
+
+TEST(allocations, EmptyTree) {
+    AVLTree<int, std::string> tree;
+    ASSERT_EQ(tree.allocations(), 0);
+}
+
+TEST(allocations, NodesArePooled) {
+    AVLTree<int, int> tree;
+    for (int i = 0; i < 1000; i++) tree.upsert(i, i);
+
+    // slabs grow geometrically, so 1000 nodes need only a handful of them
+    ASSERT_EQ(tree.size(), 1000);
+    ASSERT_LE(tree.allocations(), 8);
+}
+
+TEST(allocations, RemovedNodesAreReused) {
+    AVLTree<int, int> tree;
+    for (int i = 0; i < 100; i++) tree.upsert(i, i);
+    int before = tree.allocations();
+
+    for (int i = 0; i < 100; i++) tree.remove(i);
+    for (int i = 100; i < 200; i++) tree.upsert(i, i);
+
+    ASSERT_EQ(tree.size(), 100);
+    ASSERT_EQ(tree.allocations(), before);
+}
+
 // Accessory test: CONTAINS ---------------------------
 
 TEST(contains, EmptyTree) {
@@ -207,6 +271,178 @@ TEST(getRange, InvalidRange) {
     ASSERT_TRUE(result.isEmpty());
 }
 
+// Accessory test: ITERATORS ---------------------------
+
+TEST(iterators, EmptyTree) {
+    AVLTree<int, std::string> tree;
+    ASSERT_TRUE(tree.begin() == tree.end());
+    ASSERT_TRUE(tree.first() == tree.end());
+    ASSERT_TRUE(tree.last() == tree.end());
+    ASSERT_TRUE(tree.lowerBound(0) == tree.end());
+    ASSERT_TRUE(tree.predecessor(0) == tree.end());
+}
+
+TEST(iterators, ForwardAndBackward) {
+    AVLTree<int, std::string> tree;
+    for (int k : {50, 20, 80, 10, 30, 70, 90, 60}) tree.upsert(k, std::to_string(k));
+
+    std::vector<int> forward;
+    for (const auto& [k, v] : tree) {
+        forward.push_back(k);
+        ASSERT_EQ(v, std::to_string(k));
+    }
+    ASSERT_EQ(forward, (std::vector<int>{10, 20, 30, 50, 60, 70, 80, 90}));
+
+    std::vector<int> backward;
+    for (auto it = tree.end(); it != tree.begin();) {
+        --it;
+        backward.push_back(it.key());
+    }
+    ASSERT_EQ(backward, (std::vector<int>{90, 80, 70, 60, 50, 30, 20, 10}));
+
+    ASSERT_EQ(tree.first().key(), 10);
+    ASSERT_EQ(tree.last().key(), 90);
+}
+
+TEST(iterators, ValuesAreMutable) {
+    AVLTree<int, std::string> tree;
+    tree.upsert(1, "one");
+    tree.upsert(2, "two");
+
+    for (auto [k, v] : tree) v += "!";
+    tree.begin()->second += "?";
+
+    ASSERT_EQ(tree.get(1)->get(), "one!?");
+    ASSERT_EQ(tree.get(2)->get(), "two!");
+}
+
+TEST(iterators, Bounds) {
+    AVLTree<int, int> tree;
+    for (int k = 0; k <= 100; k += 10) tree.upsert(k, k);
+
+    ASSERT_EQ(tree.lowerBound(30).key(), 30);
+    ASSERT_EQ(tree.lowerBound(31).key(), 40);
+    ASSERT_EQ(tree.upperBound(30).key(), 40);
+    ASSERT_EQ(tree.lowerBound(-5).key(), 0);
+    ASSERT_TRUE(tree.lowerBound(101) == tree.end());
+    ASSERT_TRUE(tree.upperBound(100) == tree.end());
+
+    ASSERT_EQ(tree.successor(30).key(), 40);
+    ASSERT_EQ(tree.successor(35).key(), 40);
+    ASSERT_EQ(tree.predecessor(30).key(), 20);
+    ASSERT_EQ(tree.predecessor(35).key(), 30);
+    ASSERT_EQ(tree.predecessor(1000).key(), 100);
+    ASSERT_TRUE(tree.predecessor(0) == tree.end());
+    ASSERT_TRUE(tree.successor(100) == tree.end());
+}
+
+TEST(iterators, StopEarly) {
+    AVLTree<int, int> tree;
+    for (int k = 0; k < 1000; k++) tree.upsert(k, k);
+
+    int visited = 0;
+    bool finished = tree.forEachInRange(100, 900, [&visited](const int& k, int&) {
+        visited++;
+        return k < 109;
+    });
+    ASSERT_FALSE(finished);
+    ASSERT_EQ(visited, 10);
+}
+
+// Accessory test: BULK LOAD ---------------------------
+
+TEST(buildFromSorted, Empty) {
+    AVLTree<int, std::string> tree;
+    tree.upsert(1, "one");
+
+    std::vector<std::pair<int, std::string>> none;
+    tree.buildFromSorted(none.begin(), none.end());
+    ASSERT_EQ(tree.size(), 0);
+    ASSERT_TRUE(tree.begin() == tree.end());
+}
+
+TEST(buildFromSorted, FromVectorAndMap) {
+    std::vector<std::pair<int, std::string>> entries;
+    std::map<int, std::string> reference;
+    for (int k = -50; k < 50; k += 3) {
+        entries.push_back({k, std::to_string(k)});
+        reference[k] = std::to_string(k);
+    }
+
+    AVLTree<int, std::string> fromVector;
+    fromVector.buildFromSorted(entries.begin(), entries.end());
+    AVLTree<int, std::string, IndexedNodes> fromMap;
+    fromMap.buildFromSorted(reference.begin(), reference.end());
+
+    ASSERT_EQ(fromVector.size(), static_cast<int>(entries.size()));
+    ASSERT_EQ(fromMap.size(), static_cast<int>(entries.size()));
+    auto a = fromVector.begin();
+    auto b = fromMap.begin();
+    for (const auto& [k, v] : entries) {
+        ASSERT_EQ(a.key(), k);
+        ASSERT_EQ(a.value(), v);
+        ASSERT_EQ(b.key(), k);
+        ASSERT_EQ(b.value(), v);
+        ++a;
+        ++b;
+    }
+}
+
+// the built tree must have correct parents and heights, or later edits break it
+template <typename Nodes>
+static void editAfterBuild(unsigned seed) {
+    std::map<int, int> reference;
+    for (int k = 0; k < 1000; k += 2) reference[k] = k;
+
+    AVLTree<int, int, Nodes> tree;
+    tree.buildFromSorted(reference.begin(), reference.end());
+
+    std::mt19937 rng(seed);
+    for (int i = 0; i < 5000; i++) {
+        int k = rng() % 1200;
+        if (rng() % 2 == 0) {
+            tree.remove(k);
+            reference.erase(k);
+        } else {
+            tree.upsert(k, i);
+            reference[k] = i;
+        }
+    }
+
+    ASSERT_EQ(tree.size(), static_cast<int>(reference.size()));
+    auto it = tree.begin();
+    for (const auto& [k, v] : reference) {
+        ASSERT_EQ(it.key(), k);
+        ASSERT_EQ(it.value(), v);
+        ++it;
+    }
+    ASSERT_TRUE(it == tree.end());
+}
+
+TEST(buildFromSorted, PooledEditAfterBuild) {
+    editAfterBuild<PooledNodes>(3);
+}
+
+TEST(buildFromSorted, IndexedEditAfterBuild) {
+    editAfterBuild<IndexedNodes>(3);
+}
+
+TEST(buildFromSorted, FromAnotherTree) {
+    AVLTree<int, AVLTree<int, QColor>> layer;
+    for (int x = 0; x < 20; x++) {
+        layer.upsert(x, AVLTree<int, QColor>());
+        for (int y = 0; y < 20; y++) layer.get(x)->get().upsert(y, QColor(x, y, 0));
+    }
+
+    AVLTree<int, AVLTree<int, QColor>> rebuilt;
+    rebuilt.buildFromSorted(layer.begin(), layer.end());
+    layer.clear(); // the columns were copied, not shared
+
+    ASSERT_EQ(rebuilt.size(), 20);
+    ASSERT_EQ(rebuilt.get(7)->get().size(), 20);
+    ASSERT_EQ(rebuilt.get(7)->get().get(11)->get(), QColor(7, 11, 0));
+}
+
 // Accessory test: CLEAR ---------------------------
 
 TEST(clear, ClearEmptyTree) {
@@ -296,6 +532,119 @@ TEST(remove, RemoveExistentKey) {
     ASSERT_FALSE(tree.contains(42));
 }
 
+// Storage policy tests ---------------------------
+
+// apply the same random edits to a tree and a std::map and check they agree
+template <typename Nodes>
+static void randomizedAgainstMap(unsigned seed) {
+    AVLTree<int, int, Nodes> tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(seed);
+
+    for (int i = 0; i < 5000; i++) {
+        int k = rng() % 500;
+        if (rng() % 3 == 0) {
+            tree.remove(k);
+            reference.erase(k);
+        } else {
+            tree.upsert(k, i);
+            reference[k] = i;
+        }
+    }
+
+    ASSERT_EQ(tree.size(), static_cast<int>(reference.size()));
+    for (int k = 0; k < 500; k++) {
+        auto it = reference.find(k);
+        ASSERT_EQ(tree.contains(k), it != reference.end());
+        if (it != reference.end()) {
+            ASSERT_EQ(tree.get(k)->get(), it->second);
+        }
+    }
+
+    // in-order walks agree in both directions
+    auto it = tree.begin();
+    for (const auto& [k, v] : reference) {
+        ASSERT_EQ(it.key(), k);
+        ASSERT_EQ(it.value(), v);
+        ++it;
+    }
+    ASSERT_TRUE(it == tree.end());
+    for (auto rit = reference.rbegin(); rit != reference.rend(); ++rit) {
+        --it;
+        ASSERT_EQ(it.key(), rit->first);
+    }
+
+    for (int k = -1; k <= 500; k += 7) {
+        auto lb = reference.lower_bound(k);
+        auto ub = reference.upper_bound(k);
+        ASSERT_EQ(tree.lowerBound(k) == tree.end(), lb == reference.end());
+        if (lb != reference.end()) {
+            ASSERT_EQ(tree.lowerBound(k).key(), lb->first);
+        }
+        ASSERT_EQ(tree.upperBound(k) == tree.end(), ub == reference.end());
+        if (ub != reference.end()) {
+            ASSERT_EQ(tree.upperBound(k).key(), ub->first);
+        }
+    }
+
+    auto range = tree.getRange(100, 300);
+    auto lo = reference.lower_bound(100);
+    auto hi = reference.upper_bound(300);
+    ASSERT_EQ(range.size(), std::distance(lo, hi));
+    for (const auto& pair : range) {
+        ASSERT_EQ(pair.first, lo->first);
+        ASSERT_EQ(pair.second.get(), lo->second);
+        ++lo;
+    }
+}
+
+TEST(storage, PooledMatchesMap) {
+    randomizedAgainstMap<PooledNodes>(1);
+}
+
+TEST(storage, IndexedMatchesMap) {
+    randomizedAgainstMap<IndexedNodes>(1);
+}
+
+TEST(storage, IndexedNonTrivialValues) {
+    AVLTree<int, std::string, IndexedNodes> tree;
+    for (int i = 0; i < 100; i++) tree.upsert(i, std::to_string(i));
+    for (int i = 0; i < 100; i += 2) tree.remove(i);
+
+    ASSERT_EQ(tree.size(), 50);
+    ASSERT_FALSE(tree.contains(10));
+    ASSERT_EQ(tree.get(11)->get(), "11");
+
+    AVLTree<int, std::string, IndexedNodes> copy(tree);
+    tree.clear();
+    ASSERT_EQ(copy.size(), 50);
+    ASSERT_EQ(copy.get(99)->get(), "99");
+}
+
+TEST(storage, CompactKeepsContents) {
+    AVLTree<int, std::string> pooled;
+    AVLTree<int, std::string, IndexedNodes> indexed;
+    for (int i = 0; i < 200; i++) {
+        pooled.upsert(i * 7 % 200, std::to_string(i));
+        indexed.upsert(i * 7 % 200, std::to_string(i));
+    }
+    pooled.compact();
+    indexed.compact();
+
+    ASSERT_EQ(pooled.size(), 200);
+    ASSERT_EQ(indexed.size(), 200);
+    for (int i = 0; i < 200; i++) {
+        ASSERT_EQ(pooled.get(i * 7 % 200)->get(), std::to_string(i));
+        ASSERT_EQ(indexed.get(i * 7 % 200)->get(), std::to_string(i));
+    }
+
+    // still editable afterwards
+    indexed.remove(0);
+    indexed.upsert(1000, "new");
+    ASSERT_EQ(indexed.size(), 200);
+    ASSERT_TRUE(indexed.contains(1000));
+}
+
 // MEMORY LEAK TESTS ---------------------------
 // NOTE: run these under a memory profiler.
 
@@ -0,0 +1,334 @@
+#include <QtCore/qdebug.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <blendkernels.h>
+#include <compositor.h>
+#include <random>
+#include <thread>
+
+using namespace testing;
+
+typedef RasterLayer::BlendMode Mode;
+
+static const Mode AllModes[] = {Mode::Normal, Mode::Multiply, Mode::Screen, Mode::Add};
+
+// a random valid premultiplied pixel, fully transparent or opaque now and then
+static QRgb randomPixel(std::mt19937& rng) {
+    const int pick = rng() % 8;
+    const int a = pick == 0 ? 0 : pick == 1 ? 255 : static_cast<int>(rng() % 256);
+    if (a == 0) return 0;
+    return qRgba(rng() % (a + 1), rng() % (a + 1), rng() % (a + 1), a);
+}
+
+// blend one pixel with the scalar kernels
+static QRgb blendOne(Mode mode, QRgb dst, QRgb src, int opacity = 255) {
+    scalarBlendKernels().blend(mode, &dst, &src, 1, opacity);
+    return dst;
+}
+
+// BlendKernels tests ---------------------------
+
+TEST(BlendKernels, ScalarFormulas) {
+    const QRgb red = qRgba(255, 0, 0, 255), blue = qRgba(0, 0, 255, 255), halfRed = qRgba(128, 0, 0, 128);
+    const QRgb gray = qRgba(100, 100, 100, 255), light = qRgba(200, 200, 200, 255);
+
+    EXPECT_EQ(blendOne(Mode::Normal, blue, red), red);
+    EXPECT_EQ(blendOne(Mode::Normal, blue, halfRed), qRgba(128, 0, 127, 255));
+    EXPECT_EQ(blendOne(Mode::Normal, blue, red, 128), qRgba(128, 0, 127, 255)); // opacity acts like alpha
+    EXPECT_EQ(blendOne(Mode::Multiply, light, gray), qRgba(78, 78, 78, 255));
+    EXPECT_EQ(blendOne(Mode::Multiply, 0, gray), gray); // nothing below: the layer as is
+    EXPECT_EQ(blendOne(Mode::Screen, light, gray), qRgba(222, 222, 222, 255));
+    EXPECT_EQ(blendOne(Mode::Add, light, gray), qRgba(255, 255, 255, 255));
+    EXPECT_EQ(blendOne(Mode::Add, qRgba(10, 20, 30, 40), qRgba(1, 2, 3, 4)), qRgba(11, 22, 33, 44));
+}
+
+TEST(BlendKernels, TransparentSourceLeavesDestination) {
+    std::mt19937 rng(1);
+    for (const BlendKernels* kernels : supportedBlendKernels()) {
+        for (Mode mode : AllModes) {
+            std::vector<QRgb> dst(50), src(50, 0);
+            for (QRgb& p : dst) p = randomPixel(rng);
+            const std::vector<QRgb> before = dst;
+            kernels->blend(mode, dst.data(), src.data(), 50, 255);
+            EXPECT_EQ(dst, before) << kernels->name;
+
+            for (QRgb& p : src) p = randomPixel(rng);
+            kernels->blend(mode, dst.data(), src.data(), 50, 0);
+            EXPECT_EQ(dst, before) << kernels->name;
+        }
+    }
+}
+
+TEST(BlendKernels, EveryKernelMatchesScalar) {
+    std::mt19937 rng(7);
+    auto kernels = supportedBlendKernels();
+    EXPECT_STREQ(kernels.front()->name, "scalar");
+    EXPECT_EQ(&blendKernels(), kernels.back());
+
+    for (int count : {0, 1, 3, 4, 7, 8, 9, 31, 64, 4096}) {
+        for (Mode mode : AllModes) {
+            for (int opacity : {1, 77, 128, 254, 255}) {
+                std::vector<QRgb> src(count), dst(count);
+                for (QRgb& p : src) p = randomPixel(rng);
+                for (QRgb& p : dst) p = randomPixel(rng);
+
+                std::vector<QRgb> expected = dst;
+                scalarBlendKernels().blend(mode, expected.data(), src.data(), count, opacity);
+                for (const BlendKernels* k : kernels) {
+                    std::vector<QRgb> out = dst;
+                    k->blend(mode, out.data(), src.data(), count, opacity);
+                    ASSERT_EQ(out, expected) << k->name << " mode " << static_cast<int>(mode) << " opacity " << opacity;
+                }
+            }
+        }
+    }
+}
+
+// Compositor tests ---------------------------
+
+TEST(Compositor, FlattenRespectsOrderVisibilityAndOpacity) {
+    QVector<RasterLayer> layers(3);
+    layers[0].fillRect(QRect(0, 0, 4, 4), QColor(0, 0, 255));
+    layers[1].upsert(QPoint(1, 1), QColor(255, 0, 0));
+    layers[2].upsert(QPoint(2, 2), QColor(0, 255, 0));
+    layers[2].setVisible(false);
+
+    std::vector<QRgb> out(8 * 4, 0xdeadbeef);
+    EXPECT_TRUE(Compositor::flatten(layers, QRect(-2, 0, 6, 4), out.data(), 8));
+    EXPECT_EQ(out[0], 0u);                         // (-2, 0): nothing there
+    EXPECT_EQ(out[2], qRgba(0, 0, 255, 255));      // (0, 0): bottom layer
+    EXPECT_EQ(out[8 + 3], qRgba(255, 0, 0, 255));  // (1, 1): red on top
+    EXPECT_EQ(out[16 + 4], qRgba(0, 0, 255, 255)); // (2, 2): green is hidden
+    EXPECT_EQ(out[6], 0xdeadbeef);                 // past the box width, untouched
+
+    layers[1].setOpacity(0.5f);
+    layers[1].setBlendMode(Mode::Screen);
+    Compositor::flatten(layers, QRect(-2, 0, 6, 4), out.data(), 8);
+    EXPECT_EQ(out[8 + 3], blendOne(Mode::Screen, qRgba(0, 0, 255, 255), qRgba(255, 0, 0, 255), 128));
+
+    std::vector<QRgb> empty(16);
+    EXPECT_FALSE(Compositor::flatten(layers, QRect(100, 100, 4, 4), empty.data(), 4));
+}
+
+TEST(Compositor, TilesAreCachedUntilInvalidated) {
+    QVector<RasterLayer> layers(1);
+    layers[0].fillRect(QRect(0, 0, 70, 10), QColor(255, 0, 0));
+    layers[0].takeDirtyRects();
+    Compositor compositor;
+
+    const QRgb* tile = compositor.tile(layers, 0, 0);
+    ASSERT_NE(tile, nullptr);
+    EXPECT_EQ(tile[0], qRgba(255, 0, 0, 255));
+    EXPECT_EQ(tile[10 * Compositor::TileSize], 0u);
+    EXPECT_EQ(compositor.tile(layers, 5, 5), nullptr); // empty
+    EXPECT_EQ(compositor.cachedTiles(), 2);
+
+    // an edit the cache has not been told about is not seen
+    layers[0].upsert(QPoint(0, 0), QColor(0, 255, 0));
+    EXPECT_EQ(compositor.tile(layers, 0, 0)[0], qRgba(255, 0, 0, 255));
+
+    // only the tiles under the edit are composited again
+    compositor.tile(layers, 1, 0);
+    for (const QRect& box : layers[0].takeDirtyRects()) compositor.invalidate(box);
+    EXPECT_EQ(compositor.cachedTiles(), 2);
+    EXPECT_EQ(compositor.tile(layers, 0, 0)[0], qRgba(0, 255, 0, 255));
+
+    compositor.invalidate(QRect(-100000, -100000, 200000, 200000));
+    EXPECT_EQ(compositor.cachedTiles(), 0);
+    compositor.tile(layers, 1, 0);
+    compositor.evict(1, 0);
+    EXPECT_EQ(compositor.cachedTiles(), 0);
+}
+
+TEST(Compositor, PrefetchMatchesSerialTiles) {
+    std::mt19937 rng(3);
+    QVector<RasterLayer> layers(4);
+    for (int i = 0; i < 4; i++) {
+        for (int p = 0; p < 3000; p++) layers[i].upsert(QPoint(rng() % 300 - 20, rng() % 300 - 20), QColor::fromRgba(randomPixel(rng)));
+        layers[i].setBlendMode(AllModes[i]);
+    }
+    layers[1].setOpacity(0.4f);
+
+    std::vector<QPoint> tiles;
+    for (int ty = -1; ty < 6; ty++)
+        for (int tx = -1; tx < 6; tx++) tiles.emplace_back(tx, ty);
+
+    Compositor serial;
+    for (int threads : {0, 1, 3, 8}) {
+        WorkerPool pool(threads);
+        Compositor parallel;
+        parallel.prefetch(layers, tiles, pool);
+        EXPECT_EQ(parallel.cachedTiles(), static_cast<int>(tiles.size()));
+
+        for (const QPoint& t : tiles) {
+            const QRgb* expected = serial.tile(layers, t.x(), t.y());
+            const QRgb* got = nullptr;
+            ASSERT_TRUE(parallel.cached(t.x(), t.y(), &got));
+            ASSERT_EQ(got == nullptr, expected == nullptr) << t.x() << "," << t.y();
+            if (expected) {
+                EXPECT_TRUE(std::equal(got, got + Compositor::TileSize * Compositor::TileSize, expected));
+            }
+        }
+    }
+}
+
+TEST(Compositor, RequestsFinishInTheBackground) {
+    QVector<RasterLayer> layers(1);
+    layers[0].fillRect(QRect(0, 0, 128, 64), QColor(255, 0, 0));
+    WorkerPool pool(2);
+    Compositor compositor;
+
+    std::atomic<int> ready{0};
+    compositor.request(layers, {{0, 0, 7}, {1, 0, 8}, {9, 9, 9}}, pool, [&] { ready++; });
+
+    // the layer can be edited meanwhile; the request sees it as it was
+    layers[0].fillRect(QRect(0, 0, 128, 64), QColor(0, 0, 255));
+
+    std::vector<Compositor::Finished> done;
+    while (ready.load() == 0 || compositor.isBusy()) std::this_thread::yield();
+    done = compositor.takeFinished();
+    EXPECT_EQ(ready.load(), 1);
+    ASSERT_EQ(done.size(), 3u);
+    std::sort(done.begin(), done.end(), [](const auto& a, const auto& b) { return a.stamp < b.stamp; });
+    EXPECT_EQ(done[0].tx, 0);
+    EXPECT_EQ(done[1].stamp, 8u);
+    ASSERT_NE(done[0].pixels, nullptr);
+    EXPECT_EQ(done[0].pixels[0], qRgba(255, 0, 0, 255));
+    EXPECT_EQ(done[2].pixels, nullptr); // empty
+    EXPECT_TRUE(compositor.takeFinished().empty());
+    EXPECT_EQ(compositor.cachedTiles(), 0); // not cached until stored
+
+    compositor.store(0, 0, std::move(done[0].pixels));
+    EXPECT_EQ(compositor.tile(layers, 0, 0)[0], qRgba(255, 0, 0, 255));
+}
+
+// the average of a square of full resolution pixels, per channel and rounded
+static QRgb boxAverage(const QVector<RasterLayer>& layers, int x, int y, int side) {
+    std::vector<QRgb> pixels(side * side);
+    Compositor::flatten(layers, QRect(x, y, side, side), pixels.data(), side);
+    int sums[4] = {0, 0, 0, 0};
+    for (QRgb p : pixels) {
+        sums[0] += qRed(p), sums[1] += qGreen(p), sums[2] += qBlue(p), sums[3] += qAlpha(p);
+    }
+    const int n = side * side;
+    return qRgba((sums[0] + n / 2) / n, (sums[1] + n / 2) / n, (sums[2] + n / 2) / n, (sums[3] + n / 2) / n);
+}
+
+TEST(Compositor, MipLevelsAverageTheLevelBelow) {
+    std::mt19937 rng(5);
+    QVector<RasterLayer> layers(1);
+    for (int p = 0; p < 20000; p++) layers[0].upsert(QPoint(rng() % 256 - 128, rng() % 256 - 128), QColor::fromRgba(randomPixel(rng)));
+    layers[0].fillRect(QRect(-128, 200, 256, 56), QColor(10, 200, 30));
+    Compositor compositor;
+
+    // level 1 is exact: one rounding away from full resolution
+    const QRgb* level1 = compositor.tile(layers, -1, -1, 1);
+    ASSERT_NE(level1, nullptr);
+    for (int y = 0; y < Compositor::TileSize; y += 7)
+        for (int x = 0; x < Compositor::TileSize; x += 5)
+            ASSERT_EQ(level1[y * Compositor::TileSize + x], boxAverage(layers, -128 + 2 * x, -128 + 2 * y, 2)) << x << "," << y;
+
+    // further up each rounding can be off by one
+    const QRgb* level2 = compositor.tile(layers, -1, -1, 2);
+    const QRgb expected = boxAverage(layers, -256 + 4 * 40, -256 + 4 * 40, 4), got = level2[40 * Compositor::TileSize + 40];
+    EXPECT_NEAR(qRed(got), qRed(expected), 1);
+    EXPECT_NEAR(qAlpha(got), qAlpha(expected), 1);
+
+    // a uniform fill stays the same colour at every level, and nothing stays nothing
+    EXPECT_EQ(compositor.tile(layers, 0, 0, 2)[60 * Compositor::TileSize], qRgba(10, 200, 30, 255));
+    EXPECT_EQ(compositor.tile(layers, 5, 5, 3), nullptr);
+    EXPECT_EQ(compositor.tile(layers, 0, 0, Compositor::MaxLevel), compositor.tile(layers, 0, 0, Compositor::MaxLevel));
+}
+
+TEST(Compositor, EditsDropOnlyTheTilesAboveThem) {
+    QVector<RasterLayer> layers(1);
+    layers[0].fillRect(QRect(0, 0, 512, 512), QColor(255, 0, 0));
+    Compositor compositor;
+    compositor.tile(layers, 0, 0, 3);
+    EXPECT_EQ(compositor.cachedTiles(), 64 + 16 + 4 + 1);
+
+    layers[0].fillRect(QRect(0, 0, 64, 64), QColor(0, 0, 255));
+    compositor.invalidate(QRect(0, 0, 64, 64));
+    EXPECT_EQ(compositor.cachedTiles(), 63 + 15 + 3);
+
+    // building level 3 again composites one tile and shrinks one per level
+    const QRgb corner = compositor.tile(layers, 0, 0, 3)[0];
+    EXPECT_EQ(corner, qRgba(0, 0, 255, 255));
+    EXPECT_EQ(compositor.cachedTiles(), 64 + 16 + 4 + 1);
+
+    // storing a full resolution tile drops what was shrunk from the old one
+    compositor.store(7, 7, nullptr);
+    EXPECT_EQ(compositor.cachedTiles(), 64 + 15 + 3);
+
+    compositor.trim(QRect(0, 0, 128, 64));
+    EXPECT_EQ(compositor.cachedTiles(), 2 + 1 + 1);
+}
+
+TEST(Compositor, TryTileRequestsWhatIsMissing) {
+    QVector<RasterLayer> layers(1);
+    layers[0].fillRect(QRect(0, 0, 128, 128), QColor(0, 255, 0));
+    WorkerPool pool(2);
+    Compositor compositor;
+    compositor.tile(layers, 1, 1);
+
+    const QRgb* pixels = nullptr;
+    std::vector<QPoint> missing;
+    EXPECT_FALSE(compositor.tryTile(layers, 0, 0, 1, &pixels, missing));
+    EXPECT_EQ(missing.size(), 3u); // (1, 1) is cached already
+
+    std::atomic<int> ready{0};
+    compositor.requestMissing(layers, missing, pool, [&] { ready++; });
+    missing.clear();
+    EXPECT_FALSE(compositor.tryTile(layers, 0, 0, 1, &pixels, missing));
+    EXPECT_TRUE(missing.empty()); // requested, so not listed again
+
+    // an edit while they are being composited throws its tile away
+    compositor.invalidate(QRect(0, 0, 1, 1));
+    while (ready.load() == 0 || compositor.isBusy()) std::this_thread::yield();
+    EXPECT_EQ(compositor.collect(), 2);
+    EXPECT_FALSE(compositor.tryTile(layers, 0, 0, 1, &pixels, missing));
+    ASSERT_EQ(missing.size(), 1u);
+    EXPECT_EQ(missing[0], QPoint(0, 0));
+
+    compositor.requestMissing(layers, missing, pool, [&] { ready++; });
+    while (ready.load() == 1 || compositor.isBusy()) std::this_thread::yield();
+    EXPECT_EQ(compositor.collect(), 1);
+    missing.clear();
+    ASSERT_TRUE(compositor.tryTile(layers, 0, 0, 1, &pixels, missing));
+    EXPECT_EQ(pixels[0], qRgba(0, 255, 0, 255));
+    EXPECT_EQ(pixels[Compositor::TileSize * Compositor::TileSize - 1], qRgba(0, 255, 0, 255));
+}
+
+// WorkerPool tests ---------------------------
+
+TEST(WorkerPool, RunsEveryItemOnce) {
+    for (int threads : {0, 1, 4}) {
+        WorkerPool pool(threads);
+        EXPECT_EQ(pool.threadCount(), threads);
+        for (int count : {0, 1, 2, 5, 1000}) {
+            std::vector<std::atomic<int>> hits(count);
+            // uneven items, so the threads that finish early steal
+            pool.parallelFor(count, [&](int i) {
+                if (i % 7 == 0) std::this_thread::sleep_for(std::chrono::microseconds(50));
+                hits[i]++;
+            });
+            for (int i = 0; i < count; i++) ASSERT_EQ(hits[i].load(), 1) << threads << " threads, item " << i;
+        }
+    }
+}
+
+TEST(WorkerPool, BatchesRunConcurrently) {
+    WorkerPool pool(3);
+    std::atomic<int> sum{0}, batches{0};
+    for (int b = 0; b < 20; b++) pool.submit(100, [&](int i) { sum += i; }, [&] { batches++; });
+    pool.parallelFor(100, [&](int i) { sum += i; });
+
+    while (batches.load() < 20) std::this_thread::yield();
+    EXPECT_EQ(sum.load(), 21 * 4950);
+
+    // with no workers a submitted batch runs right away
+    WorkerPool inline_(0);
+    int ran = 0;
+    inline_.submit(3, [&](int) { ran++; }, [&] { ran += 10; });
+    EXPECT_EQ(ran, 13);
+}
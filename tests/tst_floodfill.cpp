@@ -0,0 +1,111 @@
+#include <QtCore/qdebug.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <floodfill.h>
+#include <deque>
+#include <random>
+#include <set>
+#include "testhelpers.h"
+
+using namespace testing;
+
+// return if two premultiplied colors are within tolerance in every channel
+static bool close(QRgb a, QRgb b, int tolerance) {
+    return std::abs(qAlpha(a) - qAlpha(b)) <= tolerance && std::abs(qRed(a) - qRed(b)) <= tolerance &&
+           std::abs(qGreen(a) - qGreen(b)) <= tolerance && std::abs(qBlue(a) - qBlue(b)) <= tolerance;
+}
+
+static QRgb valueAt(const RasterLayer& layer, QPoint loc) {
+    const auto p = layer.get(loc);
+    return p ? p->value.argb : 0;
+}
+
+// the fill done the slow way: a pixel at a time through get
+static PixelSet naiveFill(const RasterLayer& layer, const QRect& bounds, QPoint seed, int tolerance, bool contiguous) {
+    PixelSet out;
+    const QRgb target = valueAt(layer, seed);
+    if (!contiguous) {
+        for (int x = bounds.left(); x <= bounds.right(); x++)
+            for (int y = bounds.top(); y <= bounds.bottom(); y++)
+                if (close(valueAt(layer, QPoint(x, y)), target, tolerance)) out.emplace(x, y);
+        return out;
+    }
+    std::deque<QPoint> pending{seed};
+    out.emplace(seed.x(), seed.y());
+    while (!pending.empty()) {
+        const QPoint p = pending.front();
+        pending.pop_front();
+        for (const QPoint next : {p + QPoint(1, 0), p - QPoint(1, 0), p + QPoint(0, 1), p - QPoint(0, 1)}) {
+            if (!bounds.contains(next) || out.count({next.x(), next.y()})) continue;
+            if (!close(valueAt(layer, next), target, tolerance)) continue;
+            out.emplace(next.x(), next.y());
+            pending.push_back(next);
+        }
+    }
+    return out;
+}
+
+TEST(FloodFill, FillsInsideWalls) {
+    WorkerPool pool(0);
+    for (const auto mode : {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled}) {
+        // the outline of a square, with its top left corner cut: a diagonal gap a
+        // 4-connected fill must not leak through
+        RasterLayer layer(mode);
+        const Pixel wall(QColor(0, 0, 0));
+        layer.fillRect(QRect(10, 11, 1, 10), wall);
+        layer.fillRect(QRect(20, 10, 1, 11), wall);
+        layer.fillRect(QRect(11, 10, 9, 1), wall);
+        layer.fillRect(QRect(10, 20, 10, 1), wall);
+        layer.fillRect(QRect(13, 17, 1, 1), wall); // a loose pixel inside
+        const QRect bounds(0, 0, 100, 80);
+
+        const QVector<ColumnRun> inside = FloodFill::region(layer, bounds, QPoint(15, 15), 0, FloodFill::Mode::Contiguous, pool);
+        EXPECT_EQ(pixelsOf(inside).size(), 9u * 9u - 1);
+        EXPECT_FALSE(pixelsOf(inside).count({10, 10}));
+
+        // outside: everything else, which stops at the bounds
+        const QVector<ColumnRun> outside = FloodFill::region(layer, bounds, QPoint(0, 0), 0, FloodFill::Mode::Contiguous, pool);
+        EXPECT_EQ(pixelsOf(outside).size(), 100u * 80u - 11 * 11 + 1);
+        ASSERT_EQ(outside.size(), 100 + 11); // one run per column but around the square
+        EXPECT_EQ(outside.front().x, 0);
+        EXPECT_EQ(outside.front().length, 80);
+
+        // the walls themselves; global takes the loose pixel too
+        EXPECT_EQ(pixelsOf(FloodFill::region(layer, bounds, QPoint(20, 20), 0, FloodFill::Mode::Contiguous, pool)).size(), 39u);
+        EXPECT_EQ(pixelsOf(FloodFill::region(layer, bounds, QPoint(20, 20), 0, FloodFill::Mode::Global, pool)).size(), 40u);
+
+        EXPECT_TRUE(FloodFill::region(layer, bounds, QPoint(100, 5), 0, FloodFill::Mode::Contiguous, pool).isEmpty());
+    }
+}
+
+TEST(FloodFill, MatchesTheNaiveFill) {
+    WorkerPool serial(0), parallel(3);
+    std::mt19937 random(7);
+    for (const auto mode : {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled}) {
+        // blobs of a few close colors over empty canvas, across tile edges
+        RasterLayer layer(mode);
+        const QRgb colors[] = {qRgba(100, 100, 100, 255), qRgba(104, 98, 100, 255), qRgba(160, 20, 20, 255),
+                               qRgba(3, 2, 1, 4)};
+        for (int i = 0; i < 400; i++) {
+            const QRect blob(random() % 150 - 20, random() % 110 - 20, random() % 9 + 1, random() % 9 + 1);
+            layer.fillRect(blob, Pixel::fromPremultiplied(colors[random() % 4]));
+        }
+        const QRect bounds(-10, -5, 130, 100);
+
+        for (int trial = 0; trial < 30; trial++) {
+            const QPoint seed(bounds.left() + random() % bounds.width(), bounds.top() + random() % bounds.height());
+            const int tolerance = trial % 3 == 0 ? 0 : trial % 3 == 1 ? 5 : 60;
+            for (const bool contiguous : {true, false}) {
+                const auto fillMode = contiguous ? FloodFill::Mode::Contiguous : FloodFill::Mode::Global;
+                const PixelSet expected = naiveFill(layer, bounds, seed, tolerance, contiguous);
+                for (WorkerPool* pool : {&serial, &parallel}) {
+                    const QVector<ColumnRun> runs = FloodFill::region(layer, bounds, seed, tolerance, fillMode, *pool);
+                    ASSERT_EQ(pixelsOf(runs), expected) << seed.x() << "," << seed.y() << " " << tolerance;
+                    QVector<ColumnRun> united = runs;
+                    RasterLayer::uniteRuns(united);
+                    EXPECT_EQ(united.size(), runs.size()); // already united
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#include <QtCore/qdebug.h>
+#include <QBuffer>
+#include <QByteArray>
+#include <compositor.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <imageio.h>
+#include "testhelpers.h"
+
+using namespace testing;
+
+// opaque pixels and a few translucent ones, over more than one band and tile column.
+// Alpha is 255 or 128 so that colors come back exactly through RGBA8
+static RasterLayer makeLayer() {
+    RasterLayer layer;
+    for (int y = -3; y < 150; y++) {
+        for (int x = -70; x < 90; x++) {
+            if ((x * 7 + y * 3) % 5 == 0) continue;
+            const int a = (x + y) % 3 == 0 ? 128 : 255;
+            layer.upsert(QPoint(x, y), Pixel(QColor(x & 255, y & 255, (x ^ y) & 255, a)));
+        }
+    }
+    return layer;
+}
+
+static QByteArray exportLayer(const RasterLayer& layer, const QRect& box, bool png) {
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    Scanlines rows(layer, box);
+    QString error;
+    EXPECT_TRUE(png ? ImageIO::writePng(rows, &buffer, &error) : ImageIO::writeRaw(rows, &buffer, &error))
+        << error.toStdString();
+    return bytes;
+}
+
+TEST(ImageIO, RoundTripsPng) {
+    const RasterLayer layer = makeLayer();
+    const QRect box(-70, -3, 160, 153);
+    QByteArray bytes = exportLayer(layer, box, true);
+    ASSERT_GT(bytes.size(), 8);
+
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    RasterLayer loaded;
+    LayerDelta delta;
+    QString error;
+    ASSERT_TRUE(ImageIO::readImage(&buffer, box.topLeft(), loaded, &delta, &error)) << error.toStdString();
+    EXPECT_EQ(contents(loaded), contents(layer));
+    EXPECT_TRUE(loaded.isDirty());
+
+    // the delta takes the import back out
+    delta.revert(loaded);
+    EXPECT_TRUE(contents(loaded).empty());
+}
+
+TEST(ImageIO, RoundTripsRawAtAnOffset) {
+    const RasterLayer layer = makeLayer();
+    const QRect box(0, 0, 90, 150);
+    QByteArray bytes = exportLayer(layer, box, false);
+    ASSERT_EQ(bytes.size(), 90 * 150 * 4);
+
+    // placed elsewhere, over pixels already there
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    RasterLayer loaded;
+    loaded.upsert(QPoint(-1, -1), QColor(1, 2, 3));
+    ASSERT_TRUE(ImageIO::readRaw(&buffer, 90, QPoint(1000, -500), loaded));
+    EXPECT_EQ(loaded.get(QPoint(-1, -1))->value, Pixel(QColor(1, 2, 3)));
+    for (int y = 0; y < 150; y++) {
+        for (int x = 0; x < 90; x++) {
+            const auto want = layer.get(QPoint(x, y)), got = loaded.get(QPoint(1000 + x, y - 500));
+            ASSERT_EQ(want.has_value(), got.has_value()) << x << "," << y;
+            if (want) {
+                EXPECT_EQ(want->value, got->value);
+            }
+        }
+    }
+
+    // a partial row is an error, after the whole rows before it
+    bytes.resize(bytes.size() - 4);
+    buffer.seek(0);
+    RasterLayer cut;
+    QString error;
+    EXPECT_FALSE(ImageIO::readRaw(&buffer, 90, QPoint(0, 0), cut, nullptr, &error));
+    EXPECT_FALSE(error.isEmpty());
+    EXPECT_EQ(cut.get(QPoint(1, 148)).has_value(), layer.get(QPoint(1, 148)).has_value());
+    EXPECT_FALSE(cut.get(QPoint(1, 149)).has_value());
+}
+
+TEST(ImageIO, ScanlinesFlattenLayers) {
+    QVector<RasterLayer> layers(2);
+    layers[0].fillRect(QRect(0, 0, 100, 100), QColor(255, 0, 0));
+    layers[1].fillRect(QRect(50, 50, 100, 100), QColor(0, 0, 255, 128));
+    const QRect box(-10, 40, 200, 90);
+
+    std::vector<QRgb> expected(box.width() * box.height());
+    Compositor::flatten(layers, box, expected.data(), box.width());
+
+    Scanlines rows(layers, box);
+    int count = 0;
+    while (const QRgb* row = rows.next()) {
+        ASSERT_LT(count, box.height());
+        for (int x = 0; x < box.width(); x++) ASSERT_EQ(row[x], expected[count * box.width() + x]) << x << "," << count;
+        count++;
+    }
+    EXPECT_EQ(count, box.height());
+}
+
+TEST(ImageIO, DecodesOtherPngFormats) {
+    // 5x2, 2 bit palette with alpha for the first two entries
+    static const uchar palette[] = {
+        0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52, 0x00, 0x00,
+        0x00, 0x05, 0x00, 0x00, 0x00, 0x02, 0x02, 0x03, 0x00, 0x00, 0x00, 0xed, 0x04, 0xfe, 0xce, 0x00, 0x00, 0x00,
+        0x0c, 0x50, 0x4c, 0x54, 0x45, 0xff, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0xff, 0x0a, 0x14, 0x1e, 0x22,
+        0x88, 0x29, 0x04, 0x00, 0x00, 0x00, 0x02, 0x74, 0x52, 0x4e, 0x53, 0x00, 0x80, 0x9b, 0x2b, 0x4e, 0x18, 0x00,
+        0x00, 0x00, 0x0e, 0x49, 0x44, 0x41, 0x54, 0x78, 0x9c, 0x63, 0x90, 0x76, 0x60, 0x78, 0xc2, 0x00, 0x00, 0x03,
+        0x55, 0x01, 0x40, 0xca, 0x14, 0x98, 0xb0, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60,
+        0x82};
+    // 2x2, 16 bit gray with a transparent key, second row Sub filtered
+    static const uchar gray[] = {
+        0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52, 0x00, 0x00,
+        0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x10, 0x00, 0x00, 0x00, 0x00, 0x07, 0x4d, 0x8e, 0xbb, 0x00, 0x00, 0x00,
+        0x02, 0x74, 0x52, 0x4e, 0x53, 0x12, 0x34, 0x2f, 0xd3, 0x49, 0x5e, 0x00, 0x00, 0x00, 0x12, 0x49, 0x44, 0x41,
+        0x54, 0x78, 0x9c, 0x63, 0xf8, 0xff, 0x5f, 0xc8, 0x84, 0xb1, 0x81, 0xa1, 0x81, 0x01, 0x00, 0x15, 0xb4, 0x03,
+        0x46, 0xbe, 0xae, 0x82, 0x43, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82};
+
+    auto read = [](const uchar* data, int size, RasterLayer& layer) {
+        QByteArray bytes(reinterpret_cast<const char*>(data), size);
+        QBuffer buffer(&bytes);
+        buffer.open(QIODevice::ReadOnly);
+        QString error;
+        EXPECT_TRUE(ImageIO::readImage(&buffer, QPoint(0, 0), layer, nullptr, &error)) << error.toStdString();
+    };
+
+    RasterLayer indexed;
+    read(palette, sizeof(palette), indexed);
+    EXPECT_EQ(indexed.size(), 7);
+    EXPECT_FALSE(indexed.get(QPoint(0, 0)).has_value());
+    EXPECT_EQ(indexed.get(QPoint(1, 0))->value, Pixel(QColor(0, 255, 0, 128)));
+    EXPECT_EQ(indexed.get(QPoint(2, 0))->value, Pixel(QColor(0, 0, 255)));
+    EXPECT_EQ(indexed.get(QPoint(0, 1))->value, Pixel(QColor(10, 20, 30)));
+    EXPECT_FALSE(indexed.get(QPoint(4, 1)).has_value());
+
+    RasterLayer wide;
+    read(gray, sizeof(gray), wide);
+    EXPECT_EQ(wide.size(), 3);
+    EXPECT_EQ(wide.get(QPoint(0, 0))->value, Pixel(QColor(255, 255, 255)));
+    EXPECT_FALSE(wide.get(QPoint(1, 0)).has_value());
+    EXPECT_EQ(wide.get(QPoint(0, 1))->value, Pixel(QColor(128, 128, 128)));
+    EXPECT_EQ(wide.get(QPoint(1, 1))->value, Pixel(QColor(0, 0, 0)));
+
+    // a flipped bit fails the checksum
+    QByteArray bytes(reinterpret_cast<const char*>(gray), sizeof(gray));
+    bytes.data()[60] ^= 1;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    RasterLayer broken;
+    EXPECT_FALSE(ImageIO::readImage(&buffer, QPoint(0, 0), broken));
+}
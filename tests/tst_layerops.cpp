@@ -0,0 +1,75 @@
+#include <QtCore/qdebug.h>
+#include <compositor.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <layerops.h>
+
+using namespace testing;
+
+TEST(LayerOps, FlattenedMatchesTheCompositor) {
+    QVector<RasterLayer> layers(3);
+    layers[0].fillRect(QRect(0, 0, 80, 70), QColor(200, 10, 10));
+    layers[1].fillRect(QRect(40, 30, 90, 90), QColor(10, 10, 200, 100));
+    layers[1].setBlendMode(RasterLayer::BlendMode::Screen);
+    layers[2].upsert(QPoint(5, 5), QColor(0, 255, 0));
+    layers[2].setVisible(false);
+    const QRect box(-5, -5, 150, 140);
+
+    std::vector<QRgb> expected(box.width() * box.height());
+    Compositor::flatten(layers, box, expected.data(), box.width());
+
+    const RasterLayer flat = LayerOps::flattened(layers, box);
+    int opaque = 0;
+    for (int y = 0; y < box.height(); y++) {
+        for (int x = 0; x < box.width(); x++) {
+            const QRgb want = expected[y * box.width() + x];
+            const auto got = flat.get(QPoint(box.left() + x, box.top() + y));
+            ASSERT_EQ(got.has_value(), want != 0) << x << "," << y;
+            if (got) {
+                EXPECT_EQ(got->value.argb, want);
+                opaque++;
+            }
+        }
+    }
+    EXPECT_EQ(flat.size(), opaque);
+}
+
+TEST(LayerOps, ResizesByNearestNeighbour) {
+    // a 4 x 2 checkerboard of 2 x 2 cells at (10, 20)
+    RasterLayer layer;
+    for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 8; x++)
+            if ((x / 2 + y / 2) % 2 == 0) layer.upsert(QPoint(10 + x, 20 + y), QColor(255, 0, 0));
+    const QRect box(10, 20, 8, 4);
+
+    // halved, each cell becomes one pixel at the origin
+    const RasterLayer half = LayerOps::resized(layer, box, QSize(4, 2));
+    EXPECT_EQ(half.size(), 4);
+    for (int y = 0; y < 2; y++)
+        for (int x = 0; x < 4; x++) EXPECT_EQ(half.contains(QPoint(x, y)), (x + y) % 2 == 0) << x << "," << y;
+
+    // tripled, each source pixel becomes a 3 x 3 block
+    const RasterLayer big = LayerOps::resized(layer, box, QSize(24, 12));
+    EXPECT_EQ(big.size(), layer.size() * 9);
+    for (int y = 0; y < 12; y++)
+        for (int x = 0; x < 24; x++) EXPECT_EQ(big.contains(QPoint(x, y)), layer.contains(QPoint(10 + x / 3, 20 + y / 3)));
+
+    EXPECT_EQ(LayerOps::resized(layer, box, QSize(0, 5)).size(), 0);
+}
+
+TEST(LayerOps, RecolorsAndRemoves) {
+    RasterLayer layer;
+    layer.fillRect(QRect(0, 0, 10, 10), QColor(255, 0, 0));
+    layer.fillRect(QRect(0, 0, 10, 2), QColor(0, 0, 255));
+    layer.upsert(QPoint(50, 50), QColor(255, 0, 0));
+
+    LayerOps::ColorMap colors;
+    colors[Pixel(QColor(255, 0, 0)).argb] = Pixel(QColor(0, 255, 0, 128)).argb;
+    colors[Pixel(QColor(0, 0, 255)).argb] = 0;
+    EXPECT_EQ(LayerOps::recolor(layer, QRect(0, 0, 10, 10), colors), 100);
+
+    EXPECT_EQ(layer.size(), 81); // 80 recolored, the one outside the box left alone
+    EXPECT_FALSE(layer.contains(QPoint(3, 1)));
+    EXPECT_EQ(layer.get(QPoint(3, 2))->value, Pixel(QColor(0, 255, 0, 128)));
+    EXPECT_EQ(layer.get(QPoint(50, 50))->value, Pixel(QColor(255, 0, 0)));
+}
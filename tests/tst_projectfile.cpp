@@ -0,0 +1,128 @@
+#include <QtCore/qdebug.h>
+#include <QFile>
+#include <QTemporaryDir>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <projectfile.h>
+#include "testhelpers.h"
+
+using namespace testing;
+
+// a few layers covering every format, storage mode and layer setting
+static QVector<RasterLayer> makeLayers() {
+    QVector<RasterLayer> layers;
+
+    RasterLayer background(RasterLayer::StorageMode::Tiled);
+    background.setName("Background");
+    background.fillRect(QRect(-70, -10, 200, 150), QColor(250, 240, 230));
+    layers.append(background);
+
+    RasterLayer sketch(RasterLayer::StorageMode::Sparse);
+    sketch.setName("Skizze ✏");
+    for (int i = 0; i < 300; i++) sketch.upsert(QPoint(i * 37 % 1000 - 500, i * 91 % 700), QColor(i % 256, 0, 255 - i % 256, 128));
+    sketch.setVisible(false);
+    sketch.setOpacity(0.25f);
+    sketch.setBlendMode(RasterLayer::BlendMode::Screen);
+    layers.append(sketch);
+
+    RasterLayer wide(RasterLayer::StorageMode::Auto, RasterLayer::PixelFormat::Rgba16);
+    wide.setName("");
+    wide.fillRect(QRect(0, 0, 65, 3), QColor(1, 2, 3));
+    wide.upsertWide(QPoint(1000, -1000), QRgba64::fromRgba64(1, 2, 3, 4));
+    wide.setBlendMode(RasterLayer::BlendMode::Add);
+    layers.append(wide);
+    return layers;
+}
+
+TEST(ProjectFile, RoundTripsLayers) {
+    QTemporaryDir dir;
+    const QString path = dir.filePath("round.pxa");
+    const QVector<RasterLayer> layers = makeLayers();
+    ASSERT_TRUE(ProjectFile::save(path, QSize(320, 200), layers));
+
+    QSize size;
+    QVector<RasterLayer> loaded;
+    QString error;
+    ASSERT_TRUE(ProjectFile::load(path, &size, &loaded, &error)) << error.toStdString();
+    EXPECT_EQ(size, QSize(320, 200));
+    ASSERT_EQ(loaded.size(), layers.size());
+    for (qsizetype i = 0; i < layers.size(); i++) {
+        EXPECT_EQ(loaded[i].name(), layers[i].name());
+        EXPECT_EQ(loaded[i].isVisible(), layers[i].isVisible());
+        EXPECT_EQ(loaded[i].opacity(), layers[i].opacity());
+        EXPECT_EQ(loaded[i].blendMode(), layers[i].blendMode());
+        EXPECT_EQ(loaded[i].format(), layers[i].format());
+        EXPECT_EQ(loaded[i].storageMode(), layers[i].storageMode());
+        EXPECT_EQ(loaded[i].size(), layers[i].size());
+        EXPECT_EQ(contents(loaded[i]), contents(layers[i]));
+    }
+    EXPECT_TRUE(loaded[1].isTiled()); // sparse layers stay tiles until edited...
+    loaded[1].upsert(QPoint(0, 0), QColor(1, 2, 3));
+    EXPECT_FALSE(loaded[1].isTiled()); // ...then come back sparse
+    EXPECT_EQ(loaded[1].backend(), RasterLayer::StorageMode::Sparse);
+    EXPECT_TRUE(loaded[0].isDirty());  // new pixels for the view
+}
+
+TEST(ProjectFile, MappedTilesAreCopiedOnWrite) {
+    QTemporaryDir dir;
+    const QString path = dir.filePath("mapped.pxa");
+    ASSERT_TRUE(ProjectFile::save(path, QSize(64, 64), makeLayers()));
+
+    QSize size;
+    QVector<RasterLayer> first;
+    ASSERT_TRUE(ProjectFile::load(path, &size, &first));
+    const auto before = contents(first[0]);
+
+    // editing a loaded layer leaves the file alone
+    first[0].upsert(QPoint(0, 0), QColor(1, 1, 1));
+    first[0].eraseRect(QRect(-70, 100, 200, 50));
+    QVector<RasterLayer> second;
+    ASSERT_TRUE(ProjectFile::load(path, &size, &second));
+    EXPECT_EQ(contents(second[0]), before);
+    EXPECT_EQ(first[0].get(QPoint(0, 0))->value, Pixel(QColor(1, 1, 1)));
+
+    // saving over the file the tiles are mapped from keeps them readable
+    ASSERT_TRUE(ProjectFile::save(path, QSize(64, 64), first));
+    EXPECT_EQ(contents(second[0]), before);
+    QVector<RasterLayer> third;
+    ASSERT_TRUE(ProjectFile::load(path, &size, &third));
+    EXPECT_EQ(contents(third[0]), contents(first[0]));
+}
+
+TEST(ProjectFile, RefusesBrokenFiles) {
+    QTemporaryDir dir;
+    QSize size(1, 2);
+    QVector<RasterLayer> layers(3);
+    QString error;
+    EXPECT_FALSE(ProjectFile::load(dir.filePath("missing.pxa"), &size, &layers, &error));
+    EXPECT_FALSE(error.isEmpty());
+
+    // not a project
+    const QString junk = dir.filePath("junk.pxa");
+    {
+        QFile file(junk);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        const char bytes[64] = "PNG and then some";
+        file.write(bytes, sizeof(bytes));
+    }
+    EXPECT_FALSE(ProjectFile::load(junk, &size, &layers));
+
+    // cut short in the tiles
+    const QString cut = dir.filePath("cut.pxa");
+    ASSERT_TRUE(ProjectFile::save(cut, QSize(64, 64), makeLayers()));
+    {
+        QFile file(cut);
+        ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+        const qint64 bytes = file.size();
+        std::vector<char> data(bytes / 2);
+        ASSERT_EQ(file.read(data.data(), data.size()), static_cast<qint64>(data.size()));
+        file.close();
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(data.data(), data.size());
+    }
+    EXPECT_FALSE(ProjectFile::load(cut, &size, &layers, &error));
+
+    // nothing was touched
+    EXPECT_EQ(size, QSize(1, 2));
+    EXPECT_EQ(layers.size(), 3);
+}
@@ -1,10 +1,20 @@
 #include <QtCore/qdebug.h>
 #include <gmock/gmock-matchers.h>
 #include <gtest/gtest.h>
+#include <mortonstorage.h>
 #include <rasterlayer.h>
+#include <runstorage.h>
+#include <sparsestorage.h>
+#include <tiledstorage.h>
+#include <random>
+#include <set>
 
 using namespace testing;
 
+// the backends a layer can be pinned to
+static const RasterLayer::StorageMode EveryBackend[] = {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled,
+                                                       RasterLayer::StorageMode::Runs, RasterLayer::StorageMode::Morton};
+
 // Constructor destructor tests ---------------------------
 
 TEST(ConstructorDestructor, DefaultConstructor) {
@@ -107,7 +117,7 @@ TEST(getSingle, GetExistingPixel) {
     auto pixelOpt = layer.get(QPoint(0, 0));
     ASSERT_TRUE(pixelOpt.has_value());
     EXPECT_EQ(pixelOpt->location, QPoint(0, 0));
-    EXPECT_EQ(pixelOpt->value.get(), QColor(0, 255, 0));
+    EXPECT_EQ(pixelOpt->value, QColor(0, 255, 0));
 }
 
 TEST(getSingle, GetNonExistingPixel) {
@@ -117,14 +127,14 @@ TEST(getSingle, GetNonExistingPixel) {
     EXPECT_FALSE(pixelOpt.has_value());
 }
 
-TEST(getSingle, getReferenceTest) {
+TEST(getSingle, getReturnsCopy) {
     RasterLayer layer;
     layer.upsert(QPoint(10, 10), QColor(255, 0, 0));
     auto pixelOpt = layer.get(QPoint(10, 10));
     ASSERT_TRUE(pixelOpt.has_value());
-    // modify (should not change)
-    pixelOpt->value.get() = QColor(0, 255, 0);
-    EXPECT_EQ(layer.get(QPoint(10, 10))->value.get(), QColor(0, 255, 0));
+    // modify the copy (should not change the layer)
+    pixelOpt->value = QColor(0, 255, 0);
+    EXPECT_EQ(layer.get(QPoint(10, 10))->value, QColor(255, 0, 0));
 }
 
 // Accessory test: GETREGION ---------------------------
@@ -215,7 +225,7 @@ TEST(update, UpdateExistingPixel) {
     layer.update(QPoint(5, 5), QColor(255, 0, 0));
     auto pixOpt = layer.get(QPoint(5, 5));
     ASSERT_TRUE(pixOpt.has_value());
-    EXPECT_EQ(pixOpt->value.get(), QColor(255, 0, 0));
+    EXPECT_EQ(pixOpt->value, QColor(255, 0, 0));
 
     // Size unchanged
     EXPECT_EQ(layer.size(), 1);
@@ -241,7 +251,7 @@ TEST(upsert, UpdateExistingPixel) {
 
     auto pixOpt = layer.get(QPoint(1, 2));
     ASSERT_TRUE(pixOpt.has_value());
-    EXPECT_EQ(pixOpt->value.get(), QColor(20, 20, 20));
+    EXPECT_EQ(pixOpt->value, QColor(20, 20, 20));
 }
 
 // Mutators tests: REMOVE ---------------------------
@@ -267,9 +277,688 @@ TEST(remove, RemoveExistentPixel) {
     EXPECT_FALSE(layer.contains(QPoint(-5, 0)));
 }
 
+TEST(remove, RemoveInnerColumn) {
+    RasterLayer layer;
+    // column 2 ends up with a child on both sides in the column tree
+    for (int x = 0; x < 5; x++) layer.upsert(QPoint(x, 0), QColor(x, x, x));
+
+    layer.remove(QPoint(1, 0));
+    layer.remove(QPoint(3, 0));
+    EXPECT_EQ(layer.size(), 3);
+    EXPECT_TRUE(layer.contains(QPoint(0, 0)));
+    EXPECT_TRUE(layer.contains(QPoint(2, 0)));
+    EXPECT_TRUE(layer.contains(QPoint(4, 0)));
+    EXPECT_EQ(layer.get(QPoint(4, 0))->value, QColor(4, 4, 4));
+}
+
+// Storage backend tests ---------------------------
+
+TEST(storage, TiledBasics) {
+    RasterLayer layer(RasterLayer::StorageMode::Tiled);
+    EXPECT_TRUE(layer.isTiled());
+
+    // straddle tile borders, including negative coordinates
+    layer.upsert(QPoint(-1, -1), QColor(1, 2, 3, 4));
+    layer.upsert(QPoint(0, 0), QColor(5, 6, 7));
+    layer.upsert(QPoint(63, 64), QColor(8, 9, 10));
+    layer.upsert(QPoint(-65, 200), QColor(11, 12, 13));
+    EXPECT_EQ(layer.size(), 4);
+
+    EXPECT_EQ(layer.get(QPoint(-1, -1))->value, QColor(1, 2, 3, 4));
+    EXPECT_EQ(layer.get(QPoint(-65, 200))->value, QColor(11, 12, 13));
+    EXPECT_FALSE(layer.contains(QPoint(-64, 200)));
+    EXPECT_FALSE(layer.contains(QPoint(1, 0)));
+
+    layer.update(QPoint(0, 0), QColor(100, 100, 100));
+    EXPECT_EQ(layer.get(QPoint(0, 0))->value, QColor(100, 100, 100));
+
+    layer.remove(QPoint(-1, -1));
+    layer.remove(QPoint(-1, -1)); // twice, should not change size again
+    EXPECT_EQ(layer.size(), 3);
+    EXPECT_FALSE(layer.contains(QPoint(-1, -1)));
+}
+
+TEST(storage, TiledRegion) {
+    RasterLayer layer(RasterLayer::StorageMode::Tiled);
+    for (int x = -100; x < 100; x += 3)
+        for (int y = -100; y < 100; y += 7) layer.upsert(QPoint(x, y), QColor(x & 0xff, y & 0xff, 0));
+
+    RasterLayer sparse(RasterLayer::StorageMode::Sparse);
+    for (int x = -100; x < 100; x += 3)
+        for (int y = -100; y < 100; y += 7) sparse.upsert(QPoint(x, y), QColor(x & 0xff, y & 0xff, 0));
+
+    // both backends agree on every region, order aside
+    for (QRect box : {QRect(-70, -70, 140, 140), QRect(-1, -1, 2, 2), QRect(10, -100, 1, 200), QRect(-1000, -1000, 5000, 5000)}) {
+        auto tiled = layer.get(box);
+        auto reference = sparse.get(box);
+        ASSERT_EQ(tiled.size(), reference.size());
+        for (const auto& pix : tiled) {
+            EXPECT_TRUE(box.contains(pix.location));
+            EXPECT_EQ(sparse.get(pix.location)->value, pix.value);
+        }
+    }
+}
+
+TEST(storage, AutoSwitchesToTilesWhenDense) {
+    RasterLayer layer;
+    EXPECT_EQ(layer.storageMode(), RasterLayer::StorageMode::Auto);
+    EXPECT_FALSE(layer.isTiled());
+
+    for (int x = 0; x < 100; x++)
+        for (int y = 0; y < 100; y++) layer.upsert(QPoint(x, y), QColor(x, y, 0));
+
+    EXPECT_TRUE(layer.isTiled());
+    EXPECT_EQ(layer.size(), 10000);
+    EXPECT_EQ(layer.get(QPoint(42, 17))->value, QColor(42, 17, 0));
+
+    // an empty layer goes back to sparse
+    layer.clear();
+    EXPECT_FALSE(layer.isTiled());
+    EXPECT_EQ(layer.size(), 0);
+}
+
+TEST(storage, AutoStaysSparseWhenScattered) {
+    RasterLayer layer;
+    for (int i = 0; i < 10000; i++) layer.upsert(QPoint(i * 100, i * 37), QColor(1, 1, 1));
+
+    EXPECT_FALSE(layer.isTiled());
+    EXPECT_EQ(layer.size(), 10000);
+}
+
+TEST(storage, SetStorageModeConverts) {
+    RasterLayer layer(RasterLayer::StorageMode::Sparse);
+    layer.upsert(QPoint(3, 4), QColor(1, 2, 3));
+    layer.upsert(QPoint(-300, 4000), QColor(4, 5, 6, 7));
+
+    layer.setStorageMode(RasterLayer::StorageMode::Tiled);
+    EXPECT_TRUE(layer.isTiled());
+    EXPECT_EQ(layer.size(), 2);
+    EXPECT_EQ(layer.get(QPoint(-300, 4000))->value, QColor(4, 5, 6, 7));
+
+    layer.setStorageMode(RasterLayer::StorageMode::Sparse);
+    EXPECT_FALSE(layer.isTiled());
+    EXPECT_EQ(layer.get(QPoint(3, 4))->value, QColor(1, 2, 3));
+}
+
+TEST(storage, TiledCopyIsIndependent) {
+    RasterLayer original(RasterLayer::StorageMode::Tiled);
+    original.upsert(QPoint(1, 1), QColor(1, 1, 1));
+
+    RasterLayer copy(original);
+    original.upsert(QPoint(1, 1), QColor(2, 2, 2));
+    original.upsert(QPoint(2, 2), QColor(2, 2, 2));
+
+    EXPECT_TRUE(copy.isTiled());
+    EXPECT_EQ(copy.size(), 1);
+    EXPECT_EQ(copy.get(QPoint(1, 1))->value, QColor(1, 1, 1));
+}
+
+TEST(storage, RunsSplitAndMerge) {
+    RunStorage storage;
+    storage.fillRect(QRect(0, 0, 10, 100), QColor(1, 2, 3));
+    EXPECT_EQ(storage.size(), 1000);
+    EXPECT_EQ(storage.runCount(), 10); // a run per column
+
+    // another color in the middle splits the run around it
+    EXPECT_FALSE(storage.upsert(QPoint(4, 50), QColor(9, 9, 9)));
+    EXPECT_EQ(storage.runCount(), 12);
+    EXPECT_EQ(storage.get(QPoint(4, 49)).value(), QColor(1, 2, 3));
+    EXPECT_EQ(storage.get(QPoint(4, 50)).value(), QColor(9, 9, 9));
+    EXPECT_EQ(storage.get(QPoint(4, 51)).value(), QColor(1, 2, 3));
+
+    // and the old color merges them again
+    storage.update(QPoint(4, 50), QColor(1, 2, 3));
+    EXPECT_EQ(storage.runCount(), 10);
+
+    // a pixel touching a run of its color extends it; a hole splits it
+    EXPECT_TRUE(storage.upsert(QPoint(0, 100), QColor(1, 2, 3)));
+    EXPECT_TRUE(storage.remove(QPoint(1, 10)));
+    EXPECT_FALSE(storage.remove(QPoint(1, 10)));
+    EXPECT_EQ(storage.runCount(), 11);
+    EXPECT_EQ(storage.size(), 1000);
+    EXPECT_TRUE(storage.contains(QPoint(0, 100)));
+    EXPECT_FALSE(storage.contains(QPoint(1, 10)));
+    EXPECT_FALSE(storage.contains(QPoint(1, 101)));
+
+    // erasing the ends of runs and whole columns
+    EXPECT_EQ(storage.eraseRect(QRect(-5, 95, 8, 20)), 5 * 3 + 1);
+    EXPECT_EQ(storage.eraseRect(QRect(5, -5, 5, 200)), 500);
+    EXPECT_EQ(storage.runCount(), 6);
+    EXPECT_EQ(storage.size(), 1000 - 16 - 500);
+}
+
+TEST(storage, RunsMatchSparse) {
+    std::mt19937 random(5);
+    RunStorage runs;
+    SparseStorage reference;
+    auto color = [&random]() { return Pixel(QColor(random() % 3 * 100, 0, 0)); };
+    for (int i = 0; i < 2000; i++) {
+        const int x = random() % 40 - 20, y = random() % 200 - 100;
+        const QRect box(x, y, random() % 6 + 1, random() % 60 + 1);
+        const ColumnRun run{x, y, static_cast<int>(random() % 30 + 1)};
+        const Pixel p = color();
+        switch (random() % 6) {
+        case 0:
+            ASSERT_EQ(runs.fillRect(box, p), reference.fillRect(box, p));
+            break;
+        case 1:
+            ASSERT_EQ(runs.eraseRect(box), reference.eraseRect(box));
+            break;
+        case 2:
+            ASSERT_EQ(runs.fillRuns(&run, &run + 1, p), reference.fillRuns(&run, &run + 1, p));
+            break;
+        case 3:
+            ASSERT_EQ(runs.eraseRuns(&run, &run + 1), reference.eraseRuns(&run, &run + 1));
+            break;
+        case 4:
+            ASSERT_EQ(runs.upsert(QPoint(x, y), p), reference.upsert(QPoint(x, y), p));
+            break;
+        default:
+            ASSERT_EQ(runs.remove(QPoint(x, y)), reference.remove(QPoint(x, y)));
+        }
+        ASSERT_EQ(runs.size(), reference.size());
+    }
+
+    const QRect everything(-30, -110, 80, 320);
+    for (int x = everything.left(); x <= everything.right(); x++)
+        for (int y = everything.top(); y <= everything.bottom(); y++) ASSERT_EQ(runs.get(QPoint(x, y)), reference.get(QPoint(x, y)));
+
+    // the runs handed out cover the same pixels, and no two that touch share a color
+    int pixels = 0;
+    ColumnRun previous{INT_MIN, 0, 0};
+    Pixel previousValue;
+    runs.forEachRunInRect(everything, [&](const ColumnRun& run, Pixel p) {
+        for (int y = run.y; y < run.y + run.length; y++) EXPECT_EQ(reference.get(QPoint(run.x, y)), p);
+        if (run.x == previous.x && run.y == previous.y + previous.length) {
+            EXPECT_NE(p, previousValue);
+        }
+        previous = run;
+        previousValue = p;
+        pixels += run.length;
+    });
+    EXPECT_EQ(pixels, reference.size());
+    EXPECT_LT(runs.runCount(), reference.size() / 4);
+}
+
+TEST(storage, RunsLayerConverts) {
+    RasterLayer layer(RasterLayer::StorageMode::Runs);
+    EXPECT_EQ(layer.backend(), RasterLayer::StorageMode::Runs);
+    EXPECT_FALSE(layer.isTiled());
+    layer.fillRect(QRect(0, 0, 200, 200), QColor(1, 2, 3)); // never switches on its own
+    EXPECT_EQ(layer.backend(), RasterLayer::StorageMode::Runs);
+
+    layer.setStorageMode(RasterLayer::StorageMode::Tiled);
+    EXPECT_TRUE(layer.isTiled());
+    layer.setStorageMode(RasterLayer::StorageMode::Runs);
+    EXPECT_EQ(layer.backend(), RasterLayer::StorageMode::Runs);
+    EXPECT_EQ(layer.size(), 40000);
+    EXPECT_EQ(layer.get(QPoint(199, 199))->value, QColor(1, 2, 3));
+
+    // tiles from a file stay tiles until the first write, then come back as runs
+    RasterLayer loaded(RasterLayer::StorageMode::Runs);
+    loaded.setTiledPixels(std::const_pointer_cast<PixelStorage>(layer.tiledPixels()));
+    EXPECT_TRUE(loaded.isTiled());
+    EXPECT_EQ(loaded.size(), 40000);
+    loaded.upsert(QPoint(500, 500), QColor(1, 2, 3));
+    EXPECT_EQ(loaded.backend(), RasterLayer::StorageMode::Runs);
+    EXPECT_EQ(loaded.size(), 40001);
+
+    // so does a clear before any write
+    RasterLayer cleared(RasterLayer::StorageMode::Runs);
+    cleared.setTiledPixels(std::const_pointer_cast<PixelStorage>(layer.tiledPixels()));
+    cleared.clear();
+    EXPECT_EQ(cleared.backend(), RasterLayer::StorageMode::Runs);
+
+    // a clear keeps the backend
+    loaded.clear();
+    EXPECT_EQ(loaded.backend(), RasterLayer::StorageMode::Runs);
+}
+
+TEST(storage, MortonMatchesSparse) {
+    std::mt19937 random(6);
+    MortonStorage morton;
+    SparseStorage reference;
+    for (int i = 0; i < 3000; i++) {
+        const QPoint loc(random() % 300 - 150, random() % 300 - 150);
+        const Pixel p = QColor(random() % 256, 0, 0);
+        switch (random() % 4) {
+        case 0:
+            ASSERT_EQ(morton.remove(loc), reference.remove(loc));
+            break;
+        case 1: {
+            const QRect box(loc, QSize(random() % 9 + 1, random() % 9 + 1));
+            ASSERT_EQ(morton.fillRect(box, p), reference.fillRect(box, p));
+            break;
+        }
+        default:
+            ASSERT_EQ(morton.upsert(loc, p), reference.upsert(loc, p));
+        }
+    }
+    ASSERT_EQ(morton.size(), reference.size());
+
+    // boxes of every shape, across the sign change, visit exactly the pixels inside
+    for (const QRect box : {QRect(-150, -150, 300, 300), QRect(-100, -3, 250, 4), QRect(-2, -120, 3, 200),
+                            QRect(7, 9, 1, 1), QRect(-64, -64, 128, 128), QRect(400, 0, 10, 10)}) {
+        std::set<std::pair<int, int>> expected, seen;
+        reference.forEachInRect(box, [&](QPoint loc, Pixel) { expected.insert({loc.x(), loc.y()}); }, nullptr);
+        morton.forEachInRect(box, [&](QPoint loc, Pixel p) {
+            EXPECT_TRUE(box.contains(loc));
+            EXPECT_EQ(reference.get(loc), p);
+            EXPECT_TRUE(seen.insert({loc.x(), loc.y()}).second);
+        }, nullptr);
+        EXPECT_EQ(seen, expected);
+    }
+
+    // a cell's pixels are one range of codes, so each cell comes out once
+    std::vector<QPoint> cells, referenceCells;
+    morton.collectCells(6, cells);
+    reference.collectCells(6, referenceCells);
+    auto byXY = [](QPoint a, QPoint b) { return a.x() != b.x() ? a.x() < b.x() : a.y() < b.y(); };
+    std::sort(cells.begin(), cells.end(), byXY);
+    std::sort(referenceCells.begin(), referenceCells.end(), byXY);
+    EXPECT_EQ(cells, referenceCells);
+}
+
+TEST(storage, MortonReachesTheEdges) {
+    MortonStorage storage;
+    const QPoint corners[] = {QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MIN), QPoint(INT_MIN, INT_MAX),
+                              QPoint(INT_MAX, INT_MAX), QPoint(-1, 0), QPoint(0, -1)};
+    for (const QPoint loc : corners) EXPECT_TRUE(storage.upsert(loc, QColor(1, 2, 3)));
+    for (const QPoint loc : corners) EXPECT_TRUE(storage.contains(loc));
+
+    RasterLayer layer(RasterLayer::StorageMode::Morton);
+    for (const QPoint loc : corners) layer.upsert(loc, QColor(1, 2, 3));
+    EXPECT_EQ(layer.backend(), RasterLayer::StorageMode::Morton);
+    EXPECT_EQ(layer.get(QRect(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX))).size(), 6);
+    EXPECT_EQ(layer.get(QRect(-1, -1, 2, 2)).size(), 2);
+    int visited = 0;
+    for (const PixelRef& pix : layer.pixels(QRect(QPoint(INT_MIN, INT_MIN), QPoint(INT_MAX, INT_MAX)))) {
+        (void)pix;
+        visited++;
+    }
+    EXPECT_EQ(visited, 6);
+}
+
+// Pixel format tests ---------------------------
+
+TEST(pixel, PackedAndPremultiplied) {
+    Pixel opaque = QColor(10, 20, 30);
+    EXPECT_EQ(opaque.argb, qRgba(10, 20, 30, 255));
+    EXPECT_EQ(opaque.toColor(), QColor(10, 20, 30));
+
+    Pixel half = QColor(255, 128, 0, 128);
+    EXPECT_EQ(half.alpha(), 128);
+    EXPECT_EQ(half.red(), 128); // 255 * 128 / 255
+    EXPECT_EQ(half.green(), 64);
+    EXPECT_EQ(half.blue(), 0);
+
+    // fully transparent colors all collapse to the same value
+    EXPECT_EQ(Pixel(QColor(1, 2, 3, 0)), Pixel(QColor(200, 100, 50, 0)));
+}
+
+TEST(pixel, WideLayerKeepsPrecision) {
+    RasterLayer layer(RasterLayer::StorageMode::Sparse, RasterLayer::PixelFormat::Rgba16);
+    EXPECT_EQ(layer.format(), RasterLayer::PixelFormat::Rgba16);
+    EXPECT_TRUE(layer.isTiled()); // 16 bit layers are always tiled
+
+    const QRgba64 deep = QRgba64::fromRgba64(0x1234, 0x5678, 0x9abc, 0xffff);
+    layer.upsertWide(QPoint(5, -5), deep);
+    EXPECT_EQ(layer.size(), 1);
+    EXPECT_EQ(quint64(layer.getWide(QPoint(5, -5)).value()), quint64(deep));
+
+    // 8 bit access still works, rounded
+    EXPECT_EQ(layer.get(QPoint(5, -5))->value, Pixel::fromRgba64(deep));
+
+    // an 8 bit layer rounds wide colors on the way in
+    RasterLayer narrow;
+    narrow.upsertWide(QPoint(0, 0), deep);
+    EXPECT_EQ(narrow.getWide(QPoint(0, 0))->red(), 0x1212);
+}
+
+// Copy-on-write tests ---------------------------
+
+TEST(copyOnWrite, CopySharesUntilWrite) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        for (int i = 0; i < 100; i++) layer.upsert(QPoint(i, i), QColor(1, 2, 3));
+
+        RasterLayer snapshot(layer);
+        EXPECT_TRUE(snapshot.sharesPixelsWith(layer));
+
+        layer.remove(QPoint(500, 500)); // nothing there, still shared
+        layer.update(QPoint(500, 500), QColor(9, 9, 9));
+        EXPECT_TRUE(snapshot.sharesPixelsWith(layer));
+
+        layer.upsert(QPoint(0, 0), QColor(4, 5, 6));
+        EXPECT_FALSE(snapshot.sharesPixelsWith(layer));
+        EXPECT_EQ(layer.get(QPoint(0, 0))->value, QColor(4, 5, 6));
+        EXPECT_EQ(snapshot.get(QPoint(0, 0))->value, QColor(1, 2, 3));
+
+        // and the other way round
+        RasterLayer other = layer;
+        other.remove(QPoint(1, 1));
+        EXPECT_TRUE(layer.contains(QPoint(1, 1)));
+        EXPECT_FALSE(other.contains(QPoint(1, 1)));
+    }
+}
+
+TEST(copyOnWrite, MovedFromLayersAreEmptyAndIndependent) {
+    RasterLayer a, b;
+    a.upsert(QPoint(1, 1), QColor(1, 2, 3));
+    b.upsert(QPoint(2, 2), QColor(1, 2, 3));
+    RasterLayer movedA(std::move(a)), movedB(std::move(b));
+    EXPECT_EQ(a.size(), 0);
+    EXPECT_EQ(b.size(), 0);
+
+    // both hold the same empty pixels until one of them writes
+    a.upsert(QPoint(5, 5), QColor(4, 5, 6));
+    EXPECT_FALSE(a.sharesPixelsWith(b));
+    EXPECT_EQ(a.size(), 1);
+    EXPECT_EQ(b.size(), 0);
+    b.upsert(QPoint(6, 6), QColor(4, 5, 6));
+    EXPECT_FALSE(b.contains(QPoint(5, 5)));
+    EXPECT_EQ(movedA.size(), 1);
+    EXPECT_EQ(movedB.size(), 1);
+}
+
+TEST(copyOnWrite, ClearKeepsSnapshot) {
+    for (auto mode : {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled, RasterLayer::StorageMode::Auto,
+                      RasterLayer::StorageMode::Runs, RasterLayer::StorageMode::Morton}) {
+        RasterLayer layer(mode);
+        layer.fillRect(QRect(0, 0, 80, 80), QColor(1, 2, 3));
+        const bool tiled = layer.isTiled();
+
+        RasterLayer snapshot = layer;
+        layer.clear();
+        EXPECT_EQ(layer.size(), 0);
+        EXPECT_EQ(snapshot.size(), 6400);
+        EXPECT_EQ(snapshot.isTiled(), tiled);
+
+        layer.upsert(QPoint(1, 1), QColor(4, 5, 6));
+        EXPECT_EQ(snapshot.get(QPoint(1, 1))->value, QColor(1, 2, 3));
+    }
+}
+
+TEST(copyOnWrite, TilesCopiedOnlyWhenWritten) {
+    TiledStorage storage;
+    for (int x = 0; x < 256; x++)
+        for (int y = 0; y < 64; y++) storage.upsert(QPoint(x, y), QColor(1, 2, 3)); // 4 tiles
+
+    TiledStorage copy(storage);
+    EXPECT_EQ(storage.sharedTileCount(), 4);
+
+    copy.upsert(QPoint(70, 3), QColor(4, 5, 6)); // second tile only
+    EXPECT_EQ(storage.sharedTileCount(), 3);
+    EXPECT_EQ(copy.sharedTileCount(), 3);
+    EXPECT_EQ(storage.get(QPoint(70, 3)).value(), QColor(1, 2, 3));
+    EXPECT_EQ(copy.get(QPoint(70, 3)).value(), QColor(4, 5, 6));
+
+    storage.remove(QPoint(200, 10)); // fourth tile, in the original
+    EXPECT_EQ(storage.sharedTileCount(), 2);
+    EXPECT_TRUE(copy.contains(QPoint(200, 10)));
+
+    copy.update(QPoint(10, 10), QColor(7, 8, 9));
+    copy.fillRect(QRect(130, 0, 2, 2), QColor(7, 8, 9));
+    EXPECT_EQ(storage.sharedTileCount(), 0);
+    EXPECT_EQ(storage.get(QPoint(10, 10)).value(), QColor(1, 2, 3));
+    EXPECT_EQ(storage.get(QPoint(130, 0)).value(), QColor(1, 2, 3));
+}
+
+// Batch mutator tests ---------------------------
+
+TEST(batch, UpsertManyMatchesUpsert) {
+    for (auto mode : EveryBackend) {
+        RasterLayer batched(mode), single(mode);
+        for (int i = 0; i < 50; i++) { // some existing pixels for the batch to merge into
+            batched.upsert(QPoint(i % 7, i), QColor(9, 9, 9));
+            single.upsert(QPoint(i % 7, i), QColor(9, 9, 9));
+        }
+
+        QVector<PixelRef> stroke;
+        for (int i = 0; i < 500; i++) {
+            QPoint loc((i * 37) % 23 - 5, (i * 11) % 61 - 3); // unsorted, with repeats
+            stroke.emplaceBack(loc, Pixel(QColor(i & 0xff, 0, 0)));
+            single.upsert(loc, QColor(i & 0xff, 0, 0));
+        }
+        batched.upsertMany(stroke);
+
+        ASSERT_EQ(batched.size(), single.size());
+        for (const PixelRef& pix : single.get(QRect(-100, -100, 200, 200))) {
+            EXPECT_EQ(batched.get(pix.location)->value, pix.value); // last write wins
+        }
+    }
+}
+
+TEST(batch, RemoveMany) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        for (int x = 0; x < 10; x++)
+            for (int y = 0; y < 10; y++) layer.upsert(QPoint(x, y), QColor(1, 2, 3));
+
+        QVector<QPoint> erase;
+        for (int y = 0; y < 10; y++) erase.append(QPoint(3, y)); // a whole column
+        erase.append(QPoint(5, 5));
+        erase.append(QPoint(5, 5));     // twice
+        erase.append(QPoint(50, 50));   // nothing there
+        layer.removeMany(erase);
+
+        EXPECT_EQ(layer.size(), 89);
+        EXPECT_FALSE(layer.contains(QPoint(3, 4)));
+        EXPECT_FALSE(layer.contains(QPoint(5, 5)));
+        EXPECT_TRUE(layer.contains(QPoint(5, 6)));
+    }
+}
+
+TEST(batch, FillRectAndSpan) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        layer.upsert(QPoint(0, 0), QColor(9, 9, 9));
+
+        layer.fillRect(QRect(-70, -3, 140, 7), QColor(255, 0, 0));
+        EXPECT_EQ(layer.size(), 140 * 7);
+        EXPECT_EQ(layer.get(QPoint(0, 0))->value, QColor(255, 0, 0));
+        EXPECT_EQ(layer.get(QPoint(-70, -3))->value, QColor(255, 0, 0));
+        EXPECT_TRUE(layer.contains(QPoint(69, 3)));
+        EXPECT_FALSE(layer.contains(QPoint(70, 3)));
+        EXPECT_FALSE(layer.contains(QPoint(0, 4)));
+
+        layer.fillSpan(10, 5, 9, QColor(0, 255, 0));
+        EXPECT_EQ(layer.size(), 140 * 7 + 5);
+        EXPECT_EQ(layer.get(QPoint(9, 10))->value, QColor(0, 255, 0));
+        EXPECT_FALSE(layer.contains(QPoint(10, 10)));
+
+        layer.fillSpan(10, 9, 5, QColor(0, 255, 0)); // invalid, ignored
+        EXPECT_EQ(layer.size(), 140 * 7 + 5);
+    }
+}
+
+TEST(batch, EraseRect) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        layer.fillRect(QRect(-70, -70, 140, 140), QColor(255, 0, 0));
+
+        layer.eraseRect(QRect(-80, -10, 100, 20)); // spans tiles, pokes outside the fill
+        EXPECT_EQ(layer.size(), 140 * 140 - 90 * 20);
+        EXPECT_FALSE(layer.contains(QPoint(-70, -10)));
+        EXPECT_FALSE(layer.contains(QPoint(19, 9)));
+        EXPECT_TRUE(layer.contains(QPoint(20, 9)));
+        EXPECT_TRUE(layer.contains(QPoint(-70, -11)));
+
+        layer.eraseRect(QRect(-100, -100, 200, 200));
+        EXPECT_EQ(layer.size(), 0);
+    }
+}
+
+TEST(batch, AutoFillGoesStraightToTiles) {
+    RasterLayer layer;
+    layer.fillRect(QRect(0, 0, 100, 100), QColor(1, 2, 3));
+    EXPECT_TRUE(layer.isTiled());
+    EXPECT_EQ(layer.size(), 10000);
+
+    // a few scattered pixels plus a small fill stay sparse
+    RasterLayer scattered;
+    for (int i = 0; i < 50; i++) scattered.upsert(QPoint(i * 1000, 0), QColor(1, 2, 3));
+    scattered.fillRect(QRect(0, 0, 4, 4), QColor(1, 2, 3));
+    EXPECT_FALSE(scattered.isTiled());
+}
+
+// Region walk tests ---------------------------
+
+TEST(region, ForEachMatchesGet) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        for (int x = -150; x < 150; x += 3)
+            for (int y = -150; y < 150; y += 5) layer.upsert(QPoint(x, y), QColor(x & 0xff, y & 0xff, 0));
+
+        QRect box(-70, -90, 200, 130);
+        auto reference = layer.get(box);
+
+        int visited = 0;
+        bool finished = layer.forEachInRect(box, [&](QPoint loc, Pixel p) {
+            EXPECT_TRUE(box.contains(loc));
+            EXPECT_EQ(layer.get(loc)->value, p);
+            visited++;
+        });
+        EXPECT_TRUE(finished);
+        EXPECT_EQ(visited, reference.size());
+    }
+}
+
+TEST(region, ForEachStopsEarly) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        for (int i = 0; i < 100; i++) layer.upsert(QPoint(i, i), QColor(1, 2, 3));
+
+        int visited = 0;
+        bool finished = layer.forEachInRect(QRect(0, 0, 100, 100), [&](QPoint, Pixel) {
+            return ++visited < 10;
+        });
+        EXPECT_FALSE(finished);
+        EXPECT_EQ(visited, 10);
+    }
+}
+
+TEST(region, RangeForVisitsEveryPixelOnce) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        // spans several tiles and many iterator chunks, with negative coordinates
+        for (int x = -130; x < 130; x += 2)
+            for (int y = -70; y < 70; y += 3) layer.upsert(QPoint(x, y), QColor(x & 0xff, y & 0xff, 7));
+
+        for (QRect box : {QRect(-130, -70, 260, 140), QRect(-65, -1, 130, 66), QRect(5, 5, 1, 1), QRect(500, 500, 10, 10)}) {
+            std::set<std::pair<int, int>> seen;
+            for (const PixelRef& pix : layer.pixels(box)) {
+                EXPECT_TRUE(box.contains(pix.location));
+                EXPECT_EQ(layer.get(pix.location)->value, pix.value);
+                EXPECT_TRUE(seen.insert({pix.location.x(), pix.location.y()}).second); // no repeats
+            }
+            EXPECT_EQ(static_cast<int>(seen.size()), layer.get(box).size());
+        }
+    }
+}
+
+TEST(region, ForEachRunClipsAndCovers) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        layer.fillRect(QRect(-80, -80, 160, 160), QColor(1, 2, 3));
+        layer.fillRect(QRect(-10, -10, 20, 20), QColor(4, 5, 6));
+
+        const QRect box(-20, -70, 40, 100);
+        std::set<std::pair<int, int>> seen;
+        int runs = 0;
+        bool finished = layer.forEachRunInRect(box, [&](const ColumnRun& run, Pixel p) {
+            runs++;
+            for (int y = run.y; y < run.y + run.length; y++) {
+                EXPECT_TRUE(box.contains(QPoint(run.x, y)));
+                EXPECT_EQ(layer.get(QPoint(run.x, y))->value, p);
+                EXPECT_TRUE(seen.insert({run.x, y}).second);
+            }
+        });
+        EXPECT_TRUE(finished);
+        EXPECT_EQ(static_cast<int>(seen.size()), 40 * 100);
+        if (mode == RasterLayer::StorageMode::Runs) {
+            EXPECT_EQ(runs, 20 + 20 * 3); // whole runs, cut only by color
+        }
+
+        int visited = 0;
+        EXPECT_FALSE(layer.forEachRunInRect(box, [&](const ColumnRun&, Pixel) { return ++visited < 5; }));
+        EXPECT_EQ(visited, 5);
+    }
+}
+
+TEST(region, RangeForOnEmptyLayer) {
+    RasterLayer layer;
+    int visited = 0;
+    for (const PixelRef& pix : layer.pixels(QRect(0, 0, 10, 10))) {
+        (void)pix;
+        visited++;
+    }
+    EXPECT_EQ(visited, 0);
+}
+
 // MEMORY LEAK TESTS ---------------------------
 // NOTE: run these under a memory profiler.
 
+TEST(dirty, TracksEditedTiles) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        EXPECT_FALSE(layer.isDirty());
+
+        layer.upsert(QPoint(1, 1), QColor(1, 2, 3));
+        layer.upsert(QPoint(2, 1), QColor(1, 2, 3));
+        layer.upsert(QPoint(-1, 200), QColor(1, 2, 3));
+        EXPECT_TRUE(layer.isDirty());
+        EXPECT_THAT(layer.takeDirtyRects(), ElementsAre(QRect(0, 0, 64, 64), QRect(-64, 192, 64, 64)));
+        EXPECT_FALSE(layer.isDirty());
+
+        layer.remove(QPoint(500, 500)); // nothing there, nothing changed
+        layer.update(QPoint(500, 500), QColor(1, 2, 3));
+        EXPECT_FALSE(layer.isDirty());
+
+        // neighbouring tiles of a row come back as one rect
+        layer.fillRect(QRect(10, 10, 140, 10), QColor(4, 5, 6));
+        EXPECT_THAT(layer.takeDirtyRects(), ElementsAre(QRect(0, 0, 192, 64)));
+    }
+}
+
+TEST(dirty, ClearAndEraseMarkOnlyPaintedTiles) {
+    for (auto mode : EveryBackend) {
+        RasterLayer layer(mode);
+        layer.upsert(QPoint(0, 0), QColor(1, 2, 3));
+        layer.upsert(QPoint(100000, 100000), QColor(1, 2, 3));
+        layer.takeDirtyRects();
+
+        layer.eraseRect(QRect(-1000000, -1000000, 2000000, 2000000));
+        EXPECT_THAT(layer.takeDirtyRects(), ElementsAre(QRect(0, 0, 64, 64), QRect(99968, 99968, 64, 64)));
+
+        layer.upsert(QPoint(-70, 5), QColor(1, 2, 3));
+        layer.takeDirtyRects();
+        layer.clear();
+        EXPECT_THAT(layer.takeDirtyRects(), ElementsAre(QRect(-128, 0, 64, 64)));
+    }
+}
+
+TEST(dirty, CopiesStartCleanAndAssignmentMarksBothSides) {
+    RasterLayer a, b;
+    a.upsert(QPoint(0, 0), QColor(1, 2, 3));
+    b.upsert(QPoint(64, 0), QColor(1, 2, 3));
+    b.takeDirtyRects();
+
+    RasterLayer copy(a);
+    EXPECT_FALSE(copy.isDirty());
+    EXPECT_TRUE(a.isDirty());
+
+    b = a;
+    EXPECT_THAT(b.takeDirtyRects(), ElementsAre(QRect(0, 0, 128, 64)));
+
+    RasterLayer c;
+    c.upsert(QPoint(200, 70), QColor(1, 2, 3));
+    b = std::move(c);
+    EXPECT_TRUE(b.isDirty());
+    EXPECT_THAT(b.takeDirtyRects(), ElementsAre(QRect(0, 0, 64, 64), QRect(192, 64, 64, 64)));
+    EXPECT_FALSE(b.isDirty());
+}
+
 TEST(MemoryLeak, InsertAndClearRepeatedly) {
     RasterLayer layer;
     for (int iteration = 0; iteration < 10; ++iteration) {
@@ -0,0 +1,142 @@
+#include <QtCore/qdebug.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <selectionmask.h>
+#include <random>
+#include <set>
+#include "testhelpers.h"
+
+using namespace testing;
+
+// a mask of scattered boxes, or of loose pixels, which ends up a bitmap
+static SelectionMask randomMask(std::mt19937& random, bool noisy) {
+    QVector<ColumnRun> runs;
+    if (noisy) {
+        for (int i = 0; i < 3000; i++) runs.append({static_cast<int>(random() % 140) - 70, static_cast<int>(random() % 140) - 70, 1});
+    } else {
+        for (int i = 0; i < 12; i++) {
+            const int x = random() % 120 - 70, y = random() % 120 - 70, w = random() % 40 + 1, h = random() % 40 + 1;
+            for (int c = x; c < x + w; c++) runs.append({c, y, h});
+        }
+    }
+    return SelectionMask::fromRuns(runs);
+}
+
+TEST(SelectionMask, BuildsShapes) {
+    const SelectionMask box = SelectionMask::rect(QRect(-3, 5, 10, 4));
+    EXPECT_EQ(box.area(), 40);
+    EXPECT_EQ(box.boundingRect(), QRect(-3, 5, 10, 4));
+    EXPECT_TRUE(box.contains(QPoint(-3, 5)));
+    EXPECT_TRUE(box.contains(QPoint(6, 8)));
+    EXPECT_FALSE(box.contains(QPoint(7, 8)));
+    EXPECT_FALSE(box.contains(QPoint(0, 9)));
+    EXPECT_FALSE(box.isBitmap());
+
+    // a circle, the same both ways and about pi r^2
+    const SelectionMask circle = SelectionMask::ellipse(QRect(0, 0, 64, 64));
+    EXPECT_EQ(circle.boundingRect(), QRect(0, 0, 64, 64));
+    EXPECT_NEAR(circle.area(), 3.14159 * 32 * 32, 64);
+    for (int x = 0; x < 64; x++)
+        for (int y = 0; y < 64; y++) EXPECT_EQ(circle.contains(QPoint(x, y)), circle.contains(QPoint(y, x)));
+    EXPECT_FALSE(circle.contains(QPoint(0, 0)));
+    EXPECT_TRUE(circle.contains(QPoint(32, 32)));
+
+    // a right triangle with legs of 20: the pixels whose centers are above the
+    // diagonal, 19 in the first column down to none in the last
+    const SelectionMask triangle = SelectionMask::lasso({QPointF(0, 0), QPointF(20, 0), QPointF(0, 20)});
+    EXPECT_EQ(triangle.area(), 20 * 19 / 2);
+    EXPECT_TRUE(triangle.contains(QPoint(0, 18)));
+    EXPECT_FALSE(triangle.contains(QPoint(0, 19)));
+    EXPECT_FALSE(triangle.contains(QPoint(19, 19)));
+    EXPECT_TRUE(isUnited(triangle.runs()));
+
+    // a lasso crossing itself: the overlap of an even-odd bow tie is out
+    const SelectionMask bow = SelectionMask::lasso({QPointF(0, 0), QPointF(10, 10), QPointF(10, 0), QPointF(0, 10)});
+    EXPECT_FALSE(bow.contains(QPoint(5, 1)));
+    EXPECT_TRUE(bow.contains(QPoint(1, 5)));
+    EXPECT_TRUE(bow.contains(QPoint(8, 5)));
+
+    EXPECT_TRUE(SelectionMask().isEmpty());
+    EXPECT_TRUE(SelectionMask::rect(QRect()).isEmpty());
+    EXPECT_TRUE(SelectionMask::lasso({QPointF(0, 0), QPointF(5, 5)}).isEmpty());
+}
+
+TEST(SelectionMask, KeepsTheSmallerForm) {
+    std::mt19937 random(1);
+    const SelectionMask boxes = randomMask(random, false);
+    const SelectionMask noise = randomMask(random, true);
+    EXPECT_FALSE(boxes.isBitmap());
+    EXPECT_TRUE(noise.isBitmap());
+    EXPECT_LT(noise.bytes(), static_cast<qint64>(noise.area() * sizeof(ColumnRun)));
+
+    // the same pixels either way
+    const PixelSet pixels = pixelsOf(noise.runs());
+    EXPECT_EQ(static_cast<qint64>(pixels.size()), noise.area());
+    EXPECT_TRUE(isUnited(noise.runs()));
+    for (int x = -72; x < 72; x++)
+        for (int y = -72; y < 72; y++) ASSERT_EQ(noise.contains(QPoint(x, y)), pixels.count({x, y}) > 0);
+
+    // cut down to a few boxes again, it goes back to runs
+    const SelectionMask cut = noise.united(SelectionMask::rect(QRect(-80, -80, 160, 160)))
+                                   .subtracted(SelectionMask::rect(QRect(-80, -80, 160, 150)));
+    EXPECT_FALSE(cut.isBitmap());
+    EXPECT_EQ(cut.area(), 160 * 10);
+    EXPECT_EQ(cut.boundingRect(), QRect(-80, 70, 160, 10));
+}
+
+TEST(SelectionMask, CombinesLikeSets) {
+    std::mt19937 random(2);
+    for (int trial = 0; trial < 40; trial++) {
+        const SelectionMask a = randomMask(random, trial % 2), b = randomMask(random, trial % 3 == 0);
+        const PixelSet pa = pixelsOf(a.runs()), pb = pixelsOf(b.runs());
+
+        PixelSet both, either, only;
+        std::set_intersection(pa.begin(), pa.end(), pb.begin(), pb.end(), std::inserter(both, both.end()));
+        std::set_union(pa.begin(), pa.end(), pb.begin(), pb.end(), std::inserter(either, either.end()));
+        std::set_difference(pa.begin(), pa.end(), pb.begin(), pb.end(), std::inserter(only, only.end()));
+
+        for (const auto& [mask, expected] : {std::make_pair(a.united(b), either), std::make_pair(a.intersected(b), both),
+                                             std::make_pair(a.subtracted(b), only)}) {
+            const QVector<ColumnRun> runs = mask.runs();
+            ASSERT_TRUE(isUnited(runs)) << trial;
+            ASSERT_EQ(pixelsOf(runs), expected) << trial;
+            EXPECT_EQ(mask.area(), static_cast<qint64>(expected.size()));
+        }
+
+        // clipping edits is intersecting with them
+        const QVector<ColumnRun> clipped = a.clip(b.runs());
+        EXPECT_TRUE(isUnited(clipped));
+        EXPECT_EQ(pixelsOf(clipped), both);
+    }
+}
+
+TEST(SelectionMask, ClipsEdits) {
+    const SelectionMask mask = SelectionMask::rect(QRect(0, 0, 10, 10)).subtracted(SelectionMask::rect(QRect(3, 3, 4, 4)));
+    EXPECT_EQ(mask.area(), 100 - 16);
+
+    // a fill over the hole leaves it alone
+    const QVector<ColumnRun> runs = mask.clip(QRect(-5, 2, 20, 3));
+    EXPECT_EQ(pixelsOf(runs).size(), 10u * 3 - 4 * 2);
+    RasterLayer layer;
+    layer.fillRuns(runs, Pixel(QColor(9, 9, 9)));
+    EXPECT_TRUE(layer.contains(QPoint(3, 2)));
+    EXPECT_FALSE(layer.contains(QPoint(3, 3)));
+    EXPECT_FALSE(layer.contains(QPoint(-1, 3)));
+    EXPECT_TRUE(layer.contains(QPoint(9, 4)));
+
+    // runs out of order and overlapping come out united
+    const QVector<ColumnRun> strokes = mask.clip({{5, 0, 10}, {1, 0, 2}, {5, 5, 10}});
+    ASSERT_EQ(strokes.size(), 3);
+    EXPECT_EQ(strokes[1].x, 5);
+    EXPECT_EQ(strokes[1].length, 3);
+    EXPECT_EQ(strokes[2].y, 7);
+    EXPECT_EQ(strokes[2].length, 3);
+
+    // a magic wand selects what a fill would fill
+    WorkerPool pool(0);
+    const SelectionMask wand =
+        SelectionMask::magicWand(layer, QRect(0, 0, 20, 20), QPoint(0, 2), 0, FloodFill::Mode::Contiguous, pool);
+    EXPECT_EQ(wand.area(), 22);
+    EXPECT_EQ(wand.boundingRect(), QRect(0, 2, 10, 3));
+    EXPECT_TRUE(wand.clip(QRect(3, 3, 4, 4)).isEmpty());
+}
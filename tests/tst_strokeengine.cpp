@@ -0,0 +1,152 @@
+#include <QtCore/qdebug.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <layerdelta.h>
+#include <strokeengine.h>
+#include <cmath>
+#include <set>
+#include "testhelpers.h"
+
+using namespace testing;
+
+TEST(StrokeEngine, BuildsStamps) {
+    StrokeEngine engine;
+    ASSERT_EQ(engine.stamp().size(), 1u);
+    EXPECT_EQ(engine.stamp()[0].x, 0);
+    EXPECT_EQ(engine.stamp()[0].y, 0);
+    EXPECT_EQ(engine.stamp()[0].length, 1);
+
+    engine.setBrush({4, StrokeEngine::Shape::Square, 0.1f});
+    ASSERT_EQ(engine.stamp().size(), 4u);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(engine.stamp()[i].x, i - 2);
+        EXPECT_EQ(engine.stamp()[i].y, -2);
+        EXPECT_EQ(engine.stamp()[i].length, 4);
+    }
+
+    // a round 64 pixel brush: a disc of about pi * 32^2 pixels, the same both ways
+    engine.setBrush({64, StrokeEngine::Shape::Round, 0.1f});
+    const std::vector<ColumnRun>& disc = engine.stamp();
+    ASSERT_EQ(disc.size(), 64u);
+    int area = 0;
+    for (size_t i = 0; i < disc.size(); i++) {
+        area += disc[i].length;
+        EXPECT_EQ(disc[i].length, disc[63 - i].length);
+        EXPECT_EQ(2 * (disc[i].y + 32) + disc[i].length - 1, 63) << i; // symmetric about the middle row
+    }
+    EXPECT_NEAR(area, 3.14159 * 32 * 32, 64);
+    EXPECT_EQ(disc[32].length, 64);
+}
+
+TEST(StrokeEngine, HardLineHasNoGaps) {
+    StrokeEngine engine;
+    EXPECT_EQ(pixelsOf(engine.moveTo(QPointF(0.5, 0.5))), (PixelSet{{0, 0}}));
+
+    // a fast move: one pixel per column, each next to the last
+    const QVector<ColumnRun> line = engine.moveTo(QPointF(20.2, 7.9));
+    const PixelSet covered = pixelsOf(line);
+    const std::vector<std::pair<int, int>> pixels(covered.begin(), covered.end());
+    ASSERT_EQ(pixels.size(), 20u);
+    EXPECT_EQ(pixels.front(), std::make_pair(1, 0));
+    EXPECT_EQ(pixels.back(), std::make_pair(20, 7));
+    for (size_t i = 1; i < pixels.size(); i++) {
+        EXPECT_EQ(pixels[i].first, pixels[i - 1].first + 1);
+        EXPECT_LE(pixels[i].second - pixels[i - 1].second, 1);
+    }
+
+    // the same pixel again covers nothing new; after a reset it starts over
+    EXPECT_TRUE(engine.moveTo(QPointF(20.9, 7.1)).isEmpty());
+    engine.reset();
+    EXPECT_EQ(pixelsOf(engine.moveTo(QPointF(-3.5, 2))), (PixelSet{{-4, 2}}));
+}
+
+TEST(StrokeEngine, StampsAtSpacing) {
+    StrokeEngine engine;
+    engine.setBrush({8, StrokeEngine::Shape::Square, 1.0f}); // a stamp every 8 pixels
+    engine.moveTo(QPointF(0, 0));
+    const QVector<ColumnRun> runs = engine.moveTo(QPointF(40, 0));
+
+    // squares side by side: one run per column from the first stamp's right edge on
+    EXPECT_TRUE(isUnited(runs));
+    ASSERT_EQ(runs.size(), 40);
+    for (qsizetype i = 0; i < runs.size(); i++) {
+        EXPECT_EQ(runs[i].x, static_cast<int>(i) + 4);
+        EXPECT_EQ(runs[i].y, -4);
+        EXPECT_EQ(runs[i].length, 8);
+    }
+
+    // a round brush along a diagonal comes out united, whatever the overlap
+    engine.setBrush({16, StrokeEngine::Shape::Round, 0.1f});
+    const QVector<ColumnRun> diagonal = engine.moveTo(QPointF(100, 70));
+    EXPECT_TRUE(isUnited(diagonal));
+    EXPECT_GT(diagonal.size(), 60);
+}
+
+TEST(StrokeEngine, LeavesOutWhatTheLastStampCovered) {
+    // the same drag twice, once restamping in full at every sample
+    StrokeEngine engine, full;
+    for (StrokeEngine* e : {&engine, &full}) e->setBrush({32, StrokeEngine::Shape::Round, 0.1f});
+    std::set<std::pair<int, int>> covered, expected;
+    size_t emitted = 0, emittedFull = 0;
+    for (int i = 0; i < 100; i++) {
+        const QPointF p(i * 1.5, 40 * std::sin(i / 10.0));
+        full.restamp();
+        const QVector<ColumnRun> runs = engine.moveTo(p), runsFull = full.moveTo(p);
+        EXPECT_TRUE(isUnited(runs));
+        const auto pixels = pixelsOf(runs), pixelsFull = pixelsOf(runsFull);
+        covered.insert(pixels.begin(), pixels.end());
+        expected.insert(pixelsFull.begin(), pixelsFull.end());
+        emitted += pixels.size();
+        emittedFull += pixelsFull.size();
+    }
+    EXPECT_EQ(covered, expected);
+    EXPECT_LT(emitted * 4, emittedFull); // a slow drag emits the crescents only
+
+    // a new brush, or a restamp, puts the whole stamp down again
+    engine.reset();
+    engine.setBrush({8, StrokeEngine::Shape::Square, 0.1f});
+    EXPECT_EQ(pixelsOf(engine.moveTo(QPointF(200, 0))).size(), 64u);
+    EXPECT_EQ(pixelsOf(engine.moveTo(QPointF(201, 0))).size(), 8u);
+    engine.restamp();
+    EXPECT_EQ(pixelsOf(engine.moveTo(QPointF(202, 0))).size(), 64u);
+    engine.setBrush({8, StrokeEngine::Shape::Square, 0.1f});
+    EXPECT_EQ(pixelsOf(engine.moveTo(QPointF(203, 1))).size(), 64u);
+}
+
+TEST(StrokeEngine, RunsEditLayersAndUndo) {
+    for (const auto mode : {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled}) {
+        RasterLayer layer(mode);
+        layer.fillRect(QRect(0, 0, 4, 4), QColor(1, 2, 3));
+
+        // overlapping and out of order, across tile edges
+        QVector<ColumnRun> runs{{2, 60, 10}, {-1, -2, 3}, {2, 2, 60}, {3, 0, 1}};
+        QVector<ColumnRun> united = runs;
+        RasterLayer::uniteRuns(united);
+        ASSERT_EQ(united.size(), 3);
+        EXPECT_EQ(united[1].x, 2);
+        EXPECT_EQ(united[1].y, 2);
+        EXPECT_EQ(united[1].length, 68);
+
+        LayerDelta delta;
+        delta.recordRuns(layer, united, Pixel(QColor(200, 0, 0)));
+        layer.fillRuns(runs, Pixel(QColor(200, 0, 0)));
+        EXPECT_EQ(layer.size(), 16 + 3 + 66);
+        EXPECT_EQ(layer.get(QPoint(2, 69))->value, Pixel(QColor(200, 0, 0)));
+        EXPECT_EQ(layer.get(QPoint(2, 1))->value, Pixel(QColor(1, 2, 3)));
+        EXPECT_EQ(layer.get(QPoint(3, 0))->value, Pixel(QColor(200, 0, 0)));
+
+        // erasing records only what was there
+        LayerDelta erase;
+        const QVector<ColumnRun> column{{2, -100, 200}};
+        erase.recordRuns(layer, column, std::nullopt);
+        layer.eraseRuns(column);
+        EXPECT_EQ(erase.size(), 70);
+        EXPECT_FALSE(layer.contains(QPoint(2, 3)));
+        EXPECT_TRUE(layer.contains(QPoint(1, 3)));
+
+        erase.revert(layer);
+        delta.revert(layer);
+        EXPECT_EQ(layer.size(), 16);
+        EXPECT_EQ(layer.get(QPoint(3, 0))->value, Pixel(QColor(1, 2, 3)));
+    }
+}
@@ -0,0 +1,258 @@
+#include <QtCore/qdebug.h>
+#include <gmock/gmock-matchers.h>
+#include <gtest/gtest.h>
+#include <undohistory.h>
+#include <map>
+#include "testhelpers.h"
+
+using namespace testing;
+
+// LayerDelta tests ---------------------------
+
+TEST(LayerDelta, SealKeepsFirstBeforeAndLastAfter) {
+    LayerDelta delta;
+    delta.record(QPoint(1, 1), std::nullopt, Pixel(QColor(1, 0, 0)));
+    delta.record(QPoint(0, 5), Pixel(QColor(9, 9, 9)), Pixel(QColor(2, 0, 0)));
+    delta.record(QPoint(1, 1), Pixel(QColor(1, 0, 0)), Pixel(QColor(3, 0, 0)));
+    delta.record(QPoint(2, 2), std::nullopt, Pixel(QColor(4, 0, 0)));
+    delta.record(QPoint(2, 2), Pixel(QColor(4, 0, 0)), std::nullopt); // drawn then erased: no change
+    delta.seal();
+
+    auto changes = delta.changes();
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].location, QPoint(0, 5));
+    EXPECT_EQ(changes[1].location, QPoint(1, 1));
+    EXPECT_FALSE(changes[1].before.has_value());
+    EXPECT_EQ(changes[1].after.value(), Pixel(QColor(3, 0, 0)));
+}
+
+TEST(LayerDelta, CompressRoundTrips) {
+    LayerDelta delta;
+    for (int x = -40; x < 40; x++) {
+        for (int y = -30; y < 30; y++) {
+            // mixes long uniform runs with varying values and gaps
+            std::optional<Pixel> before;
+            if (x % 3 == 0) before = Pixel(QColor(x & 0xff, y & 0xff, 5));
+            if (y % 7 != 0) delta.record(QPoint(x, y), before, Pixel(QColor(200, 10, 10)));
+        }
+    }
+    delta.record(QPoint(INT_MAX, INT_MIN), std::nullopt, Pixel(QColor(1, 2, 3)));
+    delta.seal();
+
+    auto raw = delta.changes();
+    const qint64 rawBytes = delta.bytes();
+    delta.compress();
+    EXPECT_TRUE(delta.isCompressed());
+    EXPECT_LT(delta.bytes(), rawBytes);
+
+    auto unpacked = delta.changes();
+    ASSERT_EQ(unpacked.size(), raw.size());
+    for (size_t i = 0; i < raw.size(); i++) {
+        EXPECT_EQ(unpacked[i].location, raw[i].location);
+        EXPECT_EQ(unpacked[i].before, raw[i].before);
+        EXPECT_EQ(unpacked[i].after, raw[i].after);
+    }
+}
+
+TEST(LayerDelta, FillCompressesToRuns) {
+    RasterLayer layer;
+    LayerDelta delta;
+    delta.recordFill(layer, QRect(0, 0, 500, 500), QColor(1, 2, 3));
+    delta.seal();
+    EXPECT_EQ(delta.size(), 250000);
+
+    delta.compress();
+    EXPECT_LT(delta.bytes(), 500 * 16); // a handful of bytes per column
+}
+
+TEST(LayerDelta, FillIsRecordedAsRuns) {
+    RasterLayer layer;
+    for (int i = 0; i < 100; i++) layer.upsert(QPoint(i * 7, i * 13), QColor(i, 9, 9));
+
+    LayerDelta delta;
+    delta.recordFill(layer, QRect(0, 0, 2000, 2000), QColor(1, 2, 3));
+    EXPECT_LT(delta.bytes(), 2200 * 64); // a few spans per column, not one change per pixel
+    delta.seal();
+    EXPECT_EQ(delta.size(), 2000 * 2000);
+    EXPECT_LT(delta.bytes(), 2200 * 64);
+}
+
+TEST(LayerDelta, SealCutsOverlappingSpans) {
+    // spans and single pixels laid over each other in one column, against a per
+    // location record of the first before and the last after
+    RasterLayer layer;
+    layer.fillRect(QRect(0, 10, 1, 10), QColor(5, 5, 5));
+    std::map<int, std::pair<std::optional<Pixel>, std::optional<Pixel>>> expected;
+    auto note = [&expected](int y, std::optional<Pixel> before, std::optional<Pixel> after) {
+        auto it = expected.find(y);
+        if (it == expected.end()) expected[y] = {before, after};
+        else it->second.second = after;
+    };
+
+    LayerDelta delta;
+    const Pixel a(QColor(1, 0, 0)), b(QColor(2, 0, 0));
+    delta.recordRuns(layer, {ColumnRun{0, 0, 15}}, a);
+    for (int y = 0; y < 15; y++) note(y, layer.get(QPoint(0, y)).has_value() ? std::optional<Pixel>(Pixel(QColor(5, 5, 5))) : std::nullopt, a);
+    layer.fillRuns({ColumnRun{0, 0, 15}}, a);
+
+    delta.recordRuns(layer, {ColumnRun{0, 5, 20}}, b);
+    for (int y = 5; y < 25; y++) note(y, layer.get(QPoint(0, y)).has_value() ? std::optional<Pixel>(layer.get(QPoint(0, y))->value) : std::nullopt, b);
+    layer.fillRuns({ColumnRun{0, 5, 20}}, b);
+
+    delta.record(QPoint(0, 7), b, a);
+    note(7, b, a);
+    delta.recordRuns(layer, {ColumnRun{0, 20, 2}}, std::nullopt);
+    for (int y = 20; y < 22; y++) note(y, b, std::nullopt);
+    delta.seal();
+
+    std::vector<LayerDelta::Change> want;
+    for (const auto& [y, change] : expected)
+        if (change.first != change.second) want.push_back({QPoint(0, y), change.first, change.second});
+    auto changes = delta.changes();
+    ASSERT_EQ(changes.size(), want.size());
+    for (size_t i = 0; i < want.size(); i++) {
+        EXPECT_EQ(changes[i].location, want[i].location);
+        EXPECT_EQ(changes[i].before, want[i].before);
+        EXPECT_EQ(changes[i].after, want[i].after);
+    }
+}
+
+TEST(LayerDelta, RevertAndReapply) {
+    for (auto mode : {RasterLayer::StorageMode::Sparse, RasterLayer::StorageMode::Tiled}) {
+        RasterLayer layer(mode);
+        for (int i = 0; i < 30; i++) layer.upsert(QPoint(i, i), QColor(7, 7, 7));
+        auto original = contents(layer);
+
+        LayerDelta delta;
+        delta.recordFill(layer, QRect(5, 5, 10, 10), QColor(1, 2, 3));
+        layer.fillRect(QRect(5, 5, 10, 10), QColor(1, 2, 3));
+        QVector<QPoint> erase{QPoint(20, 20), QPoint(21, 21), QPoint(99, 99)};
+        delta.recordRemoves(layer, erase);
+        layer.removeMany(erase);
+        delta.seal();
+        auto edited = contents(layer);
+
+        delta.revert(layer);
+        EXPECT_EQ(contents(layer), original);
+        delta.reapply(layer);
+        EXPECT_EQ(contents(layer), edited);
+
+        delta.compress();
+        delta.revert(layer);
+        EXPECT_EQ(contents(layer), original);
+    }
+}
+
+// UndoHistory tests ---------------------------
+
+// draw one pixel on layers[layer] and push the edit
+static void draw(UndoHistory& history, QVector<RasterLayer>& layers, int layer, QPoint loc, QColor c, qint64 time) {
+    LayerDelta delta;
+    delta.recordUpserts(layers[layer], {PixelRef(loc, c)});
+    layers[layer].upsert(loc, c);
+    history.push(layer, std::move(delta), time);
+}
+
+TEST(UndoHistory, UndoRedo) {
+    QVector<RasterLayer> layers(2);
+    UndoHistory history(UndoHistory::DefaultMemoryLimit, 0);
+    EXPECT_FALSE(history.canUndo());
+    EXPECT_EQ(history.undo(layers), -1);
+
+    draw(history, layers, 0, QPoint(1, 1), QColor(1, 0, 0), 0);
+    draw(history, layers, 1, QPoint(2, 2), QColor(2, 0, 0), 1000);
+    draw(history, layers, 0, QPoint(1, 1), QColor(3, 0, 0), 2000);
+    EXPECT_EQ(history.undoCount(), 3);
+
+    EXPECT_EQ(history.undo(layers), 0);
+    EXPECT_EQ(layers[0].get(QPoint(1, 1))->value, QColor(1, 0, 0));
+    EXPECT_EQ(history.undo(layers), 1);
+    EXPECT_FALSE(layers[1].contains(QPoint(2, 2)));
+    EXPECT_EQ(history.redoCount(), 2);
+
+    EXPECT_EQ(history.redo(layers), 1);
+    EXPECT_TRUE(layers[1].contains(QPoint(2, 2)));
+
+    // a new edit drops what is left to redo
+    draw(history, layers, 0, QPoint(5, 5), QColor(5, 0, 0), 3000);
+    EXPECT_FALSE(history.canRedo());
+    EXPECT_EQ(history.undoCount(), 3);
+}
+
+TEST(UndoHistory, CoalescesQuickEditsOnOneLayer) {
+    QVector<RasterLayer> layers(2);
+    UndoHistory history(UndoHistory::DefaultMemoryLimit, 300);
+
+    for (int i = 0; i < 10; i++) draw(history, layers, 0, QPoint(i, 0), QColor(1, 0, 0), i * 100);
+    EXPECT_EQ(history.undoCount(), 1);
+
+    draw(history, layers, 0, QPoint(20, 0), QColor(1, 0, 0), 5000); // too late
+    draw(history, layers, 1, QPoint(20, 0), QColor(1, 0, 0), 5010); // other layer
+    history.closeEntry();
+    draw(history, layers, 1, QPoint(21, 0), QColor(1, 0, 0), 5020); // closed
+    EXPECT_EQ(history.undoCount(), 4);
+
+    history.undo(layers);
+    history.undo(layers);
+    history.undo(layers);
+    history.undo(layers);
+    EXPECT_EQ(layers[0].size(), 0);
+    EXPECT_EQ(layers[1].size(), 0);
+}
+
+TEST(UndoHistory, OlderEntriesAreCompressed) {
+    QVector<RasterLayer> layers(1);
+    UndoHistory history(UndoHistory::DefaultMemoryLimit, 0);
+
+    for (int i = 0; i < 10; i++) {
+        LayerDelta delta;
+        delta.recordFill(layers[0], QRect(0, i * 10, 100, 10), QColor(i, 0, 0));
+        layers[0].fillRect(QRect(0, i * 10, 100, 10), QColor(i, 0, 0));
+        history.push(0, std::move(delta), i * 1000);
+    }
+    const qint64 raw = static_cast<qint64>(UndoHistory::RawEntries) * 1000 * sizeof(LayerDelta::Change);
+    EXPECT_LT(history.bytes(), raw + 10 * 1000); // the 6 older fills are a few hundred bytes each
+
+    while (history.canUndo()) history.undo(layers);
+    EXPECT_EQ(layers[0].size(), 0);
+}
+
+TEST(UndoHistory, MemoryLimitDropsOldest) {
+    QVector<RasterLayer> layers(1);
+    UndoHistory history(64 * 1024, 0);
+
+    for (int i = 0; i < 50; i++) {
+        // scattered pixels with distinct values compress poorly
+        QVector<PixelRef> pixels;
+        for (int j = 0; j < 200; j++) pixels.emplaceBack(j * 3 + i, j * 5, Pixel(QColor(j & 0xff, i, 1)));
+        LayerDelta delta;
+        delta.recordUpserts(layers[0], pixels);
+        layers[0].upsertMany(pixels);
+        history.push(0, std::move(delta), i * 1000);
+    }
+
+    EXPECT_LE(history.bytes(), 64 * 1024);
+    EXPECT_LT(history.undoCount(), 50);
+    EXPECT_GT(history.undoCount(), 0);
+
+    history.setMemoryLimit(0); // keeps the newest step only
+    EXPECT_EQ(history.undoCount(), 1);
+}
+
+TEST(UndoHistory, MemoryLimitCompressesBeforeDropping) {
+    QVector<RasterLayer> layers(1);
+    UndoHistory history(100 * 1024, 0);
+
+    for (int i = 0; i < 3; i++) {
+        // scattered pixels: large raw, but a few bytes each packed
+        QVector<PixelRef> pixels;
+        for (int j = 0; j < 2000; j++) pixels.emplaceBack(j * 2, i * 2, Pixel(QColor(1, 2, 3)));
+        LayerDelta delta;
+        delta.recordUpserts(layers[0], pixels);
+        layers[0].upsertMany(pixels);
+        history.push(0, std::move(delta), i * 1000);
+    }
+
+    EXPECT_EQ(history.undoCount(), 3); // nothing dropped
+    EXPECT_LE(history.bytes(), 100 * 1024);
+}